@@ -41,6 +41,63 @@
 # include <pwd.h>
 #endif
 
+#if HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+/* Looking up the user's groups can mean asking a directory server, and every
+ * init needs the user's permissions; so the names of the groups are kept for
+ * GROUP_TTL seconds for each user we act for, and the entries of each
+ * notesfile's access file are kept until the file changes.  Checking that
+ * takes a single stat, and the permissions worked out from the entries are
+ * kept too, so as long as neither the file nor the user changes, and the
+ * groups they went by haven't expired, that's all getperms does.  A daemon
+ * running for weeks thus sees changes to the group database within
+ * GROUP_TTL seconds.
+ */
+
+#define ACL_BUCKETS 64
+#define GROUP_TTL 60
+
+struct acl_cache
+{
+  char *filename;               /* The access file. */
+  dev_t dev;                    /* What it looked like when read. */
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  long mtime_ns;
+  struct perm_f *entries;       /* What was in it. */
+  int count;
+  char *name;                   /* Whose permissions PERMS are, or NULL. */
+  uid_t uid;                    /* Whose groups they went by. */
+  time_t resolved;              /* When they were worked out. */
+  int perms;
+  struct acl_cache *next;
+};
+
+static struct acl_cache *acls[ACL_BUCKETS];
+
+/* The names of the groups each user we've acted for is in. */
+
+struct group_cache
+{
+  uid_t uid;
+  time_t loaded;                /* When NAMES were looked up. */
+  char **names;
+  int count;
+  struct group_cache *next;
+};
+
+static struct group_cache *groups = NULL;
+
+static struct group_cache *find_groups (void);
+static struct acl_cache *find_acl (const char *filename, int create);
+static int acl_current (const struct acl_cache *acl, const struct stat *st);
+static void load_acl (struct acl_cache *acl);
+static int resolve (const struct acl_cache *acl, const char *name);
+static unsigned long hash_filename (const char *filename);
+
 /* getperms - fill in a struct perm_f for IO for username NAME.
  *
  * Whoo, the UIUC version of this puppy was a mess.
@@ -60,18 +117,12 @@ getperms (struct io_f *io, char *name)
   static uid_t notes;
   static short notes_is_set = FALSE;
 
-  int permissions = 0;
-  int matches = 0;
-  int perfectmatch = 0;
-  int ngroups = 0;        /* Actual number of groups the user belongs to. */
-  GETGROUPS_T *gid;
-  char **gname;
-  struct flock alock;
-  struct group *gr;
+  struct acl_cache *acl;
+  struct stat statbuf;
   char *filename;
   size_t length;
-  int fid;
-  struct perm_f entry;
+  time_t now;
+  uid_t uid;
 
   if (io == NULL || name == NULL)
     return;
@@ -82,7 +133,7 @@ getperms (struct io_f *io, char *name)
     {
       struct passwd *pw = getpwnam (NOTES);
 
-      notes = pw->pw_uid;
+      notes = pw != NULL ? pw->pw_uid : (uid_t) -1;
       notes_is_set = TRUE;
       endpwent ();
     }
@@ -93,37 +144,198 @@ getperms (struct io_f *io, char *name)
       return;
     }
 
-  /* Iterate through all the groups this user belongs to and grab the names.
-   * If it doesn't work, we don't really care too much, because we can still
-   * get a result.
-   */
+  io->access = 0;         /* Clear the official list. */
+
+  length = strlen (io->basedir) + strlen (io->nf) + strlen (ACCESS) + 3;
+  filename = newts_nmalloc (sizeof (char), length);
+  snprintf (filename, length, "%s/%s/%s", io->basedir, io->nf, ACCESS);
+
+  acl = find_acl (filename, TRUE);
+  newts_free (filename);
+
+  if (stat (acl->filename, &statbuf) || !acl_current (acl, &statbuf))
+    load_acl (acl);
+
+  get_identity (&uid);
+  time (&now);
+  if (acl->name == NULL || strcmp (acl->name, name) != 0 || acl->uid != uid ||
+      now - acl->resolved >= GROUP_TTL || now < acl->resolved)
+    {
+      newts_free (acl->name);
+      acl->name = newts_strdup (name);
+      acl->uid = uid;
+      acl->resolved = now;
+      acl->perms = resolve (acl, name);
+    }
+
+  io->access = acl->perms;
+}
+
+/* forget_perms - stop using what we know about the access file FILENAME,
+ * which we've just rewritten.
+ */
+
+void
+forget_perms (const char *filename)
+{
+  struct acl_cache *acl = find_acl (filename, FALSE);
+
+  if (acl != NULL)
+    {
+      acl->count = -1;
+      newts_free (acl->name);
+      acl->name = NULL;
+    }
+}
+
+/* find_groups - return the names of the groups the user we're acting for
+ * belongs to, looking them up if need be or if we did so more than GROUP_TTL
+ * seconds ago.  If that doesn't work, we don't really care too much, because
+ * we can still get a result.
+ */
+
+static struct group_cache *
+find_groups (void)
+{
+  struct group_cache *cache;
+  GETGROUPS_T *gid;
+  struct group *gr;
+  time_t now;
+  uid_t uid;
+  int acting, ngroups;
+
+  acting = get_identity (&uid);
+  time (&now);
+
+  for (cache = groups; cache != NULL; cache = cache->next)
+    if (cache->uid == uid)
+      break;
+
+  if (cache == NULL)
+    {
+      cache = newts_zalloc (sizeof (struct group_cache));
+      cache->uid = uid;
+      cache->next = groups;
+      groups = cache;
+    }
+  else if (now - cache->loaded < GROUP_TTL && now >= cache->loaded)
+    return cache;
+  else
+    {
+      while (cache->count > 0)
+        newts_free (cache->names[--cache->count]);
+      newts_free (cache->names);
+      cache->names = NULL;
+    }
+
+  cache->loaded = now;
 
   ngroups = sysconf (_SC_NGROUPS_MAX);
   gid = newts_nmalloc (sizeof (GETGROUPS_T), ngroups);
-  gname = newts_nmalloc (sizeof (char *), ngroups);
 
-  if ((ngroups = getgroups (ngroups, gid)) >= 0)
+  /* Our own groups come from the kernel; anyone else's from the group
+   * database.
+   */
+
+  if (!acting)
+    ngroups = getgroups (ngroups, gid);
+  else
     {
-      register int i, j;
+#if HAVE_GETGROUPLIST
+      struct passwd *pw = getpwuid (uid);
 
-      for (i = 0, j = 0; i < ngroups; i++)
+      if (pw == NULL || getgrouplist (pw->pw_name, pw->pw_gid,
+                                      (gid_t *) gid, &ngroups) < 0)
+        ngroups = -1;
+      endpwent ();
+#else
+      ngroups = -1;
+#endif
+    }
+
+  if (ngroups > 0)
+    {
+      register int i;
+
+      cache->names = newts_nmalloc (sizeof (char *), ngroups);
+      for (i = 0; i < ngroups; i++)
         {
           if ((gr = getgrgid (gid[i])) == NULL)
             {
               continue;   /* Bogus group, skip it and move on. */
             }
-          gname[j++] = newts_strdup (gr->gr_name);
+          cache->names[cache->count++] = newts_strdup (gr->gr_name);
         }
-      ngroups = j;
     }
 
-  io->access = 0;         /* Clear the official list. */
+  newts_free (gid);
 
-  length = strlen (io->basedir) + strlen (io->nf) + strlen (ACCESS) + 3;
-  filename = newts_nmalloc (sizeof (char), length);
-  snprintf (filename, length, "%s/%s/%s", io->basedir, io->nf, ACCESS);
+  return cache;
+}
+
+/* find_acl - return the cache entry for the access file FILENAME.  If there
+ * isn't one, an empty one is made if CREATE is nonzero, and NULL returned
+ * otherwise.
+ */
+
+static struct acl_cache *
+find_acl (const char *filename, int create)
+{
+  struct acl_cache **bucket = &acls[hash_filename (filename) % ACL_BUCKETS];
+  struct acl_cache *acl;
+
+  for (acl = *bucket; acl != NULL; acl = acl->next)
+    if (strcmp (acl->filename, filename) == 0)
+      return acl;
+
+  if (!create)
+    return NULL;
+
+  acl = newts_zalloc (sizeof (struct acl_cache));
+  acl->filename = newts_strdup (filename);
+  acl->count = -1;
+  acl->next = *bucket;
+  *bucket = acl;
 
-  fid = TEMP_FAILURE_RETRY (open (filename, O_RDONLY));
+  return acl;
+}
+
+/* acl_current - return TRUE if ACL was read from the file that now has the
+ * status ST.
+ */
+
+static int
+acl_current (const struct acl_cache *acl, const struct stat *st)
+{
+  long mtime_ns = 0;
+
+#if HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  mtime_ns = st->st_mtim.tv_nsec;
+#endif
+
+  return acl->count >= 0 && acl->dev == st->st_dev && acl->ino == st->st_ino &&
+    acl->size == st->st_size && acl->mtime == st->st_mtime &&
+    acl->mtime_ns == mtime_ns;
+}
+
+/* load_acl - read the entries of ACL's access file again. */
+
+static void
+load_acl (struct acl_cache *acl)
+{
+  struct flock alock;
+  struct stat statbuf;
+  struct perm_f entry;
+  int fid;
+
+  newts_free (acl->entries);
+  acl->entries = NULL;
+  acl->count = -1;
+  newts_free (acl->name);
+  acl->name = NULL;
+
+  if ((fid = TEMP_FAILURE_RETRY (open (acl->filename, O_RDONLY))) < 0)
+    return;
 
   alock.l_type = F_RDLCK;
   alock.l_whence = SEEK_SET;
@@ -131,49 +343,91 @@ getperms (struct io_f *io, char *name)
   alock.l_len = 0;    /* All of it. */
   TEMP_FAILURE_RETRY (fcntl (fid, F_SETLKW, &alock));
 
-  while ((TEMP_FAILURE_RETRY (read (fid, &entry, sizeof (struct perm_f))) ==
-          sizeof (struct perm_f)) && !perfectmatch)
+  acl->count = 0;
+  while (TEMP_FAILURE_RETRY (read (fid, &entry, sizeof (struct perm_f))) ==
+         sizeof (struct perm_f))
     {
+      acl->entries = newts_nrealloc (acl->entries, acl->count + 1,
+                                     sizeof (struct perm_f));
+      acl->entries[acl->count++] = entry;
+    }
+
+  /* What we read goes with the file as it was while we held the lock. */
+
+  if (fstat (fid, &statbuf) == 0)
+    {
+      acl->dev = statbuf.st_dev;
+      acl->ino = statbuf.st_ino;
+      acl->size = statbuf.st_size;
+      acl->mtime = statbuf.st_mtime;
+      acl->mtime_ns = 0;
+#if HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+      acl->mtime_ns = statbuf.st_mtim.tv_nsec;
+#endif
+    }
+  else
+    acl->count = -1;
+
+  alock.l_type = F_UNLCK;
+  fcntl (fid, F_SETLK, &alock);
+
+  TEMP_FAILURE_RETRY (close (fid));
+}
+
+/* resolve - work out the permissions of username NAME from the entries of
+ * ACL.
+ */
+
+static int
+resolve (const struct acl_cache *acl, const char *name)
+{
+  struct group_cache *cache = find_groups ();
+  int permissions = 0;
+  int matches = 0;
+  int i;
+
+  for (i = 0; i < acl->count; i++)
+    {
+      const struct perm_f *entry = &acl->entries[i];
+
       /* We're not dealing with system permissions yet. */
 
-      if (entry.ptype == PERMSYSTEM)
+      if (entry->ptype == PERMSYSTEM)
         continue;
 
       /* In the actual UIUC notes distribution, "other" was capitalized.  We
        * use strcasecmp just to be sure.
        */
 
-      if (strcasecmp (entry.name, "other") == 0)
+      if (strcasecmp (entry->name, "other") == 0)
         {
           if (matches == 0)
             {
-              permissions = entry.perms;
+              permissions = entry->perms;
               matches++;
             }
         }
 
-      switch (entry.ptype)
+      switch (entry->ptype)
         {
         case PERMUSER:
-          if (strcmp (name, entry.name) == 0)
+          if (strcmp (name, entry->name) == 0)
             {
               /* Specific user permissions are the last word. */
 
-              permissions = entry.perms;
-              matches++;
-              perfectmatch++;
+              return entry->perms;
             }
           break;
 
         case PERMGROUP:
           {
-            register int i;
+            register int j;
 
-            for (i = 0; i < ngroups; i++)
+            for (j = 0; j < cache->count; j++)
               {
-                if (strcmp (gname[i], entry.name) == 0)
+                if (strcmp (cache->names[j], entry->name) == 0)
                   {
-                    permissions |= entry.perms;
+                    permissions |= entry->perms;
                     matches++;
                     break;
                   }
@@ -191,26 +445,18 @@ getperms (struct io_f *io, char *name)
         }
     }
 
-  io->access = permissions;
-
-  fdatasync (fid);
-  alock.l_type = F_UNLCK;
-  fcntl (fid, F_SETLK, &alock);
-
-  TEMP_FAILURE_RETRY (close (fid));
-  newts_free (filename);
-  newts_free (gid);
+  return permissions;
+}
 
-  {
-    register int i;
+static unsigned long
+hash_filename (const char *filename)
+{
+  unsigned long hash = 5381;
 
-    for (i = 0; i < ngroups; i++)
-      {
-        newts_free (gname[i]);
-      }
-  }
+  while (*filename != '\0')
+    hash = hash * 33 + (unsigned char) *filename++;
 
-  newts_free (gname);
+  return hash;
 }
 
 /* allow - An internal macro to verify permissions; an equivalent of the
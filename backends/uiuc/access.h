@@ -26,5 +26,6 @@
 
 extern int allow (struct io_f *io, int mode);
 extern void getperms (struct io_f *io, char *username);
+extern void forget_perms (const char *filename);
 
 #endif /* not ACCESS_H */
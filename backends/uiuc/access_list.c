@@ -144,6 +144,7 @@ uiuc_write_access_list (const newts_nfref *ref, List *list)
 
   TEMP_FAILURE_RETRY (close (accessfile));
 
+  forget_perms (filename);
   newts_free (filename);
   closenf (&io);
 
@@ -0,0 +1,448 @@
+/*
+ * author_index.c - find notes by who wrote them
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "uiuc-backend.h"
+
+#if STDC_HEADERS
+# include <ctype.h>
+#endif
+
+#if HAVE_PWD_H
+# include <pwd.h>
+#endif
+
+/* AUTHINDEX maps the author of every note and response, as 'name@system' in
+ * lower case, to where they wrote.  put_note and put_resp add the author of
+ * what they write, and uiuc_modify_note_text adds the new author of a note
+ * that was made anonymous; a search checks that everything the index turns
+ * up still exists and still has a matching author.
+ *
+ * A search matches any author whose 'name@system', or whose real name, has
+ * the search string in it.  There are few enough authors in any notesfile
+ * that every one of them can be checked, once; only the notes of those that
+ * match are read.
+ */
+
+#define AUTHOR_MAX (NAMESZ + SYSSZ + 2)
+#define VERDICTS   256
+
+/* What we've decided about each author seen so far. */
+
+struct verdict
+{
+  struct verdict *next;
+  char *term;
+  int match;
+};
+
+struct matcher
+{
+  char search[AUTHOR_MAX];
+  struct verdict *table[VERDICTS];
+};
+
+static size_t author_term (char *term, const char *name, const char *system);
+static void init_matcher (struct matcher *m, const char *author);
+static void free_matcher (struct matcher *m);
+static int is_match (struct matcher *m, const char *term, const char *name);
+static int compare_matches (const void *a, const void *b);
+static int add_match (struct newts_match **matches, int nmatches, int notenum,
+                      int respnum);
+static int scan_all (struct io_f *io, struct matcher *m,
+                     struct newts_match **matches);
+
+/* aindex_add - add NAME at SYSTEM as the author of WHERE in note NOTENUM to
+ * the author index of IO.
+ */
+
+void
+aindex_add (struct io_f *io, int notenum, int where, const char *name,
+            const char *system)
+{
+  struct post_writer *w;
+  char term[AUTHOR_MAX];
+  size_t length = author_term (term, name, system);
+
+  if ((w = post_begin (io, AUTHINDEX, FALSE)) == NULL)
+    return;
+
+  post_add (w, term, length, notenum, where, 1);
+  post_end (w);
+}
+
+/* aindex_rebuild - build the author index of IO from scratch.  Returns 0 on
+ * success, or -1 if the index can't be written.
+ */
+
+int
+aindex_rebuild (struct io_f *io)
+{
+  struct post_writer *w;
+  struct note_f note;
+  struct resp_f resp;
+  struct descr_f descr;
+  char term[AUTHOR_MAX];
+  size_t length;
+  int i, max;
+
+  if ((w = post_begin (io, AUTHINDEX, TRUE)) == NULL)
+    return -1;
+
+  readdescr (io, &descr);
+  max = getrespcount (io);
+
+  for (i = 1; i <= descr.d_nnote; i++)
+    {
+      int record, live, blocks, k;
+
+      readnoterec (io, i, &note);
+      if (note.n_stat & ISDELETED)
+        continue;
+
+      length = author_term (term, note.n_auth.aname, note.n_id.sys);
+      post_add (w, term, length, i, 0, 1);
+
+      live = note.n_nresp;
+      for (record = note.n_rindx, blocks = 0;
+           record >= 0 && record < max && blocks < max && live > 0;
+           record = resp.r_next, blocks++)
+        {
+          readresprec (io, record, &resp);
+          for (k = 0; k < RESPSZ && live > 0; k++)
+            if ((resp.r_stat[k] & ISDELETED) == 0)
+              {
+                length = author_term (term, resp.r_auth[k].aname,
+                                      resp.r_id[k].sys);
+                post_add (w, term, length, i, POST_RESP (record, k), 1);
+                live--;
+              }
+        }
+    }
+
+  post_end (w);
+
+  return 0;
+}
+
+/* aindex_find - find every basenote and response in IO written by AUTHOR,
+ * through the author index, building it first if it's missing.  The matches
+ * are stored in a newly allocated array in MATCHES, in note order.
+ *
+ * Returns: the number of matches, or -1 if the index can't be used.
+ */
+
+int
+aindex_find (struct io_f *io, const char *author, struct newts_match **matches)
+{
+  struct matcher m;
+  struct posting *postings = NULL;
+  char **terms;
+  long nterms, npostings = 0, i;
+  int nmatches = 0;
+
+  *matches = NULL;
+
+  if ((nterms = post_terms (io, AUTHINDEX, &terms)) < 0)
+    {
+      if (aindex_rebuild (io) != 0 ||
+          (nterms = post_terms (io, AUTHINDEX, &terms)) < 0)
+        return -1;
+    }
+
+  init_matcher (&m, author);
+
+  /* Gather up the postings of every author that matches. */
+
+  for (i = 0; i < nterms; i++)
+    {
+      char name[AUTHOR_MAX];
+      char *at;
+
+      strcpy (name, terms[i]);
+      if ((at = strrchr (name, '@')) != NULL)
+        *at = '\0';
+
+      if (is_match (&m, terms[i], name))
+        {
+          struct posting *found;
+          long count = post_lookup (io, AUTHINDEX, terms[i], strlen (terms[i]),
+                                    &found);
+
+          if (count > 0)
+            {
+              postings = newts_nrealloc (postings, npostings + count,
+                                         sizeof (struct posting));
+              memcpy (postings + npostings, found,
+                      count * sizeof (struct posting));
+              npostings += count;
+            }
+          newts_free (found);
+        }
+      newts_free (terms[i]);
+    }
+  newts_free (terms);
+
+  npostings = post_sort (postings, npostings);
+
+  /* Check each of them against what's actually there now. */
+
+  for (i = 0; i < npostings; i++)
+    {
+      struct note_f note;
+      struct resp_f resp;
+      char term[AUTHOR_MAX];
+      const char *name;
+      int respnum;
+
+      if (postings[i].p_note == 0 ||
+          post_resolve (io, &postings[i], &note, &resp, &respnum) != 0)
+        continue;
+
+      if (respnum == 0)
+        {
+          name = note.n_auth.aname;
+          author_term (term, name, note.n_id.sys);
+        }
+      else
+        {
+          int slot = POST_SLOT (postings[i].p_where);
+
+          name = resp.r_auth[slot].aname;
+          author_term (term, name, resp.r_id[slot].sys);
+        }
+
+      if (is_match (&m, term, name))
+        nmatches = add_match (matches, nmatches, postings[i].p_note, respnum);
+    }
+
+  if (nmatches > 1)
+    qsort (*matches, (size_t) nmatches, sizeof (struct newts_match),
+           compare_matches);
+
+  free_matcher (&m);
+  newts_free (postings);
+
+  return nmatches;
+}
+
+/* author_search_all - find every basenote and response of REF written by
+ * AUTHOR, matched as for author_search.  The matches are stored in a newly
+ * allocated array in MATCHES, in note order.
+ *
+ * Returns: the number of matches, -1 if the notesfile can't be opened, or -2
+ * if the caller may not read it.
+ */
+
+int
+uiuc_author_search_all (const newts_nfref *ref, const char *author,
+                        struct newts_match **matches)
+{
+  struct io_f io;
+  int nmatches;
+
+  *matches = NULL;
+
+  if (init (&io, ref) != NEWTS_NO_ERROR)
+    return -1;
+
+  if (!allow (&io, READOK))
+    {
+      closenf (&io);
+      return -2;
+    }
+
+  if ((nmatches = aindex_find (&io, author, matches)) < 0)
+    {
+      struct matcher m;
+
+      init_matcher (&m, author);
+      nmatches = scan_all (&io, &m, matches);
+      free_matcher (&m);
+    }
+
+  closenf (&io);
+  return nmatches;
+}
+
+/* author_term - store the index term for NAME at SYSTEM in TERM, which holds
+ * AUTHOR_MAX characters.  Neither NAME nor SYSTEM need be NUL-terminated.
+ * Returns the length of the term.
+ */
+
+static size_t
+author_term (char *term, const char *name, const char *system)
+{
+  size_t i;
+
+  snprintf (term, AUTHOR_MAX, "%.*s@%.*s", NAMESZ, name, SYSSZ, system);
+  for (i = 0; term[i]; i++)
+    term[i] = (char) tolower ((unsigned char) term[i]);
+
+  return i;
+}
+
+static void
+init_matcher (struct matcher *m, const char *author)
+{
+  int i;
+
+  memset (m, 0, sizeof (struct matcher));
+  strncpy (m->search, author, AUTHOR_MAX - 1);
+  for (i = 0; m->search[i]; i++)
+    m->search[i] = (char) tolower ((unsigned char) m->search[i]);
+}
+
+static void
+free_matcher (struct matcher *m)
+{
+  struct verdict *v, *next;
+  int i;
+
+  for (i = 0; i < VERDICTS; i++)
+    for (v = m->table[i]; v != NULL; v = next)
+      {
+        next = v->next;
+        newts_free (v->term);
+        newts_free (v);
+      }
+}
+
+/* is_match - return TRUE if the author TERM, whose user name is NAME, matches
+ * what M is searching for: either the search string is in TERM, or it's in
+ * the real name of user NAME.  Each author is only looked up once.
+ */
+
+static int
+is_match (struct matcher *m, const char *term, const char *name)
+{
+  struct verdict *v;
+  unsigned long hash = 0;
+  const char *p;
+
+  for (p = term; *p; p++)
+    hash = hash * 31 + (unsigned char) *p;
+
+  for (v = m->table[hash % VERDICTS]; v != NULL; v = v->next)
+    if (strcmp (v->term, term) == 0)
+      return v->match;
+
+  v = newts_malloc (sizeof (struct verdict));
+  v->term = newts_strdup (term);
+  v->match = strstr (term, m->search) != NULL;
+
+  if (!v->match)
+    {
+      char user[NAMESZ + 1];
+      struct passwd *pw;
+
+      snprintf (user, sizeof user, "%.*s", NAMESZ, name);
+
+      if ((pw = getpwnam (user)) != NULL && pw->pw_gecos != NULL)
+        {
+          char *real = newts_strdup (pw->pw_gecos);
+          char *separator;
+          int i;
+
+          if ((separator = strpbrk (real, ":,")) != NULL)
+            *separator = '\0';
+          for (i = 0; real[i]; i++)
+            real[i] = (char) tolower ((unsigned char) real[i]);
+
+          v->match = strstr (real, m->search) != NULL;
+          newts_free (real);
+        }
+      endpwent ();
+    }
+
+  v->next = m->table[hash % VERDICTS];
+  m->table[hash % VERDICTS] = v;
+
+  return v->match;
+}
+
+static int
+compare_matches (const void *a, const void *b)
+{
+  const struct newts_match *x = a, *y = b;
+
+  if (x->notenum != y->notenum)
+    return x->notenum < y->notenum ? -1 : 1;
+  return (x->respnum > y->respnum) - (x->respnum < y->respnum);
+}
+
+/* add_match - append NOTENUM and RESPNUM to the NMATCHES MATCHES, and return
+ * the new number of matches.
+ */
+
+static int
+add_match (struct newts_match **matches, int nmatches, int notenum,
+           int respnum)
+{
+  *matches = newts_nrealloc (*matches, nmatches + 1,
+                             sizeof (struct newts_match));
+  (*matches)[nmatches].notenum = notenum;
+  (*matches)[nmatches].respnum = respnum;
+  (*matches)[nmatches].score = 1.0;
+
+  return nmatches + 1;
+}
+
+/* scan_all - find the matches for M the slow way, reading every record of IO,
+ * and store them in MATCHES.  Returns the number found.
+ */
+
+static int
+scan_all (struct io_f *io, struct matcher *m, struct newts_match **matches)
+{
+  struct note_f note;
+  struct resp_f resp;
+  char term[AUTHOR_MAX];
+  int nmatches = 0;
+  int i, j, offset, record;
+
+  for (i = 1; i <= io->descr.d_nnote; i++)
+    {
+      readnoterec (io, i, &note);
+      if (note.n_stat & ISDELETED)
+        continue;
+
+      author_term (term, note.n_auth.aname, note.n_id.sys);
+      if (is_match (m, term, note.n_auth.aname))
+        nmatches = add_match (matches, nmatches, i, 0);
+
+      for (j = 1; j <= note.n_nresp; j++)
+        {
+          if (logical_resp (io, i, j, &resp, &offset, &record) == -1)
+            break;
+
+          author_term (term, resp.r_auth[offset].aname,
+                       resp.r_id[offset].sys);
+          if (is_match (m, term, resp.r_auth[offset].aname))
+            nmatches = add_match (matches, nmatches, i, j);
+        }
+    }
+
+  return nmatches;
+}
@@ -33,14 +33,13 @@
 # include <ctype.h>
 #endif
 
-#if HAVE_FCNTL_H
-# include <fcntl.h>
-#endif
-
 #if HAVE_PWD_H
 # include <pwd.h>
 #endif
 
+static int next_match (struct newtref *nrp, struct newts_match *matches,
+                       int count);
+
 /* author_search will search half-backwards through a notesfile trying to find
  * a note with the specified author.
  *
@@ -49,6 +48,9 @@
  * to the last basenote, and then it will move to the second-to-last basenote,
  * and so on and so forth.
  *
+ * The author index answers the search where it can; otherwise every record is
+ * read in turn.
+ *
  * Returns the note number if a match is found, or -1 if no match.
  */
 
@@ -59,7 +61,7 @@ uiuc_author_search (struct newtref *nrp, const char *author)
   struct io_f io;
   struct note_f note;
   struct resp_f resp;
-  struct flock lock;
+  struct newts_match *matches;
   register int i;
   int offset, record;
   char buffer[NAMESZ + SYSSZ + 2];
@@ -84,22 +86,18 @@ uiuc_author_search (struct newtref *nrp, const char *author)
     if (isupper (io.xauthor[i]))
       io.xauthor[i] = tolower (io.xauthor[i]);
 
-  lock.l_whence = SEEK_SET;
-  lock.l_len = (off_t) sizeof (struct note_f);
-
-  if (nrp->respnum != 0)
+  if ((i = aindex_find (&io, io.xauthor, &matches)) >= 0)
     {
-      lock.l_type = F_RDLCK;
-      lock.l_start = (off_t) (sizeof (struct descr_f) +
-                              (nrp->notenum * sizeof (struct note_f)));
-      TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &lock));
-
-      getnoterec (&io, nrp->notenum, &note);
+      int found = next_match (nrp, matches, i);
 
-      fdatasync (io.fidndx);
-      lock.l_type = F_UNLCK;
-      fcntl (io.fidndx, F_SETLK, &lock);
+      newts_free (matches);
+      closenf (&io);
+      return found;
+    }
 
+  if (nrp->respnum != 0)
+    {
+      readnoterec (&io, nrp->notenum, &note);
       goto inloop;
     }
 
@@ -107,16 +105,7 @@ uiuc_author_search (struct newtref *nrp, const char *author)
 
   while (nrp->notenum > 0)
     {
-      lock.l_type = F_RDLCK;
-      lock.l_start = (off_t) (sizeof (struct descr_f) +
-                              (nrp->notenum * sizeof (struct note_f)));
-      TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &lock));
-
-      getnoterec (&io, nrp->notenum, &note);
-
-      fdatasync (io.fidndx);
-      lock.l_type = F_UNLCK;
-      fcntl (io.fidndx, F_SETLK, &lock);
+      readnoterec (&io, nrp->notenum, &note);
 
       if (note.n_stat & ISDELETED)
         {
@@ -134,7 +123,7 @@ uiuc_author_search (struct newtref *nrp, const char *author)
         newts_free (real);
 
       pw = getpwnam (note.n_auth.aname);
-      real = newts_strdup (pw->pw_gecos);
+      real = newts_strdup (pw != NULL ? pw->pw_gecos : "");
       endpwent ();
 
       if ((separator = strpbrk (real, ":,")) != NULL)
@@ -171,7 +160,7 @@ uiuc_author_search (struct newtref *nrp, const char *author)
             newts_free (real);
 
           pw = getpwnam (resp.r_auth[offset].aname);
-          real = newts_strdup (pw->pw_gecos);
+          real = newts_strdup (pw != NULL ? pw->pw_gecos : "");
           endpwent ();
 
           if ((separator = strpbrk (real, ":,")) != NULL)
@@ -200,3 +189,42 @@ uiuc_author_search (struct newtref *nrp, const char *author)
   closenf (&io);
   return -1;
 }
+
+/* next_match - find where a search from NRP would first come to one of the
+ * COUNT MATCHES, which are in note order, and set NRP to it.  Returns the note
+ * number, or -1 if there's none.
+ */
+
+static int
+next_match (struct newtref *nrp, struct newts_match *matches, int count)
+{
+  int i;
+
+  /* The rest of the current note comes first... */
+
+  for (i = 0; i < count; i++)
+    if (matches[i].notenum > nrp->notenum ||
+        (matches[i].notenum == nrp->notenum &&
+         matches[i].respnum >= nrp->respnum))
+      break;
+
+  if (i < count && matches[i].notenum == nrp->notenum)
+    {
+      nrp->respnum = matches[i].respnum;
+      return nrp->notenum;
+    }
+
+  /* ...then the notes before it, each from the basenote on. */
+
+  while (i > 0 && matches[i - 1].notenum >= nrp->notenum)
+    i--;
+  if (i == 0)
+    return -1;
+
+  for (i--; i > 0 && matches[i - 1].notenum == matches[i].notenum; i--)
+    ;
+
+  nrp->notenum = matches[i].notenum;
+  nrp->respnum = matches[i].respnum;
+  return nrp->notenum;
+}
@@ -0,0 +1,634 @@
+/*
+ * change_log.c - what has been written to a notesfile, and when
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "uiuc-backend.h"
+
+#if HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+/* CHANGELOG records every basenote and response as it's written, every edit
+ * that counts as modifying it, and every deletion, so that finding out
+ * whether anything is new since some time doesn't mean reading the note
+ * records.  Entries are only ever appended, each stamped with when it was
+ * logged; the stamps never go backwards, so the entries after any time can
+ * be found by binary search, and they're usually few.
+ *
+ * The time a note or response was written or edited, which is what the
+ * sequencer goes by, can be older than its stamp (a note received from
+ * elsewhere keeps its own time) but never newer, so nothing written after a
+ * time is logged before it.
+ *
+ * Like the postings files, the header records the inode of 'note.indx', and
+ * a log that doesn't match is rebuilt from the records.  The records don't
+ * say which response was edited, or when anything was edited before the
+ * last write to its note, so a rebuilt log only has an edit for a basenote
+ * whose modification time is later than anything written in it; that's
+ * when the sequencer would find it new, too.
+ */
+
+#define CLOG_MAGIC "NEWTSCL1"
+
+struct clog_header
+{
+  char h_magic[8];
+  long h_inode;                 /* Inode of 'note.indx' when built. */
+};
+
+struct change_f
+{
+  long c_logged;                /* When it was logged. */
+  long c_time;                  /* When it was written or edited. */
+  int c_note;                   /* Basenote number. */
+  int c_where;                  /* 0, or a response slot from POST_RESP. */
+  int c_kind;                   /* Which of the CHANGE_* it records. */
+  struct auth_f c_auth;         /* Who wrote it. */
+};
+
+#define CHANGE_WRITTEN  0
+#define CHANGE_DELETED  1
+#define CHANGE_MODIFIED 2
+
+static void append (struct io_f *io, struct change_f *change);
+static int open_log (struct io_f *io);
+static int check_header (int fid, struct io_f *io);
+static long count_changes (int fid);
+static int read_change (int fid, long index, struct change_f *change);
+static int rebuild (int fid, struct io_f *io);
+static int compare_changes (const void *a, const void *b);
+static void lock_header (int fid, short type);
+
+/* clog_add - log the note or response at WHERE in note NOTENUM of IO,
+ * written at CREATED by AUTH.
+ */
+
+void
+clog_add (struct io_f *io, int notenum, int where, time_t created,
+          const struct auth_f *auth)
+{
+  struct change_f change;
+
+  memset (&change, 0, sizeof (struct change_f));
+  change.c_time = (long) created;
+  change.c_note = notenum;
+  change.c_where = where;
+  change.c_auth = *auth;
+
+  append (io, &change);
+}
+
+/* clog_delete - log the deletion of the note or response at WHERE in note
+ * NOTENUM of IO.
+ */
+
+void
+clog_delete (struct io_f *io, int notenum, int where)
+{
+  struct change_f change;
+
+  memset (&change, 0, sizeof (struct change_f));
+  change.c_time = (long) time (NULL);
+  change.c_note = notenum;
+  change.c_where = where;
+  change.c_kind = CHANGE_DELETED;
+
+  append (io, &change);
+}
+
+/* clog_modify - log the modification at MODIFIED of the note or response at
+ * WHERE in note NOTENUM of IO, written by AUTH.
+ */
+
+void
+clog_modify (struct io_f *io, int notenum, int where, time_t modified,
+             const struct auth_f *auth)
+{
+  struct change_f change;
+
+  memset (&change, 0, sizeof (struct change_f));
+  change.c_time = (long) modified;
+  change.c_note = notenum;
+  change.c_where = where;
+  change.c_kind = CHANGE_MODIFIED;
+  change.c_auth = *auth;
+
+  append (io, &change);
+}
+
+/* clog_rebuild - build the change log of IO from scratch.  Returns 0, or -1
+ * if it can't be written.
+ */
+
+int
+clog_rebuild (struct io_f *io)
+{
+  int fid, result;
+
+  if (io->handle == NULL || (fid = open_sidecar (io->fullname, CHANGELOG)) < 0)
+    return -1;
+
+  lock_header (fid, F_WRLCK);
+  result = rebuild (fid, io);
+  lock_header (fid, F_UNLCK);
+
+  TEMP_FAILURE_RETRY (close (fid));
+  return result;
+}
+
+/* get_changes - find every basenote and response of REF written or modified
+ * after SEQ that's still there, without looking at the notes themselves.
+ * They're stored in a newly allocated array in CHANGES, oldest first.
+ *
+ * Returns: the number found, -1 if the notesfile can't be opened or its
+ * change log can't be used, or -2 if the caller may not read it.
+ */
+
+int
+uiuc_get_changes (const newts_nfref *ref, time_t seq,
+                  struct newts_change **changes)
+{
+  struct io_f io;
+  struct change_f *tail = NULL;
+  long count, low, high, ntail = 0, i, j;
+  int fid, found = 0;
+
+  *changes = NULL;
+
+  if (init (&io, ref) != NEWTS_NO_ERROR)
+    return -1;
+
+  if (!allow (&io, READOK))
+    {
+      closenf (&io);
+      return -2;
+    }
+
+  if ((fid = open_log (&io)) < 0)
+    {
+      closenf (&io);
+      return -1;
+    }
+
+  /* Find the first change logged after SEQ, and read from there on. */
+
+  count = count_changes (fid);
+  low = 0;
+  high = count;
+  while (low < high)
+    {
+      struct change_f change;
+      long middle = low + (high - low) / 2;
+
+      if (read_change (fid, middle, &change) != 0)
+        break;
+      if (change.c_logged > (long) seq)
+        high = middle;
+      else
+        low = middle + 1;
+    }
+
+  if (low < count)
+    {
+      size_t size = (size_t) (count - low) * sizeof (struct change_f);
+      ssize_t got;
+
+      tail = newts_malloc (size);
+      lseek (fid, (off_t) (sizeof (struct clog_header) +
+                           (size_t) low * sizeof (struct change_f)),
+             SEEK_SET);
+      got = TEMP_FAILURE_RETRY (read (fid, tail, size));
+      ntail = got > 0 ? (long) ((size_t) got / sizeof (struct change_f)) : 0;
+    }
+
+  lock_header (fid, F_UNLCK);
+  TEMP_FAILURE_RETRY (close (fid));
+  closenf (&io);
+
+  /* Drop whatever was deleted afterwards.  Deleting a basenote deletes its
+   * responses as well.  Of a note written and then modified, only the last
+   * modification is kept.
+   */
+
+  for (i = 0; i < ntail; i++)
+    if (tail[i].c_kind != CHANGE_WRITTEN)
+      for (j = 0; j < i; j++)
+        if (tail[j].c_kind != CHANGE_DELETED &&
+            tail[j].c_note == tail[i].c_note &&
+            (tail[j].c_where == tail[i].c_where ||
+             (tail[i].c_where == 0 && tail[i].c_kind == CHANGE_DELETED)))
+          tail[j].c_note = -1;
+
+  for (i = 0; i < ntail; i++)
+    {
+      struct newts_change *change;
+
+      if (tail[i].c_kind == CHANGE_DELETED || tail[i].c_note <= 0 ||
+          tail[i].c_time <= (long) seq)
+        continue;
+
+      *changes = newts_nrealloc (*changes, found + 1,
+                                 sizeof (struct newts_change));
+      change = &(*changes)[found++];
+
+      change->notenum = tail[i].c_note;
+      change->response = tail[i].c_where != 0;
+      change->created = (time_t) tail[i].c_time;
+      change->auth.name = newts_nmalloc (NAMESZ + 1, sizeof (char));
+      snprintf (change->auth.name, NAMESZ + 1, "%.*s", NAMESZ,
+                tail[i].c_auth.aname);
+      change->auth.system = newts_nmalloc (HOMESYSSZ + 1, sizeof (char));
+      snprintf (change->auth.system, HOMESYSSZ + 1, "%.*s", HOMESYSSZ,
+                tail[i].c_auth.asystem);
+      change->auth.uid = (uid_t) tail[i].c_auth.aid;
+    }
+
+  newts_free (tail);
+
+  return found;
+}
+
+/* follow_changes - find the basenotes and responses written to REF since
+ * FOLLOW was last brought up to date, without checking who may read them, and
+ * bring it up to date.  They're stored in a newly allocated array in
+ * CHANGES, oldest first, with RESPONSE holding the number of each response.
+ * A FOLLOW that's new, or that was brought up to date before the notesfile
+ * was compressed, only catches up.
+ *
+ * Returns: the number found, or -1 if the notesfile can't be opened or its
+ * change log can't be used.
+ */
+
+int
+uiuc_follow_changes (const newts_nfref *ref, struct uiuc_follow *follow,
+                     struct newts_change **changes)
+{
+  struct io_f io;
+  struct stat statbuf;
+  struct change_f *tail = NULL;
+  long count, ntail = 0, i;
+  int fid, found = 0;
+
+  *changes = NULL;
+
+  if (init (&io, ref) != NEWTS_NO_ERROR)
+    return -1;
+
+  if ((fid = open_log (&io)) < 0 || fstat (io.fidndx, &statbuf))
+    {
+      if (fid >= 0)
+        {
+          lock_header (fid, F_UNLCK);
+          TEMP_FAILURE_RETRY (close (fid));
+        }
+      closenf (&io);
+      return -1;
+    }
+
+  /* A rebuilt log starts over, and has nothing new in it. */
+
+  count = count_changes (fid);
+  if (follow->inode != (long) statbuf.st_ino || count < follow->seen)
+    {
+      follow->inode = (long) statbuf.st_ino;
+      follow->seen = count;
+    }
+  else if (count > follow->seen)
+    {
+      size_t size = (size_t) (count - follow->seen) *
+        sizeof (struct change_f);
+      ssize_t got;
+
+      tail = newts_malloc (size);
+      lseek (fid, (off_t) (sizeof (struct clog_header) +
+                           (size_t) follow->seen * sizeof (struct change_f)),
+             SEEK_SET);
+      got = TEMP_FAILURE_RETRY (read (fid, tail, size));
+      ntail = got > 0 ? (long) ((size_t) got / sizeof (struct change_f)) : 0;
+      follow->seen += ntail;
+    }
+
+  lock_header (fid, F_UNLCK);
+  TEMP_FAILURE_RETRY (close (fid));
+
+  for (i = 0; i < ntail; i++)
+    {
+      struct newts_change *change;
+      struct posting posting;
+      struct note_f note;
+      struct resp_f resp;
+      int respnum;
+
+      posting.p_note = tail[i].c_note;
+      posting.p_where = tail[i].c_where;
+      if (tail[i].c_kind != CHANGE_WRITTEN || tail[i].c_note <= 0 ||
+          post_resolve (&io, &posting, &note, &resp, &respnum) != 0)
+        continue;
+
+      *changes = newts_nrealloc (*changes, found + 1,
+                                 sizeof (struct newts_change));
+      change = &(*changes)[found++];
+
+      change->notenum = tail[i].c_note;
+      change->response = respnum;
+      change->created = (time_t) tail[i].c_time;
+      change->auth.name = newts_nmalloc (NAMESZ + 1, sizeof (char));
+      snprintf (change->auth.name, NAMESZ + 1, "%.*s", NAMESZ,
+                tail[i].c_auth.aname);
+      change->auth.system = newts_nmalloc (HOMESYSSZ + 1, sizeof (char));
+      snprintf (change->auth.system, HOMESYSSZ + 1, "%.*s", HOMESYSSZ,
+                tail[i].c_auth.asystem);
+      change->auth.uid = (uid_t) tail[i].c_auth.aid;
+    }
+
+  newts_free (tail);
+  closenf (&io);
+
+  return found;
+}
+
+/* open_log - open the change log of IO with its header locked, rebuilding it
+ * if it isn't usable.  Returns the file descriptor, or -1.
+ */
+
+static int
+open_log (struct io_f *io)
+{
+  short type = F_RDLCK;
+  int fid;
+
+  if (io->handle == NULL ||
+      (fid = open_sidecar (io->fullname, CHANGELOG)) < 0)
+    return -1;
+
+  /* Usually the log is good, and a read lock will do.  Otherwise, start
+   * over with a write lock and rebuild it.
+   */
+
+  for (;;)
+    {
+      lock_header (fid, type);
+      if (check_header (fid, io) == 0)
+        return fid;
+      if (type == F_WRLCK)
+        {
+          if (rebuild (fid, io) == 0)
+            return fid;
+
+          lock_header (fid, F_UNLCK);
+          TEMP_FAILURE_RETRY (close (fid));
+          return -1;
+        }
+
+      lock_header (fid, F_UNLCK);
+      type = F_WRLCK;
+    }
+}
+
+/* append - stamp CHANGE and add it to the end of the change log of IO.  If
+ * the log isn't usable it's left alone, to be rebuilt by the next reader.
+ */
+
+static void
+append (struct io_f *io, struct change_f *change)
+{
+  struct change_f last;
+  long count;
+  int fid;
+
+  if (io->handle == NULL || (fid = open_sidecar (io->fullname, CHANGELOG)) < 0)
+    return;
+
+  lock_header (fid, F_WRLCK);
+
+  if (check_header (fid, io) == 0)
+    {
+      change->c_logged = (long) time (NULL);
+      if (change->c_logged < change->c_time)
+        change->c_logged = change->c_time;
+
+      count = count_changes (fid);
+      if (count > 0 && read_change (fid, count - 1, &last) == 0 &&
+          change->c_logged < last.c_logged)
+        change->c_logged = last.c_logged;
+
+      lseek (fid, (off_t) (sizeof (struct clog_header) +
+                           (size_t) count * sizeof (struct change_f)),
+             SEEK_SET);
+      TEMP_FAILURE_RETRY (write (fid, change, sizeof (struct change_f)));
+    }
+
+  lock_header (fid, F_UNLCK);
+  TEMP_FAILURE_RETRY (close (fid));
+}
+
+/* check_header - return 0 if the change log FID is usable with IO, or -1. */
+
+static int
+check_header (int fid, struct io_f *io)
+{
+  struct clog_header header;
+  struct stat statbuf;
+
+  if (fstat (io->fidndx, &statbuf))
+    return -1;
+
+  lseek (fid, (off_t) 0, SEEK_SET);
+  if (TEMP_FAILURE_RETRY (read (fid, &header, sizeof header)) ==
+      sizeof header &&
+      memcmp (header.h_magic, CLOG_MAGIC, sizeof header.h_magic) == 0 &&
+      header.h_inode == (long) statbuf.st_ino)
+    return 0;
+
+  return -1;
+}
+
+/* count_changes - return the number of changes in the change log FID. */
+
+static long
+count_changes (int fid)
+{
+  struct stat statbuf;
+
+  if (fstat (fid, &statbuf) ||
+      statbuf.st_size < (off_t) sizeof (struct clog_header))
+    return 0;
+
+  return (long) ((statbuf.st_size - sizeof (struct clog_header)) /
+                 sizeof (struct change_f));
+}
+
+/* read_change - read change INDEX of the change log FID into CHANGE.
+ * Returns 0, or -1 if there's no such change.
+ */
+
+static int
+read_change (int fid, long index, struct change_f *change)
+{
+  lseek (fid, (off_t) (sizeof (struct clog_header) +
+                       (size_t) index * sizeof (struct change_f)), SEEK_SET);
+  if (TEMP_FAILURE_RETRY (read (fid, change, sizeof (struct change_f))) !=
+      sizeof (struct change_f))
+    return -1;
+
+  return 0;
+}
+
+/* rebuild - rewrite the change log FID of IO from the note and response
+ * records, in the order they were written.  The caller holds the header's
+ * write lock.  Returns 0, or -1 if it couldn't be written.
+ */
+
+static int
+rebuild (int fid, struct io_f *io)
+{
+  struct clog_header header;
+  struct change_f *changes = NULL;
+  struct note_f note;
+  struct resp_f resp;
+  struct descr_f descr;
+  struct stat statbuf;
+  long count = 0, i;
+  int max, result = 0;
+  size_t size;
+
+  if (fstat (io->fidndx, &statbuf))
+    return -1;
+
+  readdescr (io, &descr);
+  max = getrespcount (io);
+
+  for (i = 1; i <= descr.d_nnote; i++)
+    {
+      int record, live, blocks, k;
+      long latest;
+
+      readnoterec (io, (int) i, &note);
+      if (note.n_stat & ISDELETED)
+        continue;
+
+      changes = newts_nrealloc (changes, count + 1, sizeof (struct change_f));
+      memset (&changes[count], 0, sizeof (struct change_f));
+      changes[count].c_logged = changes[count].c_time = latest =
+        (long) convert_time (&note.n_date);
+      changes[count].c_note = (int) i;
+      changes[count].c_auth = note.n_auth;
+      count++;
+
+      live = note.n_nresp;
+      for (record = note.n_rindx, blocks = 0;
+           record >= 0 && record < max && blocks < max && live > 0;
+           record = resp.r_next, blocks++)
+        {
+          readresprec (io, record, &resp);
+          for (k = 0; k < RESPSZ && live > 0; k++)
+            if ((resp.r_stat[k] & ISDELETED) == 0)
+              {
+                changes = newts_nrealloc (changes, count + 1,
+                                          sizeof (struct change_f));
+                memset (&changes[count], 0, sizeof (struct change_f));
+                changes[count].c_logged = changes[count].c_time =
+                  (long) convert_time (&resp.r_when[k]);
+                changes[count].c_note = (int) i;
+                changes[count].c_where = POST_RESP (record, k);
+                changes[count].c_auth = resp.r_auth[k];
+                if (changes[count].c_time > latest)
+                  latest = changes[count].c_time;
+                count++;
+                live--;
+              }
+        }
+
+      if ((long) convert_time (&note.n_lmod) > latest)
+        {
+          changes = newts_nrealloc (changes, count + 1,
+                                    sizeof (struct change_f));
+          memset (&changes[count], 0, sizeof (struct change_f));
+          changes[count].c_logged = changes[count].c_time =
+            (long) convert_time (&note.n_lmod);
+          changes[count].c_note = (int) i;
+          changes[count].c_kind = CHANGE_MODIFIED;
+          changes[count].c_auth = note.n_auth;
+          count++;
+        }
+    }
+
+  if (count > 1)
+    qsort (changes, (size_t) count, sizeof (struct change_f),
+           compare_changes);
+
+  memset (&header, 0, sizeof header);
+  memcpy (header.h_magic, CLOG_MAGIC, sizeof header.h_magic);
+  header.h_inode = (long) statbuf.st_ino;
+
+  /* Write the changes before the header, so a failure leaves the log
+   * unusable rather than wrong.
+   */
+
+  ftruncate (fid, (off_t) 0);
+  size = (size_t) count * sizeof (struct change_f);
+  lseek (fid, (off_t) sizeof header, SEEK_SET);
+  if (size > 0 &&
+      TEMP_FAILURE_RETRY (write (fid, changes, size)) != (ssize_t) size)
+    result = -1;
+  else
+    {
+      lseek (fid, (off_t) 0, SEEK_SET);
+      if (TEMP_FAILURE_RETRY (write (fid, &header, sizeof header)) !=
+          sizeof header)
+        result = -1;
+    }
+
+  newts_free (changes);
+  return result;
+}
+
+static int
+compare_changes (const void *a, const void *b)
+{
+  const struct change_f *x = a, *y = b;
+
+  return (x->c_logged > y->c_logged) - (x->c_logged < y->c_logged);
+}
+
+/* lock_header - lock or unlock the header of the change log FID. */
+
+static void
+lock_header (int fid, short type)
+{
+  struct flock lock;
+
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = (off_t) sizeof (struct clog_header);
+  if (type == F_UNLCK)
+    fcntl (fid, F_SETLK, &lock);
+  else
+    TEMP_FAILURE_RETRY (fcntl (fid, F_SETLKW, &lock));
+}
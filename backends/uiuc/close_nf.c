@@ -43,7 +43,11 @@ uiuc_close_nf (struct notesfile *nf, short updatestats)
 
   error = init (&io, nf->ref);
   if (error != NEWTS_NO_ERROR)
-    return error;
+    {
+      release_handle (nf->handle);
+      nf->handle = NULL;
+      return error;
+    }
 
   if (updatestats)
     {
@@ -51,7 +55,12 @@ uiuc_close_nf (struct notesfile *nf, short updatestats)
       dlock.l_whence = SEEK_SET;
       dlock.l_start = 0;
       dlock.l_len = (off_t) sizeof (struct daddr_f);
-      TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &dlock));
+      if (lock_current (&io, nf->ref, &dlock, NULL) != 0)
+        {
+          release_handle (nf->handle);
+          nf->handle = NULL;
+          return -1;
+        }
 
       getdescr (&io, &io.descr);
 
@@ -62,11 +71,15 @@ uiuc_close_nf (struct notesfile *nf, short updatestats)
 
       putdescr (&io, &io.descr);
 
-      fdatasync (io.fidndx);
+      syncnf (&io, io.fidndx);
       dlock.l_type = F_UNLCK;
       fcntl (io.fidndx, F_SETLK, &dlock);
     }
 
   closenf (&io);
+
+  release_handle (nf->handle);
+  nf->handle = NULL;
+
   return NEWTS_NO_ERROR;
 }
@@ -47,8 +47,10 @@ static void fixtime (struct when_f *when);
  * compresion.  On error, their values are undefined.
  *
  * Returns: -5 if somebody is already compressing this notesfile (hey, it could
- * happen), or 0 if compression was successful.  Or it segfaults.  *shrug* Or
- * so the UIUC source sez; I haven't been able to make it segfault.
+ * happen), NEWTS_IO_ERROR if the text couldn't be copied, in which case the
+ * notesfile is left as it was, or 0 if compression was successful.  Or it
+ * segfaults.  *shrug* Or so the UIUC source sez; I haven't been able to make
+ * it segfault.
  */
 
 int
@@ -68,6 +70,7 @@ uiuc_compress_nf (struct notesfile *nf, unsigned *numnotes, unsigned *numresps)
   int nresps = 0;
   int savedresps;
   int offset, record;
+  int failed = FALSE;
   struct io_f old, new;
   struct daddr_f daddr;
   struct note_f note;
@@ -161,8 +164,11 @@ uiuc_compress_nf (struct notesfile *nf, unsigned *numnotes, unsigned *numresps)
                 ref->name, TEXT);
     }
 
-  /* Create and initialize the virgin files. */
+  /* Create and initialize the virgin files.  These are not shared with anyone
+   * else, so they do not go through the handle cache.
+   */
 
+  new.handle = NULL;
   new.fidndx = TEMP_FAILURE_RETRY (creat (cnindx, 0660));
   new.fidrdx = TEMP_FAILURE_RETRY (creat (crindx, 0660));
   new.fidtxt = TEMP_FAILURE_RETRY (creat (ctext, 0660));
@@ -219,6 +225,10 @@ uiuc_compress_nf (struct notesfile *nf, unsigned *numnotes, unsigned *numresps)
   getdescr (&old, &new.descr);
   if (new.descr.d_stat & NFINVALID)
     {
+      dlock.l_type = F_UNLCK;
+      fcntl (old.fidndx, F_SETLK, &dlock);
+      closenf (&old);
+
       closenf (&new);
       unlink (cnindx);
       unlink (crindx);
@@ -260,7 +270,7 @@ uiuc_compress_nf (struct notesfile *nf, unsigned *numnotes, unsigned *numresps)
       nlock.l_type = F_UNLCK;
       fcntl (old.fidndx, F_SETLK, &nlock);
 
-      movetextrec (&old, &note.n_addr, &new, &daddr);
+      failed = movetextrec (&old, &note.n_addr, &new, &daddr) < 0;
 
 #ifdef FIXTIMES
       fixtime (&note.n_rcvd);
@@ -274,7 +284,7 @@ uiuc_compress_nf (struct notesfile *nf, unsigned *numnotes, unsigned *numresps)
 
   /* Recursively copy all the notes and responses. */
 
-  for (i=1; i<=old.descr.d_nnote; i++)
+  for (i=1; i<=old.descr.d_nnote && !failed; i++)
     {
       data.nr.notenum = i;
       data.nr.respnum = 0;
@@ -304,7 +314,11 @@ uiuc_compress_nf (struct notesfile *nf, unsigned *numnotes, unsigned *numresps)
 
       /* Move over the text. */
 
-      movetextrec (&old, &note.n_addr, &new, &daddr);
+      if (movetextrec (&old, &note.n_addr, &new, &daddr) < 0)
+        {
+          failed = TRUE;
+          break;
+        }
 
 #ifdef FIXTIMES
       fixtime (&note.n_rcvd);
@@ -330,26 +344,59 @@ uiuc_compress_nf (struct notesfile *nf, unsigned *numnotes, unsigned *numresps)
           if (logical_resp (&old, i, j, &resp, &offset, &record) != 0)
             break;
 
-          movetextrec (&old, &resp.r_addr[offset], &new, &daddr);
+          if (movetextrec (&old, &resp.r_addr[offset], &new, &daddr) < 0)
+            {
+              failed = TRUE;
+              break;
+            }
 
 #ifdef FIXTIMES
           fixtime (&resp.r_when[offset]);
           fixtime (&resp.r_rcvd[offset]);
 #endif
 
+          /* The note may have a new number in the new files. */
+
           load_note (&data, NULL, FALSE);
+          data.nr.notenum = nnotes;
           put_resp (&new, &daddr, &data, SKIP_MODERATION);
+          data.nr.notenum = i;
 
           nresps++;
         }
     }
 
+  closenf (&new);
+
+  /* If some text didn't make it, the new files are no good; leave the old ones
+   * where they are.
+   */
+
+  if (failed)
+    {
+      dlock.l_type = F_UNLCK;
+      fcntl (old.fidndx, F_SETLK, &dlock);
+      closenf (&old);
+
+      unlink (cnindx);
+      unlink (crindx);
+      unlink (ctext);
+
+      newts_free (nindx);
+      newts_free (rindx);
+      newts_free (text);
+      newts_free (cnindx);
+      newts_free (crindx);
+      newts_free (ctext);
+
+      umask (old_umask);
+      return NEWTS_IO_ERROR;
+    }
+
   /* Having copied all the notes and responses over, it's time to replace the
    * old files.  First mark the old set as invalid, then replace each file.
    */
 
-  closenf (&new);
-
   getdescr (&old, &old.descr);
   old.descr.d_stat |= NFINVALID;
   putdescr (&old, &old.descr);
@@ -369,6 +416,25 @@ uiuc_compress_nf (struct notesfile *nf, unsigned *numnotes, unsigned *numresps)
   unlink (nindx);
   link (cnindx, nindx);
   unlink (cnindx);
+  remove_sidecars (old.fullname);
+
+  /* Nobody in this process should keep using the files we just replaced. */
+
+  invalidate_handle (old.handle);
+  closenf (&old);
+
+  /* The search indexes were thrown away with the rest; build them again now,
+   * rather than leaving it to the first search.
+   */
+
+  if (init (&old, ref) == NEWTS_NO_ERROR)
+    {
+      tindex_rebuild (&old);
+      aindex_rebuild (&old);
+      clog_rebuild (&old);
+      mindex_rebuild (&old);
+      closenf (&old);
+    }
 
   /* Clean up. */
 
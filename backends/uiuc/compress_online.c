@@ -0,0 +1,801 @@
+/*
+ * compress_online.c - recreate a notesfile while people keep using it
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "uiuc-backend.h"
+
+#if TIME_WITH_SYS_TIME
+# include <sys/time.h>
+# include <time.h>
+#else
+# if HAVE_SYS_TIME_H
+#  include <sys/time.h>
+# else
+#  include <time.h>
+# endif
+#endif
+
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#if HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+/* uiuc_compress_nf holds the descriptor locked for the whole copy, which
+ * shuts everybody out of a large notesfile for minutes.  Here we copy without
+ * holding any locks, in three phases:
+ *
+ * 1. Copy every note, with its responses and text, into the '.compress' files,
+ *    remembering a fingerprint of the note record and its chain of response
+ *    blocks as we read them.
+ * 2. Go over the notesfile again, recopying the notes whose fingerprint has
+ *    changed and copying the notes written since we started, until few enough
+ *    are left over or we give up on catching up.
+ * 3. Lock the whole of 'note.indx' and 'resp.indx', catch up for the last
+ *    time, mark the old files invalid and swap in the new ones.
+ *
+ * Only the last phase shuts anybody out, and it only copies what changed
+ * since the phase before.  Writers that were waiting on it find the old
+ * descriptor marked invalid once they have their locks, and start again on
+ * the new files; see lock_current.
+ *
+ * A note that's recopied gets a fresh chain of response blocks and fresh text
+ * in the new files, and the ones copied before are simply abandoned; the next
+ * compression will get rid of them.
+ *
+ * Two compressions of the same notesfile are kept apart by a write lock on
+ * the new 'note.indx'.
+ */
+
+#define COMPRESS_BATCH 64       /* Notes copied between progress reports. */
+#define CATCHUP_PASSES 4        /* Unlocked passes before giving up. */
+#define CATCHUP_QUIET  16       /* Changed notes we'll leave to phase 3. */
+
+struct copied
+{
+  int newnum;                   /* Number in the new files, or -1. */
+  int nresp;                    /* Responses copied. */
+  short seen;                   /* Nonzero if PRINT is valid. */
+  short deleted;                /* Nonzero if copied as deleted. */
+  unsigned long print;          /* Fingerprint when last copied. */
+};
+
+struct compression
+{
+  struct io_f old, new;
+  struct copied *copied;        /* Indexed by old note number. */
+  int ncopied;                  /* Entries in the above. */
+  int blocks;                   /* Response blocks in the new files. */
+  int locked;                   /* Nonzero in the critical section. */
+  int failed;                   /* Nonzero if some text didn't copy. */
+};
+
+static char *nf_file (const char *fullname, const char *name,
+                      const char *suffix);
+static int copy_note (struct compression *c, int notenum);
+static int catch_up (struct compression *c);
+static int read_chain (struct compression *c, struct note_f *note,
+                       struct resp_f **blocks);
+static unsigned long fingerprint (struct note_f *note, struct resp_f *blocks,
+                                  int nblocks);
+static void copy_resps (struct compression *c, struct note_f *note,
+                        struct resp_f *blocks, int nblocks);
+static void lock_whole (int fid, short type);
+static void discard (struct compression *c, char **names);
+static int relocate (struct io_f *old, struct newtref *nr);
+static int same_id (const struct id_f *a, const struct id_f *b);
+
+/* compress_nf_online - do what compress_nf does, without keeping everybody
+ * else out of NF while it happens.  PROGRESS, if not NULL, is called every so
+ * often during the copy with the number of notes copied, the number of notes
+ * there were to copy, and DATA.
+ *
+ * Returns: NEWTS_ALREADY_COMPRESSING if somebody is already compressing this
+ * notesfile, NEWTS_IO_ERROR if the text couldn't be copied, another error
+ * code if it couldn't be opened, or 0 if compression was successful.  On
+ * error the notesfile is left as it was.
+ */
+
+int
+uiuc_compress_nf_online (struct notesfile *nf, unsigned *numnotes,
+                         unsigned *numresps,
+                         void (*progress) (unsigned, unsigned, void *),
+                         void *data)
+{
+  struct compression c;
+  struct descr_f descr;
+  struct flock lock;
+  char *names[6];
+  mode_t old_umask;
+  int error, total, pass, i;
+  int respptr = 0;
+  unsigned nnotes = 0, nresps = 0;
+
+  memset (&c, 0, sizeof c);
+
+  error = init (&c.old, nf->ref);
+  if (error != NEWTS_NO_ERROR)
+    return error;
+
+  if (c.old.descr.d_stat & NFINVALID)
+    {
+      closenf (&c.old);
+      return NEWTS_ALREADY_COMPRESSING;
+    }
+
+  names[0] = nf_file (c.old.fullname, NOTEINDX, "");
+  names[1] = nf_file (c.old.fullname, RESPINDX, "");
+  names[2] = nf_file (c.old.fullname, TEXT, "");
+  names[3] = nf_file (c.old.fullname, NOTEINDX, ".compress");
+  names[4] = nf_file (c.old.fullname, RESPINDX, ".compress");
+  names[5] = nf_file (c.old.fullname, TEXT, ".compress");
+
+  /* Open the virgin files without truncating them, since another compression
+   * may be using them, and see whether one is.
+   */
+
+  old_umask = umask (0);
+
+  c.new.handle = NULL;
+  c.new.fidndx = TEMP_FAILURE_RETRY (open (names[3], O_RDWR | O_CREAT,
+                                           0660));
+  c.new.fidrdx = TEMP_FAILURE_RETRY (open (names[4], O_RDWR | O_CREAT,
+                                           0660));
+  c.new.fidtxt = TEMP_FAILURE_RETRY (open (names[5], O_RDWR | O_CREAT,
+                                           0660));
+
+  umask (old_umask);
+
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = 0;
+  if (c.new.fidndx < 0 || c.new.fidrdx < 0 || c.new.fidtxt < 0 ||
+      fcntl (c.new.fidndx, F_SETLK, &lock) < 0)
+    {
+      closenf (&c.new);
+      closenf (&c.old);
+      for (i=0; i<6; i++)
+        newts_free (names[i]);
+      return NEWTS_ALREADY_COMPRESSING;
+    }
+
+  /* They're ours; start them from scratch. */
+
+  ftruncate (c.new.fidndx, (off_t) 0);
+  ftruncate (c.new.fidrdx, (off_t) 0);
+  ftruncate (c.new.fidtxt, (off_t) 0);
+
+  {
+    struct daddr_f daddr;
+
+    daddr.addr = sizeof (struct daddr_f);
+    daddr.textlen = 0;
+    TEMP_FAILURE_RETRY (write (c.new.fidrdx, &respptr, sizeof (int)));
+    TEMP_FAILURE_RETRY (write (c.new.fidtxt, &daddr,
+                               sizeof (struct daddr_f)));
+  }
+
+  strncpy (c.new.nf, c.old.nf, NNLEN);
+  strncpy (c.new.basedir, c.old.basedir, WDLEN);
+  strncpy (c.new.fullname, c.old.fullname, WDLEN);
+  c.new.access = c.old.access;
+
+  c.new.descr = c.old.descr;
+  c.new.descr.d_nnote = c.new.descr.d_delnote = c.new.descr.d_delresp = 0;
+  putdescr (&c.new, &c.new.descr);
+
+  /* Phase 1: copy everything there is. */
+
+  total = c.old.descr.d_nnote;
+  c.ncopied = total + 1;
+  c.copied = newts_nmalloc (c.ncopied, sizeof (struct copied));
+  for (i=0; i<c.ncopied; i++)
+    {
+      c.copied[i].newnum = -1;
+      c.copied[i].seen = FALSE;
+    }
+
+  if (c.old.descr.d_plcy)
+    copy_note (&c, 0);
+
+  for (i=1; i<=total && !c.failed; i++)
+    {
+      copy_note (&c, i);
+
+      if (progress != NULL && i % COMPRESS_BATCH == 0)
+        progress ((unsigned) i, (unsigned) total, data);
+    }
+
+  if (progress != NULL)
+    progress ((unsigned) total, (unsigned) total, data);
+
+  /* Phase 2: catch up with whatever happened in the meantime. */
+
+  for (pass=0; pass<CATCHUP_PASSES && !c.failed; pass++)
+    if (catch_up (&c) <= CATCHUP_QUIET)
+      break;
+
+  if (c.failed)
+    {
+      discard (&c, names);
+      return NEWTS_IO_ERROR;
+    }
+
+  /* Phase 3: shut everybody out, catch up one last time and swap. */
+
+  lock_whole (c.old.fidndx, F_WRLCK);
+  lock_whole (c.old.fidrdx, F_WRLCK);
+  c.locked = TRUE;
+
+  getdescr (&c.old, &descr);
+  if (descr.d_stat & NFINVALID)
+    {
+      lock_whole (c.old.fidrdx, F_UNLCK);
+      lock_whole (c.old.fidndx, F_UNLCK);
+      discard (&c, names);
+      return NEWTS_ALREADY_COMPRESSING;
+    }
+
+  catch_up (&c);
+
+  if (c.failed)
+    {
+      lock_whole (c.old.fidrdx, F_UNLCK);
+      lock_whole (c.old.fidndx, F_UNLCK);
+      discard (&c, names);
+      return NEWTS_IO_ERROR;
+    }
+
+  /* The new descriptor gets everything the old one has now, except for what
+   * compression changes.
+   */
+
+  getdescr (&c.old, &descr);
+  i = c.new.descr.d_nnote;
+  c.new.descr = descr;
+  c.new.descr.d_nnote = i;
+  c.new.descr.d_delnote = c.new.descr.d_delresp = 0;
+
+  for (i=0; i<c.ncopied; i++)
+    if (c.copied[i].newnum > 0)
+      {
+        if (c.copied[i].deleted)
+          c.new.descr.d_delnote++;
+        else
+          {
+            nnotes++;
+            nresps += (unsigned) c.copied[i].nresp;
+          }
+      }
+
+  putdescr (&c.new, &c.new.descr);
+  lseek (c.new.fidrdx, (off_t) 0, SEEK_SET);
+  TEMP_FAILURE_RETRY (write (c.new.fidrdx, &c.blocks, sizeof (int)));
+
+  fdatasync (c.new.fidtxt);
+  fdatasync (c.new.fidrdx);
+  fdatasync (c.new.fidndx);
+
+  descr.d_stat |= NFINVALID;
+  putdescr (&c.old, &descr);
+  fdatasync (c.old.fidndx);
+
+  /* Each rename replaces a file in one step, so that anybody opening the
+   * notesfile meanwhile finds either the old file or the new one, and never
+   * neither.  'note.indx' goes last: until it's replaced, whoever opens it
+   * finds it invalid and keeps away from the others.
+   */
+
+  rename (names[4], names[1]);
+  rename (names[5], names[2]);
+  rename (names[3], names[0]);
+  remove_sidecars (c.old.fullname);
+
+  /* Nobody in this process should keep using the files we just replaced, and
+   * anybody waiting on them will find them invalid.
+   */
+
+  invalidate_handle (c.old.handle);
+
+  lock_whole (c.old.fidrdx, F_UNLCK);
+  lock_whole (c.old.fidndx, F_UNLCK);
+
+  closenf (&c.new);
+  closenf (&c.old);
+
+  /* Build the search indexes again, taking in anything written meanwhile. */
+
+  if (init (&c.old, nf->ref) == NEWTS_NO_ERROR)
+    {
+      tindex_rebuild (&c.old);
+      aindex_rebuild (&c.old);
+      clog_rebuild (&c.old);
+      mindex_rebuild (&c.old);
+      closenf (&c.old);
+    }
+
+  uiuc_update_nf (nf);
+  *numnotes = nnotes;
+  *numresps = nresps;
+
+  newts_free (c.copied);
+  for (i=0; i<6; i++)
+    newts_free (names[i]);
+
+  return 0;
+}
+
+/* lock_current - take LOCK on IO's 'note.indx', which was opened for REF,
+ * waiting for it if need be.  An online compression may swap in new files
+ * while we wait, leaving the old ones marked invalid, so we look again once
+ * we have the lock.  If they were swapped and NR is NULL, IO is opened again
+ * on the new files and the lock taken there instead.  Otherwise NR is
+ * pointed at the same note or response in the new files, since compression
+ * renumbers them, and the caller has to start again.
+ *
+ * Returns: 0 with LOCK held, or, with IO closed, SWAPPED if the caller has to
+ * start again or -1 if the notesfile, or what NR refers to, is gone.
+ */
+
+int
+lock_current (struct io_f *io, const newts_nfref *ref, struct flock *lock,
+              struct newtref *nr)
+{
+  short type = lock->l_type;
+  int result;
+
+  while (1)
+    {
+      TEMP_FAILURE_RETRY (fcntl (io->fidndx, F_SETLKW, lock));
+
+      readdescr (io, &io->descr);
+      if (!(io->descr.d_stat & NFINVALID))
+        return 0;
+
+      lock->l_type = F_UNLCK;
+      fcntl (io->fidndx, F_SETLK, lock);
+      lock->l_type = type;
+      invalidate_handle (io->handle);
+
+      if (nr != NULL)
+        {
+          result = relocate (io, nr);
+          closenf (io);
+          return result;
+        }
+
+      closenf (io);
+      if (init (io, ref) != NEWTS_NO_ERROR)
+        return -1;
+
+      /* Invalid from the start means an offline compression has it. */
+
+      if (io->descr.d_stat & NFINVALID)
+        {
+          closenf (io);
+          return -1;
+        }
+    }
+}
+
+/* nf_file - return the newly allocated name of the file NAME with SUFFIX in
+ * the notesfile directory FULLNAME.
+ */
+
+static char *
+nf_file (const char *fullname, const char *name, const char *suffix)
+{
+  size_t length = strlen (fullname) + strlen (name) + strlen (suffix) + 2;
+  char *result = newts_nmalloc (length, sizeof (char));
+
+  snprintf (result, length, "%s/%s%s", fullname, name, suffix);
+  return result;
+}
+
+/* copy_note - copy note NOTENUM of the old files of C, with its responses and
+ * text, unless it's unchanged since we last copied it.  Returns TRUE if the
+ * note was copied.
+ */
+
+static int
+copy_note (struct compression *c, int notenum)
+{
+  struct copied *cp;
+  struct note_f note;
+  struct resp_f *blocks;
+  struct stat statbuf;
+  unsigned long print;
+  time_t now;
+  int nblocks, sane;
+
+  if (notenum >= c->ncopied)
+    {
+      int i;
+
+      c->copied = newts_nrealloc (c->copied, notenum + 1,
+                                  sizeof (struct copied));
+      for (i=c->ncopied; i<=notenum; i++)
+        {
+          c->copied[i].newnum = -1;
+          c->copied[i].seen = FALSE;
+        }
+      c->ncopied = notenum + 1;
+    }
+  cp = &c->copied[notenum];
+
+  /* Fingerprint what we read before copying any of it, so a change made while
+   * we copy is caught on the next pass.
+   */
+
+  if (c->locked)
+    getnoterec (&c->old, notenum, &note);
+  else
+    readnoterec (&c->old, notenum, &note);
+
+  nblocks = read_chain (c, &note, &blocks);
+  print = fingerprint (&note, blocks, nblocks);
+
+  if (cp->seen && cp->print == print)
+    {
+      newts_free (blocks);
+      return FALSE;
+    }
+  cp->seen = TRUE;
+  cp->print = print;
+
+  fstat (c->old.fidtxt, &statbuf);
+  time (&now);
+  sane = !(nblocks < 0 || note.n_addr.textlen > HARDMAX ||
+           note.n_nresp < 0 || convert_time (&note.n_lmod) > now ||
+           convert_time (&note.n_date) > now ||
+           (off_t) (note.n_addr.textlen + note.n_addr.addr) >
+           statbuf.st_size);
+
+  /* Deleted and damaged notes are left behind, unless we've already copied
+   * them, in which case they're marked deleted in their new place.
+   */
+
+  if (cp->newnum < 0)
+    {
+      if (note.n_stat & ISDELETED || !sane)
+        {
+          newts_free (blocks);
+          return FALSE;
+        }
+      cp->newnum = notenum == 0 ? 0 : ++c->new.descr.d_nnote;
+    }
+
+  if (!sane)
+    {
+      note.n_addr.addr = 0;
+      note.n_addr.textlen = 0;
+      note.n_stat |= ISDELETED;
+      nblocks = 0;
+    }
+
+  copy_resps (c, &note, blocks, nblocks);
+  newts_free (blocks);
+
+  putnoterec (&c->new, cp->newnum, &note);
+
+  cp->nresp = note.n_nresp;
+  cp->deleted = (note.n_stat & ISDELETED) != 0;
+
+  return TRUE;
+}
+
+/* catch_up - copy every note of C that changed since we copied it, or that
+ * we haven't seen before.  Returns the number of notes copied.
+ */
+
+static int
+catch_up (struct compression *c)
+{
+  struct descr_f descr;
+  int count = 0;
+  int i;
+
+  if (c->locked)
+    getdescr (&c->old, &descr);
+  else
+    readdescr (&c->old, &descr);
+
+  if (descr.d_plcy)
+    count += copy_note (c, 0);
+
+  for (i=1; i<=descr.d_nnote && !c->failed; i++)
+    count += copy_note (c, i);
+
+  return count;
+}
+
+/* read_chain - read the chain of response blocks of NOTE from the old files
+ * of C into a newly allocated array stored in BLOCKS.  Returns the number of
+ * blocks, or -1 if the chain is broken.
+ */
+
+static int
+read_chain (struct compression *c, struct note_f *note,
+            struct resp_f **blocks)
+{
+  int max, count, record;
+
+  *blocks = NULL;
+  if (note->n_rindx < 0)
+    return 0;
+
+  max = getrespcount (&c->old);
+
+  for (count = 0, record = note->n_rindx; record >= 0; count++)
+    {
+      if (record >= max || count >= max)
+        {
+          newts_free (*blocks);
+          *blocks = NULL;
+          return -1;
+        }
+
+      *blocks = newts_nrealloc (*blocks, count + 1, sizeof (struct resp_f));
+      if (c->locked)
+        getresprec (&c->old, record, &(*blocks)[count]);
+      else
+        readresprec (&c->old, record, &(*blocks)[count]);
+      record = (*blocks)[count].r_next;
+    }
+
+  return count;
+}
+
+/* fingerprint - hash NOTE and its NBLOCKS response BLOCKS. */
+
+static unsigned long
+fingerprint (struct note_f *note, struct resp_f *blocks, int nblocks)
+{
+  unsigned long hash = 2166136261UL;
+  unsigned char *p;
+  size_t i;
+  int b;
+
+  for (p = (unsigned char *) note, i = 0; i < sizeof *note; i++)
+    hash = (hash ^ p[i]) * 16777619UL;
+
+  for (b = 0; b < nblocks; b++)
+    for (p = (unsigned char *) &blocks[b], i = 0; i < sizeof *blocks; i++)
+      hash = (hash ^ p[i]) * 16777619UL;
+
+  return hash ^ (unsigned long) nblocks;
+}
+
+/* copy_resps - copy the text of NOTE, and the responses in its NBLOCKS
+ * response BLOCKS with their text, into a new chain at the end of the new
+ * files of C, and point NOTE at them.  Deleted and damaged responses are left
+ * behind.  All the text goes over in one go, which keeps what was back to
+ * back in the old text back to back in the new.  If it doesn't all make it,
+ * C is marked failed.
+ */
+
+static void
+copy_resps (struct compression *c, struct note_f *note, struct resp_f *blocks,
+            int nblocks)
+{
+  struct resp_f out;
+  struct stat statbuf;
+  struct daddr_f *from, *to;
+  int *kept;
+  time_t now;
+  int live = note->n_nresp;
+  int count = 0;
+  int record = -1;
+  int b, k, j, slot;
+
+  fstat (c->old.fidtxt, &statbuf);
+  time (&now);
+
+  /* Find the responses worth keeping; slot 0 of FROM is the note's text. */
+
+  from = newts_nmalloc (nblocks * RESPSZ + 1, sizeof (struct daddr_f));
+  to = newts_nmalloc (nblocks * RESPSZ + 1, sizeof (struct daddr_f));
+  kept = newts_nmalloc (nblocks * RESPSZ + 1, sizeof (int));
+
+  from[0] = note->n_addr;
+
+  for (b = 0; b < nblocks && live > 0; b++)
+    for (k = 0; k < RESPSZ && live > 0; k++)
+      {
+        struct resp_f *in = &blocks[b];
+
+        if (in->r_stat[k] & ISDELETED)
+          continue;
+        live--;
+
+        if (in->r_addr[k].textlen > HARDMAX ||
+            convert_time (&in->r_when[k]) > now ||
+            convert_time (&in->r_rcvd[k]) > now ||
+            (off_t) (in->r_addr[k].textlen + in->r_addr[k].addr) >
+            statbuf.st_size)
+          continue;
+
+        kept[count] = b * RESPSZ + k;
+        from[++count] = in->r_addr[k];
+      }
+
+  if (movetextrecs (&c->old, from, count + 1, &c->new, to) < 0)
+    {
+      c->failed = TRUE;
+      count = 0;
+      to[0].addr = 0;
+      to[0].textlen = 0;
+    }
+  note->n_addr = to[0];
+
+  /* Now build the chain. */
+
+  note->n_rindx = -1;
+
+  for (j = 0; j < count; j++)
+    {
+      struct resp_f *in = &blocks[kept[j] / RESPSZ];
+
+      k = kept[j] % RESPSZ;
+      slot = j % RESPSZ;
+      if (slot == 0)
+        {
+          int next = c->blocks++;
+
+          if (record >= 0)
+            {
+              out.r_next = next;
+              putresprec (&c->new, record, &out);
+            }
+          else
+            note->n_rindx = next;
+
+          memset (&out, 0, sizeof out);
+          out.r_first = (short) (j + 1);
+          out.r_previous = record;
+          out.r_next = -1;
+          record = next;
+        }
+
+      out.r_id[slot] = in->r_id[k];
+      out.r_addr[slot] = to[j + 1];
+      out.r_when[slot] = in->r_when[k];
+      memcpy (out.r_from[slot], in->r_from[k], SYSSZ);
+      out.r_rcvd[slot] = in->r_rcvd[k];
+      out.r_auth[slot] = in->r_auth[k];
+      out.r_stat[slot] = in->r_stat[k];
+      out.r_last = (short) (j + 1);
+    }
+
+  if (record >= 0)
+    putresprec (&c->new, record, &out);
+
+  note->n_nresp = (short) count;
+
+  newts_free (from);
+  newts_free (to);
+  newts_free (kept);
+}
+
+/* lock_whole - lock or unlock the whole of FID. */
+
+static void
+lock_whole (int fid, short type)
+{
+  struct flock lock;
+
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = 0;
+  if (type == F_UNLCK)
+    fcntl (fid, F_SETLK, &lock);
+  else
+    TEMP_FAILURE_RETRY (fcntl (fid, F_SETLKW, &lock));
+}
+
+/* discard - throw away the compression C, whose file NAMES are freed. */
+
+static void
+discard (struct compression *c, char **names)
+{
+  int i;
+
+  unlink (names[3]);
+  unlink (names[4]);
+  unlink (names[5]);
+  closenf (&c->new);
+  closenf (&c->old);
+
+  newts_free (c->copied);
+  for (i=0; i<6; i++)
+    newts_free (names[i]);
+}
+
+/* relocate - point NR, which refers to a note or response in the old files
+ * of IO, at the same one in the files that replaced them, going by their
+ * unique ids.  Returns SWAPPED, or -1 if it isn't there.
+ */
+
+static int
+relocate (struct io_f *old, struct newtref *nr)
+{
+  struct io_f io;
+  struct note_f note;
+  struct resp_f resp;
+  struct id_f noteid, respid;
+  int offset, record, i;
+  int result = -1;
+
+  readnoterec (old, nr->notenum, &note);
+  noteid = note.n_id;
+  if (nr->respnum > 0)
+    {
+      if (logical_resp (old, nr->notenum, nr->respnum, &resp, &offset,
+                        &record) == -1)
+        return -1;
+      respid = resp.r_id[offset];
+    }
+
+  if (init (&io, &nr->nfr) != NEWTS_NO_ERROR)
+    return -1;
+
+  for (i=0; i<=io.descr.d_nnote; i++)
+    {
+      readnoterec (&io, i, &note);
+      if (same_id (&note.n_id, &noteid))
+        break;
+    }
+
+  if (i <= io.descr.d_nnote)
+    {
+      nr->notenum = i;
+      if (nr->respnum == 0)
+        result = SWAPPED;
+      else
+        for (i=1; i<=note.n_nresp; i++)
+          if (logical_resp (&io, nr->notenum, i, &resp, &offset,
+                            &record) == 0 &&
+              same_id (&resp.r_id[offset], &respid))
+            {
+              nr->respnum = i;
+              result = SWAPPED;
+              break;
+            }
+    }
+
+  closenf (&io);
+  return result;
+}
+
+/* same_id - return TRUE if A and B are the same unique id. */
+
+static int
+same_id (const struct id_f *a, const struct id_f *b)
+{
+  return a->uniqid == b->uniqid && strncmp (a->sys, b->sys, SYSSZ) == 0;
+}
@@ -44,15 +44,34 @@
 # endif
 #endif
 
+static int delete_once (struct newtref *nrp);
+
 /* delete_note - delete note or response NRP. */
 
 int
 uiuc_delete_note (struct newtref *nrp)
+{
+  int result;
+
+  while ((result = delete_once (nrp)) == SWAPPED)
+    ;
+
+  return result;
+}
+
+/* delete_once - do what uiuc_delete_note does, unless an online compression
+ * swaps the files first, in which case SWAPPED is returned and NRP points at
+ * the note or response in the new ones.
+ */
+
+static int
+delete_once (struct newtref *nrp)
 {
   struct io_f io;
   struct note_f note;
   struct newt newt;
   struct flock nlock, dlock;
+  int result;
 
   memset (&newt, 0, sizeof (struct newt));
   newt.nr.nfr.owner = nrp->nfr.owner;
@@ -87,7 +106,9 @@ uiuc_delete_note (struct newtref *nrp)
   if (nrp->respnum == 0)
     {
       nlock.l_type = F_RDLCK;
-      TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &nlock));
+      result = lock_current (&io, &nrp->nfr, &nlock, nrp);
+      if (result != 0)
+        return result;
 
       getnoterec (&io, nrp->notenum, &note);
       if ((note.n_stat & ISDELETED) == 0)
@@ -116,9 +137,11 @@ uiuc_delete_note (struct newtref *nrp)
           io.descr.d_delresp += note.n_nresp;
           putdescr (&io, &io.descr);
 
-          fdatasync (io.fidndx);
+          syncnf (&io, io.fidndx);
           dlock.l_type = F_UNLCK;
           fcntl (io.fidndx, F_SETLK, &dlock);
+
+          clog_delete (&io, nrp->notenum, 0);
         }
       else
         {
@@ -144,12 +167,15 @@ uiuc_delete_note (struct newtref *nrp)
       if ((resp.r_stat[offset] & ISDELETED) == 0)
         {
           struct flock rlock;
+          struct daddr_f daddr = resp.r_addr[offset];
 
           dlock.l_type = F_WRLCK;
           dlock.l_whence = SEEK_SET;
           dlock.l_start = 0;
           dlock.l_len = (off_t) sizeof (struct daddr_f);
-          TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &dlock));
+          result = lock_current (&io, &nrp->nfr, &dlock, nrp);
+          if (result != 0)
+            return result;
 
           rlock.l_type = F_WRLCK;
           rlock.l_whence = SEEK_SET;
@@ -169,7 +195,7 @@ uiuc_delete_note (struct newtref *nrp)
               putresprec (&io, i, &resp);
             }
 
-          fdatasync (io.fidrdx);
+          syncnf (&io, io.fidrdx);
           rlock.l_type = F_UNLCK;
           fcntl (io.fidrdx, F_SETLK, &rlock);
 
@@ -190,9 +216,16 @@ uiuc_delete_note (struct newtref *nrp)
           io.descr.d_delresp++;
           putdescr (&io, &io.descr);
 
-          fdatasync (io.fidndx);
+          syncnf (&io, io.fidndx);
           dlock.l_type = F_UNLCK;
           fcntl (io.fidndx, F_SETLK, &dlock);
+
+          /* Deleted responses can't be brought back, so their text is free
+           * for the taking.
+           */
+
+          tfree_release (&io, &daddr);
+          clog_delete (&io, nrp->notenum, POST_RESP (record, offset));
         }
 
       closenf (&io);
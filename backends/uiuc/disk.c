@@ -48,7 +48,55 @@
 #  include <fcntl.h>
 #endif
 
-static int opennf (struct io_f *io, const newts_nfref *ref);
+#if HAVE_MMAP
+#  include <sys/mman.h>
+#endif
+
+#if HAVE_SYS_SENDFILE_H
+#  include <sys/sendfile.h>
+#endif
+
+/* Notesfiles are kept open for the life of the process.  Each notesfile
+ * directory gets a single struct nf_handle holding its three data files; init
+ * takes a reference on the handle and closenf drops it, so a session making
+ * many backend calls against the same notesfile opens its files only once.
+ * Holding a struct notesfile open (see uiuc_open_nf) keeps a reference too.
+ *
+ * A cached handle is revalidated against the device, inode and modification
+ * time of the notesfile directory every time it is used.  Compression swaps
+ * in new data files, which changes the directory; so does deleting and
+ * recreating the notesfile.  As a second line of defense, init reopens the
+ * files if it finds NFINVALID set and the files have since been replaced.
+ *
+ * Up to MAX_IDLE_HANDLES handles with no references are kept open, most
+ * recently used first; past that, the least recently used are closed.
+ */
+
+#define MAX_IDLE_HANDLES 8
+
+/* Text that can't be copied inside the kernel goes through a buffer this
+ * big.
+ */
+
+#define COPY_BUFSIZE 65536
+
+static struct nf_handle *handles = NULL;
+
+static int opennf (struct io_f *io, const newts_nfref *ref, int *reused);
+static struct nf_handle *open_handle (const char *fullname,
+                                      const struct stat *nfstat, int *error);
+static void close_handle (struct nf_handle *handle);
+static void detach_handle (struct nf_handle *handle);
+static void unlink_handle (struct nf_handle *handle);
+static void trim_handles (void);
+static int replaced (struct io_f *io);
+static void flush_overdue (void);
+static ssize_t readrec (struct io_f *io, int fid, off_t where, void *buf,
+                        size_t length);
+static long copy_text (int from, off_t src, int to, off_t dst, long length);
+#if HAVE_MMAP
+static int map_covers (int fid, struct nf_map *map, off_t end);
+#endif
 
 /* FIXME: NOTE TO SELF!
  *
@@ -59,24 +107,29 @@ int
 init (struct io_f *io, const newts_nfref *ref)
 {
   int result;
+  int reused;
   struct auth_f ident;
-  struct flock lock;
 
-  if ((result = opennf (io, ref)) != NEWTS_NO_ERROR)
+  flush_overdue ();
+
+  if ((result = opennf (io, ref, &reused)) != NEWTS_NO_ERROR)
     {
       return result;
     }
 
-  lock.l_type = F_RDLCK;
-  lock.l_whence = SEEK_SET;
-  lock.l_start = 0;
-  lock.l_len = (off_t) sizeof (struct daddr_f);
-  TEMP_FAILURE_RETRY (fcntl (io->fidndx, F_SETLKW, &lock));
+  readdescr (io, &io->descr);
 
-  getdescr (io, &io->descr);
+  /* Files marked invalid are being replaced by a compression, or have been
+   * already without our noticing the change to the directory.  Once they're
+   * replaced, try again with freshly opened files.
+   */
 
-  lock.l_type = F_UNLCK;
-  fcntl (io->fidndx, F_SETLK, &lock);
+  if (io->descr.d_stat & NFINVALID && replaced (io))
+    {
+      invalidate_handle (io->handle);
+      closenf (io);
+      return init (io, ref);
+    }
 
   if (io->descr.d_format != DBVERSION)
     {
@@ -103,11 +156,21 @@ init (struct io_f *io, const newts_nfref *ref)
   return NEWTS_NO_ERROR;
 }
 
-int
-opennf (struct io_f *io, const newts_nfref *ref)
+/* opennf - attach IO to the notesfile named by REF, using a cached handle if
+ * there is a valid one.  REUSED is set to TRUE if the handle came from the
+ * cache.
+ */
+
+static int
+opennf (struct io_f *io, const newts_nfref *ref, int *reused)
 {
-  char *filename;
-  size_t length;
+  struct nf_handle *handle;
+  struct stat nfstat;
+  int error;
+
+  io->handle = NULL;
+  io->fidtxt = io->fidndx = io->fidrdx = -1;
+  *reused = FALSE;
 
   /* If we're passed in a string in REF->NAME, we need to parse that string to
    * fill in various fields in IO.
@@ -126,79 +189,409 @@ opennf (struct io_f *io, const newts_nfref *ref)
   /* At this point, we have IO->BASEDIR, IO->NF, and IO->FULLNAME set up,
    * however we got there, either by parsing them or by having them already set
    * up in IO.
-   *
-   * We're ready to enter the long, dark night of file descriptors.
    */
 
+  for (handle = handles; handle != NULL; handle = handle->next)
+    if (strcmp (handle->fullname, io->fullname) == 0)
+      break;
+
+  /* Make sure that his alleged notesfile actually exists, and that it is still
+   * the one we have cached.
+   */
+
+  if (stat (io->fullname, &nfstat))
+    {
+      if (handle != NULL)
+        unlink_handle (handle);
+      return NEWTS_NF_DOESNT_EXIST;
+    }
+
+  if (handle != NULL && (handle->dev != nfstat.st_dev ||
+                         handle->ino != nfstat.st_ino ||
+                         handle->mtime != nfstat.st_mtime))
+    {
+      unlink_handle (handle);
+      handle = NULL;
+    }
+
+  if (handle == NULL)
+    {
+      if ((handle = open_handle (io->fullname, &nfstat, &error)) == NULL)
+        return error;
+    }
+  else
+    {
+      detach_handle (handle);   /* It goes back on at the front. */
+      *reused = TRUE;
+    }
+
+  handle->next = handles;
+  handles = handle;
+
+  io->handle = hold_handle (handle);
+  io->fidtxt = handle->fidtxt;
+  io->fidndx = handle->fidndx;
+  io->fidrdx = handle->fidrdx;
+
+  return NEWTS_NO_ERROR;
+}
+
+int
+closenf (struct io_f *io)
+{
+  if (io->handle != NULL)
+    {
+      release_handle (io->handle);
+      io->handle = NULL;
+      return NEWTS_NO_ERROR;
+    }
+
+  /* Files that were opened by hand rather than through init, such as those
+   * being built by compression, are simply closed.
+   */
+
+  /* FIXME: these should not use the TEMP_FAILURE_RETRY macro. */
+
+  TEMP_FAILURE_RETRY (close (io->fidtxt));
+  TEMP_FAILURE_RETRY (close (io->fidndx));
+  TEMP_FAILURE_RETRY (close (io->fidrdx));
+
+  return NEWTS_NO_ERROR;
+}
+
+/* hold_handle - take another reference on HANDLE, which is returned. */
+
+struct nf_handle *
+hold_handle (struct nf_handle *handle)
+{
+  if (handle != NULL)
+    handle->refs++;
+
+  return handle;
+}
+
+/* release_handle - drop a reference on HANDLE.  The files stay open while the
+ * handle is cached; stale handles are closed as soon as nobody uses them.
+ */
+
+void
+release_handle (struct nf_handle *handle)
+{
+  if (handle == NULL || --handle->refs > 0)
+    return;
+
+  /* Writes deferred by the sync policy are flushed once the notesfile is no
+   * longer in use.
+   */
+
+  if (handle->dirty)
+    flush_handle (handle);
+
+  if (handle->stale)
+    close_handle (handle);
+  else
+    trim_handles ();
+}
+
+/* flush_overdue - sync the notesfiles whose writes the sync policy has held
+ * for as long as it allows.  Every use of the backend comes through init, so
+ * this is where the policy's deadline is kept when no more writes come along
+ * to keep it.
+ */
+
+static void
+flush_overdue (void)
+{
+  struct nf_handle *handle;
+
+  for (handle = handles; handle != NULL; handle = handle->next)
+    if (sync_due (handle))
+      flush_handle (handle);
+}
+
+/* replaced - wait for whoever has the descriptor of IO locked to let go of
+ * it, then return TRUE if IO's 'note.indx' is no longer the one in the
+ * notesfile directory.  An online compression keeps the old files locked
+ * until the new ones are in place.
+ */
+
+static int
+replaced (struct io_f *io)
+{
+  struct flock lock;
+  struct stat ours, theirs;
+  char *filename;
+  size_t length;
+  int result;
+
+  lock.l_type = F_RDLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = (off_t) sizeof (struct descr_f);
+  TEMP_FAILURE_RETRY (fcntl (io->fidndx, F_SETLKW, &lock));
+  lock.l_type = F_UNLCK;
+  fcntl (io->fidndx, F_SETLK, &lock);
+
+  length = strlen (io->fullname) + strlen (NOTEINDX) + 2;
+  filename = newts_nmalloc (sizeof (char), length);
+  snprintf (filename, length, "%s/%s", io->fullname, NOTEINDX);
+
+  result = fstat (io->fidndx, &ours) == 0 && stat (filename, &theirs) == 0 &&
+    (ours.st_dev != theirs.st_dev || ours.st_ino != theirs.st_ino);
+
+  newts_free (filename);
+  return result;
+}
+
+/* invalidate_handle - stop handing out HANDLE for its notesfile; the next init
+ * will open the files again.  Used when we know the files have been replaced.
+ */
+
+void
+invalidate_handle (struct nf_handle *handle)
+{
+  if (handle != NULL && !handle->stale)
+    unlink_handle (handle);
+}
+
+/* open_handle - open the data files of the notesfile at FULLNAME, whose
+ * directory has the status NFSTAT.  On failure, NULL is returned and ERROR is
+ * set.
+ */
+
+static struct nf_handle *
+open_handle (const char *fullname, const struct stat *nfstat, int *error)
+{
+  struct nf_handle *handle;
+  char *filename;
+  size_t length;
+
   {
     size_t long_filename = strlen (NOTEINDX);
     if (strlen (RESPINDX) > long_filename) long_filename = strlen (RESPINDX);
     if (strlen (TEXT) > long_filename) long_filename = strlen (TEXT);
-    length = strlen (io->fullname) + long_filename + 2;
+    length = strlen (fullname) + long_filename + 2;
 
     filename = newts_nmalloc (sizeof (char), length);
   }
 
-  /* Make sure that his alleged notesfile actually exists. */
+  handle = newts_zalloc (sizeof (struct nf_handle));
 
-  {
-    struct stat nfstat;
+  /* We're ready to enter the long, dark night of file descriptors. */
 
-    snprintf (filename, length, "%s", io->fullname);
-    if (stat (filename, &nfstat))
-      {
-        newts_free (filename);
-        return NEWTS_NF_DOESNT_EXIST;
-      }
-  }
-
-  snprintf (filename, length, "%s/%s", io->fullname, TEXT);
-  if ((io->fidtxt = TEMP_FAILURE_RETRY (open (filename, O_RDWR))) < 0)
+  snprintf (filename, length, "%s/%s", fullname, TEXT);
+  if ((handle->fidtxt = TEMP_FAILURE_RETRY (open (filename, O_RDWR))) < 0)
     {
       newts_free (filename);
-      return NEWTS_UNABLE_TO_OPEN;
+      newts_free (handle);
+      *error = NEWTS_UNABLE_TO_OPEN;
+      return NULL;
     }
 
-  snprintf (filename, length, "%s/%s", io->fullname, NOTEINDX);
-  if ((io->fidndx = TEMP_FAILURE_RETRY (open (filename, O_RDWR))) < 0)
+  snprintf (filename, length, "%s/%s", fullname, NOTEINDX);
+  if ((handle->fidndx = TEMP_FAILURE_RETRY (open (filename, O_RDWR))) < 0)
     {
       newts_free (filename);
-      TEMP_FAILURE_RETRY (close (io->fidtxt));
-      return NEWTS_UNABLE_TO_OPEN;
+      TEMP_FAILURE_RETRY (close (handle->fidtxt));
+      newts_free (handle);
+      *error = NEWTS_UNABLE_TO_OPEN;
+      return NULL;
     }
 
-  snprintf (filename, length, "%s/%s", io->fullname, RESPINDX);
-  if ((io->fidrdx = TEMP_FAILURE_RETRY (open (filename, O_RDWR))) < 0)
+  snprintf (filename, length, "%s/%s", fullname, RESPINDX);
+  if ((handle->fidrdx = TEMP_FAILURE_RETRY (open (filename, O_RDWR))) < 0)
     {
       newts_free (filename);
-      TEMP_FAILURE_RETRY (close (io->fidtxt));
-      TEMP_FAILURE_RETRY (close (io->fidndx));
-      return NEWTS_UNABLE_TO_OPEN;
+      TEMP_FAILURE_RETRY (close (handle->fidtxt));
+      TEMP_FAILURE_RETRY (close (handle->fidndx));
+      newts_free (handle);
+      *error = NEWTS_UNABLE_TO_OPEN;
+      return NULL;
     }
 
   newts_free (filename);
-  return NEWTS_NO_ERROR;
+
+  /* Cached descriptors must not leak into programs we spawn. */
+
+  fcntl (handle->fidtxt, F_SETFD, FD_CLOEXEC);
+  fcntl (handle->fidndx, F_SETFD, FD_CLOEXEC);
+  fcntl (handle->fidrdx, F_SETFD, FD_CLOEXEC);
+
+  strncpy (handle->fullname, fullname, WDLEN);
+  handle->dev = nfstat->st_dev;
+  handle->ino = nfstat->st_ino;
+  handle->mtime = nfstat->st_mtime;
+
+  open_seqlock (handle);
+  handle->fidfree = -1;
+
+  return handle;
 }
 
-int
-closenf (struct io_f *io)
+/* close_handle - close the files of HANDLE and free it.  HANDLE must not be
+ * on the list of cached handles.
+ */
+
+static void
+close_handle (struct nf_handle *handle)
 {
-  /* FIXME: these should not use the TEMP_FAILURE_RETRY macro. */
+  if (handle->dirty)
+    flush_handle (handle);
+
+#if HAVE_MMAP
+  if (handle->txtmap.base != NULL)
+    munmap (handle->txtmap.base, handle->txtmap.size);
+  if (handle->ndxmap.base != NULL)
+    munmap (handle->ndxmap.base, handle->ndxmap.size);
+  if (handle->rdxmap.base != NULL)
+    munmap (handle->rdxmap.base, handle->rdxmap.size);
+#endif
 
-  TEMP_FAILURE_RETRY (close (io->fidtxt));
-  TEMP_FAILURE_RETRY (close (io->fidndx));
-  TEMP_FAILURE_RETRY (close (io->fidrdx));
+  rpos_free (handle);
+  close_seqlock (handle);
+  if (handle->fidfree >= 0)
+    TEMP_FAILURE_RETRY (close (handle->fidfree));
 
-  return NEWTS_NO_ERROR;
+  TEMP_FAILURE_RETRY (close (handle->fidtxt));
+  TEMP_FAILURE_RETRY (close (handle->fidndx));
+  TEMP_FAILURE_RETRY (close (handle->fidrdx));
+
+  newts_free (handle);
+}
+
+/* detach_handle - take HANDLE off the list of cached handles. */
+
+static void
+detach_handle (struct nf_handle *handle)
+{
+  struct nf_handle **hp;
+
+  for (hp = &handles; *hp != NULL; hp = &(*hp)->next)
+    if (*hp == handle)
+      {
+        *hp = handle->next;
+        break;
+      }
+
+  handle->next = NULL;
 }
 
+/* unlink_handle - remove HANDLE from the cache for good, closing it if nobody
+ * is using it.
+ */
+
+static void
+unlink_handle (struct nf_handle *handle)
+{
+  detach_handle (handle);
+  handle->stale = TRUE;
+
+  if (handle->refs == 0)
+    close_handle (handle);
+}
+
+/* trim_handles - close the least recently used idle handles, keeping at most
+ * MAX_IDLE_HANDLES of them.
+ */
+
+static void
+trim_handles (void)
+{
+  struct nf_handle **hp = &handles;
+  int idle = 0;
+
+  while (*hp != NULL)
+    {
+      struct nf_handle *handle = *hp;
+
+      if (handle->refs == 0 && ++idle > MAX_IDLE_HANDLES)
+        {
+          *hp = handle->next;
+          close_handle (handle);
+        }
+      else
+        hp = &handle->next;
+    }
+}
+
+/* Reads of the data files of a cached notesfile are served from read-only
+ * shared mappings of the files where the system supports it, which turns the
+ * many small record reads of index displays and sequencer scans into plain
+ * memory copies.  Writes still go through write(2); the mappings see them
+ * because they share the page cache.  When a read falls past the end of a
+ * mapping, the file is checked for growth and mapped again.  Files opened
+ * outside the handle cache, and systems without mmap, use lseek and read.
+ */
+
+static ssize_t
+readrec (struct io_f *io, int fid, off_t where, void *buf, size_t length)
+{
+#if HAVE_MMAP
+  struct nf_map *map = NULL;
+
+  if (io->handle != NULL)
+    {
+      if (fid == io->handle->fidndx)
+        map = &io->handle->ndxmap;
+      else if (fid == io->handle->fidrdx)
+        map = &io->handle->rdxmap;
+      else if (fid == io->handle->fidtxt)
+        map = &io->handle->txtmap;
+    }
+
+  if (map != NULL && map_covers (fid, map, where + (off_t) length))
+    {
+      memcpy (buf, map->base + where, length);
+      return (ssize_t) length;
+    }
+#endif
+
+  lseek (fid, where, SEEK_SET);
+  return TEMP_FAILURE_RETRY (read (fid, buf, length));
+}
+
+#if HAVE_MMAP
+
+/* map_covers - make sure that MAP, a mapping of FID, extends at least to END,
+ * mapping the file again if it has grown.  Returns FALSE if the file is too
+ * short or can't be mapped.
+ */
+
+static int
+map_covers (int fid, struct nf_map *map, off_t end)
+{
+  struct stat statbuf;
+  void *base;
+
+  if ((size_t) end <= map->size)
+    return TRUE;
+
+  if (fstat (fid, &statbuf) || statbuf.st_size < end ||
+      (off_t) (size_t) statbuf.st_size != statbuf.st_size)
+    return FALSE;
+
+  base = mmap (NULL, (size_t) statbuf.st_size, PROT_READ, MAP_SHARED, fid,
+               (off_t) 0);
+  if (base == MAP_FAILED)
+    return FALSE;
+
+  if (map->base != NULL)
+    munmap (map->base, map->size);
+
+  map->base = base;
+  map->size = (size_t) statbuf.st_size;
+
+  return TRUE;
+}
+
+#endif /* HAVE_MMAP */
+
 int
 getdescr (struct io_f *io, struct descr_f *descr)
 {
   int error = NEWTS_NO_ERROR;
 
-  lseek (io->fidndx, (off_t) 0, SEEK_SET);
-  TEMP_FAILURE_RETRY (read (io->fidndx, descr, sizeof *descr));
+  readrec (io, io->fidndx, (off_t) 0, descr, sizeof *descr);
 
   return error;
 }
@@ -208,9 +601,11 @@ putdescr (struct io_f *io, struct descr_f *descr)
 {
   int error = NEWTS_NO_ERROR;
 
+  begin_descr_write (io);
   lseek (io->fidndx, (off_t) 0, SEEK_SET);
   TEMP_FAILURE_RETRY (write (io->fidndx, descr, sizeof *descr));
-  fsync (io->fidndx);
+  end_descr_write (io);
+  syncnf (io, io->fidndx);
 
   return error;
 }
@@ -223,8 +618,7 @@ getnoterec (struct io_f *io, int n, struct note_f *note)
   if (n >= 0)
     {
       where = (off_t) (sizeof (struct descr_f) + (n * sizeof *note));
-      lseek (io->fidndx, where, SEEK_SET);
-      TEMP_FAILURE_RETRY (read (io->fidndx, note, sizeof *note));
+      readrec (io, io->fidndx, where, note, sizeof *note);
     }
 }
 
@@ -236,9 +630,12 @@ putnoterec (struct io_f *io, int n, struct note_f *note)
   if (n >= 0)
     {
       where = (off_t) (sizeof (struct descr_f) + (n * sizeof *note));
+      begin_note_write (io, n);
       lseek (io->fidndx, where, SEEK_SET);
       TEMP_FAILURE_RETRY (write (io->fidndx, note, sizeof *note));
-      fsync (io->fidndx);
+      end_note_write (io, n);
+      syncnf (io, io->fidndx);
+      mindex_put (io, n, convert_time (&note->n_lmod));
     }
 }
 
@@ -250,8 +647,7 @@ getresprec (struct io_f *io, int n, struct resp_f *resp)
   if (n >= 0)
     {
       where = (off_t) (sizeof (int) + (n * sizeof *resp));
-      lseek (io->fidrdx, where, SEEK_SET);
-      TEMP_FAILURE_RETRY (read (io->fidrdx, resp, sizeof *resp));
+      readrec (io, io->fidrdx, where, resp, sizeof *resp);
     }
 }
 
@@ -263,12 +659,54 @@ putresprec (struct io_f *io, int n, struct resp_f *resp)
   if (n >= 0)
     {
       where = (off_t) (sizeof (int) + (n * sizeof *resp));
+      begin_resp_write (io, n);
       lseek (io->fidrdx, where, SEEK_SET);
       TEMP_FAILURE_RETRY (write (io->fidrdx, resp, sizeof *resp));
-      fsync (io->fidrdx);
+      end_resp_write (io, n);
+      syncnf (io, io->fidrdx);
     }
 }
 
+/* getrespcount - return the number of response blocks allocated in IO. */
+
+int
+getrespcount (struct io_f *io)
+{
+  int count = 0;
+
+  readrec (io, io->fidrdx, (off_t) 0, &count, sizeof count);
+  return count;
+}
+
+/* gettextrec - read the text at WHERE into TEXT, which must have room for
+ * WHERE->TEXTLEN characters plus a terminating null.  Returns the number of
+ * characters read.
+ */
+
+long
+gettextrec (struct io_f *io, struct daddr_f *where, char *text)
+{
+  struct flock lock;
+  ssize_t nchars;
+
+  lock.l_type = F_RDLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = (off_t) where->addr;
+  lock.l_len = (off_t) where->textlen;
+  TEMP_FAILURE_RETRY (fcntl (io->fidtxt, F_SETLKW, &lock));
+
+  nchars = readrec (io, io->fidtxt, (off_t) where->addr, text,
+                    (size_t) where->textlen);
+  if (nchars < 0)
+    nchars = 0;
+  text[nchars] = '\0';
+
+  lock.l_type = F_UNLCK;
+  fcntl (io->fidtxt, F_SETLK, &lock);
+
+  return (long) nchars;
+}
+
 long
 puttextrec (struct io_f *io, char *text, struct daddr_f *where, int max)
 {
@@ -281,6 +719,8 @@ puttextrec (struct io_f *io, char *text, struct daddr_f *where, int max)
   struct txtbuf_f buf;
   struct flock tlock;
   struct flock nlock;
+  unsigned long length;
+  int reused;
 
   tlock.l_type = F_WRLCK;
   tlock.l_whence = SEEK_SET;
@@ -292,10 +732,17 @@ puttextrec (struct io_f *io, char *text, struct daddr_f *where, int max)
   lseek (io->fidtxt, (off_t) 0, SEEK_SET);
   TEMP_FAILURE_RETRY (read (io->fidtxt, where, sizeof (struct daddr_f)));
 
+  /* Put the text in the space of some dead text if any is big enough. */
+
+  length = strlen (text);
+  if (length > (unsigned long) io->descr.d_longnote)
+    length = (unsigned long) io->descr.d_longnote;
+  reused = tfree_alloc (io, where->addr, length, &where->addr) == 0;
+
   nlock.l_type = F_WRLCK;
   nlock.l_whence = SEEK_SET;
   nlock.l_start = (off_t) where->addr;     /* The new text address. */
-  nlock.l_len = 0;
+  nlock.l_len = reused ? (off_t) length : 0;
   TEMP_FAILURE_RETRY (fcntl (io->fidtxt, F_SETLKW, &nlock));
 
   lseek (io->fidtxt, (off_t) where->addr, SEEK_SET);
@@ -335,42 +782,71 @@ puttextrec (struct io_f *io, char *text, struct daddr_f *where, int max)
   fcntl (io->fidtxt, F_SETLK, &nlock);    /* Unlock new text. */
 
   where->textlen = nchars;
-  lseek (io->fidtxt, (off_t) 0, SEEK_SET);
-  nwhere.addr = where->addr + nchars;
-  if (nwhere.addr & 1)
-    nwhere.addr++;
+  if (!reused)
+    {
+      lseek (io->fidtxt, (off_t) 0, SEEK_SET);
+      nwhere.addr = where->addr + nchars;
+      if (nwhere.addr & 1)
+        nwhere.addr++;
 
-  TEMP_FAILURE_RETRY (write (io->fidtxt, &nwhere, sizeof nwhere));
+      TEMP_FAILURE_RETRY (write (io->fidtxt, &nwhere, sizeof nwhere));
+    }
 
-  fdatasync (io->fidtxt);
+  syncnf (io, io->fidtxt);
   tlock.l_type = F_UNLCK;
   fcntl (io->fidtxt, F_SETLK, &tlock);    /* Unlock free pointer. */
 
   return (long) nchars;
 }
 
+/* maptextrec - return a pointer to the text at WHERE in the mapping of the
+ * text of IO, or NULL if it isn't mapped; use gettextrec then.  The pointer
+ * is only good until the next read from IO.
+ */
+
+const char *
+maptextrec (struct io_f *io, struct daddr_f *where)
+{
+#if HAVE_MMAP
+  if (io->handle != NULL &&
+      map_covers (io->fidtxt, &io->handle->txtmap,
+                  (off_t) where->addr + (off_t) where->textlen))
+    return io->handle->txtmap.base + where->addr;
+#endif
+
+  return NULL;
+}
+
+/* movetextrec - copy the text at FROM in OLD to the end of the text of NEW,
+ * storing where it landed in TO.  Returns the number of characters moved, or
+ * -1 if the copy failed.
+ */
+
 long
 movetextrec (struct io_f *old, struct daddr_f *from,
              struct io_f *new, struct daddr_f *to)
 {
-  char buf[BUFSIZE];
-  register int bufchars;
-  register long moved;
-  register long total;
-  register long need;
+  return movetextrecs (old, from, 1, new, to);
+}
+
+/* movetextrecs - copy the COUNT text records at FROM in OLD to the end of the
+ * text of NEW, storing where each of them landed in TO.  Records that lie
+ * back to back in OLD, as they mostly do in a notesfile that's being
+ * compressed, are copied together and stay back to back in NEW.  Returns the
+ * number of characters moved, or -1 if the text couldn't all be copied, in
+ * which case NEW is left as it was.
+ */
+
+long
+movetextrecs (struct io_f *old, struct daddr_f *from, int count,
+              struct io_f *new, struct daddr_f *to)
+{
   struct daddr_f next;
   struct flock flock;
   struct flock nlock;
   struct flock tlock;
-
-  /* Handle the trivial case quickly. */
-
-  if (from->addr == 0 || from->textlen == 0)
-    {
-      to->addr = 0;
-      to->textlen = 0;
-      return 0;
-    }
+  long moved = 0;
+  int first, last, i;
 
   /* Set everything up for the move. */
 
@@ -380,58 +856,88 @@ movetextrec (struct io_f *old, struct daddr_f *from,
   nlock.l_len = (off_t) sizeof (struct daddr_f);
   TEMP_FAILURE_RETRY (fcntl (new->fidtxt, F_SETLKW, &nlock));
 
-  lseek (old->fidtxt, (off_t) from->addr, SEEK_SET);
   lseek (new->fidtxt, (off_t) 0, SEEK_SET);
-  TEMP_FAILURE_RETRY (read (new->fidtxt, to, sizeof (struct daddr_f)));
-  lseek (new->fidtxt, (off_t) to->addr, SEEK_SET);
-  moved = 0;
-  total = from->textlen;
-  bufchars = 0;
-  to->textlen = 0;
-
-  flock.l_type = F_RDLCK;
-  flock.l_whence = SEEK_SET;
-  flock.l_start = from->addr;
-  flock.l_len = from->textlen;
-  TEMP_FAILURE_RETRY (fcntl (old->fidtxt, F_SETLKW, &flock));
+  TEMP_FAILURE_RETRY (read (new->fidtxt, &next, sizeof (struct daddr_f)));
 
-  tlock.l_type = F_WRLCK;
-  tlock.l_whence = SEEK_SET;
-  tlock.l_start = to->addr;
-  tlock.l_len = from->textlen;
-  TEMP_FAILURE_RETRY (fcntl (new->fidtxt, F_SETLKW, &tlock));
-
-  while (moved < total)
+  for (first = 0; first < count; first = last + 1)
     {
-      need = total - moved;
-      if (need > BUFSIZE)
-        need = BUFSIZE;
-      bufchars = TEMP_FAILURE_RETRY (read (old->fidtxt, &buf, (size_t) need));
-      if (bufchars != need)
-        ; /* FIXME: Handle an error. */
-      TEMP_FAILURE_RETRY (write (new->fidtxt, &buf, (size_t) bufchars));
-      moved += bufchars;
-      to->textlen += bufchars;
-    }
+      long start, length, done;
 
-  flock.l_type = F_UNLCK;
-  fcntl (old->fidtxt, F_SETLK, &flock);
+      /* Handle the trivial case quickly. */
 
-  fdatasync (new->fidtxt);
-  tlock.l_type = F_UNLCK;
-  fcntl (new->fidtxt, F_SETLK, &tlock);
+      if (from[first].addr == 0 || from[first].textlen == 0)
+        {
+          to[first].addr = 0;
+          to[first].textlen = 0;
+          last = first;
+          continue;
+        }
 
-  if (from->textlen != to->textlen)
-    ; /* FIXME: Handle an error. */
+      /* Find the run of records that follow this one, aligned on a 2-bit
+       * boundary the way puttextrec leaves them.
+       */
 
-  /* Now that we've moved things, we need to update the pointer to the next
-   * available block in the "new" text file.
-   */
+      start = from[first].addr;
+      for (last = first; last + 1 < count; last++)
+        {
+          long end = from[last].addr + (long) from[last].textlen;
+
+          if (end & 1)
+            end++;
+          if (from[last + 1].addr != end || from[last + 1].textlen == 0)
+            break;
+        }
+      length = from[last].addr + (long) from[last].textlen - start;
+
+      flock.l_type = F_RDLCK;
+      flock.l_whence = SEEK_SET;
+      flock.l_start = (off_t) start;
+      flock.l_len = (off_t) length;
+      TEMP_FAILURE_RETRY (fcntl (old->fidtxt, F_SETLKW, &flock));
+
+      tlock.l_type = F_WRLCK;
+      tlock.l_whence = SEEK_SET;
+      tlock.l_start = (off_t) next.addr;
+      tlock.l_len = (off_t) length;
+      TEMP_FAILURE_RETRY (fcntl (new->fidtxt, F_SETLKW, &tlock));
+
+      done = copy_text (old->fidtxt, (off_t) start, new->fidtxt,
+                        (off_t) next.addr, length);
+
+      flock.l_type = F_UNLCK;
+      fcntl (old->fidtxt, F_SETLK, &flock);
+      tlock.l_type = F_UNLCK;
+      fcntl (new->fidtxt, F_SETLK, &tlock);
+
+      /* A short copy means a full disk or a bad read; we don't move the
+       * pointer past text that isn't all there.
+       */
+
+      if (done != length)
+        {
+          nlock.l_type = F_UNLCK;
+          fcntl (new->fidtxt, F_SETLK, &nlock);
+          return -1;
+        }
+
+      for (i = first; i <= last; i++)
+        {
+          to[i].addr = next.addr + (from[i].addr - start);
+          to[i].textlen = from[i].textlen;
+          moved += (long) from[i].textlen;
+        }
+
+      /* Now that we've moved things, we need to update the pointer to the
+       * next available block in the "new" text file.
+       */
+
+      next.addr += length;
+      if (next.addr & 1)
+        next.addr++;          /* Align on a 2-bit boundary. */
+    }
 
   next.textlen = 0;
-  next.addr = to->addr + to->textlen;
-  if (next.addr & 1)
-    next.addr++;          /* Align on a 2-bit boundary. */
+  fdatasync (new->fidtxt);
 
   lseek (new->fidtxt, (off_t) 0, SEEK_SET);
   TEMP_FAILURE_RETRY (write (new->fidtxt, &next, sizeof (struct daddr_f)));
@@ -442,3 +948,73 @@ movetextrec (struct io_f *old, struct daddr_f *from,
 
   return moved;
 }
+
+/* copy_text - copy LENGTH bytes at SRC in the file FROM to DST in the file TO,
+ * leaving the data in the kernel where we can.  Returns the number of bytes
+ * copied.
+ */
+
+static long
+copy_text (int from, off_t src, int to, off_t dst, long length)
+{
+  long done = 0;
+  ssize_t nchars;
+  char *buf;
+
+#if HAVE_COPY_FILE_RANGE
+  while (done < length)
+    {
+      loff_t in = (loff_t) (src + done);
+      loff_t out = (loff_t) (dst + done);
+
+      nchars = TEMP_FAILURE_RETRY (copy_file_range (from, &in, to, &out,
+                                                    (size_t) (length - done),
+                                                    0));
+      if (nchars <= 0)
+        break;                  /* Not supported here; try something else. */
+      done += (long) nchars;
+    }
+#endif
+
+#if HAVE_SENDFILE && HAVE_SYS_SENDFILE_H
+  if (done < length)
+    {
+      lseek (to, dst + done, SEEK_SET);
+      while (done < length)
+        {
+          off_t in = src + done;
+
+          nchars = TEMP_FAILURE_RETRY (sendfile (to, from, &in,
+                                                 (size_t) (length - done)));
+          if (nchars <= 0)
+            break;
+          done += (long) nchars;
+        }
+    }
+#endif
+
+  if (done >= length)
+    return done;
+
+  buf = newts_nmalloc (length - done < COPY_BUFSIZE ?
+                       (size_t) (length - done) : COPY_BUFSIZE,
+                       sizeof (char));
+
+  lseek (from, src + done, SEEK_SET);
+  lseek (to, dst + done, SEEK_SET);
+  while (done < length)
+    {
+      long need = length - done;
+
+      if (need > COPY_BUFSIZE)
+        need = COPY_BUFSIZE;
+      nchars = TEMP_FAILURE_RETRY (read (from, buf, (size_t) need));
+      if (nchars <= 0 ||
+          TEMP_FAILURE_RETRY (write (to, buf, (size_t) nchars)) != nchars)
+        break;
+      done += (long) nchars;
+    }
+
+  newts_free (buf);
+  return done;
+}
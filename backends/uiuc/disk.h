@@ -24,21 +24,94 @@
 
 #include "uiuc-backend.h"
 
+#if HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+/* struct nf_map - a read-only mapping of one of a notesfile's data files. */
+
+struct nf_map
+{
+  char *base;                   /* Start of the mapping, or NULL. */
+  size_t size;                  /* Number of bytes mapped. */
+};
+
+struct nf_seqlock;
+struct rpos_table;
+
+/* struct nf_handle - the open files of a notesfile.  Every struct io_f in the
+ * process that refers to the same notesfile directory shares one of these.
+ * Handles are reference counted; see init and closenf in disk.c.
+ */
+
+struct nf_handle
+{
+  char fullname[WDLEN];         /* Full pathname of the notesfile. */
+  int fidtxt;                   /* 'text' file descriptor. */
+  int fidndx;                   /* 'note.indx' file descriptor. */
+  int fidrdx;                   /* 'resp.indx' file descriptor. */
+  dev_t dev;                    /* Device of the notesfile directory. */
+  ino_t ino;                    /* Inode of the notesfile directory. */
+  time_t mtime;                 /* Last change of the notesfile directory. */
+  struct nf_map txtmap;         /* Mapping of 'text'. */
+  struct nf_map ndxmap;         /* Mapping of 'note.indx'. */
+  struct nf_map rdxmap;         /* Mapping of 'resp.indx'. */
+  struct rpos_table *rpos;      /* Response position index; see resp_pos.c. */
+  struct nf_seqlock *seqlock;   /* Write generations; see seqlock.c. */
+  int fidseq;                   /* File descriptor of the above. */
+  int fidfree;                  /* Free text extents; see text_free.c. */
+  int batch;                    /* Depth of nested write batches. */
+  int dirty;                    /* Files with writes not yet synced. */
+  time_t synced;                /* When the files were last synced. */
+  time_t dirtied;               /* When the oldest unsynced write was made. */
+  int refs;                     /* Number of users of this handle. */
+  int stale;                    /* Nonzero if no longer in the cache. */
+  struct nf_handle *next;
+};
+
+/* Flags for struct nf_handle's DIRTY field. */
+
+#define DIRTY_TEXT   01
+#define DIRTY_RESPS  02
+#define DIRTY_NOTES  04
+
 /* These prototypes are for disk-related functions used in various parts of the
  * UIUC module.
  */
 
 extern int init (struct io_f *io, const newts_nfref *ref);
 extern int closenf (struct io_f *io);
+extern struct nf_handle *hold_handle (struct nf_handle *handle);
+extern void release_handle (struct nf_handle *handle);
+extern void invalidate_handle (struct nf_handle *handle);
+extern void syncnf (struct io_f *io, int fid);
+extern void flush_handle (struct nf_handle *handle);
+extern int sync_due (const struct nf_handle *handle);
 extern int getdescr (struct io_f *io, struct descr_f *descr);
 extern int putdescr (struct io_f *io, struct descr_f *descr);
 extern void getnoterec (struct io_f *io, int number, struct note_f *note);
 extern void putnoterec (struct io_f *io, int number, struct note_f *note);
 extern void getresprec (struct io_f *io, int number, struct resp_f *resp);
 extern void putresprec (struct io_f *io, int number, struct resp_f *resp);
+extern int getrespcount (struct io_f *io);
+extern void open_seqlock (struct nf_handle *handle);
+extern void close_seqlock (struct nf_handle *handle);
+extern int readdescr (struct io_f *io, struct descr_f *descr);
+extern void readnoterec (struct io_f *io, int number, struct note_f *note);
+extern void readresprec (struct io_f *io, int number, struct resp_f *resp);
+extern void begin_descr_write (struct io_f *io);
+extern void end_descr_write (struct io_f *io);
+extern void begin_note_write (struct io_f *io, int number);
+extern void end_note_write (struct io_f *io, int number);
+extern void begin_resp_write (struct io_f *io, int number);
+extern void end_resp_write (struct io_f *io, int number);
+extern long gettextrec (struct io_f *io, struct daddr_f *daddr, char *text);
+extern const char *maptextrec (struct io_f *io, struct daddr_f *where);
 extern long puttextrec (struct io_f *io, char *text, struct daddr_f *daddr,
                         int flags);
 extern long movetextrec (struct io_f *old, struct daddr_f *from,
            struct io_f *new, struct daddr_f *to);
+extern long movetextrecs (struct io_f *old, struct daddr_f *from, int count,
+                          struct io_f *new, struct daddr_f *to);
 
 #endif /* not DISK_H */
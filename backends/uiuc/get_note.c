@@ -38,35 +38,33 @@ uiuc_get_note (struct newt *notep, short updatestats)
 {
   struct io_f io;
   struct daddr_f daddr;
-  struct flock lock;
-  int result;
+  int result, moved;
 
   if (notep == NULL)
     return -1;
 
-  result = load_note (notep, &daddr, updatestats);
-
-  if (result)
-    return result;
+  /* If the note was edited after load_note read its record, the text we read
+   * may already have been given to somebody else; start again.
+   */
 
-  notep->text = newts_nrealloc (notep->text, daddr.textlen + 1, sizeof (char));
-
-  init (&io, &notep->nr.nfr);
+  do
+    {
+      result = load_note (notep, &daddr, updatestats);
 
-  lock.l_type = F_RDLCK;
-  lock.l_whence = SEEK_SET;
-  lock.l_start = (off_t) daddr.addr;
-  lock.l_len = (off_t) daddr.textlen;
-  TEMP_FAILURE_RETRY (fcntl (io.fidtxt, F_SETLKW, &lock));
+      if (result)
+        return result;
 
-  lseek (io.fidtxt, (off_t) daddr.addr, SEEK_SET);
-  TEMP_FAILURE_RETRY (read (io.fidtxt, notep->text, daddr.textlen));
-  notep->text[daddr.textlen] = '\0';
+      notep->text = newts_nrealloc (notep->text, daddr.textlen + 1,
+                                    sizeof (char));
 
-  lock.l_type = F_UNLCK;
-  fcntl (io.fidtxt, F_SETLK, &lock);
+      init (&io, &notep->nr.nfr);
+      gettextrec (&io, &daddr, notep->text);
+      moved = tfree_moved (&io, notep->nr.notenum, notep->nr.respnum, &daddr);
+      closenf (&io);
 
-  closenf (&io);
+      updatestats = FALSE;
+    }
+  while (moved);
 
   return 0;
 }
@@ -76,8 +74,9 @@ load_note (struct newt *newtp, struct daddr_f *daddr, short updatestats)
 {
   struct io_f io;
   struct note_f note;
-  struct flock lock;
   struct stat statbuf;
+  time_t timet;
+  int result;
 
   if (newtp == NULL)
     return -1;
@@ -103,317 +102,321 @@ load_note (struct newt *newtp, struct daddr_f *daddr, short updatestats)
       return -1;
     }
 
-  lock.l_type = F_RDLCK;
-  lock.l_whence = SEEK_SET;
-  lock.l_start = (off_t) (sizeof (struct descr_f) +
-                          (newtp->nr.notenum * sizeof (struct note_f)));
-  lock.l_len = (off_t) sizeof (struct note_f);
-  TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &lock));
+  readnoterec (&io, newtp->nr.notenum, &note);
 
-  getnoterec (&io, newtp->nr.notenum, &note);
-
-  lock.l_type = F_UNLCK;
-  fcntl (io.fidndx, F_SETLK, &lock);
+  fstat (io.fidtxt, &statbuf);
+  time (&timet);
 
   if (newtp->nr.respnum)
     {
       struct resp_f resp;
       int offset, record;
-      time_t timet;
 
       if (logical_resp (&io, newtp->nr.notenum, newtp->nr.respnum, &resp,
                         &offset, &record) == -1)
-        return -1;
-
-      fstat (io.fidtxt, &statbuf);
+        {
+          closenf (&io);
+          return -1;
+        }
 
-      time (&timet);
+      result = decode_resp (&io, &note, &resp, offset, newtp, daddr,
+                            statbuf.st_size, timet);
+    }
+  else
+    result = decode_note (&io, &note, newtp, daddr, statbuf.st_size, timet);
 
-      if (resp.r_addr[offset].textlen > HARDMAX ||
-          convert_time (&resp.r_when[offset]) > timet ||
-          convert_time (&resp.r_rcvd[offset]) > timet ||
-          (off_t) (resp.r_addr[offset].textlen + resp.r_addr[offset].addr)
-          > statbuf.st_size)
-        {
-          const char *error_text =
-            "The data of this response has been corrupted in a way that "
-            "makes it unsafe to\nuse. To avoid memory faults or other "
-            "errors, it has not been loaded, and this\nnote has been "
-            "marked as deleted.";
-
-          newtp->title = newts_nrealloc (newtp->title,
-                                         sizeof (note.ntitle) + 1,
-                                         sizeof (char));
-          strncpy (newtp->title, note.ntitle, sizeof (note.ntitle) + 1);
-          newtp->title[sizeof (note.ntitle)] = '\0';
+  if (result != 0)
+    {
+      closenf (&io);
+      return result;
+    }
 
-          if (newtp->director_message)
-            newts_free (newtp->director_message);
-          newtp->director_message = NULL;
+  if (updatestats)
+    {
+      struct flock ulock;
+
+      ulock.l_type = F_WRLCK;
+      ulock.l_whence = SEEK_SET;
+      ulock.l_start = 0;
+      ulock.l_len = (off_t) sizeof (struct descr_f);
+      if (lock_current (&io, &newtp->nr.nfr, &ulock, NULL) != 0)
+        return 0;
+
+      getdescr (&io, &io.descr);
+      if (newtp->nr.respnum)
+        io.descr.d_rspread++;
+      else
+        io.descr.d_notread++;
+      putdescr (&io, &io.descr);
 
-          newtp->text = newts_nrealloc (newtp->text, strlen (error_text) + 1,
-                                        sizeof (char));
-          strncpy (newtp->text, error_text, strlen (error_text) + 1);
+      syncnf (&io, io.fidndx);
+      ulock.l_type = F_UNLCK;
+      fcntl (io.fidndx, F_SETLK, &ulock);
+    }
 
-          newtp->auth.system = newts_nrealloc (newtp->auth.system,
-                                               strlen (newts_get_fqdn ()) + 1,
-                                               sizeof (char));
-          strcpy (newtp->auth.system, newts_get_fqdn ());
+  closenf (&io);
+  return 0;
+}
 
-          newtp->auth.name = newts_nrealloc (newtp->auth.name,
-                                             strlen (NOTES) + 1,
-                                             sizeof (char));
-          strcpy (newtp->auth.name, NOTES);
+/* decode_note - fill in NEWTP from the basenote record NOTE of IO, and DADDR
+ * (if not NULL) with the location of its text.  TEXTSIZE is the size of the
+ * text file and NOW is the current time; both are used to catch corrupted
+ * records.
+ *
+ * Returns: 0 on success, or -3 if the note is corrupted or awaiting approval,
+ * in which case NEWTP->TEXT holds an explanation.
+ */
 
-          newtp->options = 0;
-          newtp->options |= NOTE_DELETED + NOTE_CORRUPTED;
-          newtp->total_resps = 0;
+int
+decode_note (struct io_f *io, struct note_f *note, struct newt *newtp,
+             struct daddr_f *daddr, off_t textsize, time_t now)
+{
+  /* Test for pathological notes and put in a placeholder note if we find
+   * one.
+   */
+
+  if (note->n_addr.textlen > HARDMAX ||
+      note->n_nresp < 0 || convert_time (&note->n_lmod) > now ||
+      convert_time (&note->n_date) > now ||
+      (off_t) (note->n_addr.textlen + note->n_addr.addr) > textsize)
+    {
+      const char *error_text =
+        "The data of this note has been corrupted in a way that "
+        "makes it unsafe to\nuse. To avoid memory faults or other "
+        "errors, it has not been loaded.";
 
-          closenf (&io);
-          return -3;
-        }
+      newtp->title = newts_nrealloc (newtp->title, 21, sizeof (char));
+      strcpy (newtp->title, "** Corrupted Note **");
 
-      newtp->title = newts_nrealloc (newtp->title, sizeof (note.ntitle) + 1,
-                                     sizeof (char));
-      strncpy (newtp->title, note.ntitle, sizeof (note.ntitle) + 1);
-      newtp->title[sizeof (note.ntitle)] = '\0';
+      if (newtp->director_message)
+        newts_free (newtp->director_message);
+      newtp->director_message = NULL;
 
-      if (resp.r_stat[offset] & DIRMES)
-        {
-          newtp->director_message = newts_nrealloc (newtp->director_message,
-                                                    sizeof (io.descr.d_drmes) + 1,
-                                                    sizeof (char));
-          strncpy (newtp->director_message, io.descr.d_drmes,
-                   sizeof (io.descr.d_drmes) + 1);
-          newtp->director_message[sizeof (io.descr.d_drmes)] = '\0';
-        }
-      else
-        {
-          if (newtp->director_message)
-            newts_free (newtp->director_message);
-          newtp->director_message = NULL;
-        }
+      newtp->text = newts_nrealloc (newtp->text, strlen (error_text) + 1,
+                                    sizeof (char));
+      strncpy (newtp->text, error_text, strlen (error_text) + 1);
 
       newtp->auth.system = newts_nrealloc (newtp->auth.system,
-                                           sizeof (resp.r_auth[offset].asystem) + 1,
-                                      sizeof (char));
-      strncpy (newtp->auth.system, resp.r_auth[offset].asystem,
-               sizeof (resp.r_auth[offset].asystem) + 1);
+                                           strlen (newts_get_fqdn ()) + 1,
+                                           sizeof (char));
+      strcpy (newtp->auth.system, newts_get_fqdn ());
 
       newtp->auth.name = newts_nrealloc (newtp->auth.name,
-                                         sizeof (resp.r_auth[offset].aname) + 1,
-                                         sizeof (char));
-      strncpy (newtp->auth.name, resp.r_auth[offset].aname,
-               sizeof (resp.r_auth[offset].aname) + 1);
-
-      newtp->auth.uid = (uid_t) resp.r_auth[offset].aid;
-
-      newtp->created = convert_time (&resp.r_when[offset]);
-      newtp->modified = convert_time (&resp.r_when[offset]);  /* Boo hiss. */
-
-      newtp->id.system = newts_nrealloc (newtp->id.system,
-                                         sizeof (resp.r_id[offset].sys) + 1,
+                                         strlen (NOTES) + 1,
                                          sizeof (char));
-      strncpy (newtp->id.system, resp.r_id[offset].sys,
-               sizeof (resp.r_id[offset].sys) + 1);
-
-      newtp->id.number = resp.r_id[offset].uniqid;
-
-      newtp->total_resps = note.n_nresp;
-
-      if (daddr != NULL)
-        {
-          daddr->addr = resp.r_addr[offset].addr;
-          daddr->textlen = resp.r_addr[offset].textlen;
-        }
+      strcpy (newtp->auth.name, NOTES);
 
       newtp->options = 0;
-      if (resp.r_stat[offset] & ISDELETED)
-        newtp->options |= NOTE_DELETED;
-      if (resp.r_stat[offset] & ISUNAPPROVED)
-        {
-          newtp->options |= NOTE_UNAPPROVED;
-
-          if (!allow (&io, DRCTOK))
-            {
-              const char *mod_text =
-                _("This response has not yet been approved by the notesfile "
-                  "directors.");
-
-              newtp->text = newts_nrealloc (newtp->text, strlen (mod_text) + 1,
-                                            sizeof (char));
-              strncpy (newtp->text, mod_text, strlen (mod_text) + 1);
+      newtp->options |= NOTE_DELETED + NOTE_CORRUPTED;
+      newtp->total_resps = 0;
 
-              closenf (&io);
-              return -3;
-            }
-        }
-
-      if (updatestats)
-        {
-          struct flock ulock;
-
-          ulock.l_type = F_WRLCK;
-          ulock.l_whence = SEEK_SET;
-          ulock.l_start = 0;
-          ulock.l_len = (off_t) sizeof (struct descr_f);
-          TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &ulock));
+      return -3;
+    }
 
-          getdescr (&io, &io.descr);
-          io.descr.d_rspread++;
-          putdescr (&io, &io.descr);
+  newtp->title = newts_nrealloc (newtp->title, sizeof (note->ntitle) + 1,
+                                 sizeof (char));
+  strncpy (newtp->title, note->ntitle, sizeof (note->ntitle) + 1);
 
-          fdatasync (io.fidndx);
-          ulock.l_type = F_UNLCK;
-          fcntl (io.fidndx, F_SETLK, &ulock);
-        }
+  if (note->n_stat & DIRMES)
+    {
+      newtp->director_message = newts_nrealloc (newtp->director_message,
+                                                sizeof (io->descr.d_drmes) + 1,
+                                                sizeof (char));
+      strncpy (newtp->director_message, io->descr.d_drmes,
+               sizeof (io->descr.d_drmes) + 1);
     }
   else
     {
-      time_t timet;
+      if (newtp->director_message)
+        newts_free (newtp->director_message);
+      newtp->director_message = NULL;
+    }
 
-      /* Test for pathological notes and put in a placeholder note if we find
-       * one.
-       */
+  newtp->auth.system = newts_nrealloc (newtp->auth.system,
+                                       sizeof (note->n_auth.asystem) + 1,
+                                       sizeof (char));
+  strncpy (newtp->auth.system, note->n_auth.asystem,
+           sizeof (note->n_auth.asystem) + 1);
 
-      fstat (io.fidtxt, &statbuf);
+  newtp->auth.name = newts_nrealloc (newtp->auth.name,
+                                     sizeof (note->n_auth.aname) + 1,
+                                     sizeof (char));
+  strncpy (newtp->auth.name, note->n_auth.aname,
+           sizeof (note->n_auth.aname) + 1);
 
-      time (&timet);
+  newtp->auth.uid = (uid_t) note->n_auth.aid;
 
-      if (note.n_addr.textlen > HARDMAX ||
-          note.n_nresp < 0 || convert_time (&note.n_lmod) > timet ||
-          convert_time (&note.n_date) > timet ||
-          (off_t) (note.n_addr.textlen + note.n_addr.addr) > statbuf.st_size)
-        {
-          const char *error_text =
-            "The data of this note has been corrupted in a way that "
-            "makes it unsafe to\nuse. To avoid memory faults or other "
-            "errors, it has not been loaded.";
+  if (daddr != NULL)
+    {
+      daddr->addr = note->n_addr.addr;
+      daddr->textlen = note->n_addr.textlen;
+    }
 
-          newtp->title = newts_nrealloc (newtp->title, 21, sizeof (char));
-          strcpy (newtp->title, "** Corrupted Note **");
+  newtp->total_resps = note->n_nresp;
+  newtp->created = convert_time (&note->n_date);
+  newtp->modified = convert_time (&note->n_lmod);
 
-          if (newtp->director_message)
-            newts_free (newtp->director_message);
-          newtp->director_message = NULL;
+  newtp->id.system = newts_nrealloc (newtp->id.system,
+                                     sizeof (note->n_id.sys) + 1,
+                                     sizeof (char));
+  strncpy (newtp->id.system, note->n_id.sys,
+           sizeof (note->n_id.sys) + 1);
 
-          newtp->text = newts_nrealloc (newtp->text, strlen (error_text) + 1,
-                                        sizeof (char));
-          strncpy (newtp->text, error_text, strlen (error_text) + 1);
+  newtp->id.number = note->n_id.uniqid;
 
-          newtp->auth.system = newts_nrealloc (newtp->auth.system,
-                                               strlen (newts_get_fqdn ()) + 1,
-                                               sizeof (char));
-          strcpy (newtp->auth.system, newts_get_fqdn ());
+  newtp->options = 0;
+  if (note->n_stat & ISDELETED)
+    newtp->options |= NOTE_DELETED;
+  if (note->n_stat & WRITONLY)
+    newtp->options |= NOTE_WRITE_ONLY;
+  if (note->n_stat & ISUNAPPROVED)
+    {
+      newtp->options |= NOTE_UNAPPROVED;
 
-          newtp->auth.name = newts_nrealloc (newtp->auth.name,
-                                             strlen (NOTES) + 1,
-                                             sizeof (char));
-          strcpy (newtp->auth.name, NOTES);
+      if (!allow (io, DRCTOK))
+        {
+          const char *mod_text =
+            "This note has not yet been approved by the notesfile "
+            "directors.";
 
-          newtp->options = 0;
-          newtp->options |= NOTE_DELETED + NOTE_CORRUPTED;
-          newtp->total_resps = 0;
+          newtp->text = newts_nrealloc (newtp->text, strlen (mod_text) + 1,
+                                        sizeof (char));
+          strncpy (newtp->text, mod_text, strlen (mod_text) + 1);
 
-          closenf (&io);
           return -3;
         }
+    }
+
+  return 0;
+}
+
+/* decode_resp - fill in NEWTP from slot OFFSET of the response record RESP,
+ * which belongs to the basenote record NOTE of IO.  Otherwise the same as
+ * decode_note.
+ */
 
-      newtp->title = newts_nrealloc (newtp->title, sizeof (note.ntitle) + 1,
+int
+decode_resp (struct io_f *io, struct note_f *note, struct resp_f *resp,
+             int offset, struct newt *newtp, struct daddr_f *daddr,
+             off_t textsize, time_t now)
+{
+  if (resp->r_addr[offset].textlen > HARDMAX ||
+      convert_time (&resp->r_when[offset]) > now ||
+      convert_time (&resp->r_rcvd[offset]) > now ||
+      (off_t) (resp->r_addr[offset].textlen + resp->r_addr[offset].addr)
+      > textsize)
+    {
+      const char *error_text =
+        "The data of this response has been corrupted in a way that "
+        "makes it unsafe to\nuse. To avoid memory faults or other "
+        "errors, it has not been loaded, and this\nnote has been "
+        "marked as deleted.";
+
+      newtp->title = newts_nrealloc (newtp->title,
+                                     sizeof (note->ntitle) + 1,
                                      sizeof (char));
-      strncpy (newtp->title, note.ntitle, sizeof (note.ntitle) + 1);
+      strncpy (newtp->title, note->ntitle, sizeof (note->ntitle) + 1);
+      newtp->title[sizeof (note->ntitle)] = '\0';
 
-      if (note.n_stat & DIRMES)
-        {
-          newtp->director_message = newts_nrealloc (newtp->director_message,
-                                                    sizeof (io.descr.d_drmes) + 1,
-                                                    sizeof (char));
-          strncpy (newtp->director_message, io.descr.d_drmes,
-                   sizeof (io.descr.d_drmes) + 1);
-        }
-      else
-        {
-          if (newtp->director_message)
-            newts_free (newtp->director_message);
-          newtp->director_message = NULL;
-        }
+      if (newtp->director_message)
+        newts_free (newtp->director_message);
+      newtp->director_message = NULL;
+
+      newtp->text = newts_nrealloc (newtp->text, strlen (error_text) + 1,
+                                    sizeof (char));
+      strncpy (newtp->text, error_text, strlen (error_text) + 1);
 
       newtp->auth.system = newts_nrealloc (newtp->auth.system,
-                                      sizeof (note.n_auth.asystem) + 1,
+                                           strlen (newts_get_fqdn ()) + 1,
                                            sizeof (char));
-      strncpy (newtp->auth.system, note.n_auth.asystem,
-               sizeof (note.n_auth.asystem) + 1);
+      strcpy (newtp->auth.system, newts_get_fqdn ());
 
       newtp->auth.name = newts_nrealloc (newtp->auth.name,
-                                         sizeof (note.n_auth.aname) + 1,
+                                         strlen (NOTES) + 1,
                                          sizeof (char));
-      strncpy (newtp->auth.name, note.n_auth.aname,
-               sizeof (note.n_auth.aname) + 1);
+      strcpy (newtp->auth.name, NOTES);
 
-      newtp->auth.uid = (uid_t) note.n_auth.aid;
+      newtp->options = 0;
+      newtp->options |= NOTE_DELETED + NOTE_CORRUPTED;
+      newtp->total_resps = 0;
 
-      if (daddr != NULL)
-        {
-          daddr->addr = note.n_addr.addr;
-          daddr->textlen = note.n_addr.textlen;
-        }
+      return -3;
+    }
 
-      newtp->total_resps = note.n_nresp;
-      newtp->created = convert_time (&note.n_date);
-      newtp->modified = convert_time (&note.n_lmod);
+  newtp->title = newts_nrealloc (newtp->title, sizeof (note->ntitle) + 1,
+                                 sizeof (char));
+  strncpy (newtp->title, note->ntitle, sizeof (note->ntitle) + 1);
+  newtp->title[sizeof (note->ntitle)] = '\0';
 
-      newtp->id.system = newts_nrealloc (newtp->id.system,
-                                         sizeof (note.n_id.sys) + 1,
-                                         sizeof (char));
-      strncpy (newtp->id.system, note.n_id.sys,
-               sizeof (note.n_id.sys) + 1);
+  if (resp->r_stat[offset] & DIRMES)
+    {
+      newtp->director_message = newts_nrealloc (newtp->director_message,
+                                                sizeof (io->descr.d_drmes) + 1,
+                                                sizeof (char));
+      strncpy (newtp->director_message, io->descr.d_drmes,
+               sizeof (io->descr.d_drmes) + 1);
+      newtp->director_message[sizeof (io->descr.d_drmes)] = '\0';
+    }
+  else
+    {
+      if (newtp->director_message)
+        newts_free (newtp->director_message);
+      newtp->director_message = NULL;
+    }
 
-      newtp->id.number = note.n_id.uniqid;
+  newtp->auth.system = newts_nrealloc (newtp->auth.system,
+                                       sizeof (resp->r_auth[offset].asystem) + 1,
+                                       sizeof (char));
+  strncpy (newtp->auth.system, resp->r_auth[offset].asystem,
+           sizeof (resp->r_auth[offset].asystem) + 1);
 
-      newtp->options = 0;
-      if (note.n_stat & ISDELETED)
-        newtp->options |= NOTE_DELETED;
-      if (note.n_stat & WRITONLY)
-        newtp->options |= NOTE_WRITE_ONLY;
-      if (note.n_stat & ISUNAPPROVED)
-        {
-          newtp->options |= NOTE_UNAPPROVED;
+  newtp->auth.name = newts_nrealloc (newtp->auth.name,
+                                     sizeof (resp->r_auth[offset].aname) + 1,
+                                     sizeof (char));
+  strncpy (newtp->auth.name, resp->r_auth[offset].aname,
+           sizeof (resp->r_auth[offset].aname) + 1);
 
-          if (!allow (&io, DRCTOK))
-            {
-              const char *mod_text =
-                "This note has not yet been approved by the notesfile "
-                "directors.";
+  newtp->auth.uid = (uid_t) resp->r_auth[offset].aid;
 
-              newtp->text = newts_nrealloc (newtp->text, strlen (mod_text) + 1,
-                                            sizeof (char));
-              strncpy (newtp->text, mod_text, strlen (mod_text) + 1);
+  newtp->created = convert_time (&resp->r_when[offset]);
+  newtp->modified = convert_time (&resp->r_when[offset]);  /* Boo hiss. */
 
-              closenf (&io);
-              return -3;
-            }
-        }
+  newtp->id.system = newts_nrealloc (newtp->id.system,
+                                     sizeof (resp->r_id[offset].sys) + 1,
+                                     sizeof (char));
+  strncpy (newtp->id.system, resp->r_id[offset].sys,
+           sizeof (resp->r_id[offset].sys) + 1);
 
-      if (updatestats)
-        {
-          struct flock ulock;
+  newtp->id.number = resp->r_id[offset].uniqid;
+
+  newtp->total_resps = note->n_nresp;
+
+  if (daddr != NULL)
+    {
+      daddr->addr = resp->r_addr[offset].addr;
+      daddr->textlen = resp->r_addr[offset].textlen;
+    }
 
-          ulock.l_type = F_WRLCK;
-          ulock.l_whence = SEEK_SET;
-          ulock.l_start = 0;
-          ulock.l_len = (off_t) sizeof (struct descr_f);
-          TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &ulock));
+  newtp->options = 0;
+  if (resp->r_stat[offset] & ISDELETED)
+    newtp->options |= NOTE_DELETED;
+  if (resp->r_stat[offset] & ISUNAPPROVED)
+    {
+      newtp->options |= NOTE_UNAPPROVED;
 
-          getdescr (&io, &io.descr);
-          io.descr.d_notread++;
-          putdescr (&io, &io.descr);
+      if (!allow (io, DRCTOK))
+        {
+          const char *mod_text =
+            _("This response has not yet been approved by the notesfile "
+              "directors.");
 
-          fdatasync (io.fidndx);
-          ulock.l_type = F_UNLCK;
-          fcntl (io.fidndx, F_SETLK, &ulock);
+          newtp->text = newts_nrealloc (newtp->text, strlen (mod_text) + 1,
+                                        sizeof (char));
+          strncpy (newtp->text, mod_text, strlen (mod_text) + 1);
+
+          return -3;
         }
     }
 
-  closenf (&io);
   return 0;
 }
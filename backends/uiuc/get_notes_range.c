@@ -0,0 +1,259 @@
+/*
+ * get_notes_range.c - read a run of UIUC-format notes or responses at once
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "uiuc-backend.h"
+
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#if HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+static int next_slot (struct io_f *io, struct resp_f *resp, int *offset,
+                      int *record);
+static void fetch_text (struct io_f *io, struct newt *newtp,
+                        struct daddr_f *daddr);
+
+/* get_notes_range - fill in up to COUNT newts, starting with the one that
+ * NEWTS[0].NR refers to.  If NEWTS[0].NR.RESPNUM is 0, the newts are the
+ * basenotes numbered from NEWTS[0].NR.NOTENUM on; otherwise they are the
+ * responses to that basenote, numbered from NEWTS[0].NR.RESPNUM on.  Only
+ * NEWTS[0].NR.NFR is consulted; the note and response numbers of every newt
+ * filled in are set.  With FETCH_NO_TEXT in FLAGS, the text of the newts is
+ * not read.
+ *
+ * This does in a single pass what calling uiuc_get_note on each newt would:
+ * the notesfile is initialized once, the note records are read under one
+ * lock, and the response chain is walked once rather than from the start for
+ * every response.  Corrupted and unapproved newts are filled in with the same
+ * placeholders uiuc_get_note uses.
+ *
+ * Returns: the number of newts filled in, -1 if the starting newt doesn't
+ * exist, or -2 if the user may not read the notesfile.
+ */
+
+int
+uiuc_get_notes_range (struct newt *newts, int count, int flags)
+{
+  struct io_f io;
+  struct note_f note;
+  struct flock lock;
+  struct stat statbuf;
+  time_t now;
+  int notenum = newts[0].nr.notenum;
+  int respnum = newts[0].nr.respnum;
+  int filled = 0;
+  int error;
+
+  if (count <= 0)
+    return 0;
+
+  error = init (&io, &newts[0].nr.nfr);
+  if (error != NEWTS_NO_ERROR)
+    return error;
+
+  if (io.descr.d_stat & NFINVALID)
+    {
+      closenf (&io);
+      return -1;
+    }
+
+  if (!allow (&io, READOK) && (notenum != 0 || respnum != 0))
+    {
+      closenf (&io);
+      return -2;
+    }
+
+  if (notenum > io.descr.d_nnote || notenum < 0 || respnum < 0
+      || (notenum == 0 && !io.descr.d_plcy))
+    {
+      closenf (&io);
+      return -1;
+    }
+
+  fstat (io.fidtxt, &statbuf);
+  time (&now);
+
+  lock.l_whence = SEEK_SET;
+
+  if (respnum == 0)
+    {
+      int last = notenum + count - 1;
+
+      if (last > io.descr.d_nnote)
+        last = io.descr.d_nnote;
+
+      /* Without read permission, only the policy note is available. */
+
+      if (!allow (&io, READOK))
+        last = 0;
+
+      lock.l_type = F_RDLCK;
+      lock.l_start = (off_t) (sizeof (struct descr_f) +
+                              (notenum * sizeof (struct note_f)));
+      lock.l_len = (off_t) ((last - notenum + 1) * sizeof (struct note_f));
+      TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &lock));
+
+      for (; notenum <= last; notenum++)
+        {
+          struct newt *newtp = &newts[filled++];
+          struct daddr_f daddr;
+
+          getnoterec (&io, notenum, &note);
+
+          newtp->nr.notenum = notenum;
+          newtp->nr.respnum = 0;
+
+          if (decode_note (&io, &note, newtp, &daddr, statbuf.st_size,
+                           now) == 0 && !(flags & FETCH_NO_TEXT))
+            fetch_text (&io, newtp, &daddr);
+        }
+
+      lock.l_type = F_UNLCK;
+      fcntl (io.fidndx, F_SETLK, &lock);
+    }
+  else
+    {
+      struct resp_f resp;
+      int offset, record;
+      int last;
+
+      if (logical_resp (&io, notenum, respnum, &resp, &offset, &record) == -1)
+        {
+          closenf (&io);
+          return -1;
+        }
+
+      lock.l_type = F_RDLCK;
+      lock.l_start = (off_t) (sizeof (struct descr_f) +
+                              (notenum * sizeof (struct note_f)));
+      lock.l_len = (off_t) sizeof (struct note_f);
+      TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &lock));
+
+      getnoterec (&io, notenum, &note);
+
+      lock.l_type = F_UNLCK;
+      fcntl (io.fidndx, F_SETLK, &lock);
+
+      last = respnum + count - 1;
+      if (last > note.n_nresp)
+        last = note.n_nresp;
+
+      while (1)
+        {
+          struct newt *newtp = &newts[filled++];
+          struct daddr_f daddr;
+
+          newtp->nr.notenum = notenum;
+          newtp->nr.respnum = respnum;
+
+          /* Hold the block while the text is read, so that nobody can edit
+           * or delete the response and give its old text away under us.
+           */
+
+          lock.l_type = F_RDLCK;
+          lock.l_start = (off_t) (sizeof (int) +
+                                  (record * sizeof (struct resp_f)));
+          lock.l_len = (off_t) sizeof (struct resp_f);
+          TEMP_FAILURE_RETRY (fcntl (io.fidrdx, F_SETLKW, &lock));
+
+          getresprec (&io, record, &resp);
+
+          if (decode_resp (&io, &note, &resp, offset, newtp, &daddr,
+                           statbuf.st_size, now) == 0
+              && !(flags & FETCH_NO_TEXT))
+            {
+              if (resp.r_stat[offset] & ISDELETED)
+                {
+                  newtp->text = newts_nrealloc (newtp->text, 1,
+                                                sizeof (char));
+                  newtp->text[0] = '\0';
+                }
+              else
+                fetch_text (&io, newtp, &daddr);
+            }
+
+          lock.l_type = F_UNLCK;
+          fcntl (io.fidrdx, F_SETLK, &lock);
+
+          if (++respnum > last ||
+              next_slot (&io, &resp, &offset, &record) != 0)
+            break;
+        }
+    }
+
+  closenf (&io);
+  return filled;
+}
+
+/* next_slot - advance OFFSET to the next response in use after it, moving on
+ * to the next block of the chain when RESP runs out.  RECORD is the record
+ * number of RESP.  Returns -1 if the chain ends or is broken.
+ */
+
+static int
+next_slot (struct io_f *io, struct resp_f *resp, int *offset, int *record)
+{
+  struct flock lock;
+
+  do
+    {
+      if (++*offset >= RESPSZ)
+        {
+          if (resp->r_next < 0 || resp->r_next == *record)
+            return -1;
+
+          *record = resp->r_next;
+          *offset = 0;
+
+          lock.l_type = F_RDLCK;
+          lock.l_whence = SEEK_SET;
+          lock.l_start = (off_t) (sizeof (int) +
+                                  (*record * sizeof (struct resp_f)));
+          lock.l_len = (off_t) sizeof (struct resp_f);
+          TEMP_FAILURE_RETRY (fcntl (io->fidrdx, F_SETLKW, &lock));
+
+          getresprec (io, *record, resp);
+
+          lock.l_type = F_UNLCK;
+          fcntl (io->fidrdx, F_SETLK, &lock);
+        }
+    }
+  while (resp->r_stat[*offset] & ISDELETED);
+
+  return 0;
+}
+
+/* fetch_text - read the text at DADDR into NEWTP. */
+
+static void
+fetch_text (struct io_f *io, struct newt *newtp, struct daddr_f *daddr)
+{
+  newtp->text = newts_nrealloc (newtp->text, daddr->textlen + 1,
+                                sizeof (char));
+  gettextrec (io, daddr, newtp->text);
+}
@@ -64,6 +64,8 @@ uiuc_get_stats (const newts_nfref *ref, struct stats *stats)
   stats->created = convert_time (&io.descr.d_created);
   stats->last_used = convert_time (&io.descr.d_lastuse);
   stats->days_used = io.descr.d_daysused;
+  tfree_stats (&io, &stats->text_size, &stats->text_free,
+               &stats->free_extents);
 
   closenf (&io);
 
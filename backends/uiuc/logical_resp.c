@@ -30,49 +30,33 @@
 #include "error.h"
 #include "uiuc-backend.h"
 
-#if HAVE_FCNTL_H
-# include <fcntl.h>
-#endif
+static int resp_offset (struct resp_f *resp, int respnum, int *offset);
 
 int
 logical_resp (struct io_f *iop, int notenum, int respnum, struct resp_f *resp,
               int *offset, int *record)
 {
   struct note_f note;
-  struct flock lock;
 
   if (respnum <= 0)               /* That was silly. */
     return -1;
 
-  lock.l_type = F_RDLCK;
-  lock.l_whence = SEEK_SET;
-  lock.l_start = (off_t) (sizeof (struct descr_f) +
-                          (notenum * sizeof (struct note_f)));
-  lock.l_len = (off_t) sizeof (struct note_f);
-  TEMP_FAILURE_RETRY (fcntl (iop->fidndx, F_SETLKW, &lock));
-
-  getnoterec (iop, notenum, &note);
-
-  lock.l_type = F_UNLCK;
-  fcntl (iop->fidndx, F_SETLK, &lock);
+  readnoterec (iop, notenum, &note);
 
   if (respnum > note.n_nresp)     /* That was also silly. */
     return -1;
 
-  *record = note.n_rindx;         /* Record number of first response block. */
-  *offset = 0;
-
-  /* We choose to incrementally lock the response tree as we go through it.
-   * This admittedly slows down this single access, but with 1000 or so people,
-   * it's a win.
+  /* The response position index can usually take us straight to the right
+   * block; if it can't, walk the chain.
    */
 
-  lock.l_type = F_RDLCK;
-  lock.l_start = (off_t) (sizeof (int) + (*record * sizeof (struct resp_f)));
-  lock.l_len = (off_t) sizeof (struct resp_f);
-  TEMP_FAILURE_RETRY (fcntl (iop->fidrdx, F_SETLKW, &lock));
+  if (rpos_find (iop, notenum, &note, respnum, resp, record) == 0)
+    return resp_offset (resp, respnum, offset);
 
-  getresprec (iop, *record, resp);
+  *record = note.n_rindx;         /* Record number of first response block. */
+  *offset = 0;
+
+  readresprec (iop, *record, resp);
   while (respnum > resp->r_last)
     {
       if (*record == resp->r_next)
@@ -82,52 +66,43 @@ logical_resp (struct io_f *iop, int notenum, int respnum, struct resp_f *resp,
           //if (debug)
           //  error (0, 0, "logical_resp: Stuck in infinite record loop (%d)",
           //         *record);
-          lock.l_type = F_UNLCK;
-          fcntl (iop->fidrdx, F_SETLK, &lock);
           return -1;
         }
 
       if ((*record = resp->r_next) == -1)   /* Broken chain of resps. */
-        {
-          lock.l_type = F_UNLCK;
-          fcntl (iop->fidrdx, F_SETLK, &lock);
-          return -1;
-        }
+        return -1;
 
-      lock.l_type = F_UNLCK;
-      fcntl (iop->fidrdx, F_SETLK, &lock);
-      lock.l_type = F_RDLCK;
-      lock.l_start = (off_t) (sizeof (int) +
-                              (*record * sizeof (struct resp_f)));
-      lock.l_len = (off_t) sizeof (struct resp_f);
-      TEMP_FAILURE_RETRY (fcntl (iop->fidrdx, F_SETLKW, &lock));
-
-      getresprec (iop, *record, resp);
+      readresprec (iop, *record, resp);
     }
 
-  lock.l_type = F_UNLCK;
-  fcntl (iop->fidrdx, F_SETLK, &lock);
-
   /* At this point, we've found the block of responses which contains the
    * response we're looking for.
    */
 
-  {
-    register int count = -1;
-    *offset = 0;
+  return resp_offset (resp, respnum, offset);
+}
+
+/* resp_offset - find the slot of RESP, the block holding logical response
+ * RESPNUM, that the response is in, skipping deleted responses.
+ */
 
-    while (1)
-      {
-        while (resp->r_stat[*offset] & ISDELETED)
-          ++*offset;
-        if (*offset >= RESPSZ)  /* r_last lied to us. */
-          return -1;
-        count++;
-        if (resp->r_first + count == respnum)
-          break;
+static int
+resp_offset (struct resp_f *resp, int respnum, int *offset)
+{
+  register int count = -1;
+  *offset = 0;
+
+  while (1)
+    {
+      while (*offset < RESPSZ && resp->r_stat[*offset] & ISDELETED)
         ++*offset;
-      }
-  }
+      if (*offset >= RESPSZ)    /* r_last lied to us. */
+        return -1;
+      count++;
+      if (resp->r_first + count == respnum)
+        break;
+      ++*offset;
+    }
 
   return 0;
 }
@@ -73,6 +73,42 @@ checkpath (const char *path)
     return -1;
 }
 
+/* The user the backend is acting for, if not the one running it; see
+ * uiuc_set_identity.
+ */
+
+static uid_t identity;
+static int identity_set = FALSE;
+
+/* uiuc_set_identity - act for the user UID from now on, rather than for
+ * whoever is running the backend.  A server serving many users sets this
+ * before each call it makes on one's behalf.  Passing (uid_t) -1 goes back
+ * to the user running the backend.
+ */
+
+int
+uiuc_set_identity (uid_t uid)
+{
+  identity = uid;
+  identity_set = uid != (uid_t) -1;
+
+  return NEWTS_NO_ERROR;
+}
+
+/* get_identity - store the uid of the user the backend is acting for in UID.
+ *
+ * Returns: TRUE if that was set with uiuc_set_identity, or FALSE if it's the
+ * user running the backend.
+ */
+
+int
+get_identity (uid_t *uid)
+{
+  *uid = identity_set ? identity : getuid ();
+
+  return identity_set;
+}
+
 /* getname - get the username and hostname using system calls and store them in
  * the provided struct auth_f.
  */
@@ -90,11 +126,13 @@ getname (struct auth_f *ident, const int anon_flag)
     }
   else
     {
-      struct passwd *pw = getpwuid (getuid());
+      struct passwd *pw;
+      uid_t uid;
+
+      get_identity (&uid);
+      pw = getpwuid (uid);
 
-      if (pw == NULL)
-        s = "";
-      s = pw->pw_name;
+      s = pw != NULL ? pw->pw_name : "";
       endpwent ();
     }
 
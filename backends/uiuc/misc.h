@@ -29,6 +29,7 @@
  */
 
 extern int checkpath (const char *name);
+extern int get_identity (uid_t *uid);
 extern void getname (struct auth_f *ident, const int anon_flag);
 extern void gettime (struct when_f *when, time_t setto);
 extern time_t convert_time (struct when_f *when);
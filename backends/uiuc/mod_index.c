@@ -0,0 +1,402 @@
+/*
+ * mod_index.c - which notes were modified when
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "uiuc-backend.h"
+
+#if HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#if HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
+/* MODINDEX holds the modification time of every note, from the policy note
+ * on, as the leaves of a tree in which each node holds the latest time
+ * beneath it.  Finding the next note modified after some time means
+ * climbing from the note to the first subtree to its right that was
+ * modified since, and descending into it, which takes a few dozen steps
+ * however many notes there are.
+ *
+ * The tree is stored as an array: node 1 is the root, node N's children are
+ * 2N and 2N + 1, and note N's time is at LEAVES + N.  Leaves with no note
+ * hold -1.  There are always more leaves than notes, with room to spare, so
+ * new notes fit without rebuilding it.
+ *
+ * putnoterec keeps it up to date.  A reader that finds it out of date, or
+ * too small for the notes there are, rebuilds it.  Like the postings files,
+ * the header records the inode of 'note.indx', so an index left over from
+ * before a compression isn't used.
+ */
+
+#define MIDX_MAGIC "NEWTSMT1"
+#define MIDX_MIN   256          /* Fewest leaves in a tree. */
+
+struct midx_header
+{
+  char h_magic[8];
+  long h_inode;                 /* Inode of 'note.indx' when built. */
+  long h_leaves;                /* Leaves in the tree. */
+};
+
+static long check_header (int fid, struct io_f *io);
+static int rebuild (int fid, struct io_f *io);
+static int read_node (int fid, long node, long *value);
+static void write_node (int fid, long node, long value);
+static void lock_header (int fid, short type);
+
+/* mindex_put - record MODIFIED as the modification time of note NOTENUM in
+ * the modification index of IO.  The caller holds the note's record lock.
+ */
+
+void
+mindex_put (struct io_f *io, int notenum, time_t modified)
+{
+  long leaves, node, value;
+  int fid;
+
+  if (io->handle == NULL || (fid = open_sidecar (io->fullname, MODINDEX)) < 0)
+    return;
+
+  lock_header (fid, F_WRLCK);
+
+  if ((leaves = check_header (fid, io)) > 0 && notenum < leaves)
+    {
+      /* Set the leaf, then fix up its ancestors until one doesn't change. */
+
+      node = leaves + notenum;
+      value = (long) modified;
+      write_node (fid, node, value);
+
+      for (node /= 2; node >= 1; node /= 2)
+        {
+          long left, right, old;
+
+          if (read_node (fid, 2 * node, &left) ||
+              read_node (fid, 2 * node + 1, &right) ||
+              read_node (fid, node, &old))
+            break;
+
+          value = left > right ? left : right;
+          if (value == old)
+            break;
+          write_node (fid, node, value);
+        }
+    }
+
+  lock_header (fid, F_UNLCK);
+  TEMP_FAILURE_RETRY (close (fid));
+}
+
+/* mindex_open - bring the modification index of IO up to date and map it
+ * into MI, holding it still until mindex_close.  Returns 0, or -1 if it
+ * can't be used.
+ */
+
+int
+mindex_open (struct io_f *io, struct mod_index *mi)
+{
+#if HAVE_MMAP
+  struct descr_f descr;
+  short type = F_RDLCK;
+  long leaves;
+  void *base;
+
+  memset (mi, 0, sizeof (struct mod_index));
+
+  if (io->handle == NULL ||
+      (mi->fid = open_sidecar (io->fullname, MODINDEX)) < 0)
+    return -1;
+
+  /* Usually it's up to date, and a read lock will do.  Otherwise, start over
+   * with a write lock and rebuild it.
+   */
+
+  for (;;)
+    {
+      lock_header (mi->fid, type);
+      readdescr (io, &descr);
+
+      leaves = check_header (mi->fid, io);
+      if (leaves > descr.d_nnote)
+        break;
+
+      if (type == F_WRLCK)
+        {
+          if (rebuild (mi->fid, io) == 0)
+            {
+              /* Go back to sharing it. */
+
+              lock_header (mi->fid, F_RDLCK);
+              leaves = check_header (mi->fid, io);
+            }
+          break;
+        }
+
+      lock_header (mi->fid, F_UNLCK);
+      type = F_WRLCK;
+    }
+
+  if (leaves <= descr.d_nnote)
+    {
+      lock_header (mi->fid, F_UNLCK);
+      TEMP_FAILURE_RETRY (close (mi->fid));
+      return -1;
+    }
+
+  mi->size = sizeof (struct midx_header) +
+    (size_t) (2 * leaves) * sizeof (long);
+  base = mmap (NULL, mi->size, PROT_READ, MAP_SHARED, mi->fid, (off_t) 0);
+
+  if (base == MAP_FAILED)
+    {
+      lock_header (mi->fid, F_UNLCK);
+      TEMP_FAILURE_RETRY (close (mi->fid));
+      return -1;
+    }
+
+  mi->base = base;
+  mi->nodes = (const long *) (mi->base + sizeof (struct midx_header));
+  mi->leaves = leaves;
+
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/* mindex_next - return the first note numbered NOTENUM or higher in MI that
+ * was modified after SEQ, or -1 if there isn't one.
+ */
+
+int
+mindex_next (const struct mod_index *mi, int notenum, time_t seq)
+{
+  const long *nodes = mi->nodes;
+  long node;
+
+  if (notenum < 0)
+    notenum = 0;
+  if (notenum >= mi->leaves)
+    return -1;
+
+  node = mi->leaves + notenum;
+  if (nodes[node] > (long) seq)
+    return notenum;
+
+  /* Climb until there's a subtree to the right with something in it... */
+
+  for (;;)
+    {
+      if (node == 1)
+        return -1;
+      if ((node & 1) == 0 && nodes[node + 1] > (long) seq)
+        {
+          node++;
+          break;
+        }
+      node /= 2;
+    }
+
+  /* ...and find the leftmost note in it. */
+
+  while (node < mi->leaves)
+    node = nodes[2 * node] > (long) seq ? 2 * node : 2 * node + 1;
+
+  return (int) (node - mi->leaves);
+}
+
+/* mindex_close - let go of the modification index mapped by mindex_open. */
+
+void
+mindex_close (struct mod_index *mi)
+{
+#if HAVE_MMAP
+  if (mi->base != NULL)
+    {
+      munmap (mi->base, mi->size);
+      lock_header (mi->fid, F_UNLCK);
+      TEMP_FAILURE_RETRY (close (mi->fid));
+    }
+#endif
+  mi->base = NULL;
+}
+
+/* mindex_rebuild - build the modification index of IO from scratch.  Returns
+ * 0, or -1 if it can't be written.
+ */
+
+int
+mindex_rebuild (struct io_f *io)
+{
+  int fid, result;
+
+  if (io->handle == NULL || (fid = open_sidecar (io->fullname, MODINDEX)) < 0)
+    return -1;
+
+  lock_header (fid, F_WRLCK);
+  result = rebuild (fid, io);
+  lock_header (fid, F_UNLCK);
+
+  TEMP_FAILURE_RETRY (close (fid));
+  return result;
+}
+
+/* check_header - return the number of leaves in the modification index FID
+ * if it's usable with IO, or -1.
+ */
+
+static long
+check_header (int fid, struct io_f *io)
+{
+  struct midx_header header;
+  struct stat statbuf, ourstat;
+
+  if (fstat (io->fidndx, &statbuf) || fstat (fid, &ourstat))
+    return -1;
+
+  lseek (fid, (off_t) 0, SEEK_SET);
+  if (TEMP_FAILURE_RETRY (read (fid, &header, sizeof header)) ==
+      sizeof header &&
+      memcmp (header.h_magic, MIDX_MAGIC, sizeof header.h_magic) == 0 &&
+      header.h_inode == (long) statbuf.st_ino && header.h_leaves > 0 &&
+      ourstat.st_size >= (off_t) (sizeof header + (size_t) (2 *
+                                  header.h_leaves) * sizeof (long)))
+    return header.h_leaves;
+
+  return -1;
+}
+
+/* rebuild - rewrite the modification index FID of IO from the note records,
+ * with room for twice as many notes as there are.  The caller holds the
+ * header's write lock.  Returns 0, or -1 if it couldn't be written.
+ */
+
+static int
+rebuild (int fid, struct io_f *io)
+{
+  struct midx_header header;
+  struct descr_f descr;
+  struct note_f note;
+  struct stat statbuf;
+  long *nodes;
+  long leaves = MIDX_MIN, node;
+  size_t size;
+  int i, result = 0;
+
+  if (fstat (io->fidndx, &statbuf))
+    return -1;
+
+  readdescr (io, &descr);
+  while (leaves <= 2 * (long) descr.d_nnote)
+    leaves *= 2;
+
+  nodes = newts_nmalloc ((size_t) (2 * leaves), sizeof (long));
+  for (node = 0; node < 2 * leaves; node++)
+    nodes[node] = -1;
+
+  for (i = 0; i <= descr.d_nnote; i++)
+    {
+      readnoterec (io, i, &note);
+      nodes[leaves + i] = (long) convert_time (&note.n_lmod);
+    }
+
+  for (node = leaves - 1; node >= 1; node--)
+    nodes[node] = nodes[2 * node] > nodes[2 * node + 1] ?
+      nodes[2 * node] : nodes[2 * node + 1];
+
+  memset (&header, 0, sizeof header);
+  memcpy (header.h_magic, MIDX_MAGIC, sizeof header.h_magic);
+  header.h_inode = (long) statbuf.st_ino;
+  header.h_leaves = leaves;
+
+  /* Spoil the old header first, and write the new one last, so a failure
+   * leaves the index unusable rather than wrong.
+   */
+
+  size = (size_t) (2 * leaves) * sizeof (long);
+  lseek (fid, (off_t) 0, SEEK_SET);
+  TEMP_FAILURE_RETRY (write (fid, "", 1));
+  lseek (fid, (off_t) sizeof header, SEEK_SET);
+  if (TEMP_FAILURE_RETRY (write (fid, nodes, size)) != (ssize_t) size)
+    result = -1;
+  else
+    {
+      ftruncate (fid, (off_t) (sizeof header + size));
+      lseek (fid, (off_t) 0, SEEK_SET);
+      if (TEMP_FAILURE_RETRY (write (fid, &header, sizeof header)) !=
+          sizeof header)
+        result = -1;
+    }
+
+  newts_free (nodes);
+  return result;
+}
+
+/* read_node - read node NODE of the modification index FID into VALUE.
+ * Returns 0, or -1 if there's no such node.
+ */
+
+static int
+read_node (int fid, long node, long *value)
+{
+  lseek (fid, (off_t) (sizeof (struct midx_header) +
+                       (size_t) node * sizeof (long)), SEEK_SET);
+  if (TEMP_FAILURE_RETRY (read (fid, value, sizeof (long))) != sizeof (long))
+    return -1;
+
+  return 0;
+}
+
+/* write_node - write VALUE to node NODE of the modification index FID. */
+
+static void
+write_node (int fid, long node, long value)
+{
+  lseek (fid, (off_t) (sizeof (struct midx_header) +
+                       (size_t) node * sizeof (long)), SEEK_SET);
+  TEMP_FAILURE_RETRY (write (fid, &value, sizeof (long)));
+}
+
+/* lock_header - lock or unlock the header of the modification index FID. */
+
+static void
+lock_header (int fid, short type)
+{
+  struct flock lock;
+
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = (off_t) sizeof (struct midx_header);
+  if (type == F_UNLCK)
+    fcntl (fid, F_SETLK, &lock);
+  else
+    TEMP_FAILURE_RETRY (fcntl (fid, F_SETLKW, &lock));
+}
@@ -52,13 +52,8 @@ uiuc_modify_nf (struct notesfile *nf)
   lock.l_whence = SEEK_SET;
   lock.l_start = 0;
   lock.l_len = (off_t) sizeof (struct daddr_f);
-  TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &lock));
-
-  if (io.descr.d_stat & NFINVALID)
-    {
-      closenf (&io);
-      return -1;
-    }
+  if (lock_current (&io, nf->ref, &lock, NULL) != 0)
+    return -1;
 
   if (!allow (&io, DRCTOK))
     {
@@ -103,7 +98,7 @@ uiuc_modify_nf (struct notesfile *nf)
 
   putdescr (&io, &io.descr);
 
-  fdatasync (io.fidndx);
+  syncnf (&io, io.fidndx);
   lock.l_type = F_UNLCK;
   fcntl (io.fidndx, F_SETLK, &lock);
 
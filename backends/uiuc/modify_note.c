@@ -44,16 +44,35 @@
 # endif
 #endif
 
+static int modify_once (struct newt *newt, int flags);
+
 /* uiuc_modify_note - update the non-text portions of a note. */
 
 int
 uiuc_modify_note (struct newt *newt, int flags)
+{
+  int result;
+
+  while ((result = modify_once (newt, flags)) == SWAPPED)
+    ;
+
+  return result;
+}
+
+/* modify_once - do what uiuc_modify_note does, unless an online compression
+ * swaps the files first, in which case SWAPPED is returned and NEWT points
+ * at the note in the new ones.
+ */
+
+static int
+modify_once (struct newt *newt, int flags)
 {
   struct io_f io;
   struct note_f note, oldnote;
   struct stat statbuf;
   struct flock dlock, nlock;
   time_t timet;
+  int result;
 
   init (&io, &newt->nr.nfr);
 
@@ -79,7 +98,9 @@ uiuc_modify_note (struct newt *newt, int flags)
     {
       int savestat;
 
-      TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &nlock));
+      result = lock_current (&io, &newt->nr.nfr, &nlock, &newt->nr);
+      if (result != 0)
+        return result;
 
       getnoterec (&io, newt->nr.notenum, &oldnote);
 
@@ -133,6 +154,14 @@ uiuc_modify_note (struct newt *newt, int flags)
       if (newt->options & NOTE_UNAPPROVED)
         note.n_stat |= ISUNAPPROVED;
 
+      /* Only a director may approve a note or leave it a message. */
+
+      if (!allow (&io, DRCTOK))
+        {
+          note.n_stat &= ~(DIRMES | ISUNAPPROVED);
+          note.n_stat |= savestat & (DIRMES | ISUNAPPROVED);
+        }
+
       if (flags & UPDATE_TIMES)
         {
           get_uiuc_time (&io.descr.d_lastm, newt->modified);
@@ -145,16 +174,28 @@ uiuc_modify_note (struct newt *newt, int flags)
       TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &dlock));
 
       putnoterec (&io, newt->nr.notenum, &note);
+      tcol_put (&io, newt->nr.notenum, note.ntitle);
 
       nlock.l_type = F_UNLCK;
       fcntl (io.fidndx, F_SETLK, &nlock);
 
       putdescr (&io, &io.descr);
 
-      fdatasync (io.fidndx);
+      syncnf (&io, io.fidndx);
       dlock.l_type = F_UNLCK;
       fcntl (io.fidndx, F_SETLK, &dlock);
 
+      /* Bringing a note back counts as changing it, whatever the flags. */
+
+      if (note.n_stat & ISDELETED)
+        {
+          if (!(savestat & ISDELETED))
+            clog_delete (&io, newt->nr.notenum, 0);
+        }
+      else if (flags & UPDATE_TIMES || savestat & ISDELETED)
+        clog_modify (&io, newt->nr.notenum, 0, convert_time (&note.n_lmod),
+                     &note.n_auth);
+
       closenf (&io);
       return 0;
     }
@@ -164,7 +205,9 @@ uiuc_modify_note (struct newt *newt, int flags)
       struct flock rlock;
       int offset, record;
 
-      TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &nlock));
+      result = lock_current (&io, &newt->nr.nfr, &nlock, &newt->nr);
+      if (result != 0)
+        return result;
 
       getnoterec (&io, newt->nr.notenum, &note);
 
@@ -201,6 +244,13 @@ uiuc_modify_note (struct newt *newt, int flags)
       if (newt->options & NOTE_UNAPPROVED)
         resp.r_stat[offset] |= ISUNAPPROVED;
 
+      if (!allow (&io, DRCTOK))
+        {
+          resp.r_stat[offset] &= ~(DIRMES | ISUNAPPROVED);
+          resp.r_stat[offset] |= oldresp.r_stat[offset] &
+            (DIRMES | ISUNAPPROVED);
+        }
+
       dlock.l_type = F_RDLCK;
       dlock.l_whence = SEEK_SET;
       dlock.l_start = 0;
@@ -231,13 +281,17 @@ uiuc_modify_note (struct newt *newt, int flags)
 
       putdescr (&io, &io.descr);
 
-      fdatasync (io.fidrdx);
-      fdatasync (io.fidndx);
+      syncnf (&io, io.fidrdx);
+      syncnf (&io, io.fidndx);
       dlock.l_type = F_UNLCK;
       fcntl (io.fidndx, F_SETLK, &dlock);
       rlock.l_type = F_UNLCK;
       fcntl (io.fidrdx, F_SETLK, &rlock);
 
+      if (flags & UPDATE_TIMES)
+        clog_modify (&io, newt->nr.notenum, POST_RESP (record, offset),
+                     convert_time (&note.n_lmod), &resp.r_auth[offset]);
+
       closenf (&io);
       return 0;
     }
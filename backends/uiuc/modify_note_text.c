@@ -48,20 +48,39 @@
 # endif
 #endif
 
+static int modify_once (struct newt *newt);
+
 /* uiuc_modify_note_text - update the text portions of a note. */
 
 int
 uiuc_modify_note_text (struct newt *newt)
+{
+  int result;
+
+  while ((result = modify_once (newt)) == SWAPPED)
+    ;
+
+  return result;
+}
+
+/* modify_once - do what uiuc_modify_note_text does, unless an online
+ * compression swaps the files first, in which case SWAPPED is returned and
+ * NEWT points at the note in the new ones.
+ */
+
+static int
+modify_once (struct newt *newt)
 {
   static uid_t anon;
   static short anon_is_set = FALSE;
 
   struct io_f io;
-  struct daddr_f daddr;
+  struct daddr_f daddr, olddaddr;
   struct note_f note;
   struct stat statbuf;
   struct flock dlock, nlock;
   time_t timet;
+  int result;
 
   if (!anon_is_set)
     {
@@ -94,7 +113,9 @@ uiuc_modify_note_text (struct newt *newt)
 
   if (newt->nr.respnum == 0)
     {
-      TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &nlock));
+      result = lock_current (&io, &newt->nr.nfr, &nlock, &newt->nr);
+      if (result != 0)
+        return result;
 
       getnoterec (&io, newt->nr.notenum, &note);
 
@@ -110,12 +131,15 @@ uiuc_modify_note_text (struct newt *newt)
           return -1;
         }
 
-      /* We're allowed to change the director message here; saves time. */
+      /* A director may change the director message here; saves time. */
 
-      if (newt->director_message)
-        note.n_stat |= DIRMES;
-      else
-        note.n_stat &= ~DIRMES;
+      if (allow (&io, DRCTOK))
+        {
+          if (newt->director_message)
+            note.n_stat |= DIRMES;
+          else
+            note.n_stat &= ~DIRMES;
+        }
 
       if (!allow (&io, DRCTOK))
         {
@@ -130,6 +154,7 @@ uiuc_modify_note_text (struct newt *newt)
       /* Update the note's text record */
 
       puttextrec (&io, newt->text, &daddr, -1);
+      olddaddr = note.n_addr;
       note.n_addr.addr = daddr.addr;
       note.n_addr.textlen = daddr.textlen;
 
@@ -167,10 +192,20 @@ uiuc_modify_note_text (struct newt *newt)
 
       putdescr (&io, &io.descr);
 
-      fdatasync (io.fidndx);
+      syncnf (&io, io.fidndx);
       dlock.l_type = F_UNLCK;
       fcntl (io.fidndx, F_SETLK, &dlock);
 
+      /* Nothing refers to the old text any more. */
+
+      tfree_release (&io, &olddaddr);
+      tindex_add (&io, newt->nr.notenum, 0, &daddr);
+      if (newt->options & NOTE_ANONYMOUS)
+        aindex_add (&io, newt->nr.notenum, 0, note.n_auth.aname,
+                    note.n_id.sys);
+      clog_modify (&io, newt->nr.notenum, 0, convert_time (&note.n_lmod),
+                   &note.n_auth);
+
       closenf (&io);
       return 0;
     }
@@ -180,7 +215,9 @@ uiuc_modify_note_text (struct newt *newt)
       struct flock rlock;
       int offset, record;
 
-      TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &nlock));
+      result = lock_current (&io, &newt->nr.nfr, &nlock, &newt->nr);
+      if (result != 0)
+        return result;
 
       getnoterec (&io, newt->nr.notenum, &note);
 
@@ -209,12 +246,15 @@ uiuc_modify_note_text (struct newt *newt)
 
       memcpy (&resp, &oldresp, sizeof (struct resp_f));
 
-      /* We're allowed to change the director message here; it'll save time. */
+      /* A director may change the director message here; saves time. */
 
-      if (newt->director_message)
-        resp.r_stat[offset] |= DIRMES;
-      else
-        resp.r_stat[offset] &= ~DIRMES;
+      if (allow (&io, DRCTOK))
+        {
+          if (newt->director_message)
+            resp.r_stat[offset] |= DIRMES;
+          else
+            resp.r_stat[offset] &= ~DIRMES;
+        }
 
       if (!allow (&io, DRCTOK))
         {
@@ -269,13 +309,21 @@ uiuc_modify_note_text (struct newt *newt)
 
       putdescr (&io, &io.descr);
 
-      fdatasync (io.fidrdx);
-      fdatasync (io.fidndx);
+      syncnf (&io, io.fidrdx);
+      syncnf (&io, io.fidndx);
       dlock.l_type = F_UNLCK;
       fcntl (io.fidndx, F_SETLK, &dlock);
       rlock.l_type = F_UNLCK;
       fcntl (io.fidrdx, F_SETLK, &rlock);
 
+      tfree_release (&io, &oldresp.r_addr[offset]);
+      tindex_add (&io, newt->nr.notenum, POST_RESP (record, offset), &daddr);
+      if (newt->options & NOTE_ANONYMOUS)
+        aindex_add (&io, newt->nr.notenum, POST_RESP (record, offset),
+                    resp.r_auth[offset].aname, resp.r_id[offset].sys);
+      clog_modify (&io, newt->nr.notenum, POST_RESP (record, offset),
+                   convert_time (&note.n_lmod), &resp.r_auth[offset]);
+
       closenf (&io);
       return 0;
     }
@@ -87,6 +87,12 @@ uiuc_open_nf (const newts_nfref *ref, struct notesfile *nf)
 
   time (&nf->time_entered);
 
+  /* Keep the notesfile's files open until close_nf. */
+
+  if (nf->handle)
+    release_handle (nf->handle);
+  nf->handle = hold_handle (io.handle);
+
   closenf (&io);
 
   return NEWTS_NO_ERROR;
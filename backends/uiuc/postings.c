@@ -0,0 +1,822 @@
+/*
+ * postings.c - on-disk indexes from terms to the notes they turn up in
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "uiuc-backend.h"
+
+#if HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#if HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
+/* A postings file maps terms - words of text, author names, whatever the
+ * caller likes - to the notes and responses they belong to.  After a header
+ * comes a hash table of POST_BUCKETS file offsets, each the head of a chain
+ * of terms; each term points to the newest of a chain of blocks of postings,
+ * and each block to the one before it.  Everything after the hash table is
+ * only ever appended to, except that the newest block of a term is filled up
+ * before a new one is started.  Blocks double in size up to POST_MAX, so a
+ * common term doesn't turn into a long chain.
+ *
+ * Postings name a note and a physical response slot (see POST_RESP) rather
+ * than a response number, since response numbers shift when a response is
+ * deleted and slots don't.  Nothing is ever removed; the caller has to check
+ * that what a posting points to still matches.
+ *
+ * Writers hold a write lock on the header for as long as they update the
+ * file, and mark it invalid in the meantime, so a writer that dies halfway
+ * through leaves a file that readers ignore and the next rebuild replaces.
+ * Postings are collected in memory and written out a term at a time when the
+ * writer is done, or when there are more than POST_STAGED of them.  Only the
+ * buckets of the hash table that a writer looks at are read, and only those
+ * it changes are written back, so adding the words of one note doesn't cost
+ * the whole table.
+ *
+ * A file built against one set of data files is no good for the next; the
+ * header records the inode of 'note.indx' to catch that.
+ */
+
+#define POST_MAGIC   "NEWTSPI1"
+#define POST_BUCKETS 16384
+#define POST_MIN     4          /* Postings in a term's first block. */
+#define POST_MAX     1024       /* Largest block we grow to. */
+#define POST_STAGED  (1L << 20) /* Postings held in memory before a flush. */
+#define STAGE_BUCKETS 4096
+
+struct post_header
+{
+  char h_magic[8];
+  long h_inode;                 /* Inode of 'note.indx' when built. */
+  long h_end;                   /* End of the data in use. */
+  long h_terms;                 /* Number of terms. */
+  int h_buckets;                /* Size of the hash table. */
+  int h_valid;                  /* Zero while being updated. */
+};
+
+struct post_term
+{
+  long t_next;                  /* Next term in the same bucket. */
+  long t_block;                 /* Newest block of postings. */
+  long t_count;                 /* Postings in all blocks. */
+  unsigned long t_hash;
+  int t_length;                 /* Length of the name that follows. */
+  int t_pad;
+};
+
+struct post_block
+{
+  long b_prev;                  /* Next older block, or 0. */
+  int b_used;                   /* Postings in use... */
+  int b_size;                   /* ...out of this many that follow. */
+};
+
+#define TABLE_SIZE (sizeof (struct post_header) + POST_BUCKETS * sizeof (long))
+#define ALIGN(n) (((n) + sizeof (long) - 1) & ~(sizeof (long) - 1))
+
+#define LONG_BITS (8 * sizeof (unsigned long))
+#define DIRTY_WORDS ((POST_BUCKETS + LONG_BITS - 1) / LONG_BITS)
+
+struct staged
+{
+  struct staged *next;
+  unsigned long hash;
+  size_t length;
+  char *name;
+  struct posting *postings;
+  int count, size;
+};
+
+struct post_writer
+{
+  int fid;
+  struct post_header header;
+  long *buckets;                /* The buckets changed, or all if FRESH. */
+  unsigned long *dirty;         /* Which of BUCKETS have been changed. */
+  int fresh;                    /* Nonzero if the file is being rebuilt. */
+  long disk_end;                /* What's on disk; the rest is in TAIL. */
+  char *tail;
+  size_t tail_size;
+#if HAVE_MMAP
+  char *map;                    /* The file up to DISK_END, or NULL. */
+  size_t map_size;
+#endif
+  struct staged *staged[STAGE_BUCKETS];
+  long nstaged;
+};
+
+static unsigned long hash_term (const char *term, size_t length);
+static int read_header (int fid, struct io_f *io, struct post_header *header);
+static void lock_header (int fid, short type);
+static long get_bucket (struct post_writer *w, unsigned long bucket);
+static void set_bucket (struct post_writer *w, unsigned long bucket,
+                        long where);
+static void flush (struct post_writer *w);
+static long find_term (struct post_writer *w, const char *name, size_t length,
+                       unsigned long hash);
+static void fetch (struct post_writer *w, long where, void *buf,
+                   size_t length);
+static void store (struct post_writer *w, long where, const void *buf,
+                   size_t length);
+static long allocate (struct post_writer *w, size_t length);
+static void map_file (struct post_writer *w);
+
+/* post_begin - start adding postings to the postings file NAME of IO.  If
+ * CREATE is nonzero, the file is emptied first; otherwise, NULL is returned
+ * if there's no usable file to add to, since it will have to be rebuilt from
+ * scratch anyway.  Files outside the handle cache are never indexed.
+ */
+
+struct post_writer *
+post_begin (struct io_f *io, const char *name, int create)
+{
+  struct post_writer *w;
+  int fid;
+
+  if (io->handle == NULL || (fid = open_sidecar (io->fullname, name)) < 0)
+    return NULL;
+
+  lock_header (fid, F_WRLCK);
+
+  w = newts_zalloc (sizeof (struct post_writer));
+  w->fid = fid;
+
+  if (create || read_header (fid, io, &w->header) != 0)
+    {
+      struct stat statbuf;
+
+      if (!create || fstat (io->fidndx, &statbuf))
+        {
+          lock_header (fid, F_UNLCK);
+          TEMP_FAILURE_RETRY (close (fid));
+          newts_free (w);
+          return NULL;
+        }
+
+      ftruncate (fid, (off_t) 0);
+      ftruncate (fid, (off_t) TABLE_SIZE);
+
+      memset (&w->header, 0, sizeof w->header);
+      memcpy (w->header.h_magic, POST_MAGIC, sizeof w->header.h_magic);
+      w->header.h_inode = (long) statbuf.st_ino;
+      w->header.h_end = (long) TABLE_SIZE;
+      w->header.h_buckets = POST_BUCKETS;
+      w->buckets = newts_zalloc (POST_BUCKETS * sizeof (long));
+      w->fresh = TRUE;
+    }
+  else
+    {
+      w->buckets = newts_nmalloc (POST_BUCKETS, sizeof (long));
+      w->dirty = newts_zalloc (DIRTY_WORDS * sizeof (unsigned long));
+    }
+
+  /* Until we're done, the file is no good to anybody. */
+
+  w->header.h_valid = 0;
+  lseek (fid, (off_t) 0, SEEK_SET);
+  TEMP_FAILURE_RETRY (write (fid, &w->header, sizeof w->header));
+
+  w->disk_end = w->header.h_end;
+  map_file (w);
+
+  return w;
+}
+
+/* post_add - record that TERM, of LENGTH characters, occurs COUNT times at
+ * WHERE in note NOTENUM.
+ */
+
+void
+post_add (struct post_writer *w, const char *term, size_t length,
+          int notenum, int where, int count)
+{
+  unsigned long hash = hash_term (term, length);
+  struct staged *s;
+
+  for (s = w->staged[hash % STAGE_BUCKETS]; s != NULL; s = s->next)
+    if (s->hash == hash && s->length == length &&
+        memcmp (s->name, term, length) == 0)
+      break;
+
+  if (s == NULL)
+    {
+      s = newts_zalloc (sizeof (struct staged));
+      s->hash = hash;
+      s->length = length;
+      s->name = newts_memdup (term, length);
+      s->next = w->staged[hash % STAGE_BUCKETS];
+      w->staged[hash % STAGE_BUCKETS] = s;
+    }
+
+  if (s->count == s->size)
+    {
+      s->size = s->size ? s->size * 2 : POST_MIN;
+      s->postings = newts_nrealloc (s->postings, s->size,
+                                    sizeof (struct posting));
+    }
+
+  s->postings[s->count].p_note = notenum;
+  s->postings[s->count].p_where = where;
+  s->postings[s->count].p_count = count;
+  s->count++;
+
+  if (++w->nstaged >= POST_STAGED)
+    flush (w);
+}
+
+/* post_end - write out what was added through W and make the file usable
+ * again.
+ */
+
+void
+post_end (struct post_writer *w)
+{
+  unsigned long i, j;
+
+  flush (w);
+
+  /* Write back the runs of buckets that changed, or the lot if we built the
+   * table from nothing.
+   */
+
+  for (i = 0; i < POST_BUCKETS; i = j)
+    {
+      if (!w->fresh && !(w->dirty[i / LONG_BITS] & (1UL << i % LONG_BITS)))
+        {
+          j = i + 1;
+          continue;
+        }
+
+      for (j = i + 1; j < POST_BUCKETS && (w->fresh ||
+                                           w->dirty[j / LONG_BITS] &
+                                           (1UL << j % LONG_BITS)); j++)
+        ;
+
+      lseek (w->fid, (off_t) (sizeof (struct post_header) + i * sizeof (long)),
+             SEEK_SET);
+      TEMP_FAILURE_RETRY (write (w->fid, &w->buckets[i],
+                                 (j - i) * sizeof (long)));
+    }
+
+  w->header.h_valid = 1;
+  lseek (w->fid, (off_t) 0, SEEK_SET);
+  TEMP_FAILURE_RETRY (write (w->fid, &w->header, sizeof w->header));
+
+#if HAVE_MMAP
+  if (w->map != NULL)
+    munmap (w->map, w->map_size);
+#endif
+
+  lock_header (w->fid, F_UNLCK);
+  TEMP_FAILURE_RETRY (close (w->fid));
+
+  newts_free (w->buckets);
+  newts_free (w->dirty);
+  newts_free (w);
+}
+
+/* post_lookup - find the postings of TERM, of LENGTH characters, in the
+ * postings file NAME of IO.  They are stored in a newly allocated array in
+ * POSTINGS, newest first, which the caller must free.  Returns the number of
+ * postings, or -1 if the file is missing or unusable.
+ */
+
+long
+post_lookup (struct io_f *io, const char *name, const char *term,
+             size_t length, struct posting **postings)
+{
+  struct post_header header;
+  struct post_term t;
+  struct post_block b;
+  unsigned long hash = hash_term (term, length);
+  char *found = newts_nmalloc (length + 1, sizeof (char));
+  long where, count = 0;
+  int fid;
+
+  *postings = NULL;
+
+  if ((fid = read_sidecar (io->fullname, name)) < 0)
+    {
+      newts_free (found);
+      return -1;
+    }
+
+  lock_header (fid, F_RDLCK);
+
+  if (read_header (fid, io, &header) != 0)
+    {
+      lock_header (fid, F_UNLCK);
+      TEMP_FAILURE_RETRY (close (fid));
+      newts_free (found);
+      return -1;
+    }
+
+  lseek (fid, (off_t) (sizeof header + (hash % header.h_buckets) *
+                       sizeof (long)), SEEK_SET);
+  if (TEMP_FAILURE_RETRY (read (fid, &where, sizeof where)) != sizeof where)
+    where = 0;
+
+  for (; where > 0 && where < header.h_end; where = t.t_next)
+    {
+      lseek (fid, (off_t) where, SEEK_SET);
+      if (TEMP_FAILURE_RETRY (read (fid, &t, sizeof t)) != sizeof t)
+        {
+          where = 0;
+          break;
+        }
+      if (t.t_hash != hash || t.t_length != (int) length)
+        continue;
+      if (TEMP_FAILURE_RETRY (read (fid, found, length)) == (ssize_t) length
+          && memcmp (found, term, length) == 0)
+        break;
+    }
+
+  if (where > 0 && where < header.h_end && t.t_count > 0)
+    {
+      *postings = newts_nmalloc (t.t_count, sizeof (struct posting));
+
+      for (where = t.t_block; where > 0 && where < header.h_end;
+           where = b.b_prev)
+        {
+          lseek (fid, (off_t) where, SEEK_SET);
+          if (TEMP_FAILURE_RETRY (read (fid, &b, sizeof b)) != sizeof b ||
+              b.b_used < 0 || b.b_used > t.t_count - count)
+            break;
+          if (TEMP_FAILURE_RETRY (read (fid, *postings + count,
+                                        b.b_used * sizeof (struct posting)))
+              != (ssize_t) (b.b_used * sizeof (struct posting)))
+            break;
+          count += b.b_used;
+        }
+    }
+
+  lock_header (fid, F_UNLCK);
+  TEMP_FAILURE_RETRY (close (fid));
+  newts_free (found);
+
+  return count;
+}
+
+/* post_terms - list every term in the postings file NAME of IO.  They are
+ * stored, NUL-terminated, in a newly allocated array in TERMS; the caller must
+ * free each of them and the array.  Returns the number of terms, or -1 if the
+ * file is missing or unusable.
+ */
+
+long
+post_terms (struct io_f *io, const char *name, char ***terms)
+{
+  struct post_header header;
+  struct post_term t;
+  long *buckets;
+  long where, count = 0, size = 0;
+  int fid, i;
+
+  *terms = NULL;
+
+  if ((fid = read_sidecar (io->fullname, name)) < 0)
+    return -1;
+
+  lock_header (fid, F_RDLCK);
+
+  if (read_header (fid, io, &header) != 0)
+    {
+      lock_header (fid, F_UNLCK);
+      TEMP_FAILURE_RETRY (close (fid));
+      return -1;
+    }
+
+  buckets = newts_nmalloc (POST_BUCKETS, sizeof (long));
+  if (TEMP_FAILURE_RETRY (read (fid, buckets, POST_BUCKETS * sizeof (long)))
+      != POST_BUCKETS * sizeof (long))
+    memset (buckets, 0, POST_BUCKETS * sizeof (long));
+
+  for (i = 0; i < POST_BUCKETS; i++)
+    for (where = buckets[i]; where > 0 && where < header.h_end;
+         where = t.t_next)
+      {
+        char *term;
+
+        lseek (fid, (off_t) where, SEEK_SET);
+        if (TEMP_FAILURE_RETRY (read (fid, &t, sizeof t)) != sizeof t ||
+            t.t_length <= 0 || t.t_length > header.h_end - where)
+          break;
+
+        term = newts_nmalloc (t.t_length + 1, sizeof (char));
+        if (TEMP_FAILURE_RETRY (read (fid, term, (size_t) t.t_length)) !=
+            t.t_length)
+          {
+            newts_free (term);
+            break;
+          }
+        term[t.t_length] = '\0';
+
+        if (count == size)
+          {
+            size = size ? size * 2 : 64;
+            *terms = newts_nrealloc (*terms, size, sizeof (char *));
+          }
+        (*terms)[count++] = term;
+      }
+
+  lock_header (fid, F_UNLCK);
+  TEMP_FAILURE_RETRY (close (fid));
+  newts_free (buckets);
+
+  return count;
+}
+
+/* post_compare - order postings by note, then by position in the note. */
+
+int
+post_compare (const void *a, const void *b)
+{
+  const struct posting *x = a, *y = b;
+
+  if (x->p_note != y->p_note)
+    return x->p_note < y->p_note ? -1 : 1;
+  return (x->p_where > y->p_where) - (x->p_where < y->p_where);
+}
+
+/* post_sort - sort the COUNT POSTINGS by position, dropping repeats.  Returns
+ * the number left.
+ */
+
+long
+post_sort (struct posting *postings, long count)
+{
+  long i, kept = 0;
+
+  if (count == 0)
+    return 0;
+
+  qsort (postings, (size_t) count, sizeof (struct posting), post_compare);
+  for (i = 1; i < count; i++)
+    if (post_compare (&postings[i], &postings[kept]) != 0)
+      postings[++kept] = postings[i];
+
+  return kept + 1;
+}
+
+/* post_resolve - read the records POSTING points to in IO: the basenote into
+ * NOTE and, for a response, its block into RESP.  The number of the response,
+ * or 0 for the basenote, is stored in RESPNUM.  Returns 0, or -1 if what the
+ * posting points to has been deleted.
+ */
+
+int
+post_resolve (struct io_f *io, const struct posting *posting,
+              struct note_f *note, struct resp_f *resp, int *respnum)
+{
+  int record, slot, k;
+
+  if (posting->p_note < 0 || posting->p_note > io->descr.d_nnote)
+    return -1;
+
+  readnoterec (io, posting->p_note, note);
+  if (note->n_stat & ISDELETED)
+    return -1;
+
+  *respnum = 0;
+  if (posting->p_where == 0)
+    return 0;
+
+  record = POST_RECORD (posting->p_where);
+  slot = POST_SLOT (posting->p_where);
+  if (record >= getrespcount (io))
+    return -1;
+
+  readresprec (io, record, resp);
+  if (resp->r_stat[slot] & ISDELETED)
+    return -1;
+
+  *respnum = resp->r_first;
+  for (k = 0; k < slot; k++)
+    if ((resp->r_stat[k] & ISDELETED) == 0)
+      ++*respnum;
+
+  return *respnum > note->n_nresp ? -1 : 0;
+}
+
+static unsigned long
+hash_term (const char *term, size_t length)
+{
+  unsigned long hash = 2166136261UL;
+  size_t i;
+
+  for (i = 0; i < length; i++)
+    hash = (hash ^ (unsigned char) term[i]) * 16777619UL;
+
+  return hash;
+}
+
+/* read_header - read the header of the postings file FID into HEADER, and
+ * check that it's usable with IO.  Returns 0 if so, or -1.
+ */
+
+static int
+read_header (int fid, struct io_f *io, struct post_header *header)
+{
+  struct stat statbuf;
+
+  lseek (fid, (off_t) 0, SEEK_SET);
+  if (TEMP_FAILURE_RETRY (read (fid, header, sizeof *header)) !=
+      sizeof *header || fstat (io->fidndx, &statbuf) ||
+      memcmp (header->h_magic, POST_MAGIC, sizeof header->h_magic) ||
+      header->h_inode != (long) statbuf.st_ino || !header->h_valid ||
+      header->h_buckets != POST_BUCKETS || header->h_end < (long) TABLE_SIZE)
+    return -1;
+
+  return 0;
+}
+
+/* lock_header - lock or unlock the header of the postings file FID. */
+
+static void
+lock_header (int fid, short type)
+{
+  struct flock lock;
+
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = (off_t) sizeof (struct post_header);
+  if (type == F_UNLCK)
+    fcntl (fid, F_SETLK, &lock);
+  else
+    TEMP_FAILURE_RETRY (fcntl (fid, F_SETLKW, &lock));
+}
+
+/* flush - write every staged posting of W to the file. */
+
+static void
+flush (struct post_writer *w)
+{
+  struct staged *s, *next;
+  int i;
+
+  for (i = 0; i < STAGE_BUCKETS; i++)
+    {
+      for (s = w->staged[i]; s != NULL; s = next)
+        {
+          struct post_term t;
+          struct post_block b;
+          long where, block;
+          int done = 0;
+
+          next = s->next;
+
+          if ((where = find_term (w, s->name, s->length, s->hash)) == 0)
+            {
+              unsigned long bucket = s->hash % POST_BUCKETS;
+
+              memset (&t, 0, sizeof t);
+              t.t_next = get_bucket (w, bucket);
+              t.t_hash = s->hash;
+              t.t_length = (int) s->length;
+              where = allocate (w, sizeof t + s->length);
+              store (w, where + (long) sizeof t, s->name, s->length);
+              set_bucket (w, bucket, where);
+              w->header.h_terms++;
+            }
+          else
+            fetch (w, where, &t, sizeof t);
+
+          /* Fill up the newest block, then start another. */
+
+          b.b_size = POST_MIN / 2;
+          if (t.t_block != 0)
+            {
+              fetch (w, t.t_block, &b, sizeof b);
+              done = b.b_size - b.b_used;
+              if (done > s->count)
+                done = s->count;
+              if (done > 0)
+                {
+                  store (w, t.t_block + (long) (sizeof b + b.b_used *
+                                                sizeof (struct posting)),
+                         s->postings, done * sizeof (struct posting));
+                  b.b_used += done;
+                  store (w, t.t_block, &b, sizeof b);
+                }
+              else
+                done = 0;
+            }
+
+          if (done < s->count)
+            {
+              int size = b.b_size * 2;
+
+              if (size > POST_MAX)
+                size = POST_MAX;
+              if (size < s->count - done)
+                size = s->count - done;
+
+              block = allocate (w, sizeof b + size * sizeof (struct posting));
+              b.b_prev = t.t_block;
+              b.b_used = s->count - done;
+              b.b_size = size;
+              store (w, block, &b, sizeof b);
+              store (w, block + (long) sizeof b, s->postings + done,
+                     b.b_used * sizeof (struct posting));
+              t.t_block = block;
+            }
+
+          t.t_count += s->count;
+          store (w, where, &t, sizeof t);
+
+          newts_free (s->name);
+          newts_free (s->postings);
+          newts_free (s);
+        }
+      w->staged[i] = NULL;
+    }
+  w->nstaged = 0;
+
+  /* Everything new goes on the end in one piece. */
+
+  if (w->header.h_end > w->disk_end)
+    {
+      lseek (w->fid, (off_t) w->disk_end, SEEK_SET);
+      TEMP_FAILURE_RETRY (write (w->fid, w->tail,
+                                 (size_t) (w->header.h_end - w->disk_end)));
+      w->disk_end = w->header.h_end;
+      map_file (w);
+    }
+
+  newts_free (w->tail);
+  w->tail = NULL;
+  w->tail_size = 0;
+}
+
+/* get_bucket - return the head of BUCKET of the hash table of W, reading it
+ * from the file unless W has changed it.
+ */
+
+static long
+get_bucket (struct post_writer *w, unsigned long bucket)
+{
+  long where;
+
+  if (w->fresh || w->dirty[bucket / LONG_BITS] & (1UL << bucket % LONG_BITS))
+    return w->buckets[bucket];
+
+  fetch (w, (long) (sizeof (struct post_header) + bucket * sizeof (long)),
+         &where, sizeof where);
+  return where;
+}
+
+/* set_bucket - make WHERE the head of BUCKET of the hash table of W. */
+
+static void
+set_bucket (struct post_writer *w, unsigned long bucket, long where)
+{
+  w->buckets[bucket] = where;
+  if (!w->fresh)
+    w->dirty[bucket / LONG_BITS] |= 1UL << bucket % LONG_BITS;
+}
+
+/* find_term - return where the term NAME, of LENGTH characters, is in W, or
+ * 0 if it isn't.
+ */
+
+static long
+find_term (struct post_writer *w, const char *name, size_t length,
+           unsigned long hash)
+{
+  struct post_term t;
+  char *found = NULL;
+  long where;
+
+  for (where = get_bucket (w, hash % POST_BUCKETS); where > 0;
+       where = t.t_next)
+    {
+      fetch (w, where, &t, sizeof t);
+      if (t.t_hash != hash || t.t_length != (int) length)
+        continue;
+
+      found = newts_nrealloc (found, length + 1, sizeof (char));
+      fetch (w, where + (long) sizeof t, found, length);
+      if (memcmp (found, name, length) == 0)
+        break;
+    }
+
+  newts_free (found);
+  return where;
+}
+
+/* fetch and store - read or write LENGTH bytes at WHERE in W, whether they're
+ * on disk yet or not.
+ */
+
+static void
+fetch (struct post_writer *w, long where, void *buf, size_t length)
+{
+  if (where >= w->disk_end)
+    {
+      memcpy (buf, w->tail + (where - w->disk_end), length);
+      return;
+    }
+
+#if HAVE_MMAP
+  if (w->map != NULL && (size_t) where + length <= w->map_size)
+    {
+      memcpy (buf, w->map + where, length);
+      return;
+    }
+#endif
+
+  lseek (w->fid, (off_t) where, SEEK_SET);
+  if (TEMP_FAILURE_RETRY (read (w->fid, buf, length)) != (ssize_t) length)
+    memset (buf, 0, length);
+}
+
+static void
+store (struct post_writer *w, long where, const void *buf, size_t length)
+{
+  if (where >= w->disk_end)
+    {
+      memcpy (w->tail + (where - w->disk_end), buf, length);
+      return;
+    }
+
+  lseek (w->fid, (off_t) where, SEEK_SET);
+  TEMP_FAILURE_RETRY (write (w->fid, buf, length));
+}
+
+/* allocate - make room for LENGTH bytes at the end of W, zeroed, and return
+ * where they are.
+ */
+
+static long
+allocate (struct post_writer *w, size_t length)
+{
+  long where = w->header.h_end;
+  size_t used = (size_t) (where - w->disk_end);
+
+  length = ALIGN (length);
+
+  if (used + length > w->tail_size)
+    {
+      size_t size = w->tail_size ? w->tail_size : 65536;
+
+      while (used + length > size)
+        size *= 2;
+      w->tail = newts_nrealloc (w->tail, size, sizeof (char));
+      memset (w->tail + w->tail_size, 0, size - w->tail_size);
+      w->tail_size = size;
+    }
+
+  w->header.h_end += (long) length;
+  return where;
+}
+
+/* map_file - map W as far as it's on disk, for find_term. */
+
+static void
+map_file (struct post_writer *w)
+{
+#if HAVE_MMAP
+  void *base;
+
+  if (w->map != NULL)
+    munmap (w->map, w->map_size);
+  w->map = NULL;
+  w->map_size = 0;
+
+  base = mmap (NULL, (size_t) w->disk_end, PROT_READ, MAP_SHARED, w->fid,
+               (off_t) 0);
+  if (base != MAP_FAILED)
+    {
+      w->map = base;
+      w->map_size = (size_t) w->disk_end;
+    }
+#endif
+}
@@ -0,0 +1,532 @@
+/*
+ * resp_pos.c - find response blocks without walking the response chain
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "uiuc-backend.h"
+
+#if HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+/* The responses to a note live in a chain of resp_f blocks linked through
+ * r_next, so finding response N used to mean reading and locking every block
+ * in front of it.  'resp.pos' records, for each block in 'resp.indx', which
+ * note's chain it belongs to and where in the chain it sits.  From that we
+ * keep an array of each note's blocks in chain order, and a lookup reads only
+ * the block it needs.
+ *
+ * The index doesn't record logical response numbers, which change whenever a
+ * response is deleted; the r_first and r_last fields of the blocks themselves
+ * say which responses each block holds.  Since every block but the last is
+ * physically full, response N can't be in a block before (N-1)/RESPSZ, and
+ * without deletions it's in exactly that one.  Otherwise we binary search the
+ * rest of the chain on r_last.
+ *
+ * Blocks are only ever added to a chain, by put_resp, and get_new_resp_block
+ * writes the block's entry before it bumps the block count, both under the
+ * lock on that count.  So every block we can see has an entry, unless it was
+ * written by something that doesn't know about this file; an entry of zero
+ * means the index is stale, and we rebuild it by walking every chain.  Blocks
+ * belonging to no chain are recorded with a note number of -1.
+ *
+ * Anything that looks wrong sends the caller back to walking the chain.
+ */
+
+#define RPOS_MAGIC "NEWTSRP1"
+#define RPOS_CHUNK 256          /* Entries read at once. */
+
+struct rpos_header
+{
+  char h_magic[8];
+  long h_inode;                 /* Inode of the 'resp.indx' described. */
+};
+
+struct rpos_f
+{
+  int p_note;                   /* Note whose chain has this block, or -1. */
+  int p_seq;                    /* Position of the block in the chain. */
+};
+
+#define RPOS_WHERE(n) \
+  ((off_t) (sizeof (struct rpos_header) + (n) * sizeof (struct rpos_f)))
+
+struct rpos_chain
+{
+  int nblocks;                  /* Blocks known in this chain. */
+  int size;                     /* Room in BLOCKS. */
+  int *blocks;                  /* Record numbers, in chain order. */
+};
+
+struct rpos_table
+{
+  int fid;                      /* 'resp.pos' file descriptor. */
+  int checked;                  /* Nonzero once the header has been checked. */
+  int loaded;                   /* Blocks of 'resp.indx' accounted for. */
+  int nchains;                  /* Room in CHAINS. */
+  struct rpos_chain *chains;    /* Indexed by note number. */
+};
+
+static struct rpos_table *handle_table (struct io_f *io);
+static struct rpos_table *get_table (struct io_f *io);
+static int load_table (struct io_f *io, struct rpos_table *table);
+static int rebuild_table (struct io_f *io, struct rpos_table *table);
+static void clear_table (struct rpos_table *table);
+static void add_block (struct rpos_table *table, int record, int notenum,
+                       int seq);
+static struct rpos_chain *note_chain (struct rpos_table *table, int notenum,
+                                     struct note_f *note);
+static int read_block (struct io_f *io, int record, struct resp_f *resp);
+static void lock_count (struct io_f *io, short type);
+
+/* rpos_find - find the response block of note NOTENUM, whose note record is
+ * NOTE, that holds logical response RESPNUM.  The block is read into RESP and
+ * its record number stored in RECORD.  Returns 0 on success, or -1 if the
+ * caller should walk the chain itself.
+ */
+
+int
+rpos_find (struct io_f *io, int notenum, struct note_f *note, int respnum,
+           struct resp_f *resp, int *record)
+{
+  struct rpos_table *table;
+  struct rpos_chain *chain;
+  int lo, hi, mid;
+
+  if ((table = get_table (io)) == NULL ||
+      (chain = note_chain (table, notenum, note)) == NULL)
+    return -1;
+
+  lo = (respnum - 1) / RESPSZ;
+  hi = chain->nblocks - 1;
+  if (lo > hi)
+    lo = hi;
+
+  if (read_block (io, chain->blocks[lo], resp) != 0)
+    return -1;
+
+  if (respnum > resp->r_last)
+    {
+      lo++;
+      while (lo < hi)
+        {
+          mid = lo + (hi - lo) / 2;
+          if (read_block (io, chain->blocks[mid], resp) != 0)
+            return -1;
+          if (resp->r_last >= respnum)
+            hi = mid;
+          else
+            lo = mid + 1;
+        }
+
+      if (lo > hi || read_block (io, chain->blocks[lo], resp) != 0)
+        return -1;
+    }
+
+  if (respnum < resp->r_first || respnum > resp->r_last)
+    return -1;
+
+  *record = chain->blocks[lo];
+  return 0;
+}
+
+/* rpos_last_block - find the last response block of note NOTENUM, whose note
+ * record is NOTE, reading it into RESP and storing its record number and its
+ * position in the chain in RECORD and SEQ.  Returns 0 on success, or -1 if the
+ * caller should walk the chain itself.
+ */
+
+int
+rpos_last_block (struct io_f *io, int notenum, struct note_f *note,
+                 struct resp_f *resp, int *record, int *seq)
+{
+  struct rpos_table *table;
+  struct rpos_chain *chain;
+  int last;
+
+  if ((table = get_table (io)) == NULL ||
+      (chain = note_chain (table, notenum, note)) == NULL)
+    return -1;
+
+  last = chain->nblocks - 1;
+  if (read_block (io, chain->blocks[last], resp) != 0)
+    return -1;
+
+  /* A block allocated by a writer that never got to link it in would look
+   * like the end of the chain, but it can't account for the last response.
+   */
+
+  if (resp->r_next != -1 || resp->r_last != note->n_nresp)
+    return -1;
+
+  *record = chain->blocks[last];
+  *seq = last;
+  return 0;
+}
+
+/* rpos_add - record that the new response block RECORD is block SEQ in the
+ * chain of note NOTENUM.  Called with the block count of 'resp.indx' locked,
+ * before the count is raised to include RECORD.
+ */
+
+void
+rpos_add (struct io_f *io, int record, int notenum, int seq)
+{
+  struct rpos_table *table;
+  struct rpos_f entry;
+
+  if ((table = handle_table (io)) == NULL)
+    return;
+
+  entry.p_note = notenum;
+  entry.p_seq = seq;
+
+  lseek (table->fid, RPOS_WHERE (record), SEEK_SET);
+  TEMP_FAILURE_RETRY (write (table->fid, &entry, sizeof entry));
+}
+
+/* rpos_rebuild - rebuild the response position index of IO from scratch.
+ * Returns 0 on success, or -1 if there is no index to rebuild.
+ */
+
+int
+rpos_rebuild (struct io_f *io)
+{
+  struct rpos_table *table;
+
+  if ((table = handle_table (io)) == NULL)
+    return -1;
+
+  return rebuild_table (io, table);
+}
+
+/* rpos_free - free the response position index of HANDLE, if it has one. */
+
+void
+rpos_free (struct nf_handle *handle)
+{
+  struct rpos_table *table = handle->rpos;
+
+  if (table == NULL)
+    return;
+
+  if (table->fid >= 0)
+    TEMP_FAILURE_RETRY (close (table->fid));
+  clear_table (table);
+  newts_free (table);
+  handle->rpos = NULL;
+}
+
+/* handle_table - return the index of the handle of IO, with 'resp.pos' open,
+ * or NULL if there isn't one.
+ */
+
+static struct rpos_table *
+handle_table (struct io_f *io)
+{
+  struct nf_handle *handle = io->handle;
+  struct rpos_table *table;
+
+  if (handle == NULL)
+    return NULL;
+
+  if ((table = handle->rpos) == NULL)
+    {
+      table = newts_zalloc (sizeof (struct rpos_table));
+      table->fid = -1;
+      handle->rpos = table;
+    }
+
+  if (table->fid < 0 &&
+      (table->fid = open_sidecar (io->fullname, RESPPOS)) < 0)
+    return NULL;
+
+  return table;
+}
+
+/* get_table - return the index of IO, brought up to date with 'resp.indx',
+ * or NULL if there's no usable index.
+ */
+
+static struct rpos_table *
+get_table (struct io_f *io)
+{
+  struct rpos_table *table;
+  int result;
+
+  if ((table = handle_table (io)) == NULL)
+    return NULL;
+
+  lock_count (io, F_RDLCK);
+  result = load_table (io, table);
+  lock_count (io, F_UNLCK);
+
+  if (result != 0 && rebuild_table (io, table) != 0)
+    return NULL;
+
+  return table;
+}
+
+/* load_table - read the entries of blocks allocated since we last looked.
+ * Called with the block count locked.  Returns -1 if the file is stale.
+ */
+
+static int
+load_table (struct io_f *io, struct rpos_table *table)
+{
+  struct rpos_f entries[RPOS_CHUNK];
+  int count, n, i;
+
+  if (!table->checked)
+    {
+      struct rpos_header header;
+      struct stat statbuf;
+
+      lseek (table->fid, (off_t) 0, SEEK_SET);
+      if (TEMP_FAILURE_RETRY (read (table->fid, &header, sizeof header)) !=
+          sizeof header || fstat (io->fidrdx, &statbuf) ||
+          memcmp (header.h_magic, RPOS_MAGIC, sizeof header.h_magic) ||
+          header.h_inode != (long) statbuf.st_ino)
+        return -1;
+
+      table->checked = TRUE;
+    }
+
+  count = getrespcount (io);
+  if (count < table->loaded)
+    return -1;
+
+  while (table->loaded < count)
+    {
+      n = count - table->loaded;
+      if (n > RPOS_CHUNK)
+        n = RPOS_CHUNK;
+
+      lseek (table->fid, RPOS_WHERE (table->loaded), SEEK_SET);
+      if (TEMP_FAILURE_RETRY (read (table->fid, entries, n * sizeof *entries))
+          != (ssize_t) (n * sizeof *entries))
+        return -1;
+
+      for (i = 0; i < n; i++)
+        {
+          if (entries[i].p_note == 0 || entries[i].p_seq < 0 ||
+              entries[i].p_seq >= count)
+            return -1;
+
+          if (entries[i].p_note > 0)
+            add_block (table, table->loaded + i, entries[i].p_note,
+                       entries[i].p_seq);
+        }
+
+      table->loaded += n;
+    }
+
+  return 0;
+}
+
+/* rebuild_table - walk the response chain of every note in IO, and write a
+ * new 'resp.pos' from what we find.
+ */
+
+static int
+rebuild_table (struct io_f *io, struct rpos_table *table)
+{
+  struct rpos_header header;
+  struct rpos_f *entries;
+  struct note_f note;
+  struct resp_f resp;
+  struct stat statbuf;
+  int count, notenum, record, seq, i;
+
+  /* Nobody can allocate a block while we hold this. */
+
+  lock_count (io, F_WRLCK);
+
+  if (fstat (io->fidrdx, &statbuf))
+    {
+      lock_count (io, F_UNLCK);
+      return -1;
+    }
+
+  count = getrespcount (io);
+  entries = newts_nmalloc (count > 0 ? count : 1, sizeof *entries);
+  for (i = 0; i < count; i++)
+    {
+      entries[i].p_note = -1;
+      entries[i].p_seq = 0;
+    }
+
+  getdescr (io, &io->descr);
+
+  for (notenum = 1; notenum <= io->descr.d_nnote; notenum++)
+    {
+      getnoterec (io, notenum, &note);
+
+      for (record = note.n_rindx, seq = 0;
+           record >= 0 && record < count && entries[record].p_note < 0;
+           record = resp.r_next, seq++)
+        {
+          entries[record].p_note = notenum;
+          entries[record].p_seq = seq;
+          getresprec (io, record, &resp);
+        }
+    }
+
+  memset (&header, 0, sizeof header);
+  memcpy (header.h_magic, RPOS_MAGIC, sizeof header.h_magic);
+  header.h_inode = (long) statbuf.st_ino;
+
+  ftruncate (table->fid, (off_t) 0);
+  lseek (table->fid, (off_t) 0, SEEK_SET);
+  TEMP_FAILURE_RETRY (write (table->fid, &header, sizeof header));
+  TEMP_FAILURE_RETRY (write (table->fid, entries, count * sizeof *entries));
+
+  lock_count (io, F_UNLCK);
+
+  clear_table (table);
+  for (i = 0; i < count; i++)
+    if (entries[i].p_note > 0)
+      add_block (table, i, entries[i].p_note, entries[i].p_seq);
+  table->loaded = count;
+  table->checked = TRUE;
+
+  newts_free (entries);
+
+  return 0;
+}
+
+/* clear_table - forget everything TABLE knows about the chains. */
+
+static void
+clear_table (struct rpos_table *table)
+{
+  int i;
+
+  for (i = 0; i < table->nchains; i++)
+    newts_free (table->chains[i].blocks);
+  newts_free (table->chains);
+
+  table->chains = NULL;
+  table->nchains = 0;
+  table->loaded = 0;
+  table->checked = FALSE;
+}
+
+/* add_block - note that block RECORD is block SEQ in the chain of NOTENUM.
+ * Later entries replace earlier ones, so a block abandoned by a writer that
+ * died is forgotten once its place is taken.
+ */
+
+static void
+add_block (struct rpos_table *table, int record, int notenum, int seq)
+{
+  struct rpos_chain *chain;
+  int size, i;
+
+  if (notenum >= table->nchains)
+    {
+      size = table->nchains > 0 ? table->nchains : 64;
+      while (size <= notenum)
+        size *= 2;
+
+      table->chains = newts_nrealloc (table->chains, size,
+                                      sizeof (struct rpos_chain));
+      memset (table->chains + table->nchains, 0,
+              (size - table->nchains) * sizeof (struct rpos_chain));
+      table->nchains = size;
+    }
+
+  chain = &table->chains[notenum];
+
+  if (seq >= chain->size)
+    {
+      size = chain->size > 0 ? chain->size : 4;
+      while (size <= seq)
+        size *= 2;
+
+      chain->blocks = newts_nrealloc (chain->blocks, size, sizeof (int));
+      chain->size = size;
+    }
+
+  for (i = chain->nblocks; i < seq; i++)
+    chain->blocks[i] = -1;
+  chain->blocks[seq] = record;
+  if (seq >= chain->nblocks)
+    chain->nblocks = seq + 1;
+}
+
+/* note_chain - return the chain of NOTENUM, or NULL if it doesn't agree with
+ * the note record NOTE.
+ */
+
+static struct rpos_chain *
+note_chain (struct rpos_table *table, int notenum, struct note_f *note)
+{
+  struct rpos_chain *chain;
+
+  if (notenum <= 0 || notenum >= table->nchains)
+    return NULL;
+
+  chain = &table->chains[notenum];
+  if (chain->nblocks == 0 || chain->blocks[0] != note->n_rindx)
+    return NULL;
+
+  return chain;
+}
+
+/* read_block - read response block RECORD into RESP.  A block that has been
+ * allocated but never written reads as zeroes.
+ */
+
+static int
+read_block (struct io_f *io, int record, struct resp_f *resp)
+{
+  if (record < 0)
+    return -1;
+
+  memset (resp, 0, sizeof *resp);
+  readresprec (io, record, resp);
+
+  return 0;
+}
+
+/* lock_count - lock or unlock the block count at the start of 'resp.indx'. */
+
+static void
+lock_count (struct io_f *io, short type)
+{
+  struct flock lock;
+
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = (off_t) sizeof (int);
+  if (type == F_UNLCK)
+    fcntl (io->fidrdx, F_SETLK, &lock);
+  else
+    TEMP_FAILURE_RETRY (fcntl (io->fidrdx, F_SETLKW, &lock));
+}
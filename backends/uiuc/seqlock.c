@@ -0,0 +1,462 @@
+/*
+ * seqlock.c - read UIUC records without taking record locks
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "uiuc-backend.h"
+
+#if HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#if HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
+/* Taking and dropping an fcntl read lock around every record we read costs two
+ * system calls per record, and with many users they contend in the kernel's
+ * lock table.  Writes are rare by comparison, so readers instead check a set
+ * of write generations shared through the mapped file SEQLOCK:
+ *
+ * - A writer bumps the WRITERS count and the GENERATION of the stripe its
+ *   record hashes to before writing the record, and bumps GENERATION again
+ *   and drops WRITERS afterwards.  Writers still take their record locks as
+ *   they always have.
+ * - A reader notes GENERATION, checks that WRITERS is zero, reads the record
+ *   and checks both again.  If a writer was about at either end, the reader
+ *   reads the record again the old way, under a read lock.
+ *
+ * Every process with the notesfile open holds a read lock on the first byte
+ * of SEQLOCK.  Whoever opens it and finds nobody else there clears it, so a
+ * writer that died in the middle of a write only leaves its stripe locked
+ * until everyone has closed the notesfile.  It's cleared in place, never
+ * truncated, as others may have it mapped.
+ *
+ * A process maps each notesfile's SEQLOCK once, however many handles it has
+ * on the notesfile, and keeps it until the last of them is closed.  fcntl
+ * locks belong to the process, so opening SEQLOCK again would find our own
+ * read lock no obstacle and clear stripes we're writing, and closing a second
+ * descriptor would drop the lock the first one relies on.  Where there are
+ * open file description locks, they're used instead, for good measure.
+ *
+ * Without mmap or atomic operations, every read is locked as before.
+ */
+
+#if HAVE_MMAP && HAVE_SYNC_BUILTINS
+# define OPTIMISTIC_READS 1
+#endif
+
+#ifdef F_OFD_SETLK
+# define SEQ_SETLK  F_OFD_SETLK
+# define SEQ_SETLKW F_OFD_SETLKW
+#else
+# define SEQ_SETLK  F_SETLK
+# define SEQ_SETLKW F_SETLKW
+#endif
+
+#define NSTRIPES 64
+
+struct nf_seqlock
+{
+  struct seq_stripe
+  {
+    unsigned writers;           /* Writers in the middle of a write. */
+    unsigned generation;        /* Bumped before and after every write. */
+  } stripes[NSTRIPES];
+};
+
+/* struct seq_map - a notesfile's SEQLOCK, as mapped by this process. */
+
+struct seq_map
+{
+  dev_t dev;                    /* The notesfile directory. */
+  ino_t ino;
+  int fid;
+  struct nf_seqlock *base;
+  int users;                    /* Handles using it. */
+  struct seq_map *next;
+};
+
+#if OPTIMISTIC_READS
+static struct seq_map *seq_maps = NULL;
+#endif
+
+/* Stripes of the descriptor, a note record and a response block. */
+
+#define DESCR_STRIPE   0
+#define NOTE_STRIPE(n) ((unsigned) ((n) + 1) * 2 % NSTRIPES)
+#define RESP_STRIPE(n) (((unsigned) (n) * 2 + 1) % NSTRIPES)
+
+static struct seq_stripe *read_begin (struct io_f *io, unsigned stripe,
+                                      unsigned *generation);
+static int read_end (struct seq_stripe *stripe, unsigned generation);
+static void begin_write (struct io_f *io, unsigned stripe);
+static void end_write (struct io_f *io, unsigned stripe);
+static void lock_record (int fid, off_t where, size_t length, short type);
+
+/* open_seqlock - map the write generations of the notesfile of HANDLE.  If
+ * that can't be done, HANDLE is left without them and reads are locked.
+ */
+
+void
+open_seqlock (struct nf_handle *handle)
+{
+#if OPTIMISTIC_READS
+  struct seq_map *map;
+  struct flock lock;
+  struct stat statbuf;
+  void *base;
+  int fid, alone;
+
+  handle->seqlock = NULL;
+  handle->fidseq = -1;
+
+  for (map = seq_maps; map != NULL; map = map->next)
+    if (map->dev == handle->dev && map->ino == handle->ino)
+      {
+        map->users++;
+        handle->seqlock = map->base;
+        handle->fidseq = map->fid;
+        return;
+      }
+
+  if ((fid = open_sidecar (handle->fullname, SEQLOCK)) < 0)
+    return;
+
+  memset (&lock, 0, sizeof lock);
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = 1;
+
+  lock.l_type = F_WRLCK;
+  alone = fcntl (fid, SEQ_SETLK, &lock) == 0;
+
+  if (!alone)
+    {
+      lock.l_type = F_RDLCK;
+      TEMP_FAILURE_RETRY (fcntl (fid, SEQ_SETLKW, &lock));
+    }
+
+  /* The file only ever grows, so nobody's mapping is cut short. */
+
+  if (fstat (fid, &statbuf) ||
+      (statbuf.st_size < (off_t) sizeof (struct nf_seqlock) &&
+       ftruncate (fid, (off_t) sizeof (struct nf_seqlock))))
+    {
+      TEMP_FAILURE_RETRY (close (fid));
+      return;
+    }
+
+  base = mmap (NULL, sizeof (struct nf_seqlock), PROT_READ | PROT_WRITE,
+               MAP_SHARED, fid, (off_t) 0);
+  if (base == MAP_FAILED)
+    {
+      TEMP_FAILURE_RETRY (close (fid));
+      return;
+    }
+
+  if (alone)
+    {
+      /* Nobody else is here, so no writer is either. */
+
+      memset (base, 0, sizeof (struct nf_seqlock));
+      __sync_synchronize ();
+
+      lock.l_type = F_RDLCK;
+      TEMP_FAILURE_RETRY (fcntl (fid, SEQ_SETLKW, &lock));
+    }
+
+  map = newts_malloc (sizeof (struct seq_map));
+  map->dev = handle->dev;
+  map->ino = handle->ino;
+  map->fid = fid;
+  map->base = base;
+  map->users = 1;
+  map->next = seq_maps;
+  seq_maps = map;
+
+  handle->seqlock = base;
+  handle->fidseq = fid;
+#else
+  handle->seqlock = NULL;
+  handle->fidseq = -1;
+#endif
+}
+
+/* close_seqlock - stop using the write generations of HANDLE, and unmap them
+ * if no other handle is.
+ */
+
+void
+close_seqlock (struct nf_handle *handle)
+{
+#if OPTIMISTIC_READS
+  struct seq_map **link, *map;
+
+  for (link = &seq_maps; *link != NULL; link = &(*link)->next)
+    if ((*link)->base == handle->seqlock)
+      {
+        map = *link;
+        if (--map->users == 0)
+          {
+            *link = map->next;
+            munmap ((void *) map->base, sizeof (struct nf_seqlock));
+            TEMP_FAILURE_RETRY (close (map->fid));
+            newts_free (map);
+          }
+        break;
+      }
+#endif
+
+  handle->seqlock = NULL;
+  handle->fidseq = -1;
+}
+
+/* readdescr, readnoterec and readresprec - read a record the way getdescr,
+ * getnoterec and getresprec do, making sure no writer changed it under us.
+ */
+
+int
+readdescr (struct io_f *io, struct descr_f *descr)
+{
+  struct seq_stripe *stripe;
+  unsigned generation;
+  int result;
+
+  if ((stripe = read_begin (io, DESCR_STRIPE, &generation)) != NULL)
+    {
+      result = getdescr (io, descr);
+      if (read_end (stripe, generation))
+        return result;
+    }
+
+  lock_record (io->fidndx, (off_t) 0, sizeof *descr, F_RDLCK);
+  result = getdescr (io, descr);
+  lock_record (io->fidndx, (off_t) 0, sizeof *descr, F_UNLCK);
+
+  return result;
+}
+
+void
+readnoterec (struct io_f *io, int n, struct note_f *note)
+{
+  struct seq_stripe *stripe;
+  unsigned generation;
+  off_t where;
+
+  if ((stripe = read_begin (io, NOTE_STRIPE (n), &generation)) != NULL)
+    {
+      getnoterec (io, n, note);
+      if (read_end (stripe, generation))
+        return;
+    }
+
+  where = (off_t) (sizeof (struct descr_f) + (n * sizeof *note));
+  lock_record (io->fidndx, where, sizeof *note, F_RDLCK);
+  getnoterec (io, n, note);
+  lock_record (io->fidndx, where, sizeof *note, F_UNLCK);
+}
+
+void
+readresprec (struct io_f *io, int n, struct resp_f *resp)
+{
+  struct seq_stripe *stripe;
+  unsigned generation;
+  off_t where;
+
+  if ((stripe = read_begin (io, RESP_STRIPE (n), &generation)) != NULL)
+    {
+      getresprec (io, n, resp);
+      if (read_end (stripe, generation))
+        return;
+    }
+
+  where = (off_t) (sizeof (int) + (n * sizeof *resp));
+  lock_record (io->fidrdx, where, sizeof *resp, F_RDLCK);
+  getresprec (io, n, resp);
+  lock_record (io->fidrdx, where, sizeof *resp, F_UNLCK);
+}
+
+/* uiuc_get_generation - store in GENERATION how many times the descriptor of
+ * the open notesfile NF has been written, by anyone, which every write to
+ * the notesfile does.  It takes no locks, so a server may ask while others
+ * use the backend.  The count starts over when the notesfile is next opened
+ * with nobody else using it, never while NF is open.
+ *
+ * Returns: 0, or -1 if a write is under way or nothing is counting them.
+ */
+
+int
+uiuc_get_generation (const struct notesfile *nf, unsigned long *generation)
+{
+#if OPTIMISTIC_READS
+  const struct nf_handle *handle = nf->handle;
+  struct seq_stripe *sp;
+
+  if (handle == NULL || handle->seqlock == NULL)
+    return -1;
+
+  sp = &handle->seqlock->stripes[DESCR_STRIPE];
+  *generation = *(volatile unsigned *) &sp->generation;
+  __sync_synchronize ();
+  if (*(volatile unsigned *) &sp->writers != 0 || *generation % 2 != 0)
+    return -1;
+
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/* begin_descr_write, end_descr_write and friends - bracket the write of a
+ * record, so that readers know to look again.
+ */
+
+void
+begin_descr_write (struct io_f *io)
+{
+  begin_write (io, DESCR_STRIPE);
+}
+
+void
+end_descr_write (struct io_f *io)
+{
+  end_write (io, DESCR_STRIPE);
+}
+
+void
+begin_note_write (struct io_f *io, int n)
+{
+  begin_write (io, NOTE_STRIPE (n));
+}
+
+void
+end_note_write (struct io_f *io, int n)
+{
+  end_write (io, NOTE_STRIPE (n));
+}
+
+void
+begin_resp_write (struct io_f *io, int n)
+{
+  begin_write (io, RESP_STRIPE (n));
+}
+
+void
+end_resp_write (struct io_f *io, int n)
+{
+  end_write (io, RESP_STRIPE (n));
+}
+
+/* read_begin - start an optimistic read of a record in STRIPE, storing the
+ * generation it starts at in GENERATION.  Returns NULL if the read has to be
+ * locked.
+ */
+
+static struct seq_stripe *
+read_begin (struct io_f *io, unsigned stripe, unsigned *generation)
+{
+#if OPTIMISTIC_READS
+  struct seq_stripe *sp;
+
+  if (io->handle == NULL || io->handle->seqlock == NULL)
+    return NULL;
+
+  sp = &io->handle->seqlock->stripes[stripe];
+  *generation = *(volatile unsigned *) &sp->generation;
+  __sync_synchronize ();
+  if (*(volatile unsigned *) &sp->writers != 0)
+    return NULL;
+
+  return sp;
+#else
+  return NULL;
+#endif
+}
+
+/* read_end - finish an optimistic read begun at GENERATION.  Returns FALSE if
+ * the record may have changed while we read it.
+ */
+
+static int
+read_end (struct seq_stripe *stripe, unsigned generation)
+{
+#if OPTIMISTIC_READS
+  __sync_synchronize ();
+  return (*(volatile unsigned *) &stripe->writers == 0 &&
+          *(volatile unsigned *) &stripe->generation == generation);
+#else
+  return FALSE;
+#endif
+}
+
+static void
+begin_write (struct io_f *io, unsigned stripe)
+{
+#if OPTIMISTIC_READS
+  struct seq_stripe *sp;
+
+  if (io->handle == NULL || io->handle->seqlock == NULL)
+    return;
+
+  sp = &io->handle->seqlock->stripes[stripe];
+  __sync_fetch_and_add (&sp->writers, 1);
+  __sync_fetch_and_add (&sp->generation, 1);
+#endif
+}
+
+static void
+end_write (struct io_f *io, unsigned stripe)
+{
+#if OPTIMISTIC_READS
+  struct seq_stripe *sp;
+
+  if (io->handle == NULL || io->handle->seqlock == NULL)
+    return;
+
+  sp = &io->handle->seqlock->stripes[stripe];
+  __sync_fetch_and_add (&sp->generation, 1);
+  __sync_fetch_and_sub (&sp->writers, 1);
+#endif
+}
+
+/* lock_record - set a lock of TYPE on LENGTH bytes of FID at WHERE. */
+
+static void
+lock_record (int fid, off_t where, size_t length, short type)
+{
+  struct flock lock;
+
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = where;
+  lock.l_len = (off_t) length;
+  if (type == F_UNLCK)
+    fcntl (fid, F_SETLK, &lock);
+  else
+    TEMP_FAILURE_RETRY (fcntl (fid, F_SETLKW, &lock));
+}
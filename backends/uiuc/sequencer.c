@@ -37,203 +37,245 @@
 # include <fcntl.h>
 #endif
 
+/* A user's sequencer file used to be a plain array of struct seq_f, in the
+ * order the notesfiles were first visited, which had to be read through to
+ * find any one of them.  Now the first entry is a header, with an empty name
+ * followed by SEQ_MAGIC, and the rest are sorted by notesfile name, so an
+ * entry can be found by binary search and updated where it lies.  Files
+ * still in the old format are read as they are, and sorted the first time
+ * they're written to.
+ *
+ * A session that visits many notesfiles can read every entry at once with
+ * uiuc_get_all_seqtimes, and write back all those it changed with a single
+ * uiuc_set_seqtimes.
+ */
+
+#define SEQ_MAGIC "NEWTSSEQ1"
+
+static char *seq_filename (const char *name);
+static int read_entry (int fid, long index, struct seq_f *entry);
+static long write_entry (int fid, long index, struct seq_f *entry);
+static int is_sorted (int fid);
+static long count_entries (int fid);
+static long find_entry (int fid, long count, const char *nfname,
+                        struct seq_f *entry);
+static long find_unsorted (int fid, const char *nfname, struct seq_f *entry);
+static long insert_entry (int fid, long count, long index,
+                          struct seq_f *entry);
+static struct seq_f *read_all (int fid, long *count);
+static int sort_file (int fid);
+static int compare_entries (const void *a, const void *b);
+static void lock_file (int fid, short type);
+
 int
 uiuc_get_seqtime (const newts_nfref *ref, const char *name, time_t *seq)
 {
+  struct seq_f entry;
   char *filename;
-  off_t size;
-  struct stat statbuf;
-  struct flock lock;
-  int fid = -1, i;
-  int numentries = 0;
-  struct seq_f *entries = (struct seq_f *) NULL;
+  long index;
+  int fid;
 
   if (ref == NULL || seq == NULL)
     return -1;
 
   *seq = 0;
 
-  lock.l_whence = SEEK_SET;
-  lock.l_start = 0;
-  lock.l_len = 0;    /* All of it. */
-
-  filename = newts_nmalloc (sizeof (char), strlen (SPOOL) +
-                            strlen (SEQUENCER) + strlen (name) + 3);
-
-  snprintf (filename, strlen (SPOOL) + strlen (SEQUENCER) + 2, "%s/%s", SPOOL,
-            SEQUENCER);
+  filename = seq_filename (name);
+  fid = TEMP_FAILURE_RETRY (open (filename, O_RDONLY));
+  newts_free (filename);
 
-  if (stat (filename, &statbuf))
-    mkdir (filename, 0775);
+  if (fid < 0)
+    return -1;
 
-  snprintf (filename, strlen (SPOOL) + strlen (SEQUENCER) + strlen (name) + 3,
-            "%s/%s/%s", SPOOL, SEQUENCER, name);
+  lock_file (fid, F_RDLCK);
 
-  if (stat (filename, &statbuf))
-    size = 0;
+  if (is_sorted (fid))
+    index = find_entry (fid, count_entries (fid), ref->name, &entry);
   else
-    size = statbuf.st_size;
-
-  if (size)
-    {
-      int stop = FALSE;
+    index = find_unsorted (fid, ref->name, &entry);
 
-      numentries = 0;
-
-      entries = (struct seq_f *) newts_malloc ((size_t) size);
-      if (entries == NULL)
-        {
-          newts_free (filename);
-          return -1;
-        }
+  if (index >= 0)
+    *seq = convert_time (&entry.lastin);
 
-      if (!stop && (fid = TEMP_FAILURE_RETRY (open (filename, O_RDONLY))) < 0)
-        {
-          stop = TRUE;
-        }
+  lock_file (fid, F_UNLCK);
+  TEMP_FAILURE_RETRY (close (fid));
 
-      lock.l_type = F_RDLCK;
-      TEMP_FAILURE_RETRY (fcntl (fid, F_SETLKW, &lock));
-      lock.l_type = F_UNLCK;
+  return 0;
+}
 
-      if (!stop && TEMP_FAILURE_RETRY (read (fid, entries, (size_t) size)) != size)
-        {
-          fcntl (fid, F_SETLK, &lock);
-          TEMP_FAILURE_RETRY (close (fid));
-          stop = TRUE;
-        }
+int
+uiuc_set_seqtime (const newts_nfref *ref, const char *name, time_t seq)
+{
+  struct seq_f entry;
+  char *filename;
+  long count, index;
+  int fid;
 
-      if (!stop)
-        {
-          numentries = size / sizeof (struct seq_f);
-          fcntl (fid, F_SETLK, &lock);
-          TEMP_FAILURE_RETRY (close (fid));
-        }
-    }
+  filename = seq_filename (name);
 
-  if (numentries == 0)
+  if ((fid = TEMP_FAILURE_RETRY (open (filename, O_RDWR | O_CREAT, 0666))) < 0)
     {
-      int seqfile;
-      int result;
-      struct seq_f entry;
-
-      if (entries)
-        newts_free (entries);
-
-      if ((seqfile = TEMP_FAILURE_RETRY (open (filename, O_RDONLY))) == -1)
-        {
-          newts_free (filename);
-          return -1;
-        }
+      newts_free (filename);
+      return -1;
+    }
+  newts_free (filename);
 
-      lock.l_type = F_RDLCK;
-      TEMP_FAILURE_RETRY (fcntl (seqfile, F_SETLKW, &lock));
+  lock_file (fid, F_WRLCK);
 
-      do
-        result = TEMP_FAILURE_RETRY (read (seqfile, &entry,
-                                           sizeof (struct seq_f)));
-      while (result && result == (int) sizeof (struct seq_f) &&
-             strcmp (entry.nfname, ref->name) != 0);
+  if (!is_sorted (fid) && sort_file (fid) != 0)
+    {
+      lock_file (fid, F_UNLCK);
+      TEMP_FAILURE_RETRY (close (fid));
+      return -1;
+    }
 
-      lock.l_type = F_UNLCK;
-      fcntl (seqfile, F_SETLK, &lock);
-      TEMP_FAILURE_RETRY (close (seqfile));
+  count = count_entries (fid);
+  index = find_entry (fid, count, ref->name, &entry);
 
-      if (strcmp (entry.nfname, ref->name) == 0)
-        *seq = convert_time (&entry.lastin);
-      else
-        {
-          newts_free (filename);
-          return -1;
-        }
+  if (index >= 0)
+    {
+      get_uiuc_time (&entry.lastin, seq);
+      index = write_entry (fid, index, &entry);
     }
   else
     {
-      for (i=0; i<numentries; i++)
-        if (strcmp (entries[i].nfname, ref->name) == 0)
-          *seq = convert_time (&entries[i].lastin);
-
-      newts_free (entries);
+      memset (&entry, 0, sizeof (struct seq_f));
+      strncpy (entry.nfname, ref->name, NNLEN);
+      get_uiuc_time (&entry.lastin, seq);
+      index = insert_entry (fid, count, -index - 1, &entry);
     }
 
-  newts_free (filename);
-  return 0;
+  fdatasync (fid);
+
+  lock_file (fid, F_UNLCK);
+  TEMP_FAILURE_RETRY (close (fid));
+
+  return index < 0 ? -1 : 0;
 }
 
+/* get_all_seqtimes - read every sequencer time of NAME into MAP.  Returns the
+ * number read, or -1 if NAME has no sequencer file.
+ */
+
 int
-uiuc_set_seqtime (const newts_nfref *ref, const char *name, time_t seq)
+uiuc_get_all_seqtimes (const char *name, newts_seqmap *map)
 {
-  struct seq_f entry;
-  struct flock lock;
-  struct stat dstat;
+  struct seq_f *entries;
   char *filename;
-  int fid;
-  size_t endpt;
+  long count, i;
+  int fid, found = 0;
 
-  filename = newts_nmalloc (sizeof (char), strlen (SPOOL) +
-                            strlen (SEQUENCER) + strlen (name) + 3);
+  filename = seq_filename (name);
+  fid = TEMP_FAILURE_RETRY (open (filename, O_RDONLY));
+  newts_free (filename);
 
-  snprintf (filename, strlen (SPOOL) + strlen (SEQUENCER) + 2, "%s/%s", SPOOL,
-            SEQUENCER);
+  if (fid < 0)
+    return -1;
 
-  if (stat (filename, &dstat))
-    mkdir (filename, 0775);
+  lock_file (fid, F_RDLCK);
+  entries = read_all (fid, &count);
+  lock_file (fid, F_UNLCK);
+  TEMP_FAILURE_RETRY (close (fid));
 
-  snprintf (filename, strlen (SPOOL) + strlen (SEQUENCER) + strlen (name) + 3,
-            "%s/%s/%s", SPOOL, SEQUENCER, name);
+  /* In an old-style file, the last entry for a notesfile is the one that
+   * counts, and it's stored last.
+   */
 
-  if ((fid = TEMP_FAILURE_RETRY (open (filename, O_RDWR))) == -1)
-    {
-      fid = TEMP_FAILURE_RETRY (creat (filename, 0666));
-      TEMP_FAILURE_RETRY (close (fid));
-      fid = TEMP_FAILURE_RETRY (open (filename, O_RDWR));
-    }
+  for (i = 0; i < count; i++)
+    if (entries[i].nfname[0] != '\0')
+      {
+        char nfname[NNLEN + 1];
 
-  lock.l_type = F_RDLCK;
-  lock.l_whence = SEEK_SET;
-  lock.l_start = 0;
-  lock.l_len = 0;   /* All of it. */
-  TEMP_FAILURE_RETRY (fcntl (fid, F_SETLKW, &lock));
+        strncpy (nfname, entries[i].nfname, NNLEN);
+        nfname[NNLEN] = '\0';
+        seqmap_store (map, nfname, convert_time (&entries[i].lastin), FALSE);
+        found++;
+      }
+
+  newts_free (entries);
+  return found;
+}
+
+/* set_seqtimes - write every sequencer time changed in MAP to the sequencer
+ * file of NAME, all at once, and mark them unchanged.  Returns 0, or -1 if
+ * the file couldn't be written.
+ */
+
+int
+uiuc_set_seqtimes (const char *name, newts_seqmap *map)
+{
+  struct newts_seqentry *entry;
+  struct seq_f *entries;
+  char *filename;
+  long count, added = 0;
+  unsigned i;
+  int fid, result = 0;
+  size_t size;
 
-  while ((endpt = (size_t)
-          TEMP_FAILURE_RETRY (read (fid, &entry, sizeof (struct seq_f))))
-          == sizeof (struct seq_f))
-    if (strcmp (entry.nfname, ref->name) == 0)
-      break;
+  filename = seq_filename (name);
 
-  if (endpt < 0)
+  if ((fid = TEMP_FAILURE_RETRY (open (filename, O_RDWR | O_CREAT, 0666))) < 0)
     {
       newts_free (filename);
       return -1;
     }
+  newts_free (filename);
 
-  if (endpt == sizeof (struct seq_f))
-    lseek (fid, -((off_t) sizeof (struct seq_f)), SEEK_CUR);
-  else
+  lock_file (fid, F_WRLCK);
+
+  if (!is_sorted (fid) && sort_file (fid) != 0)
     {
-      strncpy (entry.nfname, ref->name, NNLEN);
-      lseek (fid, (off_t) 0, SEEK_END);
+      lock_file (fid, F_UNLCK);
+      TEMP_FAILURE_RETRY (close (fid));
+      return -1;
     }
 
-  lock.l_type = F_WRLCK;
-  lock.l_whence = SEEK_CUR;
-  lock.l_start = 0;
-  lock.l_len = (off_t) sizeof (struct seq_f);
-  TEMP_FAILURE_RETRY (fcntl (fid, F_SETLKW, &lock));
+  entries = read_all (fid, &count);
+  entries = newts_nrealloc (entries, (size_t) count + map->count,
+                            sizeof (struct seq_f));
 
-  get_uiuc_time (&entry.lastin, seq);
-  TEMP_FAILURE_RETRY (write (fid, &entry, sizeof (struct seq_f)));
+  for (i = 0; i < map->nbuckets; i++)
+    for (entry = map->buckets[i]; entry != NULL; entry = entry->next)
+      if (entry->changed)
+        {
+          struct seq_f key, *found;
 
-  fdatasync (fid);
-  lock.l_type = F_UNLCK;
-  lock.l_whence = SEEK_SET;
-  lock.l_start = 0;
-  lock.l_len = 0;
-  fcntl (fid, F_SETLK, &lock);
+          memset (&key, 0, sizeof (struct seq_f));
+          strncpy (key.nfname, entry->name, NNLEN);
+
+          found = bsearch (&key, entries + 1, (size_t) count - 1,
+                           sizeof (struct seq_f), compare_entries);
+          if (found == NULL)
+            {
+              found = &entries[count + added++];
+              *found = key;
+            }
+
+          get_uiuc_time (&found->lastin, entry->seq);
+        }
 
+  if (added > 0)
+    qsort (entries + 1, (size_t) (count + added - 1), sizeof (struct seq_f),
+           compare_entries);
+
+  size = (size_t) (count + added) * sizeof (struct seq_f);
+  lseek (fid, (off_t) 0, SEEK_SET);
+  if (TEMP_FAILURE_RETRY (write (fid, entries, size)) != (ssize_t) size)
+    result = -1;
+  else
+    {
+      fdatasync (fid);
+
+      for (i = 0; i < map->nbuckets; i++)
+        for (entry = map->buckets[i]; entry != NULL; entry = entry->next)
+          entry->changed = FALSE;
+    }
+
+  lock_file (fid, F_UNLCK);
   TEMP_FAILURE_RETRY (close (fid));
-  newts_free (filename);
-  return 0;
+  newts_free (entries);
+
+  return result;
 }
 
 int
@@ -241,42 +283,50 @@ uiuc_get_next_note (struct newtref *nrp, time_t seq)
 {
   struct io_f io;
   struct note_f note;
-  struct flock lock;
+  struct mod_index mi;
+  int indexed;
+
   if (nrp->notenum < 0)
     nrp->notenum = 0;
 
   init (&io, &nrp->nfr);
 
-  lock.l_whence = SEEK_SET;
-  lock.l_len = (off_t) sizeof (struct note_f);
+  /* The modification index leads straight to each note modified since SEQ;
+   * without it, every note has to be looked at.  Either way, the note record
+   * has the last word.
+   */
 
-  while (nrp->notenum <= io.descr.d_nnote)
-    {
-      nrp->notenum++;
+  indexed = mindex_open (&io, &mi) == 0;
 
-      lock.l_type = F_RDLCK;
-      lock.l_start = (off_t) (sizeof (struct descr_f) +
-                              (nrp->notenum * sizeof (struct note_f)));
-      TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &lock));
+  while (nrp->notenum < io.descr.d_nnote)
+    {
+      if (indexed)
+        {
+          int next = mindex_next (&mi, nrp->notenum + 1, seq);
 
-      getnoterec (&io, nrp->notenum, &note);
+          if (next < 0 || next > io.descr.d_nnote)
+            break;
+          nrp->notenum = next;
+        }
+      else
+        nrp->notenum++;
 
-      lock.l_type = F_UNLCK;
-      fcntl (io.fidndx, F_SETLK, &lock);
+      readnoterec (&io, nrp->notenum, &note);
 
       if (note.n_stat & ISDELETED && !allow (&io, DRCTOK))
-        {
-
-          nrp->notenum++;
-          continue;
-        }
+        continue;
 
       if (difftime (convert_time (&note.n_lmod), seq) > 0)
         {
+          if (indexed)
+            mindex_close (&mi);
           closenf (&io);
           return nrp->notenum;
         }
     }
+
+  if (indexed)
+    mindex_close (&mi);
   closenf (&io);
   return -1;
 }
@@ -287,24 +337,13 @@ uiuc_get_next_resp (struct newtref *nrp, time_t seq)
   struct io_f io;
   struct note_f note;
   struct resp_f resp;
-  struct flock lock;
   int offset, record;
   if (nrp->respnum < 0)
     nrp->respnum = 0;
 
   init (&io, &nrp->nfr);
 
-  lock.l_type = F_RDLCK;
-  lock.l_whence = SEEK_SET;
-  lock.l_start = (off_t) (sizeof (struct descr_f) +
-                          (nrp->notenum * sizeof (struct note_f)));
-  lock.l_len = (off_t) sizeof (struct note_f);
-  TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &lock));
-
-  getnoterec (&io, nrp->notenum, &note);
-
-  lock.l_type = F_UNLCK;
-  fcntl (io.fidndx, F_SETLK, &lock);
+  readnoterec (&io, nrp->notenum, &note);
 
   while (nrp->respnum <= note.n_nresp)
     {
@@ -321,3 +360,276 @@ uiuc_get_next_resp (struct newtref *nrp, time_t seq)
   closenf (&io);
   return -1;
 }
+
+/* seq_filename - return the newly allocated name of the sequencer file for
+ * NAME, making the sequencer directory if need be.
+ */
+
+static char *
+seq_filename (const char *name)
+{
+  struct stat statbuf;
+  size_t length = strlen (SPOOL) + strlen (SEQUENCER) + strlen (name) + 3;
+  char *filename = newts_nmalloc (sizeof (char), length);
+
+  snprintf (filename, length, "%s/%s", SPOOL, SEQUENCER);
+  if (stat (filename, &statbuf))
+    mkdir (filename, 0775);
+
+  snprintf (filename, length, "%s/%s/%s", SPOOL, SEQUENCER, name);
+
+  return filename;
+}
+
+/* read_entry - read entry INDEX of the sequencer file FID into ENTRY.
+ * Returns 0, or -1 if there's no such entry.
+ */
+
+static int
+read_entry (int fid, long index, struct seq_f *entry)
+{
+  lseek (fid, (off_t) index * (off_t) sizeof (struct seq_f), SEEK_SET);
+  if (TEMP_FAILURE_RETRY (read (fid, entry, sizeof (struct seq_f))) !=
+      sizeof (struct seq_f))
+    return -1;
+
+  return 0;
+}
+
+/* write_entry - write ENTRY as entry INDEX of the sequencer file FID.
+ * Returns INDEX, or -1 if it couldn't be written.
+ */
+
+static long
+write_entry (int fid, long index, struct seq_f *entry)
+{
+  lseek (fid, (off_t) index * (off_t) sizeof (struct seq_f), SEEK_SET);
+  if (TEMP_FAILURE_RETRY (write (fid, entry, sizeof (struct seq_f))) !=
+      sizeof (struct seq_f))
+    return -1;
+
+  return index;
+}
+
+/* is_sorted - return TRUE if the sequencer file FID starts with the header
+ * of the sorted format.
+ */
+
+static int
+is_sorted (int fid)
+{
+  struct seq_f header;
+
+  return read_entry (fid, 0, &header) == 0 && header.nfname[0] == '\0' &&
+    strncmp (header.nfname + 1, SEQ_MAGIC, NNLEN - 1) == 0;
+}
+
+/* count_entries - return the number of entries in the sorted sequencer file
+ * FID, counting the header.
+ */
+
+static long
+count_entries (int fid)
+{
+  struct stat statbuf;
+
+  if (fstat (fid, &statbuf))
+    return 0;
+
+  return (long) (statbuf.st_size / (off_t) sizeof (struct seq_f));
+}
+
+/* find_entry - look for NFNAME among the COUNT entries of the sorted
+ * sequencer file FID.  Returns its index, having read it into ENTRY, or if
+ * it's missing, -1 less the index it would have.
+ */
+
+static long
+find_entry (int fid, long count, const char *nfname, struct seq_f *entry)
+{
+  long low = 1, high = count - 1;
+
+  while (low <= high)
+    {
+      long middle = low + (high - low) / 2;
+      int order;
+
+      if (read_entry (fid, middle, entry) != 0)
+        break;
+
+      order = strncmp (nfname, entry->nfname, NNLEN);
+      if (order == 0)
+        return middle;
+      if (order < 0)
+        high = middle - 1;
+      else
+        low = middle + 1;
+    }
+
+  return -low - 1;
+}
+
+/* find_unsorted - look for the last entry for NFNAME in the old-style
+ * sequencer file FID, and read it into ENTRY.  Returns its index, or -1 if
+ * it's missing.
+ */
+
+static long
+find_unsorted (int fid, const char *nfname, struct seq_f *entry)
+{
+  struct seq_f next;
+  long index, found = -1;
+
+  lseek (fid, (off_t) 0, SEEK_SET);
+
+  for (index = 0;
+       TEMP_FAILURE_RETRY (read (fid, &next, sizeof (struct seq_f))) ==
+         sizeof (struct seq_f);
+       index++)
+    if (strncmp (next.nfname, nfname, NNLEN) == 0)
+      {
+        *entry = next;
+        found = index;
+      }
+
+  return found;
+}
+
+/* insert_entry - insert ENTRY at INDEX among the COUNT entries of the sorted
+ * sequencer file FID, moving those after it up.  Returns INDEX, or -1 if
+ * the file couldn't be written.
+ */
+
+static long
+insert_entry (int fid, long count, long index, struct seq_f *entry)
+{
+  size_t size = (size_t) (count - index) * sizeof (struct seq_f);
+
+  if (size > 0)
+    {
+      char *tail = newts_malloc (size);
+
+      lseek (fid, (off_t) index * (off_t) sizeof (struct seq_f), SEEK_SET);
+      if (TEMP_FAILURE_RETRY (read (fid, tail, size)) != (ssize_t) size)
+        {
+          newts_free (tail);
+          return -1;
+        }
+
+      lseek (fid, (off_t) (index + 1) * (off_t) sizeof (struct seq_f),
+             SEEK_SET);
+      if (TEMP_FAILURE_RETRY (write (fid, tail, size)) != (ssize_t) size)
+        {
+          newts_free (tail);
+          return -1;
+        }
+
+      newts_free (tail);
+    }
+
+  return write_entry (fid, index, entry);
+}
+
+/* read_all - read every entry of the sequencer file FID, and store how many
+ * there were in COUNT.  Returns them in a newly allocated array, with room
+ * for at least one more.
+ */
+
+static struct seq_f *
+read_all (int fid, long *count)
+{
+  struct seq_f *entries;
+  struct stat statbuf;
+  ssize_t got;
+
+  *count = 0;
+  if (fstat (fid, &statbuf))
+    return newts_nmalloc (1, sizeof (struct seq_f));
+
+  *count = (long) (statbuf.st_size / (off_t) sizeof (struct seq_f));
+  entries = newts_nmalloc ((size_t) *count + 1, sizeof (struct seq_f));
+
+  lseek (fid, (off_t) 0, SEEK_SET);
+  got = TEMP_FAILURE_RETRY (read (fid, entries,
+                                  (size_t) *count * sizeof (struct seq_f)));
+  *count = got > 0 ? (long) ((size_t) got / sizeof (struct seq_f)) : 0;
+
+  return entries;
+}
+
+/* sort_file - rewrite the old-style sequencer file FID in the sorted format.
+ * Where a notesfile appears more than once, the latest time is kept.
+ * Returns 0, or -1 if the file couldn't be rewritten.
+ */
+
+static int
+sort_file (int fid)
+{
+  struct seq_f *entries;
+  long count, kept = 0, i;
+  size_t size;
+
+  /* Read the entries in after a blank, which becomes the header. */
+
+  entries = read_all (fid, &count);
+  memmove (entries + 1, entries, (size_t) count * sizeof (struct seq_f));
+
+  qsort (entries + 1, (size_t) count, sizeof (struct seq_f), compare_entries);
+
+  for (i = 1; i <= count; i++)
+    {
+      if (entries[i].nfname[0] == '\0')
+        continue;
+
+      if (kept > 0 &&
+          strncmp (entries[kept].nfname, entries[i].nfname, NNLEN) == 0)
+        {
+          if (convert_time (&entries[i].lastin) >
+              convert_time (&entries[kept].lastin))
+            entries[kept].lastin = entries[i].lastin;
+          continue;
+        }
+
+      entries[++kept] = entries[i];
+    }
+
+  memset (&entries[0], 0, sizeof (struct seq_f));
+  strncpy (entries[0].nfname + 1, SEQ_MAGIC, NNLEN - 1);
+
+  size = (size_t) (kept + 1) * sizeof (struct seq_f);
+  lseek (fid, (off_t) 0, SEEK_SET);
+  if (TEMP_FAILURE_RETRY (write (fid, entries, size)) != (ssize_t) size)
+    {
+      newts_free (entries);
+      return -1;
+    }
+  ftruncate (fid, (off_t) size);
+
+  newts_free (entries);
+  return 0;
+}
+
+static int
+compare_entries (const void *a, const void *b)
+{
+  const struct seq_f *x = a, *y = b;
+
+  return strncmp (x->nfname, y->nfname, NNLEN);
+}
+
+/* lock_file - lock or unlock the whole of the sequencer file FID. */
+
+static void
+lock_file (int fid, short type)
+{
+  struct flock lock;
+
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = 0;    /* All of it. */
+  if (type == F_UNLCK)
+    fcntl (fid, F_SETLK, &lock);
+  else
+    TEMP_FAILURE_RETRY (fcntl (fid, F_SETLKW, &lock));
+}
@@ -0,0 +1,117 @@
+/*
+ * sidecar.c - manage the index files Newts keeps next to UIUC notesfiles
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "uiuc-backend.h"
+
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+/* Every sidecar file derived from the data files.  Anything that replaces the
+ * data files wholesale must get rid of all of these.  SEQLOCK isn't derived
+ * from anything, and other processes may have it mapped, so it stays.
+ */
+
+static const char *sidecars[] =
+  {
+    AUTHINDEX,
+    CHANGELOG,
+    MODINDEX,
+    RESPPOS,
+    TEXTFREE,
+    TEXTINDEX,
+    TITLECOL,
+    NULL
+  };
+
+/* open_sidecar - open the sidecar file NAME of the notesfile at FULLNAME for
+ * reading and writing, creating it if necessary.  Returns the file
+ * descriptor, or -1.
+ */
+
+int
+open_sidecar (const char *fullname, const char *name)
+{
+  char *filename;
+  size_t length;
+  int fid;
+
+  length = strlen (fullname) + strlen (name) + 2;
+  filename = newts_nmalloc (sizeof (char), length);
+  snprintf (filename, length, "%s/%s", fullname, name);
+
+  fid = TEMP_FAILURE_RETRY (open (filename, O_RDWR | O_CREAT, 0660));
+  if (fid >= 0)
+    fcntl (fid, F_SETFD, FD_CLOEXEC);
+
+  newts_free (filename);
+
+  return fid;
+}
+
+/* read_sidecar - open the sidecar file NAME of the notesfile at FULLNAME for
+ * reading only, without creating it.  Returns the file descriptor, or -1.
+ */
+
+int
+read_sidecar (const char *fullname, const char *name)
+{
+  char *filename;
+  size_t length;
+  int fid;
+
+  length = strlen (fullname) + strlen (name) + 2;
+  filename = newts_nmalloc (sizeof (char), length);
+  snprintf (filename, length, "%s/%s", fullname, name);
+
+  fid = TEMP_FAILURE_RETRY (open (filename, O_RDONLY));
+  if (fid >= 0)
+    fcntl (fid, F_SETFD, FD_CLOEXEC);
+
+  newts_free (filename);
+
+  return fid;
+}
+
+/* remove_sidecars - delete every sidecar file of the notesfile at FULLNAME.
+ * They'll be rebuilt from the data files when next needed.
+ */
+
+void
+remove_sidecars (const char *fullname)
+{
+  const char **name;
+  char *filename;
+  size_t length;
+
+  for (name = sidecars; *name != NULL; name++)
+    {
+      length = strlen (fullname) + strlen (*name) + 2;
+      filename = newts_nmalloc (sizeof (char), length);
+      snprintf (filename, length, "%s/%s", fullname, *name);
+      unlink (filename);
+      newts_free (filename);
+    }
+}
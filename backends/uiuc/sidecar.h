@@ -0,0 +1,162 @@
+/*
+ * sidecar.h - indexes Newts keeps alongside the UIUC data files
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef SIDECAR_H
+#define SIDECAR_H
+
+#include "uiuc-backend.h"
+
+/* Sidecar files live in the notesfile directory next to 'text', 'note.indx'
+ * and 'resp.indx'.  UIUC notes doesn't know about them.  Most of them can be
+ * derived from the data files, so they may be deleted at any time; Newts
+ * rebuilds them when it finds them missing or out of date.  Two can't:
+ *
+ * - TEXTFREE records which text nothing refers to any more.  Deleting it
+ *   only loses that space until the notesfile is next compressed.
+ * - SEQLOCK is shared by everybody with the notesfile open.  It may be
+ *   deleted only while nobody has; otherwise readers and writers could end
+ *   up with different copies and miss each other's writes.
+ */
+
+#define AUTHINDEX  "auth.idx"   /* Authors of every note. */
+#define CHANGELOG  "changes"    /* Notes and responses as written or edited. */
+#define MODINDEX   "mtime.idx"  /* Modification times of every note. */
+#define RESPPOS    "resp.pos"   /* Response blocks of each note, in order. */
+#define SEQLOCK    "records.seq" /* Write generations; see seqlock.c. */
+#define TEXTFREE   "text.free"  /* Unused extents of 'text'. */
+#define TEXTINDEX  "text.idx"   /* Words of the text of every note. */
+#define TITLECOL   "titles"     /* Titles of every note, packed. */
+
+/* Generic sidecar handling, in sidecar.c. */
+
+extern int open_sidecar (const char *fullname, const char *name);
+extern int read_sidecar (const char *fullname, const char *name);
+extern void remove_sidecars (const char *fullname);
+
+/* The response position index, in resp_pos.c. */
+
+extern int rpos_find (struct io_f *io, int notenum, struct note_f *note,
+                      int respnum, struct resp_f *resp, int *record);
+extern int rpos_last_block (struct io_f *io, int notenum, struct note_f *note,
+                            struct resp_f *resp, int *record, int *seq);
+extern void rpos_add (struct io_f *io, int record, int notenum, int seq);
+extern int rpos_rebuild (struct io_f *io);
+extern void rpos_free (struct nf_handle *handle);
+
+/* The free extents of 'text', in text_free.c. */
+
+extern int tfree_alloc (struct io_f *io, long end, unsigned long length,
+                        long *addr);
+extern int tfree_moved (struct io_f *io, int notenum, int respnum,
+                        const struct daddr_f *where);
+extern void tfree_release (struct io_f *io, struct daddr_f *where);
+extern void tfree_stats (struct io_f *io, unsigned long *size,
+                         unsigned long *unused, unsigned *extents);
+
+/* Indexes from terms to the notes they occur in, in postings.c.  A posting
+ * names a basenote, with P_WHERE zero, or the slot of a response, with
+ * P_WHERE from POST_RESP.
+ */
+
+struct posting
+{
+  int p_note;                   /* Basenote number. */
+  int p_where;                  /* 0, or a response slot. */
+  int p_count;                  /* Occurrences, for ranking. */
+};
+
+#define POST_RESP(record, slot) ((record) * RESPSZ + (slot) + 1)
+#define POST_RECORD(where)      (((where) - 1) / RESPSZ)
+#define POST_SLOT(where)        (((where) - 1) % RESPSZ)
+
+struct post_writer;
+
+extern struct post_writer *post_begin (struct io_f *io, const char *name,
+                                       int create);
+extern void post_add (struct post_writer *w, const char *term, size_t length,
+                      int notenum, int where, int count);
+extern void post_end (struct post_writer *w);
+extern long post_lookup (struct io_f *io, const char *name, const char *term,
+                         size_t length, struct posting **postings);
+extern long post_terms (struct io_f *io, const char *name, char ***terms);
+extern int post_compare (const void *a, const void *b);
+extern long post_sort (struct posting *postings, long count);
+extern int post_resolve (struct io_f *io, const struct posting *posting,
+                         struct note_f *note, struct resp_f *resp,
+                         int *respnum);
+
+/* The full-text index, in text_index.c. */
+
+extern void tindex_add (struct io_f *io, int notenum, int where,
+                        struct daddr_f *daddr);
+extern int tindex_rebuild (struct io_f *io);
+
+/* The title column, in title_column.c.  Note N's title starts at TITLES + N *
+ * TITLEN.
+ */
+
+struct title_column
+{
+  char *base;                   /* The mapping. */
+  size_t size;
+  const char *titles;           /* The titles in it. */
+  int count;                    /* How many titles there are. */
+};
+
+extern void tcol_put (struct io_f *io, int notenum, const char *title);
+extern int tcol_open (struct io_f *io, struct title_column *col);
+extern void tcol_close (struct title_column *col);
+
+/* The author index, in author_index.c. */
+
+extern void aindex_add (struct io_f *io, int notenum, int where,
+                        const char *name, const char *system);
+extern int aindex_rebuild (struct io_f *io);
+extern int aindex_find (struct io_f *io, const char *author,
+                        struct newts_match **matches);
+
+/* The modification index, in mod_index.c. */
+
+struct mod_index
+{
+  int fid;
+  char *base;                   /* The mapping. */
+  size_t size;
+  const long *nodes;            /* The tree in it. */
+  long leaves;                  /* How many leaves the tree has. */
+};
+
+extern void mindex_put (struct io_f *io, int notenum, time_t modified);
+extern int mindex_open (struct io_f *io, struct mod_index *mi);
+extern int mindex_next (const struct mod_index *mi, int notenum, time_t seq);
+extern void mindex_close (struct mod_index *mi);
+extern int mindex_rebuild (struct io_f *io);
+
+/* The change log, in change_log.c. */
+
+extern void clog_add (struct io_f *io, int notenum, int where, time_t created,
+                      const struct auth_f *auth);
+extern void clog_delete (struct io_f *io, int notenum, int where);
+extern void clog_modify (struct io_f *io, int notenum, int where,
+                         time_t modified, const struct auth_f *auth);
+extern int clog_rebuild (struct io_f *io);
+
+#endif /* not SIDECAR_H */
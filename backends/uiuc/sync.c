@@ -0,0 +1,184 @@
+/*
+ * sync.c - control when writes to UIUC notesfiles are made durable
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "uiuc-backend.h"
+
+#if TIME_WITH_SYS_TIME
+# include <sys/time.h>
+# include <time.h>
+#else
+# if HAVE_SYS_TIME_H
+#  include <sys/time.h>
+# else
+#  include <time.h>
+# endif
+#endif
+
+/* Every place that used to fsync a data file after writing it now calls
+ * syncnf instead, which records the file as dirty in the notesfile's handle
+ * and then decides whether to sync now:
+ *
+ * - NEWTS_SYNC_EACH, the default, syncs after every write, as before.
+ * - NEWTS_SYNC_GROUP leaves writes unsynced for up to SYNC_INTERVAL seconds
+ *   from the first of them.  They're synced by the first write after that,
+ *   or failing that by init, when the process next uses the backend for any
+ *   notesfile.  There's no timer; a process that stops using the backend
+ *   leaves them until it lets go of the notesfile.
+ * - Between uiuc_begin_batch and uiuc_commit_batch, nothing is synced until
+ *   the commit, whatever the policy.
+ *
+ * Whatever is still dirty is synced when the last user of the notesfile lets
+ * go of it.  Text is always synced before the indexes, so a committed index
+ * entry never points at text that didn't make it to disk.  If the system goes
+ * down in the middle of a batch, index entries may point past the end of the
+ * text file; load_note already refuses to load those records, and compression
+ * drops them.  Text freed by an edit or a deletion isn't written over until
+ * the indexes that stopped pointing at it are synced; see text_free.c.
+ */
+
+static int sync_policy = NEWTS_SYNC_EACH;
+static unsigned sync_interval = 0;
+
+/* syncnf - note that FID, one of the data files of IO, has been written to,
+ * and sync it and the other data files if the policy calls for it.
+ */
+
+void
+syncnf (struct io_f *io, int fid)
+{
+  struct nf_handle *handle = io->handle;
+
+  if (handle == NULL)
+    {
+      fdatasync (fid);
+      return;
+    }
+
+  if (handle->dirty == 0)
+    time (&handle->dirtied);
+
+  if (fid == handle->fidtxt)
+    handle->dirty |= DIRTY_TEXT;
+  else if (fid == handle->fidrdx)
+    handle->dirty |= DIRTY_RESPS;
+  else if (fid == handle->fidndx)
+    handle->dirty |= DIRTY_NOTES;
+  else
+    {
+      fdatasync (fid);
+      return;
+    }
+
+  if (handle->batch > 0)
+    return;
+
+  if (sync_policy == NEWTS_SYNC_GROUP &&
+      difftime (time (NULL), handle->dirtied) < (double) sync_interval)
+    return;
+
+  flush_handle (handle);
+}
+
+/* sync_due - return TRUE if HANDLE has writes outside of a batch that the
+ * sync policy has left unsynced for as long as it allows.
+ */
+
+int
+sync_due (const struct nf_handle *handle)
+{
+  return sync_policy == NEWTS_SYNC_GROUP && handle->dirty &&
+    handle->batch == 0 &&
+    difftime (time (NULL), handle->dirtied) >= (double) sync_interval;
+}
+
+/* flush_handle - sync every dirty data file of HANDLE, text first. */
+
+void
+flush_handle (struct nf_handle *handle)
+{
+  if (handle->dirty & DIRTY_TEXT)
+    fdatasync (handle->fidtxt);
+  if (handle->dirty & DIRTY_RESPS)
+    fdatasync (handle->fidrdx);
+  if (handle->dirty & DIRTY_NOTES)
+    fdatasync (handle->fidndx);
+
+  handle->dirty = 0;
+  time (&handle->synced);
+}
+
+/* uiuc_set_sync_policy - choose when writes outside of a batch are synced.
+ * INTERVAL is only used by NEWTS_SYNC_GROUP.
+ *
+ * Returns: NEWTS_NO_ERROR, or NEWTS_INVALID_ARGUMENT if POLICY isn't one we
+ * know.
+ */
+
+int
+uiuc_set_sync_policy (int policy, unsigned interval)
+{
+  if (policy != NEWTS_SYNC_EACH && policy != NEWTS_SYNC_GROUP)
+    return NEWTS_INVALID_ARGUMENT;
+
+  sync_policy = policy;
+  sync_interval = interval;
+
+  return NEWTS_NO_ERROR;
+}
+
+/* uiuc_begin_batch - defer syncing writes to NF until the matching
+ * uiuc_commit_batch.  Batches nest.
+ */
+
+int
+uiuc_begin_batch (struct notesfile *nf)
+{
+  struct nf_handle *handle = nf->handle;
+
+  if (handle == NULL)
+    return NEWTS_NF_DOESNT_EXIST;
+
+  handle->batch++;
+
+  return NEWTS_NO_ERROR;
+}
+
+/* uiuc_commit_batch - end a batch of writes to NF, syncing them all if it is
+ * the outermost batch.
+ */
+
+int
+uiuc_commit_batch (struct notesfile *nf)
+{
+  struct nf_handle *handle = nf->handle;
+
+  if (handle == NULL)
+    return NEWTS_NF_DOESNT_EXIST;
+
+  if (handle->batch > 0 && --handle->batch == 0 && handle->dirty)
+    flush_handle (handle);
+
+  return NEWTS_NO_ERROR;
+}
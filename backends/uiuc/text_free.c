@@ -0,0 +1,441 @@
+/*
+ * text_free.c - reuse the space of text nobody refers to any more
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "uiuc-backend.h"
+
+#if TIME_WITH_SYS_TIME
+# include <sys/time.h>
+# include <time.h>
+#else
+# if HAVE_SYS_TIME_H
+#  include <sys/time.h>
+# else
+#  include <time.h>
+# endif
+#endif
+
+#if HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+/* UIUC notes only ever appends to 'text', so the text replaced by an edit or
+ * belonging to a deleted response stays in the file until the notesfile is
+ * compressed.  Newts keeps a list of those dead extents in TEXTFREE, sorted by
+ * address with neighbours merged, and puttextrec takes the smallest extent
+ * that fits before falling back to the end of the file.
+ *
+ * The list is only touched with the free pointer at the start of 'text' write
+ * locked, the same lock puttextrec already takes.  It's written back whole
+ * after every change, with a checksum in the header written last; a list that
+ * doesn't check out is thrown away, which only costs us the space until the
+ * next compression.
+ *
+ * A reader that fetched a note record just before the text moved could find
+ * somebody else's text at the old address.  Text is only freed after the
+ * record stops pointing at it, so readers either hold the record locked while
+ * they read the text, as uiuc_get_notes_range does, or look at the record
+ * again afterwards with tfree_moved and start over if it changed, as
+ * uiuc_get_note does.  Freshly freed extents also aren't handed out again for
+ * FREE_GRACE seconds, which keeps starting over rare.  Searches and the word
+ * index read text without either; the worst they can do is match or index
+ * the wrong words for a note that was edited at that moment, and the index
+ * is brought up to date by the edit anyway.
+ *
+ * Text is only handed out again once the indexes are synced, so that the
+ * record that let go of it can't come back after a crash to find it
+ * overwritten; see tfree_alloc.
+ *
+ * Text of deleted basenotes isn't freed, since directors can undelete them.
+ */
+
+#define FREE_MAGIC "NEWTSTF1"
+#define FREE_MAX   4096         /* Extents kept; the smallest go first. */
+#define FREE_GRACE 60           /* Seconds before freed text is reused. */
+
+struct free_header
+{
+  char h_magic[8];
+  long h_inode;                 /* Inode of the 'text' described. */
+  long h_count;                 /* Number of extents that follow. */
+  unsigned long h_check;        /* Checksum of the extents. */
+};
+
+struct free_f
+{
+  long f_addr;                  /* Start of the extent. */
+  unsigned long f_len;          /* Length of the extent; always even. */
+  long f_freed;                 /* When it was last added to. */
+};
+
+static int open_list (struct io_f *io);
+static long read_list (struct io_f *io, struct free_f **list);
+static void write_list (struct io_f *io, struct free_f *list, long count);
+static unsigned long checksum (struct free_f *list, long count);
+static void lock_freeptr (struct io_f *io, short type);
+
+/* tfree_alloc - find room for LENGTH bytes of text among the free extents of
+ * IO, none of which may reach past END, the end of the text in use.  On
+ * success, the address is stored in ADDR and 0 is returned; otherwise, -1.
+ * Called with the free pointer locked.
+ */
+
+int
+tfree_alloc (struct io_f *io, long end, unsigned long length, long *addr)
+{
+  struct free_f *list;
+  long count, best, i;
+  time_t now;
+
+  length += length & 1;
+  if (length == 0 || (count = read_list (io, &list)) <= 0)
+    return -1;
+
+  time (&now);
+
+  for (best = -1, i = 0; i < count; i++)
+    if (list[i].f_len >= length
+        && difftime (now, (time_t) list[i].f_freed) >= FREE_GRACE
+        && list[i].f_addr >= (long) sizeof (struct daddr_f)
+        && list[i].f_addr + (long) list[i].f_len <= end
+        && (best < 0 || list[i].f_len < list[best].f_len))
+      best = i;
+
+  if (best < 0)
+    {
+      newts_free (list);
+      return -1;
+    }
+
+  *addr = list[best].f_addr;
+
+  if (list[best].f_len == length)
+    {
+      memmove (&list[best], &list[best + 1],
+               (count - best - 1) * sizeof *list);
+      count--;
+    }
+  else
+    {
+      list[best].f_addr += (long) length;
+      list[best].f_len -= length;
+    }
+
+  write_list (io, list, count);
+  newts_free (list);
+
+  /* The record that let go of this text may not be on disk yet, whoever wrote
+   * it and whatever their sync policy.  If we wrote over the text and then
+   * crashed, the record on disk would point at somebody else's; so sync the
+   * indexes before handing it out, text first as always.
+   */
+
+  io->handle->dirty |= DIRTY_TEXT | DIRTY_RESPS | DIRTY_NOTES;
+  flush_handle (io->handle);
+
+  return 0;
+}
+
+/* tfree_moved - return TRUE if the text of response RESPNUM to note NOTENUM
+ * of IO, or of the note itself if RESPNUM is 0, is no longer at WHERE, or the
+ * note or response is gone.  Text read from WHERE before then may belong to
+ * somebody else.
+ */
+
+int
+tfree_moved (struct io_f *io, int notenum, int respnum,
+             const struct daddr_f *where)
+{
+  struct note_f note;
+  struct resp_f resp;
+  struct daddr_f *now;
+  int offset, record;
+
+  if (respnum == 0)
+    {
+      readnoterec (io, notenum, &note);
+      now = &note.n_addr;
+    }
+  else if (logical_resp (io, notenum, respnum, &resp, &offset, &record) == 0)
+    now = &resp.r_addr[offset];
+  else
+    return TRUE;
+
+  return now->addr != where->addr || now->textlen != where->textlen;
+}
+
+/* tfree_release - add the text at WHERE in IO to the free extents. */
+
+void
+tfree_release (struct io_f *io, struct daddr_f *where)
+{
+  struct free_f *list;
+  struct daddr_f freeptr;
+  unsigned long length = where->textlen + (where->textlen & 1);
+  long count, i;
+  time_t now;
+
+  if (length == 0 || where->addr < (long) sizeof (struct daddr_f) ||
+      where->addr & 1 || io->handle == NULL)
+    return;
+
+  time (&now);
+  lock_freeptr (io, F_WRLCK);
+
+  lseek (io->fidtxt, (off_t) 0, SEEK_SET);
+  if (TEMP_FAILURE_RETRY (read (io->fidtxt, &freeptr, sizeof freeptr)) !=
+      sizeof freeptr || where->addr + (long) length > freeptr.addr ||
+      (count = read_list (io, &list)) < 0)
+    {
+      lock_freeptr (io, F_UNLCK);
+      return;
+    }
+
+  /* Find the first extent after this one, and refuse anything that overlaps
+   * what we already have; it would mean somebody freed the same text twice.
+   */
+
+  for (i = 0; i < count && list[i].f_addr < where->addr; i++)
+    ;
+
+  if ((i > 0 && list[i - 1].f_addr + (long) list[i - 1].f_len > where->addr)
+      || (i < count && where->addr + (long) length > list[i].f_addr))
+    {
+      newts_free (list);
+      lock_freeptr (io, F_UNLCK);
+      return;
+    }
+
+  if (i > 0 && list[i - 1].f_addr + (long) list[i - 1].f_len == where->addr)
+    {
+      list[i - 1].f_len += length;
+      list[i - 1].f_freed = now;
+      if (i < count &&
+          list[i - 1].f_addr + (long) list[i - 1].f_len == list[i].f_addr)
+        {
+          list[i - 1].f_len += list[i].f_len;
+          memmove (&list[i], &list[i + 1], (count - i - 1) * sizeof *list);
+          count--;
+        }
+    }
+  else if (i < count && where->addr + (long) length == list[i].f_addr)
+    {
+      list[i].f_addr = where->addr;
+      list[i].f_len += length;
+      list[i].f_freed = now;
+    }
+  else
+    {
+      if (count >= FREE_MAX)
+        {
+          long smallest = 0, j;
+
+          for (j = 1; j < count; j++)
+            if (list[j].f_len < list[smallest].f_len)
+              smallest = j;
+
+          if (list[smallest].f_len >= length)
+            {
+              newts_free (list);
+              lock_freeptr (io, F_UNLCK);
+              return;
+            }
+
+          memmove (&list[smallest], &list[smallest + 1],
+                   (count - smallest - 1) * sizeof *list);
+          count--;
+          if (smallest < i)
+            i--;
+        }
+
+      list = newts_nrealloc (list, count + 1, sizeof *list);
+      memmove (&list[i + 1], &list[i], (count - i) * sizeof *list);
+      list[i].f_addr = where->addr;
+      list[i].f_len = length;
+      list[i].f_freed = now;
+      count++;
+    }
+
+  write_list (io, list, count);
+  newts_free (list);
+
+  lock_freeptr (io, F_UNLCK);
+}
+
+/* tfree_stats - store the number of bytes of text in IO, the number of those
+ * that are free, and the number of free extents in SIZE, UNUSED and EXTENTS.
+ */
+
+void
+tfree_stats (struct io_f *io, unsigned long *size, unsigned long *unused,
+             unsigned *extents)
+{
+  struct free_f *list;
+  struct daddr_f freeptr;
+  long count, i;
+
+  *size = *unused = 0;
+  *extents = 0;
+
+  lock_freeptr (io, F_RDLCK);
+
+  lseek (io->fidtxt, (off_t) 0, SEEK_SET);
+  if (TEMP_FAILURE_RETRY (read (io->fidtxt, &freeptr, sizeof freeptr)) ==
+      sizeof freeptr && freeptr.addr > (long) sizeof freeptr)
+    *size = (unsigned long) freeptr.addr - sizeof freeptr;
+
+  if ((count = read_list (io, &list)) > 0)
+    {
+      for (i = 0; i < count; i++)
+        *unused += list[i].f_len;
+      *extents = (unsigned) count;
+      newts_free (list);
+    }
+
+  lock_freeptr (io, F_UNLCK);
+}
+
+/* open_list - make sure the handle of IO has TEXTFREE open.  Returns FALSE if
+ * there's no handle or the file can't be opened.
+ */
+
+static int
+open_list (struct io_f *io)
+{
+  if (io->handle == NULL)
+    return FALSE;
+
+  if (io->handle->fidfree < 0)
+    io->handle->fidfree = open_sidecar (io->fullname, TEXTFREE);
+
+  return io->handle->fidfree >= 0;
+}
+
+/* read_list - read the free extents of IO into a newly allocated array stored
+ * in LIST.  Returns the number of extents, or -1 if there's no list to be had.
+ * An empty list leaves LIST NULL.
+ */
+
+static long
+read_list (struct io_f *io, struct free_f **list)
+{
+  struct free_header header;
+  struct stat statbuf;
+  ssize_t length;
+  int fid;
+
+  *list = NULL;
+
+  if (!open_list (io))
+    return -1;
+  fid = io->handle->fidfree;
+
+  lseek (fid, (off_t) 0, SEEK_SET);
+  if (TEMP_FAILURE_RETRY (read (fid, &header, sizeof header)) !=
+      sizeof header || fstat (io->fidtxt, &statbuf) ||
+      memcmp (header.h_magic, FREE_MAGIC, sizeof header.h_magic) ||
+      header.h_inode != (long) statbuf.st_ino ||
+      header.h_count < 0 || header.h_count > FREE_MAX)
+    return 0;
+
+  if (header.h_count == 0)
+    return 0;
+
+  *list = newts_nmalloc (header.h_count, sizeof **list);
+  length = (ssize_t) (header.h_count * sizeof **list);
+
+  if (TEMP_FAILURE_RETRY (read (fid, *list, (size_t) length)) != length ||
+      checksum (*list, header.h_count) != header.h_check)
+    {
+      newts_free (*list);
+      *list = NULL;
+      return 0;
+    }
+
+  return header.h_count;
+}
+
+/* write_list - replace the free extents of IO with the COUNT in LIST. */
+
+static void
+write_list (struct io_f *io, struct free_f *list, long count)
+{
+  struct free_header header;
+  struct stat statbuf;
+  int fid;
+
+  if (!open_list (io) || fstat (io->fidtxt, &statbuf))
+    return;
+  fid = io->handle->fidfree;
+
+  memset (&header, 0, sizeof header);
+  memcpy (header.h_magic, FREE_MAGIC, sizeof header.h_magic);
+  header.h_inode = (long) statbuf.st_ino;
+  header.h_count = count;
+  header.h_check = checksum (list, count);
+
+  lseek (fid, (off_t) sizeof header, SEEK_SET);
+  TEMP_FAILURE_RETRY (write (fid, list, count * sizeof *list));
+  ftruncate (fid, (off_t) (sizeof header + count * sizeof *list));
+
+  lseek (fid, (off_t) 0, SEEK_SET);
+  TEMP_FAILURE_RETRY (write (fid, &header, sizeof header));
+}
+
+static unsigned long
+checksum (struct free_f *list, long count)
+{
+  unsigned long sum = 0x5eed;
+  long i;
+
+  for (i = 0; i < count; i++)
+    {
+      sum = sum * 31 + (unsigned long) list[i].f_addr;
+      sum = sum * 31 + list[i].f_len;
+      sum = sum * 31 + (unsigned long) list[i].f_freed;
+    }
+
+  return sum;
+}
+
+/* lock_freeptr - lock or unlock the free pointer at the start of 'text'. */
+
+static void
+lock_freeptr (struct io_f *io, short type)
+{
+  struct flock lock;
+
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = (off_t) sizeof (struct daddr_f);
+  if (type == F_UNLCK)
+    fcntl (io->fidtxt, F_SETLK, &lock);
+  else
+    TEMP_FAILURE_RETRY (fcntl (io->fidtxt, F_SETLKW, &lock));
+}
@@ -0,0 +1,557 @@
+/*
+ * text_index.c - find notes by the words in their text
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "uiuc-backend.h"
+#include "fold.h"
+
+#if STDC_HEADERS
+# include <ctype.h>
+# include <math.h>
+#endif
+
+/* TEXTINDEX maps every word of WORD_MIN to WORD_MAX letters and digits, in
+ * lower case, to the notes and responses it occurs in and how often.  put_note,
+ * put_resp and uiuc_modify_note_text add the words of the text they write;
+ * nothing is taken out for deleted responses or replaced text, so a search
+ * checks that the words are still in the text of everything the index turns
+ * up.  Compression throws the index away and builds it again, and so does a
+ * search that finds it missing or damaged.
+ *
+ * If the index can't be used or built - say, by somebody with no write
+ * access to the notesfile - text_search_all reads all the text instead.  The
+ * index has nothing on single letters, so a search for only those reads all
+ * the text too, and otherwise they're just checked for in what the other
+ * words turn up.  Either way a word of the search only matches a whole word
+ * of the text, as it would in the index.
+ */
+
+#define WORD_MIN 2
+#define WORD_MAX 32
+
+struct word
+{
+  char text[WORD_MAX];
+  size_t length;
+};
+
+struct term
+{
+  char text[WORD_MAX + 1];
+  size_t length;
+  struct fold_needle *needle;
+  int indexed;                  /* Nonzero if it can be looked up. */
+  struct posting *postings;     /* Sorted by position. */
+  long count;
+  double weight;                /* Rarer words count for more. */
+};
+
+static int next_word (const char *text, size_t length, size_t *pos,
+                      size_t shortest, struct word *word);
+static int compare_words (const void *a, const void *b);
+static int compare_matches (const void *a, const void *b);
+static int compare_ranked (const void *a, const void *b);
+static void index_text (struct post_writer *w, struct io_f *io, int notenum,
+                        int where, struct daddr_f *daddr, char **buf,
+                        size_t *bufsize);
+static const char *text_of (struct io_f *io, struct daddr_f *daddr,
+                            long *length, char **buf, size_t *bufsize);
+static double score_text (struct term *terms, int nterms, const char *text,
+                          long length);
+static int scan_all (struct io_f *io, struct term *terms, int nterms,
+                     struct newts_match **matches);
+
+/* tindex_add - add the words of the text at DADDR, belonging to WHERE in note
+ * NOTENUM, to the full-text index of IO.
+ */
+
+void
+tindex_add (struct io_f *io, int notenum, int where, struct daddr_f *daddr)
+{
+  struct post_writer *w;
+  char *buf = NULL;
+  size_t bufsize = 0;
+
+  if ((w = post_begin (io, TEXTINDEX, FALSE)) == NULL)
+    return;
+
+  index_text (w, io, notenum, where, daddr, &buf, &bufsize);
+  post_end (w);
+
+  newts_free (buf);
+}
+
+/* tindex_rebuild - build the full-text index of IO from scratch.  Returns 0
+ * on success, or -1 if the index can't be written.
+ */
+
+int
+tindex_rebuild (struct io_f *io)
+{
+  struct post_writer *w;
+  struct note_f note;
+  struct resp_f resp;
+  struct descr_f descr;
+  char *buf = NULL;
+  size_t bufsize = 0;
+  int i, max;
+
+  if ((w = post_begin (io, TEXTINDEX, TRUE)) == NULL)
+    return -1;
+
+  readdescr (io, &descr);
+  max = getrespcount (io);
+
+  for (i = descr.d_plcy ? 0 : 1; i <= descr.d_nnote; i++)
+    {
+      int record, live, blocks, k;
+
+      readnoterec (io, i, &note);
+      if (note.n_stat & ISDELETED)
+        continue;
+
+      index_text (w, io, i, 0, &note.n_addr, &buf, &bufsize);
+
+      live = note.n_nresp;
+      for (record = note.n_rindx, blocks = 0;
+           record >= 0 && record < max && blocks < max && live > 0;
+           record = resp.r_next, blocks++)
+        {
+          readresprec (io, record, &resp);
+          for (k = 0; k < RESPSZ && live > 0; k++)
+            if ((resp.r_stat[k] & ISDELETED) == 0)
+              {
+                index_text (w, io, i, POST_RESP (record, k), &resp.r_addr[k],
+                            &buf, &bufsize);
+                live--;
+              }
+        }
+    }
+
+  post_end (w);
+  newts_free (buf);
+
+  return 0;
+}
+
+/* text_search_all - find every note and response of REF whose text contains
+ * all the words of SEARCH, ignoring case.  The matches are stored in a newly
+ * allocated array in MATCHES, in note order, or best first if FLAGS includes
+ * SEARCH_RANKED.
+ *
+ * Returns: the number of matches, -1 if the notesfile can't be opened, or -2
+ * if the caller may not read it.
+ */
+
+int
+uiuc_text_search_all (const newts_nfref *ref, const char *search, int flags,
+                      struct newts_match **matches)
+{
+  struct io_f io;
+  struct term *terms = NULL;
+  struct word word;
+  struct posting *candidates = NULL;
+  char *buf = NULL;
+  size_t bufsize = 0, pos = 0;
+  long ncandidates = 0, j;
+  int nterms = 0, nmatches = 0, rebuilt = FALSE;
+  int i, shortest = -1;
+
+  *matches = NULL;
+
+  if (init (&io, ref) != NEWTS_NO_ERROR)
+    return -1;
+
+  if (!allow (&io, READOK))
+    {
+      closenf (&io);
+      return -2;
+    }
+
+  /* Every distinct word of the search is a term. */
+
+  while (next_word (search, strlen (search), &pos, 1, &word))
+    {
+      for (i = 0; i < nterms; i++)
+        if (terms[i].length == word.length &&
+            memcmp (terms[i].text, word.text, word.length) == 0)
+          break;
+      if (i < nterms)
+        continue;
+
+      terms = newts_nrealloc (terms, nterms + 1, sizeof (struct term));
+      memcpy (terms[nterms].text, word.text, word.length);
+      terms[nterms].text[word.length] = '\0';
+      terms[nterms].length = word.length;
+      terms[nterms].needle = fold_compile (terms[nterms].text);
+      terms[nterms].indexed = word.length >= WORD_MIN;
+      terms[nterms].postings = NULL;
+      terms[nterms].count = 0;
+      terms[nterms].weight = 1.0;
+      nterms++;
+    }
+
+  if (nterms == 0)
+    {
+      closenf (&io);
+      newts_free (terms);
+      return 0;
+    }
+
+  /* Look every term up, building the index first if we have to. */
+
+  for (i = 0; i < nterms; i++)
+    {
+      if (!terms[i].indexed)
+        continue;
+
+      terms[i].count = post_lookup (&io, TEXTINDEX, terms[i].text,
+                                    terms[i].length, &terms[i].postings);
+      if (terms[i].count < 0 && !rebuilt)
+        {
+          rebuilt = TRUE;
+          if (tindex_rebuild (&io) == 0)
+            terms[i].count = post_lookup (&io, TEXTINDEX, terms[i].text,
+                                          terms[i].length,
+                                          &terms[i].postings);
+        }
+      if (terms[i].count < 0)
+        break;
+
+      terms[i].count = post_sort (terms[i].postings, terms[i].count);
+      terms[i].weight = log (1.0 + (io.descr.d_nnote + 1.0) /
+                             (terms[i].count + 1.0));
+
+      if (shortest < 0 || terms[i].count < terms[shortest].count)
+        shortest = i;
+    }
+
+  if (i < nterms || shortest < 0)
+    nmatches = scan_all (&io, terms, nterms, matches);
+  else
+    {
+      /* Only what's posted for every term we could look up can match; start
+       * with the term with the fewest postings and whittle it down.
+       */
+
+      ncandidates = terms[shortest].count;
+      if (ncandidates > 0)
+        candidates = newts_memdup (terms[shortest].postings,
+                                   ncandidates * sizeof (struct posting));
+
+      for (i = 0; i < nterms && ncandidates > 0; i++)
+        {
+          long kept = 0, k = 0;
+
+          if (i == shortest || !terms[i].indexed)
+            continue;
+
+          for (j = 0; j < ncandidates; j++)
+            {
+              while (k < terms[i].count &&
+                     post_compare (&terms[i].postings[k], &candidates[j]) < 0)
+                k++;
+              if (k < terms[i].count &&
+                  post_compare (&terms[i].postings[k], &candidates[j]) == 0)
+                candidates[kept++] = candidates[j];
+            }
+          ncandidates = kept;
+        }
+
+      /* Check each candidate against what's actually there now. */
+
+      for (j = 0; j < ncandidates; j++)
+        {
+          struct note_f note;
+          struct resp_f resp;
+          struct daddr_f *daddr;
+          const char *text;
+          long length;
+          double score;
+          int respnum;
+
+          if (post_resolve (&io, &candidates[j], &note, &resp, &respnum) != 0)
+            continue;
+
+          daddr = candidates[j].p_where == 0 ? &note.n_addr :
+            &resp.r_addr[POST_SLOT (candidates[j].p_where)];
+          if ((text = text_of (&io, daddr, &length, &buf, &bufsize)) == NULL
+              || (score = score_text (terms, nterms, text, length)) <= 0)
+            continue;
+
+          *matches = newts_nrealloc (*matches, nmatches + 1,
+                                     sizeof (struct newts_match));
+          (*matches)[nmatches].notenum = candidates[j].p_note;
+          (*matches)[nmatches].respnum = respnum;
+          (*matches)[nmatches].score = score;
+          nmatches++;
+        }
+    }
+
+  if (nmatches > 1)
+    qsort (*matches, (size_t) nmatches, sizeof (struct newts_match),
+           flags & SEARCH_RANKED ? compare_ranked : compare_matches);
+
+  for (i = 0; i < nterms; i++)
+    {
+      fold_free (terms[i].needle);
+      newts_free (terms[i].postings);
+    }
+  newts_free (terms);
+  newts_free (candidates);
+  newts_free (buf);
+
+  closenf (&io);
+  return nmatches;
+}
+
+/* next_word - find the next word in the LENGTH characters of TEXT, starting
+ * at POS, and store it in WORD, folded to lower case.  Words shorter than
+ * SHORTEST or longer than WORD_MAX are skipped.  Returns FALSE when there are
+ * no more words.
+ */
+
+static int
+next_word (const char *text, size_t length, size_t *pos, size_t shortest,
+           struct word *word)
+{
+  while (*pos < length)
+    {
+      size_t start;
+
+      while (*pos < length && !isalnum ((unsigned char) text[*pos]))
+        ++*pos;
+
+      start = *pos;
+      while (*pos < length && isalnum ((unsigned char) text[*pos]))
+        ++*pos;
+
+      word->length = *pos - start;
+      if (word->length >= shortest && word->length <= WORD_MAX)
+        {
+          size_t i;
+
+          for (i = 0; i < word->length; i++)
+            word->text[i] = (char) tolower ((unsigned char) text[start + i]);
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+static int
+compare_words (const void *a, const void *b)
+{
+  const struct word *x = a, *y = b;
+  size_t length = x->length < y->length ? x->length : y->length;
+  int result = memcmp (x->text, y->text, length);
+
+  if (result != 0)
+    return result;
+  return (x->length > y->length) - (x->length < y->length);
+}
+
+static int
+compare_matches (const void *a, const void *b)
+{
+  const struct newts_match *x = a, *y = b;
+
+  if (x->notenum != y->notenum)
+    return x->notenum < y->notenum ? -1 : 1;
+  return (x->respnum > y->respnum) - (x->respnum < y->respnum);
+}
+
+static int
+compare_ranked (const void *a, const void *b)
+{
+  const struct newts_match *x = a, *y = b;
+
+  if (x->score != y->score)
+    return x->score > y->score ? -1 : 1;
+  return compare_matches (a, b);
+}
+
+/* index_text - add the words of the text at DADDR in IO, belonging to WHERE
+ * in note NOTENUM, to W.  BUF and BUFSIZE are as for text_of.
+ */
+
+static void
+index_text (struct post_writer *w, struct io_f *io, int notenum, int where,
+            struct daddr_f *daddr, char **buf, size_t *bufsize)
+{
+  struct word *words = NULL;
+  const char *text;
+  long length;
+  size_t pos = 0, count = 0, size = 0, i, run;
+
+  if ((text = text_of (io, daddr, &length, buf, bufsize)) == NULL)
+    return;
+
+  for (;;)
+    {
+      if (count == size)
+        {
+          size = size ? size * 2 : 256;
+          words = newts_nrealloc (words, size, sizeof (struct word));
+        }
+      if (!next_word (text, (size_t) length, &pos, WORD_MIN, &words[count]))
+        break;
+      count++;
+    }
+
+  /* Post every distinct word once, with the number of times it occurs. */
+
+  qsort (words, count, sizeof (struct word), compare_words);
+  for (i = 0; i < count; i += run)
+    {
+      for (run = 1; i + run < count &&
+             compare_words (&words[i], &words[i + run]) == 0; run++)
+        ;
+      post_add (w, words[i].text, words[i].length, notenum, where,
+                (int) run);
+    }
+
+  newts_free (words);
+}
+
+/* text_of - return the text at DADDR in IO and store its length in LENGTH.
+ * If the text isn't mapped, it's read into BUF, which holds BUFSIZE
+ * characters and is grown as needed.  Returns NULL if there's no text.
+ */
+
+static const char *
+text_of (struct io_f *io, struct daddr_f *daddr, long *length, char **buf,
+         size_t *bufsize)
+{
+  const char *text;
+
+  if (daddr->addr == 0 || daddr->textlen == 0 || daddr->textlen > HARDMAX)
+    return NULL;
+
+  *length = (long) daddr->textlen;
+  if ((text = maptextrec (io, daddr)) != NULL)
+    return text;
+
+  if (*bufsize < daddr->textlen + 1)
+    {
+      *bufsize = daddr->textlen + 1;
+      *buf = newts_nrealloc (*buf, *bufsize, sizeof (char));
+    }
+
+  *length = gettextrec (io, daddr, *buf);
+  return *length > 0 ? *buf : NULL;
+}
+
+/* score_text - return how well the LENGTH characters of TEXT match the NTERMS
+ * TERMS, or 0 if any of them is missing.  Only whole words count.
+ */
+
+static double
+score_text (struct term *terms, int nterms, const char *text, long length)
+{
+  double score = 0;
+  int i;
+
+  for (i = 0; i < nterms; i++)
+    {
+      const char *p = text;
+      const char *end = text + length;
+      int count = 0;
+
+      while ((p = fold_search (terms[i].needle, p, (size_t) (end - p)))
+             != NULL)
+        {
+          if ((p > text && isalnum ((unsigned char) p[-1])) ||
+              (p + terms[i].length < end &&
+               isalnum ((unsigned char) p[terms[i].length])))
+            {
+              p++;
+              continue;
+            }
+
+          count++;
+          p += terms[i].length;
+        }
+
+      if (count == 0)
+        return 0;
+
+      score += terms[i].weight * (1.0 + log ((double) count));
+    }
+
+  return score;
+}
+
+/* scan_all - find the matches for the NTERMS TERMS the slow way, reading all
+ * the text of IO, and store them in MATCHES.  Returns the number found.
+ */
+
+static int
+scan_all (struct io_f *io, struct term *terms, int nterms,
+          struct newts_match **matches)
+{
+  struct note_f note;
+  struct resp_f resp;
+  char *buf = NULL;
+  size_t bufsize = 0;
+  const char *text;
+  long length;
+  double score;
+  int nmatches = 0;
+  int i, j, offset, record;
+
+  for (i = 1; i <= io->descr.d_nnote; i++)
+    {
+      readnoterec (io, i, &note);
+      if (note.n_stat & ISDELETED)
+        continue;
+
+      for (j = 0; j <= note.n_nresp; j++)
+        {
+          struct daddr_f *daddr = &note.n_addr;
+
+          if (j > 0)
+            {
+              if (logical_resp (io, i, j, &resp, &offset, &record) == -1)
+                break;
+              daddr = &resp.r_addr[offset];
+            }
+
+          if ((text = text_of (io, daddr, &length, &buf, &bufsize)) == NULL
+              || (score = score_text (terms, nterms, text, length)) <= 0)
+            continue;
+
+          *matches = newts_nrealloc (*matches, nmatches + 1,
+                                     sizeof (struct newts_match));
+          (*matches)[nmatches].notenum = i;
+          (*matches)[nmatches].respnum = j;
+          (*matches)[nmatches].score = score;
+          nmatches++;
+        }
+    }
+
+  newts_free (buf);
+  return nmatches;
+}
@@ -1,5 +1,5 @@
 /*
- * title_search.c - search for words in a note's title string
+ * text_search.c - search for a string in the text of notes and responses
  *
  * This file is part of the Newts notesfiles system.
  * Copyright (C) 2003, 2004, 2005 Tyler Berry
@@ -25,13 +25,16 @@
 
 #include "uiuc-backend.h"
 
-#if STDC_HEADERS
-# include <ctype.h>
-#endif
+#include "fold.h"
 
-#if HAVE_FCNTL_H
-# include <fcntl.h>
-#endif
+static int search_text (struct io_f *io, const struct fold_needle *needle,
+                        struct daddr_f *where, char **buf, size_t *bufsize);
+
+/* text_search - search backwards from the note or response NRP for one whose
+ * text contains STRING, ignoring case.  NRP is left pointing at the match.
+ *
+ * Returns: the number of the note that matched, or -1 if none did.
+ */
 
 int
 uiuc_text_search (struct newtref *nrp, const char *string)
@@ -39,37 +42,28 @@ uiuc_text_search (struct newtref *nrp, const char *string)
   struct io_f io;
   struct note_f note;
   struct resp_f resp;
-  struct flock nlock, tlock;
-  size_t notelen, searchlen = 0;
-  char *xstring = newts_strdup (string);
+  struct fold_needle *needle;
   char *text = NULL;
-  register int i;
+  size_t textsize = 0;
   int offset, record;
 
-  /* FIXME: switch to using a replacement function for strcasestr (which I'll
-   * have to write).
-   */
+  if (init (&io, &nrp->nfr) != NEWTS_NO_ERROR)
+    return -1;
 
-  init (&io, &nrp->nfr);
+  needle = fold_compile (string);
 
   if (nrp->notenum > io.descr.d_nnote)
     nrp->notenum = io.descr.d_nnote;
 
-
-  if (nrp->respnum != 0)
-    goto inloop;
+  if (nrp->respnum != 0 && nrp->notenum > 0)
+    {
+      readnoterec (&io, nrp->notenum, &note);
+      goto inloop;
+    }
 
   while (nrp->notenum > 0)
     {
-      nlock.l_type = F_RDLCK;
-      nlock.l_start = (off_t) (sizeof (struct descr_f) +
-                              (nrp->notenum * sizeof (struct note_f)));
-      TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &nlock));
-
-      getnoterec (&io, nrp->notenum, &note);
-
-      nlock.l_type = F_UNLCK;
-      fcntl (io.fidndx, F_SETLK, &nlock);
+      readnoterec (&io, nrp->notenum, &note);
 
       if (note.n_stat & ISDELETED)
         {
@@ -77,43 +71,13 @@ uiuc_text_search (struct newtref *nrp, const char *string)
           continue;
         }
 
-      text = newts_nrealloc (text, note.n_addr.textlen + 1, sizeof (char));
-
-      tlock.l_type = F_RDLCK;
-      tlock.l_whence = SEEK_SET;
-      tlock.l_start = (off_t) note.n_addr.addr;
-      tlock.l_len = (off_t) note.n_addr.textlen;
-      TEMP_FAILURE_RETRY (fcntl (io.fidtxt, F_SETLKW, &tlock));
-
-      lseek (io.fidtxt, (off_t) note.n_addr.addr, SEEK_SET);
-      TEMP_FAILURE_RETRY (read (io.fidtxt, text, note.n_addr.textlen));
-      text[note.n_addr.textlen] = '\0';
-
-      tlock.l_type = F_UNLCK;
-      fcntl (io.fidtxt, F_SETLK, &tlock);
-
-      searchlen = strlen (xstring);
-      notelen = strlen (text);
-
-      for (i=0; i < notelen + 1 - searchlen; i++)
-        {
-          if (strncasecmp (xstring, text + i, (size_t) searchlen) == 0)
-            {
-              closenf (&io);
-              newts_free (xstring);
-              newts_free (text);
-              return nrp->notenum;
-            }
-        }
-
-#if 0
-      if (strcasestr (text, xstring) != NULL)
+      if (search_text (&io, needle, &note.n_addr, &text, &textsize))
         {
           closenf (&io);
-          newts_free (xstring);
+          fold_free (needle);
+          newts_free (text);
           return nrp->notenum;
         }
-#endif
 
       nrp->respnum = 1;
 
@@ -126,33 +90,13 @@ uiuc_text_search (struct newtref *nrp, const char *string)
               == -1)
             break;
 
-          text = newts_nrealloc (text, resp.r_addr[offset].textlen + 1,
-                                 sizeof (char));
-
-          tlock.l_type = F_RDLCK;
-          tlock.l_whence = SEEK_SET;
-          tlock.l_start = (off_t) resp.r_addr[offset].addr;
-          tlock.l_len = (off_t) resp.r_addr[offset].textlen;
-          TEMP_FAILURE_RETRY (fcntl (io.fidtxt, F_SETLKW, &tlock));
-
-          lseek (io.fidtxt, (off_t) resp.r_addr[offset].addr, SEEK_SET);
-          TEMP_FAILURE_RETRY (read (io.fidtxt, text, resp.r_addr[offset].textlen));
-          text[resp.r_addr[offset].textlen] = '\0';
-
-          tlock.l_type = F_UNLCK;
-          fcntl (io.fidtxt, F_SETLK, &tlock);
-
-          notelen = strlen (text);
-
-          for (i=0; i < notelen + 1 - searchlen; i++)
+          if (search_text (&io, needle, &resp.r_addr[offset], &text,
+                           &textsize))
             {
-              if (strncasecmp (xstring, text + i, (size_t) searchlen) == 0)
-                {
-                  closenf (&io);
-                  newts_free (xstring);
-                  newts_free (text);
-                  return nrp->notenum;
-                }
+              closenf (&io);
+              fold_free (needle);
+              newts_free (text);
+              return nrp->notenum;
             }
 
           nrp->respnum++;
@@ -163,7 +107,37 @@ uiuc_text_search (struct newtref *nrp, const char *string)
     }
 
   closenf (&io);
-  newts_free (xstring);
+  fold_free (needle);
   newts_free (text);
   return -1;
 }
+
+/* search_text - return TRUE if the text at WHERE in IO contains NEEDLE.  The
+ * text is searched where it's mapped if it is, and otherwise read into BUF,
+ * which holds BUFSIZE characters and is grown as needed.
+ */
+
+static int
+search_text (struct io_f *io, const struct fold_needle *needle,
+             struct daddr_f *where, char **buf, size_t *bufsize)
+{
+  const char *text;
+  long length = (long) where->textlen;
+
+  if (where->textlen == 0 || where->textlen > HARDMAX)
+    return FALSE;
+
+  if ((text = maptextrec (io, where)) == NULL)
+    {
+      if (*bufsize < where->textlen + 1)
+        {
+          *bufsize = where->textlen + 1;
+          *buf = newts_nrealloc (*buf, *bufsize, sizeof (char));
+        }
+
+      length = gettextrec (io, where, *buf);
+      text = *buf;
+    }
+
+  return length > 0 && fold_search (needle, text, (size_t) length) != NULL;
+}
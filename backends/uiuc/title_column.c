@@ -0,0 +1,289 @@
+/*
+ * title_column.c - the titles of every note, packed together
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "uiuc-backend.h"
+
+#if STDC_HEADERS
+# include <ctype.h>
+#endif
+
+#if HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#if HAVE_MMAP
+# include <sys/mman.h>
+#endif
+
+/* TITLECOL holds the title of every note, from the policy note on, in lower
+ * case and padded with NULs to TITLEN characters, so that a title search
+ * reads TITLEN bytes per note instead of a whole note record.  Every title
+ * ends in a NUL, so nothing without one can match across two titles, and
+ * the column can be searched as a single string.
+ *
+ * put_note appends the title of each new note, and uiuc_modify_note rewrites
+ * it in place, both while they hold the note's record lock.  A writer that
+ * finds the column short of the note it wrote leaves it alone; the next
+ * search reads the missing titles from the note records.  Searches check
+ * every title they find against its note record, so a title that was never
+ * brought up to date can't produce a false match.
+ *
+ * Like the postings files, the header records the inode of 'note.indx', so
+ * a column left over from before a compression isn't used.
+ */
+
+#define TCOL_MAGIC "NEWTSTC1"
+#define TCOL_BATCH 1024         /* Titles read per write while catching up. */
+
+struct tcol_header
+{
+  char h_magic[8];
+  long h_inode;                 /* Inode of 'note.indx' when built. */
+};
+
+static int check_header (int fid, struct io_f *io, int create);
+static int covered (int fid);
+static void catch_up (int fid, struct io_f *io, int from, int to);
+static void fold_title (char *column, const char *title);
+static void lock_header (int fid, short type);
+
+/* tcol_put - record TITLE as the title of note NOTENUM in the title column
+ * of IO.  The caller holds the note's record lock.
+ */
+
+void
+tcol_put (struct io_f *io, int notenum, const char *title)
+{
+  char column[TITLEN];
+  int fid;
+
+  if (io->handle == NULL || (fid = open_sidecar (io->fullname, TITLECOL)) < 0)
+    return;
+
+  lock_header (fid, F_WRLCK);
+
+  if (check_header (fid, io, FALSE) == 0 && notenum <= covered (fid))
+    {
+      fold_title (column, title);
+      lseek (fid, (off_t) (sizeof (struct tcol_header) +
+                           (size_t) notenum * TITLEN), SEEK_SET);
+      TEMP_FAILURE_RETRY (write (fid, column, TITLEN));
+    }
+
+  lock_header (fid, F_UNLCK);
+  TEMP_FAILURE_RETRY (close (fid));
+}
+
+/* tcol_open - bring the title column of IO up to date and map it into COL.
+ * Returns 0, or -1 if it can't be used.
+ */
+
+int
+tcol_open (struct io_f *io, struct title_column *col)
+{
+#if HAVE_MMAP
+  struct descr_f descr;
+  short type = F_RDLCK;
+  int fid, count;
+  void *base;
+
+  memset (col, 0, sizeof (struct title_column));
+
+  if (io->handle == NULL || (fid = open_sidecar (io->fullname, TITLECOL)) < 0)
+    return -1;
+
+  /* Usually it's up to date, and a read lock will do.  Otherwise, start over
+   * with a write lock and fill in what's missing.
+   */
+
+  for (;;)
+    {
+      lock_header (fid, type);
+      readdescr (io, &descr);
+
+      count = -1;
+      if (check_header (fid, io, type == F_WRLCK) == 0)
+        count = covered (fid);
+      if (count > descr.d_nnote || type == F_WRLCK)
+        break;
+
+      lock_header (fid, F_UNLCK);
+      type = F_WRLCK;
+    }
+
+  if (count >= 0 && count <= descr.d_nnote)
+    {
+      catch_up (fid, io, count, descr.d_nnote);
+      count = covered (fid);
+    }
+
+  lock_header (fid, F_UNLCK);
+
+  if (count <= 0)
+    {
+      TEMP_FAILURE_RETRY (close (fid));
+      return -1;
+    }
+
+  col->size = sizeof (struct tcol_header) + (size_t) count * TITLEN;
+  base = mmap (NULL, col->size, PROT_READ, MAP_SHARED, fid, (off_t) 0);
+  TEMP_FAILURE_RETRY (close (fid));
+
+  if (base == MAP_FAILED)
+    return -1;
+
+  col->base = base;
+  col->titles = col->base + sizeof (struct tcol_header);
+  col->count = count;
+
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+/* tcol_close - let go of the title column mapped by tcol_open. */
+
+void
+tcol_close (struct title_column *col)
+{
+#if HAVE_MMAP
+  if (col->base != NULL)
+    munmap (col->base, col->size);
+#endif
+  col->base = NULL;
+}
+
+/* check_header - check that the title column FID is usable with IO.  If it
+ * isn't and CREATE is nonzero, it's emptied.  Returns 0 if it's usable, or
+ * -1.
+ */
+
+static int
+check_header (int fid, struct io_f *io, int create)
+{
+  struct tcol_header header;
+  struct stat statbuf;
+
+  if (fstat (io->fidndx, &statbuf))
+    return -1;
+
+  lseek (fid, (off_t) 0, SEEK_SET);
+  if (TEMP_FAILURE_RETRY (read (fid, &header, sizeof header)) ==
+      sizeof header &&
+      memcmp (header.h_magic, TCOL_MAGIC, sizeof header.h_magic) == 0 &&
+      header.h_inode == (long) statbuf.st_ino)
+    return 0;
+
+  if (!create)
+    return -1;
+
+  ftruncate (fid, (off_t) 0);
+  memset (&header, 0, sizeof header);
+  memcpy (header.h_magic, TCOL_MAGIC, sizeof header.h_magic);
+  header.h_inode = (long) statbuf.st_ino;
+  lseek (fid, (off_t) 0, SEEK_SET);
+  TEMP_FAILURE_RETRY (write (fid, &header, sizeof header));
+
+  return 0;
+}
+
+/* covered - return the number of titles in the title column FID. */
+
+static int
+covered (int fid)
+{
+  struct stat statbuf;
+
+  if (fstat (fid, &statbuf) ||
+      statbuf.st_size < (off_t) sizeof (struct tcol_header))
+    return -1;
+
+  return (int) ((statbuf.st_size - sizeof (struct tcol_header)) / TITLEN);
+}
+
+/* catch_up - fill in the titles of notes FROM through TO in the title column
+ * FID, from the note records of IO.
+ */
+
+static void
+catch_up (int fid, struct io_f *io, int from, int to)
+{
+  struct note_f note;
+  char *batch = newts_nmalloc (TCOL_BATCH, TITLEN);
+  int i, n = 0;
+
+  ftruncate (fid, (off_t) (sizeof (struct tcol_header) +
+                           (size_t) from * TITLEN));
+  lseek (fid, (off_t) 0, SEEK_END);
+
+  for (i = from; i <= to; i++)
+    {
+      readnoterec (io, i, &note);
+      fold_title (batch + n * TITLEN, note.ntitle);
+      if (++n == TCOL_BATCH || i == to)
+        {
+          TEMP_FAILURE_RETRY (write (fid, batch, (size_t) n * TITLEN));
+          n = 0;
+        }
+    }
+
+  newts_free (batch);
+}
+
+/* fold_title - store TITLE, of at most TITLEN characters, in lower case in
+ * the TITLEN characters of COLUMN, padded with NULs.
+ */
+
+static void
+fold_title (char *column, const char *title)
+{
+  int i;
+
+  for (i = 0; i < TITLEN - 1 && title[i] != '\0'; i++)
+    column[i] = (char) tolower ((unsigned char) title[i]);
+  memset (column + i, 0, (size_t) (TITLEN - i));
+}
+
+/* lock_header - lock or unlock the header of the title column FID. */
+
+static void
+lock_header (int fid, short type)
+{
+  struct flock lock;
+
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = 0;
+  lock.l_len = (off_t) sizeof (struct tcol_header);
+  if (type == F_UNLCK)
+    fcntl (fid, F_SETLK, &lock);
+  else
+    TEMP_FAILURE_RETRY (fcntl (fid, F_SETLKW, &lock));
+}
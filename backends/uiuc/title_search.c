@@ -28,57 +28,214 @@
 #endif
 
 #include "uiuc-backend.h"
+#include "fold.h"
 
-#if STDC_HEADERS
-# include <ctype.h>
-#endif
+/* Titles are searched in the title column where there is one, a chunk of
+ * CHUNK titles at a time, with fold_search picking out the candidates; each
+ * candidate is then checked against its note record.  Without the column,
+ * every note record is read in turn.
+ */
 
-#if HAVE_FCNTL_H
-# include <fcntl.h>
-#endif
+#define CHUNK 1024
+
+static int next_hit (struct title_column *col, struct fold_needle *needle,
+                     int from, int to);
+static int title_matches (struct io_f *io, int notenum,
+                          struct fold_needle *needle);
+static int add_match (struct newts_match **matches, int nmatches,
+                      int notenum);
+
+/* title_search - search backwards from the note in NRP for a note whose
+ * title contains STRING, ignoring case.  Returns the number of the note
+ * found, which is also stored in NRP, or -1 if there's none.
+ */
 
 int
 uiuc_title_search (struct newtref *nrp, const char *string)
 {
   struct io_f io;
-  struct note_f note;
-  struct flock lock;
-  register int i, length;
+  struct title_column col;
+  struct fold_needle *needle;
+  register int length;
 
   init (&io, &nrp->nfr);
-  strncpy (io.xstring, string, TITLEN + 1);
+  strncpy (io.xstring, string, TITLEN);
+  io.xstring[TITLEN] = '\0';
 
-  length = strlen (io.xstring) > TITLEN ? TITLEN : strlen (io.xstring);
+  length = strlen (io.xstring);
 
   if (nrp->notenum > io.descr.d_nnote)
     nrp->notenum = io.descr.d_nnote;
 
-  lock.l_whence = SEEK_SET;
-  lock.l_len = (off_t) sizeof (struct note_f);
+  if (length == 0)
+    {
+      closenf (&io);
+      return nrp->notenum > 0 ? nrp->notenum : -1;
+    }
 
-  while (nrp->notenum > 0)
+  needle = fold_compile (io.xstring);
+
+  if (tcol_open (&io, &col) == 0)
     {
-      lock.l_type = F_RDLCK;
-      lock.l_start = (off_t) (sizeof (struct descr_f) +
-                              (nrp->notenum * sizeof (struct note_f)));
-      TEMP_FAILURE_RETRY (fcntl (io.fidndx, F_SETLKW, &lock));
+      int hits[CHUNK];
+      int start, end, nhits, hit;
 
-      getnoterec (&io, nrp->notenum, &note);
+      /* Anything newer than the column has to be read from its record. */
 
-      lock.l_type = F_UNLCK;
-      fcntl (io.fidndx, F_SETLK, &lock);
+      for (; nrp->notenum >= col.count; nrp->notenum--)
+        if (title_matches (&io, nrp->notenum, needle))
+          goto found;
 
-      for (i=0; i < TITLEN + 1 - length; i++)
+      for (end = nrp->notenum; end > 0; end = start - 1)
         {
-          if (strncasecmp (io.xstring, note.ntitle + i, (size_t) length) == 0)
-            {
-              closenf (&io);
-              return nrp->notenum;
-            }
+          start = end >= CHUNK ? end - CHUNK + 1 : 1;
+
+          nhits = 0;
+          for (hit = next_hit (&col, needle, start, end); hit >= 0;
+               hit = next_hit (&col, needle, hit + 1, end))
+            hits[nhits++] = hit;
+
+          while (nhits > 0)
+            if (title_matches (&io, nrp->notenum = hits[--nhits], needle))
+              goto found;
+        }
+
+      tcol_close (&col);
+      fold_free (needle);
+      closenf (&io);
+      return -1;
+
+    found:
+      tcol_close (&col);
+      fold_free (needle);
+      closenf (&io);
+      return nrp->notenum;
+    }
+
+  while (nrp->notenum > 0)
+    {
+      if (title_matches (&io, nrp->notenum, needle))
+        {
+          fold_free (needle);
+          closenf (&io);
+          return nrp->notenum;
         }
       nrp->notenum--;
     }
 
+  fold_free (needle);
   closenf (&io);
   return -1;
 }
+
+/* title_search_all - find every basenote of REF whose title contains STRING,
+ * ignoring case.  The matches are stored in a newly allocated array in
+ * MATCHES, in note order.
+ *
+ * Returns: the number of matches, -1 if the notesfile can't be opened, or -2
+ * if the caller may not read it.
+ */
+
+int
+uiuc_title_search_all (const newts_nfref *ref, const char *string,
+                       struct newts_match **matches)
+{
+  struct io_f io;
+  struct title_column col;
+  struct fold_needle *needle;
+  char search[TITLEN + 1];
+  int nmatches = 0;
+  int i, last;
+
+  *matches = NULL;
+
+  if (init (&io, ref) != NEWTS_NO_ERROR)
+    return -1;
+
+  if (!allow (&io, READOK))
+    {
+      closenf (&io);
+      return -2;
+    }
+
+  strncpy (search, string, TITLEN);
+  search[TITLEN] = '\0';
+  needle = fold_compile (search);
+
+  if (tcol_open (&io, &col) == 0)
+    {
+      last = col.count - 1 < io.descr.d_nnote ? col.count - 1 :
+        io.descr.d_nnote;
+      for (i = next_hit (&col, needle, 1, last); i >= 0;
+           i = next_hit (&col, needle, i + 1, last))
+        if (title_matches (&io, i, needle))
+          nmatches = add_match (matches, nmatches, i);
+      tcol_close (&col);
+    }
+  else
+    last = 0;
+
+  for (i = last + 1; i <= io.descr.d_nnote; i++)
+    if (title_matches (&io, i, needle))
+      nmatches = add_match (matches, nmatches, i);
+
+  fold_free (needle);
+  closenf (&io);
+
+  return nmatches;
+}
+
+/* next_hit - return the first note from FROM through TO whose title in COL
+ * contains NEEDLE, or -1 if there's none.
+ */
+
+static int
+next_hit (struct title_column *col, struct fold_needle *needle, int from,
+          int to)
+{
+  const char *start, *hit;
+
+  if (from > to)
+    return -1;
+
+  start = col->titles + (size_t) from * TITLEN;
+  hit = fold_search (needle, start, (size_t) (to - from + 1) * TITLEN);
+
+  return hit != NULL ? (int) ((hit - col->titles) / TITLEN) : -1;
+}
+
+/* title_matches - return TRUE if note NOTENUM of IO is still there and its
+ * title contains NEEDLE.
+ */
+
+static int
+title_matches (struct io_f *io, int notenum, struct fold_needle *needle)
+{
+  struct note_f note;
+  size_t length;
+
+  readnoterec (io, notenum, &note);
+  if (note.n_stat & ISDELETED)
+    return FALSE;
+
+  for (length = 0; length < TITLEN && note.ntitle[length] != '\0'; length++)
+    ;
+
+  return fold_search (needle, note.ntitle, length) != NULL;
+}
+
+/* add_match - append basenote NOTENUM to the NMATCHES MATCHES, and return the
+ * new number of matches.
+ */
+
+static int
+add_match (struct newts_match **matches, int nmatches, int notenum)
+{
+  *matches = newts_nrealloc (*matches, nmatches + 1,
+                             sizeof (struct newts_match));
+  (*matches)[nmatches].notenum = notenum;
+  (*matches)[nmatches].respnum = 0;
+  (*matches)[nmatches].score = 1.0;
+
+  return nmatches + 1;
+}
@@ -31,10 +31,27 @@
 #include "misc.h"
 #include "access.h"
 #include "disk.h"
+#include "sidecar.h"
 
+/* What lock_current returns when an online compression swapped the files
+ * while we waited for a lock, and a write has to start again.
+ */
+
+#define SWAPPED 1
+
+struct flock;
+
+extern int decode_note (struct io_f *io, struct note_f *note,
+                        struct newt *newtp, struct daddr_f *daddr,
+                        off_t textsize, time_t now);
+extern int decode_resp (struct io_f *io, struct note_f *note,
+                        struct resp_f *resp, int offset, struct newt *newtp,
+                        struct daddr_f *daddr, off_t textsize, time_t now);
 extern void get_uiuc_time (struct when_f *when, time_t t);
 extern int load_note (struct newt *newtp, struct daddr_f *daddr,
                       short updatestats);
+extern int lock_current (struct io_f *io, const newts_nfref *ref,
+                         struct flock *lock, struct newtref *nr);
 extern int logical_resp (struct io_f *iop, int notenum, int respnum,
                          struct resp_f *resp, int *offset, int *record);
 extern int put_note (struct io_f *io, struct daddr_f *where, struct newt *newt,
@@ -52,7 +52,7 @@
 # endif
 #endif
 
-static int get_new_resp_block (struct io_f *iop);
+static int get_new_resp_block (struct io_f *iop, int notenum, int seq);
 
 /* write_note - the master entrypoint for adding notes and responses to the
  * database; for UIUC this is rather complicated because of the bizarre
@@ -78,7 +78,7 @@ uiuc_write_note (struct notesfile *nf, struct newt *newt, int flags)
   int result;
   int error;
 
-  if (newt->nr.notenum < -1 || newt->nr.notenum > nf->total_notes)
+  if (newt->nr.notenum < -1 || newt->nr.notenum > (int) nf->total_notes)
     return -1;
 
   flags &= ~SKIP_MODERATION;  /* Not allowed via the public interface. */
@@ -227,6 +227,15 @@ put_note (struct io_f *io, struct daddr_f *where, struct newt *newt, int flags)
 
   getdescr (io, &io->descr);
 
+  /* An online compression may have swapped the files while we waited. */
+
+  if (io->descr.d_stat & NFINVALID)
+    {
+      dlock.l_type = F_UNLCK;
+      fcntl (io->fidndx, F_SETLK, &dlock);
+      return -1;
+    }
+
   /* If specified, generate a new ID for the note.  Otherwise, use the already
    * existing ID.
    */
@@ -282,6 +291,7 @@ put_note (struct io_f *io, struct daddr_f *where, struct newt *newt, int flags)
   TEMP_FAILURE_RETRY (fcntl (io->fidndx, F_SETLKW, &dlock));
 
   putnoterec (io, notenum, &note);
+  tcol_put (io, notenum, note.ntitle);
 
   nlock.l_type = F_UNLCK;
   fcntl (io->fidndx, F_SETLK, &nlock);
@@ -290,10 +300,14 @@ put_note (struct io_f *io, struct daddr_f *where, struct newt *newt, int flags)
 
   putdescr (io, &io->descr);
 
-  fdatasync (io->fidndx);
+  syncnf (io, io->fidndx);
   dlock.l_type = F_UNLCK;
   fcntl (io->fidndx, F_SETLK, &dlock);
 
+  tindex_add (io, notenum, 0, where);
+  aindex_add (io, notenum, 0, note.n_auth.aname, note.n_id.sys);
+  clog_add (io, notenum, 0, convert_time (&note.n_date), &note.n_auth);
+
   return notenum;
 }
 
@@ -303,7 +317,7 @@ put_resp (struct io_f *io, struct daddr_f *where, struct newt *newt, int flags)
   struct note_f note;
   struct resp_f resp;
   struct flock dlock, nlock, rlock;
-  int lastin, phys, i;
+  int lastin, phys, first, seq, i;
 
   rlock.l_whence = SEEK_SET;
 
@@ -314,11 +328,22 @@ put_resp (struct io_f *io, struct daddr_f *where, struct newt *newt, int flags)
   nlock.l_len = (off_t) sizeof (struct note_f);
   TEMP_FAILURE_RETRY (fcntl (io->fidndx, F_SETLKW, &nlock));
 
+  /* An online compression may have swapped the files while we waited. */
+
+  readdescr (io, &io->descr);
+  if (io->descr.d_stat & NFINVALID)
+    {
+      nlock.l_type = F_UNLCK;
+      fcntl (io->fidndx, F_SETLK, &nlock);
+      return -1;
+    }
+
   getnoterec (io, newt->nr.notenum, &note);
 
   if (note.n_rindx < 0)
     {
-      lastin = note.n_rindx = get_new_resp_block (io);
+      lastin = note.n_rindx = get_new_resp_block (io, newt->nr.notenum, 0);
+      first = seq = 0;
       resp.r_first = 1;
       resp.r_last = 0;
       resp.r_previous = -1;
@@ -326,8 +351,16 @@ put_resp (struct io_f *io, struct daddr_f *where, struct newt *newt, int flags)
       for (i=0; i<RESPSZ; i++)
         resp.r_stat[i] = 0;
     }
+  else if (rpos_last_block (io, newt->nr.notenum, &note, &resp, &lastin,
+                            &seq) == 0)
+    {
+      /* Every block before the last is full, so we can start there. */
+
+      first = resp.r_first - 1;
+    }
   else
     {
+      first = seq = 0;
       rlock.l_type = F_RDLCK;
       rlock.l_start = (off_t) (sizeof (int) +
                                (note.n_rindx * sizeof (struct resp_f)));
@@ -340,7 +373,8 @@ put_resp (struct io_f *io, struct daddr_f *where, struct newt *newt, int flags)
       fcntl (io->fidrdx, F_SETLK, &rlock);
     }
 
-  i = phys = 0;
+  i = first;
+  phys = 0;
 
   while (i < note.n_nresp)
     {
@@ -353,6 +387,7 @@ put_resp (struct io_f *io, struct daddr_f *where, struct newt *newt, int flags)
           TEMP_FAILURE_RETRY (fcntl (io->fidrdx, F_SETLKW, &rlock));
 
           phys = 0;
+          seq++;
           getresprec (io, lastin = resp.r_next, &resp);
 
           rlock.l_type = F_UNLCK;
@@ -366,7 +401,7 @@ put_resp (struct io_f *io, struct daddr_f *where, struct newt *newt, int flags)
   if (phys >= RESPSZ)  /* We are in a new block of responses. */
     {
       phys = 0;
-      resp.r_next = get_new_resp_block (io);
+      resp.r_next = get_new_resp_block (io, newt->nr.notenum, seq + 1);
 
       rlock.l_type = F_WRLCK;
       rlock.l_start = (off_t) (sizeof (int) +
@@ -385,7 +420,7 @@ put_resp (struct io_f *io, struct daddr_f *where, struct newt *newt, int flags)
         resp.r_stat[i] = 0;
     }
 
-  fdatasync (io->fidrdx);
+  syncnf (io, io->fidrdx);
   rlock.l_type = F_RDLCK;
   rlock.l_start = (off_t) (sizeof (int) +
                            (lastin * sizeof (struct resp_f)));
@@ -470,18 +505,28 @@ put_resp (struct io_f *io, struct daddr_f *where, struct newt *newt, int flags)
 
   putdescr (io, &io->descr);
 
-  fdatasync (io->fidrdx);
-  fdatasync (io->fidndx);
+  syncnf (io, io->fidrdx);
+  syncnf (io, io->fidndx);
   dlock.l_type = F_UNLCK;
   fcntl (io->fidndx, F_SETLK, &dlock);
   rlock.l_type = F_UNLCK;
   fcntl (io->fidrdx, F_SETLK, &rlock);
 
+  tindex_add (io, newt->nr.notenum, POST_RESP (lastin, phys), where);
+  aindex_add (io, newt->nr.notenum, POST_RESP (lastin, phys),
+              resp.r_auth[phys].aname, resp.r_id[phys].sys);
+  clog_add (io, newt->nr.notenum, POST_RESP (lastin, phys),
+            convert_time (&resp.r_when[phys]), &resp.r_auth[phys]);
+
   return note.n_nresp;
 }
 
+/* get_new_resp_block - allocate a response block, which will be block SEQ in
+ * the chain of note NOTENUM, and return its record number.
+ */
+
 static int
-get_new_resp_block (struct io_f *iop)
+get_new_resp_block (struct io_f *iop, int notenum, int seq)
 {
   struct flock lock;
   int i;
@@ -494,11 +539,12 @@ get_new_resp_block (struct io_f *iop)
 
   lseek (iop->fidrdx, (off_t) 0, SEEK_SET);
   TEMP_FAILURE_RETRY (read (iop->fidrdx, &i, sizeof (int)));
+  rpos_add (iop, i, notenum, seq);
   i++;
   lseek (iop->fidrdx, (off_t) 0, SEEK_SET);
   TEMP_FAILURE_RETRY (write (iop->fidrdx, &i, sizeof (int)));
 
-  fdatasync (iop->fidrdx);
+  syncnf (iop, iop->fidrdx);
   lock.l_type = F_UNLCK;
   fcntl (iop->fidrdx, F_SETLK, &lock);
 
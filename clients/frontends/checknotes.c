@@ -32,6 +32,16 @@
 #include "dirname.h"
 #include "getopt.h"
 
+#if HAVE_SYS_SELECT_H
+# include <sys/select.h>
+#endif
+
+#if HAVE_SYS_WAIT_H
+# include <sys/wait.h>
+#endif
+
+#include <signal.h>
+
 #if TIME_WITH_SYS_TIME
 # include <sys/time.h>
 # include <time.h>
@@ -50,6 +60,9 @@ enum
     VERBOSE
   };
 
+/* The most notesfiles checked at once with --jobs. */
+#define MAX_JOBS 64
+
 /* Whether to display debugging messages. */
 int debug = FALSE;
 
@@ -62,15 +75,27 @@ time_t seqtime;
 /* Placeholder for the blacklist code. */
 const short white_basenotes = FALSE;
 
+/* Every sequencer time of the sequencer we're using. */
+static newts_seqmap *seqtimes;
+
+static int check_nf (newts_nfref *ref, struct notesfile *nf);
+static int check_parallel (newts_nfref **refs, int count, int jobs,
+                           short verbosity);
+static void report (newts_nfref *ref, int result, short verbosity);
+static int watch (newts_nfref **refs, int count, const char *seqname,
+                  short verbosity);
+static void announce (newts_nfref *ref, short verbosity);
 static int verify_sequencer (struct notesfile *nf);
 
 int
 main (int argc, char **argv)
 {
   List nflist;
-  struct notesfile *nf;
+  struct notesfile nf;
 
   int fileflag = FALSE;
+  int watching = FALSE;
+  int jobs = 1;
   int updated = 0;
   short verbosity = NORMAL;
   char *seqname;
@@ -83,9 +108,11 @@ main (int argc, char **argv)
       {N_("alternate"),1,0,'a'},
       {N_("debug"),0,0,'D'},
       {N_("file"),1,0,'f'},
+      {N_("jobs"),1,0,'j'},
       {N_("quiet"),0,0,'s'},
       {N_("silent"),0,0,'s'},
       {N_("verbose"),0,0,'v'},
+      {N_("watch"),0,0,'w'},
       {N_("no-blacklist"),0,0,'z'},
       {N_("help"),0,0,'h'},
       {N_("version"),0,0,0},
@@ -116,7 +143,7 @@ main (int argc, char **argv)
              (void (*) (void *)) nfref_free,
              NULL);
 
-  while ((opt = getopt_long (argc, argv, N_("a:f:hnqsv"),
+  while ((opt = getopt_long (argc, argv, N_("a:f:hj:nqsvw"),
                              long_options, &option_index)) != -1)
     {
       switch (opt)
@@ -151,6 +178,20 @@ main (int argc, char **argv)
             fileflag = TRUE;
           break;
 
+        case 'j':
+          {
+            char *end;
+
+            jobs = (int) strtol (optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || jobs < 1)
+              {
+                fprintf (stderr, _("%s: invalid number of jobs '%s'\n"),
+                         program_name, optarg);
+                exit (1);
+              }
+            break;
+          }
+
         case 'n':
           verbosity = NORMAL;
           break;
@@ -167,6 +208,10 @@ main (int argc, char **argv)
           verbosity = VERBOSE;
           break;
 
+        case 'w':
+          watching = TRUE;
+          break;
+
         case 'z':
           no_blacklist = TRUE;
           break;
@@ -178,8 +223,10 @@ main (int argc, char **argv)
 
           printf (_("  -a, --alternate=SEQ   Use alternate sequencer SEQ\n"
                     "  -f, --file=FILE       Read list of notesfiles to view from specified file\n"
+                    "  -j, --jobs=N          Check up to N notesfiles at once\n"
                     "  -s, --silent          Display no output\n"
                     "  -v, --verbose         Display each notesfile with new notes\n"
+                    "  -w, --watch           Keep watching for new notes, through noted\n"
                     "  -z, --no-blacklist    Ignore blacklist while checking notesfiles.\n"
                     "      --debug           Display debugging messages\n"
                     "      --quiet           Same as -s\n\n"
@@ -241,36 +288,58 @@ main (int argc, char **argv)
         parse_nf (argv[optind++], &nflist);
     }
 
+  memset (&nf, 0, sizeof (struct notesfile));
+  seqtimes = seqmap_alloc ();
+  get_all_seqtimes (seqname, seqtimes);
+
   {
-    ListNode *node = list_head (&nflist);
+    ListNode *node;
+    newts_nfref **refs;
+    int count = list_size (&nflist);
+    int i;
 
-    while (node != NULL)
+    refs = newts_nmalloc (count + 1, sizeof (newts_nfref *));
+    for (i = 0, node = list_head (&nflist); node != NULL;
+         i++, node = list_next (node))
+      refs[i] = (newts_nfref *) list_data (node);
+
+    if (watching)
       {
-        int error = open_nf ((newts_nfref *) list_data (node), nf);
+        updated = watch (refs, count, seqname, verbosity);
 
-        node = list_next (node);
+        /* Only a silent watch ever stops, when there are new notes. */
 
-        if (error != NEWTS_NO_ERROR)
-          {
-            fprintf (stderr, _("%s: error opening '%s'\n"), program_name,
-                     nfref_pretty_name (nf->ref));
-            continue;
-          }
+        newts_free (refs);
+        seqmap_free (seqtimes);
+        newts_free (seqname);
+        list_destroy (&nflist);
+        teardown ();
 
-        get_seqtime (nf->ref, seqname, &seqtime);
+        exit (updated > 0 ? 0 : 1);
+      }
 
-        if (difftime (seqtime, nf->modified) <= 0 &&
-            verify_sequencer (nf))
+    updated = -1;
+    if (jobs > 1 && count > 1)
+      updated = check_parallel (refs, count, jobs, verbosity);
+
+    if (updated < 0)
+      {
+        updated = 0;
+        for (i = 0; i < count; i++)
           {
-            updated++;
-            if (verbosity == VERBOSE)
-              {
-                printf (N_("%s\n"), nfref_pretty_name (nf->ref));
-              }
+            int result = check_nf (refs[i], &nf);
+
+            report (refs[i], result, verbosity);
+            if (result > 0)
+              updated++;
           }
       }
+
+    newts_free (refs);
   }
 
+  seqmap_free (seqtimes);
+
   if (verbosity == NORMAL)
     {
       if (updated)
@@ -289,6 +358,275 @@ main (int argc, char **argv)
   exit (updated ? 0 : 1);
 }
 
+/* check_nf - check the notesfile REF for new notes, opening it in NF.
+ *
+ * Returns: TRUE if it has new notes, FALSE if it doesn't, or -1 if it
+ * couldn't be opened.
+ */
+
+static int
+check_nf (newts_nfref *ref, struct notesfile *nf)
+{
+  int result;
+
+  if (open_nf (ref, nf) != NEWTS_NO_ERROR)
+    return -1;
+
+  seqmap_get (seqtimes, nf->ref, &seqtime);
+
+  result = difftime (seqtime, nf->modified) <= 0 && verify_sequencer (nf);
+
+  close_nf (nf, FALSE);
+
+  return result;
+}
+
+/* check_parallel - check the COUNT notesfiles in REFS with up to JOBS worker
+ * processes, reporting on each as VERBOSITY says.  The backend isn't safe to
+ * use from more than one thread, so as with search_nfs, the parent hands out
+ * list indexes through one pipe and the workers send back each result
+ * through another.
+ *
+ * Unless we're to list every notesfile with new notes, the first one found
+ * settles it, and the rest of the workers are stopped.  Otherwise results
+ * are held back until those before them in the list are in, so they're
+ * reported in the order given.
+ *
+ * Returns: the number of notesfiles found with new notes, or -1 if the
+ * workers couldn't be started.
+ */
+
+static int
+check_parallel (newts_nfref **refs, int count, int jobs, short verbosity)
+{
+  pid_t pids[MAX_JOBS];
+  int work[2], results[2];
+  int *result;
+  int next = 0, reported = 0, updated = 0;
+  int i, started = 0;
+
+  if (jobs > MAX_JOBS)
+    jobs = MAX_JOBS;
+  if (jobs > count)
+    jobs = count;
+
+  if (pipe (work) != 0)
+    return -1;
+  if (pipe (results) != 0)
+    {
+      close (work[0]);
+      close (work[1]);
+      return -1;
+    }
+
+  fflush (NULL);
+
+  for (i = 0; i < jobs; i++)
+    {
+      if ((pids[started] = fork ()) < 0)
+        break;
+
+      if (pids[started] == 0)
+        {
+          struct notesfile nf;
+          int done[2];
+
+          close (work[1]);
+          close (results[0]);
+
+          memset (&nf, 0, sizeof (struct notesfile));
+          while (TEMP_FAILURE_RETRY (read (work[0], &done[0],
+                                           sizeof done[0])) == sizeof done[0])
+            {
+              done[1] = check_nf (refs[done[0]], &nf);
+              TEMP_FAILURE_RETRY (write (results[1], done, sizeof done));
+            }
+
+          _exit (0);
+        }
+
+      started++;
+    }
+
+  close (work[0]);
+  close (results[1]);
+
+  if (started == 0)
+    {
+      close (work[1]);
+      close (results[0]);
+      return -1;
+    }
+
+  result = newts_nmalloc (count, sizeof (int));
+  for (i = 0; i < count; i++)
+    result[i] = -2;
+
+  while (reported < count)
+    {
+      fd_set readers, writers;
+      int highest = results[0];
+
+      FD_ZERO (&readers);
+      FD_ZERO (&writers);
+      FD_SET (results[0], &readers);
+      if (next < count)
+        {
+          FD_SET (work[1], &writers);
+          if (work[1] > highest)
+            highest = work[1];
+        }
+
+      if (select (highest + 1, &readers, &writers, NULL, NULL) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+
+      if (next < count && FD_ISSET (work[1], &writers))
+        {
+          if (TEMP_FAILURE_RETRY (write (work[1], &next, sizeof next)) ==
+              sizeof next)
+            next++;
+          if (next == count)
+            close (work[1]);
+        }
+
+      if (FD_ISSET (results[0], &readers))
+        {
+          int done[2];
+          ssize_t got = TEMP_FAILURE_RETRY (read (results[0], done,
+                                                  sizeof done));
+
+          if (got <= 0)
+            break;
+          if (got != sizeof done || done[0] < 0 || done[0] >= count)
+            continue;
+
+          result[done[0]] = done[1];
+          if (done[1] > 0)
+            updated++;
+
+          if (updated && verbosity != VERBOSE)
+            break;
+
+          while (reported < count && result[reported] != -2)
+            {
+              report (refs[reported], result[reported], verbosity);
+              reported++;
+            }
+        }
+    }
+
+  /* Anything still running is no longer needed. */
+
+  if (next < count)
+    close (work[1]);
+  close (results[0]);
+
+  for (i = 0; i < started; i++)
+    {
+      if (reported < count)
+        kill (pids[i], SIGTERM);
+      TEMP_FAILURE_RETRY (waitpid (pids[i], NULL, 0));
+    }
+
+  newts_free (result);
+
+  return updated;
+}
+
+/* report - tell the user about the notesfile REF, for which check_nf gave
+ * RESULT.
+ */
+
+static void
+report (newts_nfref *ref, int result, short verbosity)
+{
+  if (result < 0)
+    fprintf (stderr, _("%s: error opening '%s'\n"), program_name,
+             nfref_pretty_name (ref));
+  else if (result > 0 && verbosity == VERBOSE)
+    printf (N_("%s\n"), nfref_pretty_name (ref));
+}
+
+/* watch - watch the COUNT notesfiles in REFS through noted, announcing each
+ * new note or response in one as VERBOSITY says, and forever, unless we're
+ * to be silent, in which case the first settles it.  Notesfiles that were
+ * already new when we started are checked the usual way.
+ *
+ * Returns: 1 if a silent watch found new notes, or -1 if noted couldn't be
+ * reached or stopped answering.
+ */
+
+static int
+watch (newts_nfref **refs, int count, const char *seqname, short verbosity)
+{
+  struct notesfile nf;
+  struct newt note;
+  int *fresh;
+  int i;
+
+  fresh = newts_nmalloc (count + 1, sizeof (int));
+
+  if (watch_nfs (seqname, refs, count, fresh) < 0)
+    {
+      fprintf (stderr, _("%s: unable to reach noted\n"), program_name);
+      newts_free (fresh);
+      return -1;
+    }
+
+  memset (&nf, 0, sizeof (struct notesfile));
+
+  for (i = 0; i < count; i++)
+    {
+      int result = fresh[i] > 0 ? check_nf (refs[i], &nf) : fresh[i];
+
+      if (result < 0)
+        report (refs[i], result, verbosity);
+      else if (result > 0)
+        {
+          announce (refs[i], verbosity);
+          if (verbosity == SILENT)
+            {
+              newts_free (fresh);
+              return 1;
+            }
+        }
+    }
+
+  newts_free (fresh);
+
+  memset (&note, 0, sizeof (struct newt));
+
+  while ((i = next_new_note (&note.nr)) >= 0)
+    {
+      if (get_note (&note, FALSE) != 0 || blacklisted (&note))
+        continue;
+
+      announce (refs[i], verbosity);
+      if (verbosity == SILENT)
+        return 1;
+    }
+
+  fprintf (stderr, _("%s: lost connection to noted\n"), program_name);
+  return -1;
+}
+
+/* announce - tell the user there's something new in REF, while watching. */
+
+static void
+announce (newts_nfref *ref, short verbosity)
+{
+  if (verbosity == VERBOSE)
+    printf (N_("%s\n"), nfref_pretty_name (ref));
+  else if (verbosity == NORMAL)
+    printf (_("There are new notes in %s\n"), nfref_pretty_name (ref));
+
+  fflush (stdout);
+}
+
 /* verify_sequencer - look through a notesfile with the sequencer to see if it
  * really has new notes, with our blacklist taken into effect.
  *
@@ -299,6 +637,13 @@ static int
 verify_sequencer (struct notesfile *nf)
 {
   struct newt note;
+  int changed;
+
+  /* The change log can usually answer without our reading any notes. */
+
+  if ((changed = new_changes (nf->ref, seqtime, FALSE)) >= 0)
+    return changed;
+
   memset (&note, 0, sizeof (struct newt));
   nfref_copy (&note.nr.nfr, nf->ref);
   note.nr.notenum = 0;
@@ -33,6 +33,10 @@
 #include "newts/uiuc.h"
 #include "newts/uiuc-compatibility.h"
 
+/* The number of responses fetched from the backend at once. */
+
+#define RESP_BATCH 32
+
 static void uiuc_dump_descriptor (FILE *file, struct notesfile *nff);
 static void uiuc_dump_access (FILE *file, struct notesfile *nf);
 static void uiuc_dump_note (FILE *file, struct newt *np);
@@ -84,6 +88,8 @@ uiuc_dump_nf (struct notesfile *nf)
   for (i = 1; i <= nf->total_notes; i++)
     {
       struct newt note;
+      struct newt resps[RESP_BATCH];
+      int fetched;
       int j;
 
       memset (&note, 0, sizeof (struct newt));
@@ -95,18 +101,28 @@ uiuc_dump_nf (struct notesfile *nf)
       if (get_note (&note, FALSE) == 0)
         uiuc_dump_note (file, &note);
 
-      for (j = 1; j <= note.total_resps; j++)
-        {
-          struct newt resp;
+      /* Fetch the responses a batch at a time, so the backend walks the
+       * chain of responses once instead of once per response.
+       */
 
-          memset (&resp, 0, sizeof (struct newt));
-          nfref_copy (&resp.nr.nfr, ref);
+      memset (resps, 0, sizeof (resps));
+      nfref_copy (&resps[0].nr.nfr, ref);
 
-          resp.nr.notenum = i;
-          resp.nr.respnum = j;
-
-          if (get_note (&resp, FALSE) == 0)
-            uiuc_dump_resp (file, &note, &resp, j);
+      for (j = 1; j <= note.total_resps; j += fetched)
+        {
+          int k;
+
+          resps[0].nr.notenum = i;
+          resps[0].nr.respnum = j;
+          fetched = get_notes_range (resps, RESP_BATCH, 0);
+          if (fetched <= 0)
+            break;
+
+          for (k = 0; k < fetched; k++)
+            if (!(resps[k].options & NOTE_CORRUPTED) &&
+                !(resps[k].options & NOTE_UNAPPROVED &&
+                  !allowed (nf, DIRECTOR)))
+              uiuc_dump_resp (file, &note, &resps[k], j + k);
         }
     }
 
@@ -45,6 +45,8 @@ extern inline short blacklisted (struct newt *note);
 extern void init_blacklist (void);
 extern inline int list_parse (char *buf, int *p, int *first, int *last);
 extern inline int list_convert (char *buf, int *p);
+extern int new_changes (const newts_nfref *ref, time_t seq, short own);
+extern int parse_file (char *filename, List *list);
 extern int parse_nf (char *text, List *list);
 extern void printf_version_string (char *program_name);
 extern void setup (void);
@@ -0,0 +1,292 @@
+/*
+ * nfgrep.c - search many notesfiles at once
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "frontend.h"
+
+#include "dirname.h"
+#include "error.h"
+#include "getopt.h"
+#include "parse-datetime.h"
+
+/* Whether to display debugging messages. */
+int debug = FALSE;
+
+/* Whether any notesfile couldn't be searched. */
+static int error_occurred = FALSE;
+
+static time_t parse_time (const char *string);
+static void print_hit (const newts_nfref *ref, int notenum, int respnum,
+                       void *data);
+
+int
+main (int argc, char **argv)
+{
+  List nflist;
+  struct newts_search search;
+
+  int jobs = 0;
+  int hits;
+
+  int opt;
+  int option_index = 0;
+  extern char *optarg;
+  extern int optind, opterr, optopt;
+
+  struct option long_options[] =
+    {
+      {"after",1,0,'A'},
+      {"author",1,0,'a'},
+      {"before",1,0,'B'},
+      {"debug",0,0,'D'},
+      {"file",1,0,'f'},
+      {"jobs",1,0,'j'},
+      {"text",1,0,'e'},
+      {"title",1,0,'t'},
+      {"help",0,0,'h'},
+      {"version",0,0,0},
+      {0,0,0,0}
+    };
+
+  memset (&search, 0, sizeof (struct newts_search));
+
+#ifdef __GLIBC__
+  program_name = program_invocation_short_name;
+#else
+  program_name = base_name (argv[0]);
+#endif
+
+  /* Initialize i18n. */
+
+#ifdef HAVE_SETLOCALE
+  setlocale (LC_ALL, "");
+#endif
+
+#if ENABLE_NLS
+  bindtextdomain (PACKAGE, LOCALEDIR);
+  textdomain (PACKAGE);
+#endif
+
+  setup ();
+
+  list_init (&nflist,
+             (void * (*) (void)) nfref_alloc,
+             (void (*) (void *)) nfref_free,
+             NULL);
+
+  while ((opt = getopt_long (argc, argv, "a:e:f:hj:t:",
+                             long_options, &option_index)) != -1)
+    {
+      switch (opt)
+        {
+        case 0:
+          {
+            printf_version_string (N_("nfgrep"));
+
+            list_destroy (&nflist);
+            teardown ();
+
+            if (fclose (stdout) == EOF)
+              error (EXIT_FAILURE, errno, _("error writing output"));
+            exit (EXIT_SUCCESS);
+          }
+
+        case 'A':
+          search.after = parse_time (optarg);
+          break;
+
+        case 'a':
+          search.author = optarg;
+          break;
+
+        case 'B':
+          search.before = parse_time (optarg);
+          break;
+
+        case 'D':
+          debug = TRUE;
+          break;
+
+        case 'e':
+          search.text = optarg;
+          break;
+
+        case 'f':
+          parse_file (optarg, &nflist);
+          break;
+
+        case 'j':
+          {
+            char *end;
+
+            jobs = (int) strtol (optarg, &end, 10);
+            if (*optarg == '\0' || *end != '\0' || jobs < 0)
+              {
+                fprintf (stderr, _("%s: invalid number of jobs '%s'\n"),
+                         program_name, optarg);
+                exit (EXIT_FAILURE);
+              }
+            break;
+          }
+
+        case 't':
+          search.title = optarg;
+          break;
+
+        case 'h':
+          printf (_("Usage: %s [OPTION]... NOTESFILE...\n"
+                    "Search NOTESFILE(s) for notes and responses matching every OPTION given.\n\n"),
+                  program_name);
+
+          printf (_("  -t, --title=STRING   Find notes whose title contains STRING, and their\n"
+                    "                         responses\n"
+                    "  -a, --author=STRING  Find notes and responses by authors matching STRING\n"
+                    "  -e, --text=WORDS     Find notes and responses containing all of WORDS\n"
+                    "      --after=DATE     Find only those written at or after DATE\n"
+                    "      --before=DATE    Find only those written before DATE\n\n"
+                    "  -f, --file=FILE      Search the notesfiles listed in FILE\n"
+                    "  -j, --jobs=N         Search up to N notesfiles at once (default: one per\n"
+                    "                         processor)\n"
+                    "      --debug          Display debugging messages\n\n"
+                    "  -h, --help           Display this help and exit\n"
+                    "      --version        Display version information and exit\n\n"));
+
+          printf (_("Report bugs to <%s>.\n"), PACKAGE_BUGREPORT);
+
+          list_destroy (&nflist);
+          teardown ();
+
+          if (fclose (stdout) == EOF)
+            error (EXIT_FAILURE, errno, _("error writing output"));
+          exit (EXIT_SUCCESS);
+
+        case '?':
+          fprintf (stderr, _("Try '%s --help' for more information.\n"),
+                   program_name);
+
+          list_destroy (&nflist);
+          teardown ();
+
+          exit (EXIT_FAILURE);
+        }
+    }
+
+  if (search.title == NULL && search.author == NULL && search.text == NULL &&
+      search.after == 0 && search.before == 0)
+    {
+      fprintf (stderr, _("%s: nothing to search for\n"), program_name);
+      fprintf (stderr, _("Try '%s --help' for more information.\n"),
+               program_name);
+
+      list_destroy (&nflist);
+      teardown ();
+
+      exit (EXIT_FAILURE);
+    }
+
+  while (optind < argc)
+    parse_nf (argv[optind++], &nflist);
+
+  if (list_size (&nflist) == 0)
+    {
+      fprintf (stderr, _("%s: too few arguments\n"), program_name);
+      fprintf (stderr, _("Try '%s --help' for more information.\n"),
+               program_name);
+
+      list_destroy (&nflist);
+      teardown ();
+
+      exit (EXIT_FAILURE);
+    }
+
+  hits = search_nfs (&nflist, &search, jobs, print_hit, NULL);
+
+  if (hits < 0)
+    {
+      fprintf (stderr, _("%s: unable to start searching\n"), program_name);
+      error_occurred = TRUE;
+    }
+
+  list_destroy (&nflist);
+  teardown ();
+
+  if (fclose (stdout) == EOF)
+    error (EXIT_FAILURE, errno, _("error writing output"));
+
+  /* Like grep, exit with 1 if nothing turned up, and 2 for trouble. */
+
+  if (error_occurred)
+    exit (2);
+
+  exit (hits > 0 ? EXIT_SUCCESS : 1);
+}
+
+/* parse_time - return the time described by STRING, or exit with an error
+ * if it can't be parsed.
+ */
+
+static time_t
+parse_time (const char *string)
+{
+  struct timespec result, now;
+
+  now.tv_sec = time (NULL);
+  now.tv_nsec = 0;
+
+  if (!parse_datetime (&result, string, &now))
+    {
+      fprintf (stderr, _("%s: error parsing time '%s'\n"),
+               program_name, string);
+      exit (EXIT_FAILURE);
+    }
+
+  return result.tv_sec;
+}
+
+/* print_hit - print a line for each note and response found, and complain
+ * about each notesfile that couldn't be searched.
+ */
+
+static void
+print_hit (const newts_nfref *ref, int notenum, int respnum, void *data)
+{
+  newts_nfref *nfref = (newts_nfref *) ref;
+
+  if (notenum < 0)
+    {
+      if (respnum == -2)
+        fprintf (stderr, _("%s: permission denied for '%s'\n"),
+                 program_name, nfref_pretty_name (nfref));
+      else
+        fprintf (stderr, _("%s: unable to search '%s'\n"),
+                 program_name, nfref_pretty_name (nfref));
+      error_occurred = TRUE;
+      return;
+    }
+
+  if (respnum == 0)
+    printf ("%s %d\n", nfref_pretty_name (nfref), notenum);
+  else
+    printf ("%s %d.%d\n", nfref_pretty_name (nfref), notenum, respnum);
+}
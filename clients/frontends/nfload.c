@@ -312,7 +312,13 @@ main (int argc, char **argv)
   /* We need to prep the lexer to take the file. */
   yyin = infile;
 
-  if (load_uiuc_dump (&nf))
+  /* Sync the whole load once at the end rather than after every write. */
+
+  begin_batch (&nf);
+  result = load_uiuc_dump (&nf);
+  commit_batch (&nf);
+
+  if (result)
     fprintf (stderr, _("%s: aborting attempt to load dump file"),
              program_name);
   else
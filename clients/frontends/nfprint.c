@@ -76,6 +76,10 @@ int page = 1;
 /* Printing a table of contents only? */
 int index_only = FALSE;
 
+/* The number of responses fetched from the backend at once. */
+
+#define RESP_BATCH 32
+
 static void lprnote (FILE *toc, struct notesfile *nf, struct newt *notep);
 static void lprresp (struct newt *respp);
 
@@ -462,7 +466,8 @@ static void
 lprnote (FILE *tocf, struct notesfile *nf, struct newt *notep)
 {
   struct tm *tm = localtime (&notep->created);
-  struct newt resp;
+  struct newt resps[RESP_BATCH];
+  int fetched;
   int i;
 
   if (left < 7) /* We need seven to print a header and some text. */
@@ -650,15 +655,25 @@ lprnote (FILE *tocf, struct notesfile *nf, struct newt *notep)
       left += length;
     }
 
-  memset (&resp, 0, sizeof (struct newt));
-  nfref_copy (&resp.nr.nfr, &notep->nr.nfr);
-  resp.nr.notenum = notep->nr.notenum;
+  /* Fetch the responses a batch at a time, so the backend walks the chain of
+   * responses once instead of once per response.
+   */
+
+  memset (resps, 0, sizeof (resps));
+  nfref_copy (&resps[0].nr.nfr, &notep->nr.nfr);
 
-  for (i=1; i <= notep->total_resps; i++)
+  for (i=1; i <= notep->total_resps; i += fetched)
     {
-      resp.nr.respnum = i;
-      get_note (&resp, FALSE);
-      lprresp (&resp);
+      int j;
+
+      resps[0].nr.notenum = notep->nr.notenum;
+      resps[0].nr.respnum = i;
+      fetched = get_notes_range (resps, RESP_BATCH, 0);
+      if (fetched <= 0)
+        break;
+
+      for (j=0; j < fetched; j++)
+        lprresp (&resps[j]);
     }
 
   return;
@@ -184,6 +184,13 @@ main (int argc, char **argv)
               printf (_("Average Time/Entry:      %.2f minutes\n"),
                       (((float) stats->total_time / 60.0) /
                        (float) stats->entries));
+            printf (_("Text Storage:            %lu bytes\n"),
+                    stats->text_size);
+            if (stats->text_size)
+              printf (_("Free Text:               %lu bytes (%.1f%%) in %u "
+                        "extents\n"), stats->text_free,
+                      (100.0 * (float) stats->text_free /
+                       (float) stats->text_size), stats->free_extents);
           }
 
         stats_accumulate (stats, total_stats);
@@ -216,6 +223,13 @@ main (int argc, char **argv)
         printf (_("Average Time/Entry:       %.2f minutes\n"),
                 (((float) total_stats->total_time / 60.0)
                  / (float) total_stats->entries));
+      printf (_("Text Storage:             %lu bytes\n"),
+              total_stats->text_size);
+      if (total_stats->text_size)
+        printf (_("Free Text:                %lu bytes (%.1f%%) in %u "
+                  "extents\n"), total_stats->text_free,
+                (100.0 * (float) total_stats->text_free /
+                 (float) total_stats->text_size), total_stats->free_extents);
     }
 
   stats_free (total_stats);
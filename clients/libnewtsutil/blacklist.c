@@ -28,6 +28,8 @@
 #include "newts/list.h"
 #include "newts/newts.h"
 
+extern uid_t euid;
+extern char *fqdn;
 extern short no_blacklist;
 extern short white_basenotes;
 
@@ -45,6 +47,7 @@ List blacklist;
 List whitelist;
 
 inline short blacklisted (struct newt * note);
+int new_changes (const newts_nfref *ref, time_t seq, short own);
 static struct blacklist_entry *alloc_blacklist_entry (void);
 static void free_blacklist_entry (struct blacklist_entry *entry);
 void init_blacklist (void);
@@ -321,3 +324,43 @@ blacklisted (struct newt *note)
 
   return FALSE;
 }
+
+/* new_changes - check the change log of REF for notes and responses written
+ * or modified since SEQ, with the blacklist taken into effect.  Our own notes count only
+ * if OWN is nonzero.
+ *
+ * Returns: TRUE if there are new notes, FALSE if there aren't, or -1 if the
+ * change log can't say, and the notesfile has to be looked through instead.
+ */
+
+int
+new_changes (const newts_nfref *ref, time_t seq, short own)
+{
+  struct newts_change *changes;
+  struct newt note;
+  int count, i;
+  int result = FALSE;
+
+  count = get_changes (ref, seq, &changes);
+  if (count < 0)
+    return -1;
+
+  memset (&note, 0, sizeof (struct newt));
+  note.nr.nfr.name = ref->name;
+
+  for (i = 0; i < count && result == FALSE; i++)
+    {
+      note.nr.notenum = changes[i].notenum;
+      note.nr.respnum = changes[i].response ? 1 : 0;
+      note.auth = changes[i].auth;
+
+      if (euid == note.auth.uid && strcmp (fqdn, note.auth.system) == 0)
+        result = own ? TRUE : FALSE;
+      else if (!blacklisted (&note))
+        result = TRUE;
+    }
+
+  changes_free (changes, count);
+
+  return result;
+}
@@ -56,6 +56,8 @@ static void director_help (void);
 static void multi_delete (struct notesfile *nf, int first, int last,
                                   int mode);
 static void frob (struct notesfile *nf, int flag);
+static void show_compress_progress (unsigned done, unsigned total,
+                                    void *data);
 
 /* run_director - handle the main loop for the director screen.
  *
@@ -433,7 +435,12 @@ run_director (struct notesfile *nf)
                       _("Compressing..."));
             refresh ();
 
-            result = compress_nf (nf, &nnotes, &nresps);
+            {
+              int where = traditional ? row + 1 : LINES - 1;
+
+              result = compress_nf_online (nf, &nnotes, &nresps,
+                                           show_compress_progress, &where);
+            }
             if (result == 0)
               {
                 clear ();
@@ -1293,3 +1300,18 @@ frob (struct notesfile *nf, int flag)
   else
     nf->options |= flag;
 }
+
+/* show_compress_progress - keep the user posted while compress_nf_online
+ * works.  DATA points to the row the message goes on.
+ */
+
+static void
+show_compress_progress (unsigned done, unsigned total, void *data)
+{
+  int where = *(int *) data;
+
+  move (where, 0);
+  clrtoeol ();
+  mvprintw (where, 0, _("Compressing... %u of %u notes"), done, total);
+  refresh ();
+}
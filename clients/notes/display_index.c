@@ -41,6 +41,8 @@
 # include <sys/ioctl.h>
 #endif
 
+static void free_notes (struct newt *notes, int count);
+
 /* display_index - print out the note index for NFP, starting on note FIRST. */
 
 void
@@ -62,9 +64,8 @@ display_index (struct notesfile *nf, int *first, int *last)
   short rightoffset;
   short authspace = 27;
 
-  struct newt note;
-  memset (&note, 0, sizeof (struct newt));
-  nfref_copy (&note.nr.nfr, nf->ref);
+  struct newt *notes;
+  int batch, fetched, next;
 
   /* The following voodoo arranges things correctly on the screen in
    * non-traditional mode.
@@ -102,6 +103,14 @@ display_index (struct notesfile *nf, int *first, int *last)
     *first = 1;
   *last = *first + LINES - 13;
 
+  batch = *last - *first + 1;
+  if (batch < 1)
+    batch = 1;
+  notes = newts_nmalloc ((size_t) batch, sizeof (struct newt));
+  memset (notes, 0, sizeof (struct newt) * batch);
+  nfref_copy (&notes[0].nr.nfr, nf->ref);
+  fetched = next = 0;
+
   /* Print the notesfile title, and possibly the notesfile name. */
 
   clear ();
@@ -148,13 +157,24 @@ display_index (struct notesfile *nf, int *first, int *last)
 
   for (i = *first; (i <= *last) & (i <= nf->total_notes); i++)
     {
-      note.nr.notenum = i;
-      note.nr.respnum = 0;
-      get_note (&note, FALSE);
+      struct newt *note;
+
+      /* Fetch the rows a screenful at a time. */
 
-      if ((note.options & NOTE_DELETED ||
-           note.options & NOTE_DIRECTORS_ONLY ||
-           note.options & NOTE_UNAPPROVED) &&
+      if (next == fetched)
+        {
+          notes[0].nr.notenum = i;
+          notes[0].nr.respnum = 0;
+          fetched = get_notes_range (notes, batch, FETCH_NO_TEXT);
+          next = 0;
+          if (fetched <= 0)
+            break;
+        }
+      note = &notes[next++];
+
+      if ((note->options & NOTE_DELETED ||
+           note->options & NOTE_DIRECTORS_ONLY ||
+           note->options & NOTE_UNAPPROVED) &&
           !allowed (nf, DIRECTOR))
         {
           if (++(*last) > nf->total_notes)
@@ -162,14 +182,14 @@ display_index (struct notesfile *nf, int *first, int *last)
           continue;
         }
 
-      tm = localtime (&note.created);
+      tm = localtime (&note->created);
 
       /* The >s used to be !=s.  We changed this to match what UIUC notes
        * actually outputs.
        */
 
       if ((tm->tm_year + 1900 > last_year || (tm->tm_mon + 1) > last_month
-           || tm->tm_mday > last_day) && !(note.options & NOTE_CORRUPTED))
+           || tm->tm_mday > last_day) && !(note->options & NOTE_CORRUPTED))
         {
           if (traditional)
             mvprintw (row, 0, "%d/%d", last_month = (tm->tm_mon + 1),
@@ -190,33 +210,33 @@ display_index (struct notesfile *nf, int *first, int *last)
 
       /* Print the graphic for director message or other status. */
 
-      if (note.options & NOTE_DELETED)
+      if (note->options & NOTE_DELETED)
         printw ("-");
-      else if (note.options & NOTE_DIRECTORS_ONLY)
+      else if (note->options & NOTE_DIRECTORS_ONLY)
         printw ("=");
-      else if (note.options & NOTE_ANNOUNCEMENT)
+      else if (note->options & NOTE_ANNOUNCEMENT)
         printw ("+");
-      else if (note.options & NOTE_UNAPPROVED)
+      else if (note->options & NOTE_UNAPPROVED)
         printw (":");
-      else if (note.director_message)
+      else if (note->director_message)
         printw ("*");
       else
         printw (" ");
 
       /* Print the title. */
 
-      snprintf (title, TITLEN, "%s", note.title);
+      snprintf (title, TITLEN, "%s", note->title);
       title[TITLEN - 1] = '\0';
       printw ("%s", title);
 
       /* Print the number of responses. */
 
-      if (note.total_resps != 0)
+      if (note->total_resps != 0)
         {
           if (traditional)
-            mvprintw (row, TITLEN + 12, "%5d", note.total_resps);
+            mvprintw (row, TITLEN + 12, "%5d", note->total_resps);
           else
-            mvprintw (row, COLS - rightoffset - 6, "%5d", note.total_resps);
+            mvprintw (row, COLS - rightoffset - 6, "%5d", note->total_resps);
         }
 
       /* Print the author.  If the author's system is the same as this system,
@@ -225,19 +245,19 @@ display_index (struct notesfile *nf, int *first, int *last)
 
       if (authspace)
         {
-          if (strcmp (fqdn, note.auth.system) != 0 &&
-              strcasecmp ("anonymous", note.auth.name) != 0)
+          if (strcmp (fqdn, note->auth.system) != 0 &&
+              strcasecmp ("anonymous", note->auth.name) != 0)
             {
               snprintf (buf, authspace,
-                        "%s@%s", note.auth.name, note.auth.system);
+                        "%s@%s", note->auth.name, note->auth.system);
             }
           else
             {
-              if (strcasecmp ("anonymous", note.auth.name) == 0)
+              if (strcasecmp ("anonymous", note->auth.name) == 0)
                 snprintf (buf, authspace,
                           traditional ? "Anonymous" : "anonymous");
               else
-                snprintf (buf, authspace, "%s", note.auth.name);
+                snprintf (buf, authspace, "%s", note->auth.name);
             }
           buf[26] = '\0';                                 /* don't overflow line */
           if (traditional || COLS <= 80)
@@ -248,7 +268,11 @@ display_index (struct notesfile *nf, int *first, int *last)
 
 #ifdef FIONREAD
       ioctl (0, FIONREAD, &ioctlval);
-      if (ioctlval != 0) return;
+      if (ioctlval != 0)
+        {
+          free_notes (notes, batch);
+          return;
+        }
 #endif /* not FIONREAD */
       row++;
     }
@@ -268,9 +292,31 @@ display_index (struct notesfile *nf, int *first, int *last)
 
   refresh ();
 
-  newts_free (note.title);
-  newts_free (note.director_message);
-  newts_free (note.auth.system);
-  newts_free (note.auth.name);
-  newts_free (note.text);
+  free_notes (notes, batch);
+}
+
+/* free_notes - free the array of COUNT newts fetched by display_index. */
+
+static void
+free_notes (struct newt *notes, int count)
+{
+  int i;
+
+  for (i = 0; i < count; i++)
+    {
+      if (notes[i].title)
+        newts_free (notes[i].title);
+      if (notes[i].director_message)
+        newts_free (notes[i].director_message);
+      if (notes[i].auth.system)
+        newts_free (notes[i].auth.system);
+      if (notes[i].auth.name)
+        newts_free (notes[i].auth.name);
+      if (notes[i].id.system)
+        newts_free (notes[i].id.system);
+      if (notes[i].text)
+        newts_free (notes[i].text);
+    }
+
+  newts_free (notes);
 }
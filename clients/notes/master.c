@@ -327,7 +327,14 @@ master (newts_nfref *ref)
       if (sequencer == NONE)
         seqtime = 0;
       else if (!alt_time)
-        get_seqtime (ref, seqname, &seqtime);
+        {
+          if (seqtimes == NULL)
+            {
+              seqtimes = seqmap_alloc ();
+              get_all_seqtimes (seqname, seqtimes);
+            }
+          seqmap_get (seqtimes, ref, &seqtime);
+        }
       first = nf.total_notes - LINES + 13;
       resp = 0;
 
@@ -379,7 +386,12 @@ master (newts_nfref *ref)
 
           if ((num == NEXTSEQ || num == QUITSEQ) &&
               sequencer != NONE && !alt_time)
-            set_seqtime (ref, seqname, entered);
+            {
+              /* Save it now, so that it isn't lost if we're hung up on. */
+
+              seqmap_set (seqtimes, ref, entered);
+              set_seqtimes (seqname, seqtimes);
+            }
 
           close_nf (&nf, TRUE);
         }
@@ -398,6 +410,13 @@ int
 verify_sequencer (struct notesfile *nf)
 {
   struct newt note;
+  int changed;
+
+  /* The change log can usually answer without our reading any notes. */
+
+  if ((changed = new_changes (nf->ref, seqtime, seq_own_notes)) >= 0)
+    return changed;
+
   memset (&note, 0, sizeof (struct newt));
 
   nfref_copy (&note.nr.nfr, nf->ref);
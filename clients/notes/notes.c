@@ -92,6 +92,9 @@ int seq_own_notes = FALSE;
 /* Sequencer time */
 time_t seqtime;
 
+/* Every sequencer time, read when first needed */
+newts_seqmap *seqtimes = NULL;
+
 /* If and what kind of sequencer we're using */
 int sequencer = NONE;
 
@@ -529,6 +532,9 @@ main (int argc, char **argv)
   ignore_signals ();
   exit_curses ();
 
+  if (seqtimes != NULL)
+    seqmap_free (seqtimes);
+
   if (*messages != '\0')
     printf ("%s", messages);
 
@@ -76,6 +76,7 @@ extern uid_t real_uid;
 extern char *seqname;
 extern int seq_own_notes;
 extern time_t seqtime;
+extern newts_seqmap *seqtimes;
 extern int sequencer;
 extern char *shell;
 extern int signature;
@@ -144,6 +145,7 @@ extern int limited_index (struct notesfile *nf);
 extern inline int list_parse (char *buf, int *p, int *first, int *last);
 extern inline int list_convert (char *buf, int *p);
 extern int master (newts_nfref *ref);
+extern int new_changes (const newts_nfref *ref, time_t seq, short own);
 extern int parse_file (char *filename, List *list);
 extern int parse_nf (char *string, List *list);
 extern void printw_time (struct tm *tm);
@@ -115,6 +115,13 @@ extern int errno;
 
 extern int getpeereid (int sock, uid_t *euid, gid_t *egid);
 
+/* seqmap_store - record SEQ as the sequencer time of the notesfile NAME in
+ * MAP, marked as changed if CHANGED is nonzero.  An unchanged time doesn't
+ * replace a changed one.
+ */
+extern void seqmap_store (struct newts_seqmap *map, const char *name,
+                          time_t seq, int changed);
+
 #if WITH_DMALLOC
 # undef malloc
 # undef realloc
@@ -56,7 +56,8 @@ enum newts_access_permissions
  */
 enum newts_protocols
   {
-    NEWTS_PROTOCOL_NCP  /**< The hypothetical Newts Client Protocol. */
+    NEWTS_PROTOCOL_NCP,   /**< The hypothetical Newts Client Protocol. */
+    NEWTS_PROTOCOL_NOTED  /**< The local notes daemon, noted. */
   };
 
 /**
@@ -68,6 +69,36 @@ enum newts_standard_ports
     NEWTS_NCP_STANDARD_PORT = 12345 /**< The default port for NCP. */
   };
 
+/**
+ * Options for fetching several newts at once with get_notes_range.
+ */
+enum newts_fetch_options
+  {
+    FETCH_NO_TEXT = 01  /**< Fill in only the metadata of each newt; the text
+                         * is not read, and is left as it was. */
+  };
+
+/**
+ * Options for finding every match at once with text_search_all.
+ */
+enum newts_search_options
+  {
+    SEARCH_RANKED = 01  /**< Order the matches best first, rather than by
+                         * note and response number. */
+  };
+
+/**
+ * Policies controlling how soon writes to a notesfile are synced to disk.
+ * Writes made between begin_batch and commit_batch are always held until the
+ * commit.
+ */
+enum newts_sync_policies
+  {
+    NEWTS_SYNC_EACH,  /**< Sync after every write.  This is the default. */
+    NEWTS_SYNC_GROUP  /**< Leave writes unsynced for up to an interval,
+                       * letting them share a single sync. */
+  };
+
 /* enum note_statuses - the various statuses which a note can have.
  *
  * ANONYMOUS      - Flag to indicate that note was anonymous.
@@ -31,5 +31,7 @@
 #define NEWTS_INCORRECT_DBVERSION    -4
 #define NEWTS_ALREADY_COMPRESSING    -5
 #define NEWTS_INVALID_NOTESFILE_NAME -6
+#define NEWTS_IO_ERROR               -7
+#define NEWTS_INVALID_ARGUMENT       -8
 
 #endif /* not NEWTS_ERROR_H */
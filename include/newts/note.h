@@ -90,6 +90,27 @@ extern "C" {
 
 extern inline int delete_note (struct newtref *nrp);
 extern inline int get_note (struct newt *notep, short updatestats);
+
+/**
+ * Fetch a run of basenotes, or a run of responses to one basenote, in a
+ * single pass over the notesfile.
+ *
+ * @param newts An array of at least @e count newts.  The reference in the
+ *              first one names the notesfile and the first newt wanted: if
+ *              its response number is 0, basenotes are fetched from its note
+ *              number on; otherwise responses to that note are fetched from
+ *              its response number on.  The note and response numbers of
+ *              every newt filled in are set; their notesfile references are
+ *              left alone.
+ * @param count The most newts to fetch.  If it is 0 or less, nothing is
+ *              fetched and 0 is returned.
+ * @param flags A bitmap of @ref newts_fetch_options "fetch options".
+ *
+ * @return The number of newts filled in, which is less than @e count if the
+ * notesfile or the thread runs out first, or a negative error code.
+ */
+extern inline int get_notes_range (struct newt *newts, int count, int flags);
+
 extern inline int modify_note (struct newt *notep, int flags);
 extern inline int modify_note_text (struct newt *notep);
 extern inline int write_note (struct notesfile *nf, struct newt *notep,
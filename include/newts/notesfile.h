@@ -67,6 +67,8 @@ struct notesfile
                            * has. */
   struct opts *opts;      /**< Custom options for the notesfile; these options
                            * are backend-specific. */
+  void *handle;           /**< The backend's handle on the open notesfile,
+                           * held from open_nf until close_nf. */
 };
 
 /* struct opts - standard Newts option file.
@@ -87,6 +89,19 @@ struct opts
 extern "C" {
 #endif
 
+/**
+ * Start a batch of writes to a notesfile.  Until the matching commit_batch,
+ * the writes are not synced to disk, which makes bulk loads much faster.
+ * Batches may be nested; only the outermost commit_batch syncs.
+ *
+ * @param nf An open notesfile.
+ *
+ * @return NEWTS_NO_ERROR, or NEWTS_NF_DOESNT_EXIST if @e nf is not open.
+ *
+ * @sa commit_batch
+ */
+extern inline int begin_batch (struct notesfile *nf);
+
 /**
  * Perform whatever actions are necessary to finish using a notesfile.
  *
@@ -102,6 +117,19 @@ extern "C" {
  */
 extern inline int close_nf (struct notesfile *nf, int updatestats);
 
+/**
+ * Finish a batch of writes started with begin_batch, syncing everything
+ * written during the batch to disk.  The text of the notes is synced before
+ * the indexes that refer to it.
+ *
+ * @param nf An open notesfile.
+ *
+ * @return NEWTS_NO_ERROR, or NEWTS_NF_DOESNT_EXIST if @e nf is not open.
+ *
+ * @sa begin_batch
+ */
+extern inline int commit_batch (struct notesfile *nf);
+
 /**
  * Commit note deletions and otherwise clean up unused notesfile data.
  *
@@ -110,7 +138,9 @@ extern inline int close_nf (struct notesfile *nf, int updatestats);
  * @param numresps A location to place the number of responses after
  *                 compression.
  *
- * @return FIXME
+ * @return 0 on success, NEWTS_ALREADY_COMPRESSING if the notesfile is already
+ * being compressed, or NEWTS_IO_ERROR if the text couldn't be copied, in which
+ * case the notesfile is left as it was.
  *
  * @par Side effects:
  * @e numnotes and @e numresps will be updated to hold the number of notes and
@@ -126,6 +156,37 @@ extern inline int close_nf (struct notesfile *nf, int updatestats);
 extern inline int compress_nf (struct notesfile *nf, unsigned *numnotes,
                                unsigned *numresps);
 
+/**
+ * Compress a notesfile the way compress_nf does, while other users go on
+ * reading and writing it.  The notes are copied without holding any locks,
+ * and the notesfile is only locked at the end, long enough to copy what
+ * changed during the copy and swap in the new files.
+ *
+ * @param nf An open notesfile.
+ * @param numnotes A location to place the number of notes after compression.
+ * @param numresps A location to place the number of responses after
+ *                 compression.
+ * @param progress A function called every so often during the copy with the
+ *                 number of notes copied so far, the number of notes to copy,
+ *                 and @e data; or NULL.
+ * @param data Passed to @e progress.
+ *
+ * @return 0 on success, NEWTS_ALREADY_COMPRESSING if the notesfile is already
+ * being compressed, NEWTS_IO_ERROR if the text couldn't be copied, or another
+ * error code if it couldn't be opened.  On error the notesfile is left as it
+ * was.
+ *
+ * @par Side effects:
+ * The same as compress_nf.
+ *
+ * @sa compress_nf
+ */
+extern inline int compress_nf_online (struct notesfile *nf,
+                                      unsigned *numnotes, unsigned *numresps,
+                                      void (*progress) (unsigned, unsigned,
+                                                        void *),
+                                      void *data);
+
 /**
  *
  */
@@ -166,6 +227,24 @@ extern newts_nfref *nf_nfref (const struct notesfile *nf);
  */
 extern inline int open_nf (const newts_nfref *ref, struct notesfile *nf);
 
+/**
+ * Choose how soon writes made outside of a batch are synced to disk.
+ *
+ * @param policy One of the @ref newts_sync_policies "sync policies".
+ * @param interval For NEWTS_SYNC_GROUP, how many seconds a write may be left
+ *                 unsynced.  Ignored otherwise.
+ *
+ * @return NEWTS_NO_ERROR, or NEWTS_INVALID_ARGUMENT if @e policy is not
+ * recognized.
+ *
+ * @par Side effects:
+ * Applies to every notesfile used by the process.  There is no timer: writes
+ * left unsynced past the interval are synced the next time the process uses
+ * any notesfile, and whatever is left when the notesfile is closed is synced
+ * then.
+ */
+extern inline int set_sync_policy (int policy, unsigned interval);
+
 /**
  * Refresh the metadata for an already opened notesfile.
  *
@@ -23,12 +23,24 @@
 #define NEWTS_SEARCH_H
 
 #include "newts/config.h"
+#include "newts/list.h"
 #include "newts/notesfile.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/**
+ * A note or response found by author_search_all, text_search_all or
+ * title_search_all.
+ */
+struct newts_match
+{
+  int notenum;                  /**< The basenote. */
+  int respnum;                  /**< The response, or 0 for the basenote. */
+  double score;                 /**< How well it matched; higher is better. */
+};
+
 /* author_search - incremental search for a particular author.
  *
  * Params:
@@ -48,9 +60,98 @@ extern "C" {
  */
 extern inline int author_search (struct newtref *nrp, const char *author);
 
+/**
+ * Find every note and response in a notesfile by an author, matched as for
+ * author_search.  Uses the notesfile's author index where it can, so it
+ * needn't read every note.
+ *
+ * @param ref The notesfile to search.
+ * @param author The string to look for in each 'username@host' string and
+ *               each author's real name.
+ * @param matches Set to a newly allocated array of the matches, in note and
+ *                response order, which the caller must free with newts_free.
+ *
+ * @return The number of matches, or a negative error code.
+ */
+extern inline int author_search_all (const newts_nfref *ref,
+                                     const char *author,
+                                     struct newts_match **matches);
+
 extern inline int text_search (struct newtref *nrp, const char *search);
+
+/**
+ * Find every note and response in a notesfile whose text contains all the
+ * words of a search string as whole words, ignoring case.  Uses the
+ * notesfile's full-text index where it can, so it needn't read all the text.
+ *
+ * @param ref The notesfile to search.
+ * @param search The words to look for.  Only letters and digits count; words
+ *               longer than 32 characters are ignored.  A search for nothing
+ *               but single letters reads all the text.
+ * @param flags A bitmap of @ref newts_search_options "search options".
+ * @param matches Set to a newly allocated array of the matches, which the
+ *                caller must free with newts_free.  It is in note and response
+ *                order unless @e flags includes SEARCH_RANKED.
+ *
+ * @return The number of matches, or a negative error code.
+ */
+extern inline int text_search_all (const newts_nfref *ref, const char *search,
+                                   int flags, struct newts_match **matches);
+
 extern inline int title_search (struct newtref *nrp, const char *search);
 
+/**
+ * Find every basenote in a notesfile whose title contains a search string,
+ * ignoring case.
+ *
+ * @param ref The notesfile to search.
+ * @param search The string to look for.
+ * @param matches Set to a newly allocated array of the matches, in note
+ *                order, which the caller must free with newts_free.
+ *
+ * @return The number of matches, or a negative error code.
+ */
+extern inline int title_search_all (const newts_nfref *ref,
+                                    const char *search,
+                                    struct newts_match **matches);
+
+/**
+ * What search_nfs looks for.  Every criterion given must match; those left
+ * NULL or 0 are ignored.
+ */
+struct newts_search
+{
+  const char *title;            /**< In the title, as for title_search_all;
+                                 * responses match by their basenote. */
+  const char *author;           /**< The author, as for author_search_all. */
+  const char *text;             /**< The words, as for text_search_all. */
+  time_t after;                 /**< Written at or after this time. */
+  time_t before;                /**< Written before this time. */
+};
+
+/**
+ * Search many notesfiles at once, on a pool of worker processes.
+ *
+ * @param nflist A list of newts_nfref, as built by parse_nf or parse_file.
+ * @param search What to look for.
+ * @param jobs The most notesfiles to search at once, or 0 for one per
+ *             processor.
+ * @param hit Called in the calling process for every note and response
+ *            found, as soon as it's found; hits from different notesfiles
+ *            are interleaved, but each notesfile's are in note order.  If a
+ *            notesfile can't be searched, it's called once for it with a
+ *            note number of -1 and the error code as the response number.
+ * @param data Passed on to @e hit.
+ *
+ * @return The number of notes and responses found, or a negative error
+ *         code.
+ */
+extern int search_nfs (List *nflist, const struct newts_search *search,
+                       int jobs,
+                       void (*hit) (const newts_nfref *ref, int notenum,
+                                    int respnum, void *data),
+                       void *data);
+
 #ifdef __cplusplus
 }
 #endif
@@ -23,6 +23,7 @@
 #define NEWTS_SEQUENCER_H
 
 #include "newts/config.h"
+#include "newts/author.h"
 #include "newts/nfref.h"
 #include "newts/notesfile.h"
 
@@ -30,6 +31,88 @@
 extern "C" {
 #endif
 
+struct newtref;
+
+/**
+ * A set of sequencer times, one for each of a user's notesfiles, held in
+ * memory so that a whole session's worth can be read and written at once.
+ */
+typedef struct newts_seqmap newts_seqmap;
+
+/**
+ * Read every sequencer time recorded for @e name into @e map, in a single
+ * pass over the sequencer file.  Times already changed in @e map with
+ * seqmap_set are kept.
+ *
+ * @return The number of times read, or -1 if there's no sequencer file.
+ */
+extern inline int get_all_seqtimes (const char *name, newts_seqmap *map);
+
+/**
+ * Write every time changed with seqmap_set in @e map to the sequencer
+ * file for @e name, in a single locked update.  Other times in the file are
+ * left as they are.
+ *
+ * @return 0, or -1 if the sequencer file couldn't be written.
+ */
+extern inline int set_seqtimes (const char *name, newts_seqmap *map);
+
+/**
+ * Create an empty newts_seqmap.
+ *
+ * @return A newly allocated map, to be freed with seqmap_free.
+ */
+extern newts_seqmap *seqmap_alloc (void);
+
+/**
+ * Deallocate @e map and everything in it.
+ */
+extern void seqmap_free (newts_seqmap *map);
+
+/**
+ * Look up the sequencer time of @e ref in @e map, storing it in @e seq, or
+ * 0 if there isn't one.
+ *
+ * @return 0 if there was a time for @e ref, or -1.
+ */
+extern int seqmap_get (const newts_seqmap *map, const newts_nfref *ref,
+                       time_t *seq);
+
+/**
+ * Change the sequencer time of @e ref in @e map to @e seq, to be written by
+ * the next set_seqtimes.
+ */
+extern void seqmap_set (newts_seqmap *map, const newts_nfref *ref, time_t seq);
+
+/**
+ * A basenote or response found by get_changes.
+ */
+struct newts_change
+{
+  int notenum;                  /**< The basenote. */
+  int response;                 /**< Whether it's a response to the basenote;
+                                     from uiuc_follow_changes, its number. */
+  time_t created;               /**< When it was written, or last modified. */
+  struct author auth;           /**< Who wrote it. */
+};
+
+/**
+ * Find every basenote and response written to @e ref, or modified, after
+ * @e seq that hasn't since been deleted, without reading the notes themselves.  They're
+ * stored, oldest first, in a newly allocated array in @e changes, to be
+ * freed with changes_free.
+ *
+ * @return The number found, -1 if the notesfile can't be opened or can't
+ * answer the question this way, or -2 if permission is denied.
+ */
+extern inline int get_changes (const newts_nfref *ref, time_t seq,
+                               struct newts_change **changes);
+
+/**
+ * Deallocate the @e count changes found by get_changes in @e changes.
+ */
+extern void changes_free (struct newts_change *changes, int count);
+
 extern inline int get_next_note (struct newtref *nrp, time_t seq);
 extern inline int get_next_resp (struct newtref *nrp, time_t seq);
 extern inline int get_seqtime (const newts_nfref *ref, const char *name,
@@ -37,6 +120,31 @@ extern inline int get_seqtime (const newts_nfref *ref, const char *name,
 extern inline int set_seqtime (const newts_nfref *ref, const char *name,
                                time_t seq);
 
+/**
+ * Ask noted to announce every basenote and response written from now on to
+ * any of the @e count notesfiles in @e refs, which must be on this
+ * system, for next_new_note to pick up.  Notes the caller writes aren't
+ * announced.  This replaces any earlier watch.
+ *
+ * @param name The sequencer to compare the notesfiles against.
+ * @param fresh Set, for each notesfile, to 1 if it has been modified since
+ *              its time in the sequencer @e name, 0 if not, or a negative
+ *              error code if it can't be watched.
+ *
+ * @return 0, or -1 if noted can't be reached.
+ */
+extern inline int watch_nfs (const char *name, newts_nfref **refs, int count,
+                             int *fresh);
+
+/**
+ * Wait for noted to announce a basenote or response written to a notesfile
+ * being watched, and store where it is in @e nrp.
+ *
+ * @return The index of the notesfile in the list given to watch_nfs, or -1
+ * if the connection to noted was lost.
+ */
+extern inline int next_new_note (struct newtref *nrp);
+
 #ifdef __cplusplus
 }
 #endif
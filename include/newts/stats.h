@@ -84,6 +84,13 @@ struct stats
   unsigned days_used;        /**< The number of distinct calendars days on
                               * which at least one user entered this
                               * notesfile. */
+  unsigned long text_size;   /**< Number of bytes of text stored for this
+                              * notesfile, including dead text. */
+  unsigned long text_free;   /**< Number of those bytes known to be dead and
+                              * available for reuse. */
+  unsigned free_extents;     /**< Number of separate runs of free text; with
+                              * text_free, a measure of how badly the
+                              * notesfile needs compressing. */
 };
 
 #ifdef __cplusplus
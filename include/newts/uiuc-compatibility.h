@@ -225,6 +225,8 @@ struct descr_f
   char d_filler[20];             /* Reserved for future use. */
 };
 
+struct nf_handle;
+
 struct io_f
 {
   int fidtxt;                    /* 'text' file descriptor. */
@@ -251,6 +253,7 @@ struct io_f
   int nrspdrop;
   int norphans;
   int adopted;
+  struct nf_handle *handle;      /* Newts: the cached open notesfile. */
 };
 
 struct seq_f
@@ -60,6 +60,16 @@ enum expire_with_dirmsg_opts
     DIRANYON
   };
 
+/* How far uiuc_follow_changes has read the change log of a notesfile.  Start
+ * it out zeroed.
+ */
+
+struct uiuc_follow
+{
+  long inode;                   /* Of 'note.indx' when last read. */
+  long seen;                    /* Changes read. */
+};
+
 /* Public function declarations; these are all implementations of the API
  * described in client.h. */
 
@@ -68,17 +78,35 @@ extern "C" {
 #endif
 
 extern int uiuc_author_search (struct newtref *nrp, const char *search);
+extern int uiuc_author_search_all (const newts_nfref *ref, const char *author,
+                                   struct newts_match **matches);
+extern int uiuc_begin_batch (struct notesfile *nf);
 extern int uiuc_close_nf (struct notesfile *nfp, short updatestats);
+extern int uiuc_commit_batch (struct notesfile *nf);
 extern int uiuc_compress_nf (struct notesfile *nfp, unsigned *numnotes,
                              unsigned *numresps);
+extern int uiuc_compress_nf_online (struct notesfile *nfp, unsigned *numnotes,
+                                    unsigned *numresps,
+                                    void (*progress) (unsigned, unsigned,
+                                                      void *),
+                                    void *data);
 extern int uiuc_create_nf (const newts_nfref *ref, int flags);
 extern int uiuc_delete_nf (const newts_nfref *ref);
 extern int uiuc_delete_note (struct newtref *nrp);
 extern int uiuc_get_access_list (const newts_nfref *ref, List *list);
+extern int uiuc_get_all_seqtimes (const char *name, newts_seqmap *map);
+extern int uiuc_follow_changes (const newts_nfref *ref,
+                                struct uiuc_follow *follow,
+                                struct newts_change **changes);
+extern int uiuc_get_changes (const newts_nfref *ref, time_t seq,
+                             struct newts_change **changes);
+extern int uiuc_get_generation (const struct notesfile *nf,
+                                unsigned long *generation);
 extern int uiuc_get_next_bug (const struct notesfile *nf);
 extern int uiuc_get_next_note (struct newtref *nrp, time_t seq);
 extern int uiuc_get_next_resp (struct newtref *nrp, time_t seq);
 extern int uiuc_get_note (struct newt *notep, short updatestats);
+extern int uiuc_get_notes_range (struct newt *newts, int count, int flags);
 extern int uiuc_get_seqtime (const newts_nfref *ref, const char *name,
                              time_t *seq);
 extern int uiuc_get_stats (const newts_nfref *ref, struct stats *stats);
@@ -86,10 +114,17 @@ extern int uiuc_modify_nf (struct notesfile *nfp);
 extern int uiuc_modify_note (struct newt *notep, int flags);
 extern int uiuc_modify_note_text (struct newt *notep);
 extern int uiuc_open_nf (const newts_nfref *ref, struct notesfile *nf);
+extern int uiuc_set_identity (uid_t uid);
 extern int uiuc_set_seqtime (const newts_nfref *ref, const char *name,
                              time_t seq);
+extern int uiuc_set_seqtimes (const char *name, newts_seqmap *map);
+extern int uiuc_set_sync_policy (int policy, unsigned interval);
 extern int uiuc_text_search (struct newtref *nrp, const char *search);
+extern int uiuc_text_search_all (const newts_nfref *ref, const char *search,
+                                 int flags, struct newts_match **matches);
 extern int uiuc_title_search (struct newtref *nrp, const char *search);
+extern int uiuc_title_search_all (const newts_nfref *ref, const char *search,
+                                  struct newts_match **matches);
 extern int uiuc_update_nf (struct notesfile *nfp);
 extern int uiuc_write_access_list (const newts_nfref *ref, List *list);
 extern int uiuc_write_note (struct notesfile *nf, struct newt *note,
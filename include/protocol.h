@@ -0,0 +1,172 @@
+/*
+ * protocol.h - what noted and its clients say to each other
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef NEWTS_PROTOCOL_H
+#define NEWTS_PROTOCOL_H
+
+#include "newts/newts.h"
+
+/* Every message is a frame: a four-byte length, counting what follows it,
+ * then a four-byte request ID.  A request goes on with a one-byte operation;
+ * a reply goes on with a four-byte status, which is what the backend call
+ * returned.  The arguments or results follow.
+ *
+ * The client picks the IDs, and each reply carries the ID of its request, so
+ * a client may send many requests before reading any replies, and match
+ * them up as they come.  ID 0 is never a request's: a client watching
+ * notesfiles gets a frame with ID 0, an event, whenever something is
+ * written to one of them.
+ *
+ * Numbers are sent most significant byte first: ints as four bytes, times as
+ * eight.  A string is its length in four bytes followed by that many bytes,
+ * with NOTED_NULL as the length of a NULL string.  References to notesfiles
+ * carry only the owner and name; the server always means its own.
+ */
+
+#define NOTED_SOCKET     "/tmp/newts-sock"
+#define NOTED_SOCKET_ENV "NEWTS_SOCKET"
+
+#define NOTED_HEADER     8      /* Length and ID. */
+#define NOTED_MAX_FRAME  (512 * 1024) /* Longest request a server takes. */
+#define NOTED_NULL       0xffffffffU
+#define NOTED_EVENT      0      /* The ID of an event. */
+
+enum noted_operations
+  {
+    NOTED_OPEN_NF = 1,          /* nfref -> handle, notesfile */
+    NOTED_CLOSE_NF,             /* handle, updatestats */
+    NOTED_GET_NOTE,             /* newtref, updatestats -> newt */
+    NOTED_GET_NEXT_NOTE,        /* newtref, seq -> notenum */
+    NOTED_WRITE_NOTE,           /* handle, flags, newt -> total notes */
+    NOTED_SEARCH,               /* kind, nfref, string, flags -> matches */
+    NOTED_GET_SEQTIME,          /* nfref, name -> seq */
+    NOTED_SET_SEQTIME,          /* nfref, name, seq */
+    NOTED_WATCH,                /* name, count, nfrefs -> count states */
+    NOTED_MAP_RING,             /* -> size, and the ring's descriptor */
+    NOTED_DELETE_NOTE,          /* newtref */
+    NOTED_MODIFY_NOTE,          /* nfref, flags, newt */
+    NOTED_MODIFY_NOTE_TEXT      /* nfref, newt */
+  };
+
+/* An event is the index of the notesfile in the client's NOTED_WATCH
+ * request, then the note and response numbers of what was written.
+ */
+
+/* A local client may ask for a ring: shared memory that noted puts the text
+ * of notes in, rather than sending it down the socket.  The reply to
+ * NOTED_MAP_RING carries a descriptor for the memory, passed with
+ * SCM_RIGHTS on its first byte, and the client maps it.
+ *
+ * A get_note request whose flags have NOTED_TEXT_IN_RING gets the note with
+ * a NULL text, then a slot: -1 if the text follows as a string as usual,
+ * or else the text's offset and length in the ring.  noted sets BUSY for
+ * the slot before replying, and the client clears it once it has copied
+ * the text out; until then noted leaves that part of the ring alone.
+ */
+
+#if HAVE_MMAP && HAVE_SYNC_BUILTINS
+# define NOTED_RINGS 1
+#endif
+
+#define NOTED_RING_SLOTS   256
+#define NOTED_TEXT_IN_RING 0x100 /* Not a FETCH_* flag. */
+
+struct noted_ring
+{
+  unsigned size;                /* Bytes of text after this header. */
+  unsigned busy[NOTED_RING_SLOTS];
+};
+
+/* What NOTED_SEARCH looks for, as for the *_search_all calls. */
+
+enum noted_searches
+  {
+    NOTED_SEARCH_TITLE,
+    NOTED_SEARCH_AUTHOR,
+    NOTED_SEARCH_TEXT
+  };
+
+/* struct wire - a frame being put together or taken apart.  Reading past the
+ * end, or finding something malformed, sets FAILED; later reads return
+ * zeros and NULLs, so a decoder need only check it once at the end.
+ */
+
+struct wire
+{
+  unsigned char *data;
+  size_t length;                /* Bytes in the frame. */
+  size_t size;                  /* Bytes allocated. */
+  size_t pos;                   /* Where the next read comes from. */
+  int failed;
+};
+
+/* Frames, in libnewts/protocol.c. */
+
+extern void wire_init (struct wire *wire);
+extern void wire_free (struct wire *wire);
+extern void wire_begin (struct wire *wire, unsigned long id);
+extern void wire_finish (struct wire *wire);
+extern void wire_take (struct wire *wire, const void *data, size_t length);
+
+extern void wire_put_byte (struct wire *wire, int value);
+extern void wire_put_int (struct wire *wire, long value);
+extern void wire_put_time (struct wire *wire, time_t value);
+extern void wire_put_double (struct wire *wire, double value);
+extern void wire_put_string (struct wire *wire, const char *string);
+extern void wire_put_nfref (struct wire *wire, const newts_nfref *ref);
+extern void wire_put_newtref (struct wire *wire, const struct newtref *nr);
+extern void wire_put_newt (struct wire *wire, const struct newt *newt);
+
+extern int wire_get_byte (struct wire *wire);
+extern long wire_get_int (struct wire *wire);
+extern time_t wire_get_time (struct wire *wire);
+extern double wire_get_double (struct wire *wire);
+extern char *wire_get_string (struct wire *wire);
+extern void wire_get_nfref (struct wire *wire, newts_nfref *ref);
+extern void wire_get_newtref (struct wire *wire, struct newtref *nr);
+extern void wire_get_newt (struct wire *wire, struct newt *newt);
+
+extern unsigned long wire_peek_length (const unsigned char *header);
+extern unsigned long wire_peek_id (const unsigned char *header);
+
+/* The client side, in libnewtsclient/noted_client.c. */
+
+extern int noted_close_nf (struct notesfile *nf, int updatestats);
+extern int noted_delete_note (struct newtref *nrp);
+extern int noted_get_next_note (struct newtref *nrp, time_t seq);
+extern int noted_get_note (struct newt *notep, short updatestats);
+extern int noted_get_notes_range (struct newt *newts, int count, int flags);
+extern int noted_get_seqtime (const newts_nfref *ref, const char *name,
+                              time_t *seq);
+extern int noted_modify_note (struct newt *notep, int flags);
+extern int noted_modify_note_text (struct newt *notep);
+extern int noted_open_nf (const newts_nfref *ref, struct notesfile *nf);
+extern int noted_search (int kind, const newts_nfref *ref, const char *search,
+                         int flags, struct newts_match **matches);
+extern int noted_set_seqtime (const newts_nfref *ref, const char *name,
+                              time_t seq);
+extern int noted_write_note (struct notesfile *nf, struct newt *notep,
+                             int flags);
+extern int noted_watch_nfs (const char *name, newts_nfref **refs, int count,
+                            int *fresh);
+extern int noted_next_new_note (struct newtref *nrp);
+
+#endif /* not NEWTS_PROTOCOL_H */
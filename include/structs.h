@@ -26,6 +26,7 @@
 # include <config.h>
 #endif
 
+#include "newts/config.h"
 #include "newts/enums.h"
 
 struct newts_nfref
@@ -42,4 +43,20 @@ struct newts_nfref
                                   * user input of nfref syntax. */
 };
 
+/** One notesfile's sequencer time in a newts_seqmap. */
+struct newts_seqentry
+{
+  struct newts_seqentry *next;   /**< The next entry in the same bucket. */
+  char *name;                    /**< The name of the notesfile. */
+  time_t seq;                    /**< The sequencer time. */
+  int changed;                   /**< Whether it needs to be written. */
+};
+
+struct newts_seqmap
+{
+  struct newts_seqentry **buckets;
+  unsigned nbuckets;
+  unsigned count;                /**< The number of entries. */
+};
+
 #endif /* not NEWTS_STRUCTS_H */
@@ -0,0 +1,284 @@
+/*
+ * fold.c - case-insensitive substring search
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#if STDC_HEADERS
+# include <ctype.h>
+# include <stddef.h>
+# include <stdlib.h>
+#endif
+
+#if defined STDC_HEADERS || defined HAVE_STRING_H
+# include <string.h>
+#elif HAVE_STRINGS_H
+# include <strings.h>
+#endif
+
+#if __SSE2__
+# include <emmintrin.h>
+#endif
+
+#if HAVE_AVX2_TARGET
+# include <immintrin.h>
+#endif
+
+#include "fold.h"
+#include "xalloc.h"
+
+/* Searching a notesfile means running one short string over megabytes of
+ * text, so the string is folded to lower case and its Horspool shift table
+ * built once, up front.  Where the machine has vector instructions, we look
+ * at 16 or 32 places at once for both cases of the first and last characters
+ * of the string, and only compare the whole string where both are found;
+ * real text rarely gets that far.  Elsewhere, and on what's left over at the
+ * end of the text, we fall back to Horspool's algorithm.
+ *
+ * Folding goes through tolower and toupper, one byte at a time, so it's only
+ * as good as the current locale's idea of single-byte case.
+ */
+
+static int matches (const struct fold_needle *needle,
+                    const unsigned char *text);
+#if __SSE2__
+static const char *search_sse2 (const struct fold_needle *needle,
+                                 const unsigned char *text, size_t length,
+                                 size_t *done);
+#endif
+#if HAVE_AVX2_TARGET
+static const char *search_avx2 (const struct fold_needle *needle,
+                                const unsigned char *text, size_t length,
+                                size_t *done);
+#endif
+
+/* The widest vector, in bytes, that fold_search may use. */
+static size_t widest = 32;
+
+/* fold_compile - prepare to search for NEEDLE, ignoring case.  The result
+ * should be freed with fold_free.
+ */
+
+struct fold_needle *
+fold_compile (const char *needle)
+{
+  struct fold_needle *result = xmalloc (sizeof (struct fold_needle));
+  size_t i;
+  int c;
+
+  for (c = 0; c < 256; c++)
+    result->fold[c] = (unsigned char) tolower (c);
+
+  result->length = strlen (needle);
+  result->folded = xmalloc (result->length + 1);
+  for (i = 0; i < result->length; i++)
+    result->folded[i] = result->fold[(unsigned char) needle[i]];
+  result->folded[result->length] = '\0';
+
+  for (c = 0; c < 256; c++)
+    result->skip[c] = result->length;
+  for (i = 0; i + 1 < result->length; i++)
+    result->skip[result->folded[i]] = result->length - 1 - i;
+
+  if (result->length > 0)
+    {
+      c = result->folded[0];
+      result->first[0] = (unsigned char) c;
+      result->first[1] = (unsigned char) toupper (c);
+      c = result->folded[result->length - 1];
+      result->last[0] = (unsigned char) c;
+      result->last[1] = (unsigned char) toupper (c);
+    }
+
+  return result;
+}
+
+/* fold_free - free NEEDLE, as returned by fold_compile. */
+
+void
+fold_free (struct fold_needle *needle)
+{
+  if (needle == NULL)
+    return;
+
+  free (needle->folded);
+  free (needle);
+}
+
+/* fold_set_width - use vectors no wider than WIDTH bytes in fold_search: 32
+ * for AVX2 and SSE2, 16 for SSE2 alone, and 0 for neither.  Each is still
+ * only used if the machine has it.  This is for the tests, which check every
+ * way of searching against the others.
+ */
+
+void
+fold_set_width (size_t width)
+{
+  widest = width;
+}
+
+/* fold_search - find the first place NEEDLE occurs in the LENGTH characters
+ * at HAYSTACK, ignoring case.  HAYSTACK need not be null-terminated.  Returns
+ * a pointer to the match, or NULL if there isn't one.
+ */
+
+const char *
+fold_search (const struct fold_needle *needle, const char *haystack,
+             size_t length)
+{
+  const unsigned char *text = (const unsigned char *) haystack;
+  size_t m = needle->length;
+  size_t i = 0;
+
+  if (m == 0)
+    return haystack;
+  if (length < m)
+    return NULL;
+
+#if HAVE_AVX2_TARGET
+  if (widest >= 32 && __builtin_cpu_supports ("avx2"))
+    {
+      const char *found = search_avx2 (needle, text, length, &i);
+
+      if (found != NULL)
+        return found;
+    }
+#endif
+
+#if __SSE2__
+  if (i == 0 && widest >= 16)
+    {
+      const char *found = search_sse2 (needle, text, length, &i);
+
+      if (found != NULL)
+        return found;
+    }
+#endif
+
+  /* Horspool, for whatever the vector loops didn't get to. */
+
+  while (i + m <= length)
+    {
+      if (needle->fold[text[i + m - 1]] == needle->folded[m - 1] &&
+          matches (needle, text + i))
+        return haystack + i;
+
+      i += needle->skip[needle->fold[text[i + m - 1]]];
+    }
+
+  return NULL;
+}
+
+/* matches - return nonzero if NEEDLE occurs at TEXT. */
+
+static int
+matches (const struct fold_needle *needle, const unsigned char *text)
+{
+  size_t i;
+
+  for (i = 0; i < needle->length; i++)
+    if (needle->fold[text[i]] != needle->folded[i])
+      return 0;
+
+  return 1;
+}
+
+#if __SSE2__
+
+/* search_sse2 - look for NEEDLE in TEXT sixteen places at a time, for as long
+ * as there's room.  Returns the match, or NULL with the number of places
+ * ruled out stored in DONE.
+ */
+
+static const char *
+search_sse2 (const struct fold_needle *needle, const unsigned char *text,
+             size_t length, size_t *done)
+{
+  size_t m = needle->length;
+  __m128i first0 = _mm_set1_epi8 ((char) needle->first[0]);
+  __m128i first1 = _mm_set1_epi8 ((char) needle->first[1]);
+  __m128i last0 = _mm_set1_epi8 ((char) needle->last[0]);
+  __m128i last1 = _mm_set1_epi8 ((char) needle->last[1]);
+  size_t i;
+
+  for (i = 0; i + m - 1 + 16 <= length; i += 16)
+    {
+      __m128i head = _mm_loadu_si128 ((const __m128i *) (text + i));
+      __m128i tail = _mm_loadu_si128 ((const __m128i *) (text + i + m - 1));
+      __m128i hit =
+        _mm_and_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (head, first0),
+                                     _mm_cmpeq_epi8 (head, first1)),
+                       _mm_or_si128 (_mm_cmpeq_epi8 (tail, last0),
+                                     _mm_cmpeq_epi8 (tail, last1)));
+      unsigned mask = (unsigned) _mm_movemask_epi8 (hit);
+      unsigned bit;
+
+      for (bit = 0; mask != 0; bit++, mask >>= 1)
+        if (mask & 1 && matches (needle, text + i + bit))
+          return (const char *) text + i + bit;
+    }
+
+  *done = i;
+  return NULL;
+}
+
+#endif /* __SSE2__ */
+
+#if HAVE_AVX2_TARGET
+
+/* search_avx2 - the same as search_sse2, thirty-two places at a time. */
+
+__attribute__ ((target ("avx2")))
+static const char *
+search_avx2 (const struct fold_needle *needle, const unsigned char *text,
+             size_t length, size_t *done)
+{
+  size_t m = needle->length;
+  __m256i first0 = _mm256_set1_epi8 ((char) needle->first[0]);
+  __m256i first1 = _mm256_set1_epi8 ((char) needle->first[1]);
+  __m256i last0 = _mm256_set1_epi8 ((char) needle->last[0]);
+  __m256i last1 = _mm256_set1_epi8 ((char) needle->last[1]);
+  size_t i;
+
+  for (i = 0; i + m - 1 + 32 <= length; i += 32)
+    {
+      __m256i head = _mm256_loadu_si256 ((const __m256i *) (text + i));
+      __m256i tail = _mm256_loadu_si256 ((const __m256i *)
+                                         (text + i + m - 1));
+      __m256i hit =
+        _mm256_and_si256 (_mm256_or_si256 (_mm256_cmpeq_epi8 (head, first0),
+                                           _mm256_cmpeq_epi8 (head, first1)),
+                          _mm256_or_si256 (_mm256_cmpeq_epi8 (tail, last0),
+                                           _mm256_cmpeq_epi8 (tail, last1)));
+      unsigned mask = (unsigned) _mm256_movemask_epi8 (hit);
+      unsigned bit;
+
+      for (bit = 0; mask != 0; bit++, mask >>= 1)
+        if (mask & 1 && matches (needle, text + i + bit))
+          return (const char *) text + i + bit;
+    }
+
+  *done = i;
+  return NULL;
+}
+
+#endif /* HAVE_AVX2_TARGET */
@@ -0,0 +1,45 @@
+/*
+ * fold.h - case-insensitive substring search
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef FOLD_H
+#define FOLD_H
+
+#include <stddef.h>
+
+/* struct fold_needle - a string to search for, compiled by fold_compile. */
+
+struct fold_needle
+{
+  unsigned char *folded;        /* The string, in lower case. */
+  size_t length;                /* Its length. */
+  unsigned char fold[256];      /* Lower case of every character. */
+  size_t skip[256];             /* Horspool shifts, by folded character. */
+  unsigned char first[2];       /* Both cases of the first character... */
+  unsigned char last[2];        /* ...and of the last. */
+};
+
+extern struct fold_needle *fold_compile (const char *needle);
+extern void fold_free (struct fold_needle *needle);
+extern const char *fold_search (const struct fold_needle *needle,
+                                const char *haystack, size_t length);
+extern void fold_set_width (size_t width);
+
+#endif /* not FOLD_H */
@@ -0,0 +1,46 @@
+/*
+ * change.c - methods for handling the changes found by get_changes
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "internal.h"
+#include "newts/memory.h"
+#include "newts/sequencer.h"
+
+void
+changes_free (struct newts_change *changes, int count)
+{
+  int i;
+
+  if (changes == NULL)
+    return;
+
+  for (i = 0; i < count; i++)
+    {
+      newts_free (changes[i].auth.name);
+      newts_free (changes[i].auth.system);
+    }
+
+  newts_free (changes);
+}
@@ -138,7 +138,25 @@ nfref_pretty_name (newts_nfref *ref)
   if (ref->name == NULL)
     return NULL;
 
-  if (nfref_system_is_localhost (ref))
+  if (ref->protocol == NEWTS_PROTOCOL_NOTED &&
+      nfref_system_is_localhost (ref))
+    {
+      if (ref->owner == NULL)
+        {
+          ref->pretty_name = newts_nmalloc (strlen (ref->name) + 9,
+                                            sizeof (char));
+          sprintf (ref->pretty_name, N_("noted://%s"), ref->name);
+        }
+      else
+        {
+          ref->pretty_name = newts_nmalloc (strlen (ref->owner) +
+                                            strlen (ref->name) + 10,
+                                            sizeof (char));
+          sprintf (ref->pretty_name, N_("noted://%s:%s"), ref->owner,
+                   ref->name);
+        }
+    }
+  else if (nfref_system_is_localhost (ref))
     {
       if (ref->owner == NULL)
         {
@@ -65,6 +65,7 @@ struct protocol_name_map
 static struct protocol_name_map protocol_maps[] =
   {
     {N_("newts"), NEWTS_PROTOCOL_NCP},
+    {N_("noted"), NEWTS_PROTOCOL_NOTED},
     {NULL, 0}
   };
 
@@ -0,0 +1,388 @@
+/*
+ * protocol.c - putting together and taking apart noted's frames
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "internal.h"
+#include "protocol.h"
+
+static void reserve (struct wire *wire, size_t length);
+static void put_bytes (struct wire *wire, const void *data, size_t length);
+static void put_u32 (struct wire *wire, unsigned long value);
+static unsigned long get_u32 (struct wire *wire);
+static void replace (char **field, char *value);
+
+void
+wire_init (struct wire *wire)
+{
+  memset (wire, 0, sizeof (struct wire));
+}
+
+void
+wire_free (struct wire *wire)
+{
+  newts_free (wire->data);
+  memset (wire, 0, sizeof (struct wire));
+}
+
+/* wire_begin - start a new frame in WIRE for request ID.  The length is
+ * filled in by wire_finish.
+ */
+
+void
+wire_begin (struct wire *wire, unsigned long id)
+{
+  wire->length = 0;
+  wire->pos = 0;
+  wire->failed = FALSE;
+
+  put_u32 (wire, 0);
+  put_u32 (wire, id);
+}
+
+void
+wire_finish (struct wire *wire)
+{
+  size_t length = wire->length - 4;
+
+  wire->data[0] = (unsigned char) (length >> 24);
+  wire->data[1] = (unsigned char) (length >> 16);
+  wire->data[2] = (unsigned char) (length >> 8);
+  wire->data[3] = (unsigned char) length;
+}
+
+/* wire_take - make WIRE the whole frame of LENGTH bytes at DATA, ready to be
+ * read from just after the request ID.
+ */
+
+void
+wire_take (struct wire *wire, const void *data, size_t length)
+{
+  wire->length = 0;
+  wire->failed = FALSE;
+  put_bytes (wire, data, length);
+  wire->pos = NOTED_HEADER;
+
+  if (length < NOTED_HEADER)
+    wire->failed = TRUE;
+}
+
+/* wire_peek_length - return the length of the frame whose header is at
+ * HEADER, counting the header.
+ */
+
+unsigned long
+wire_peek_length (const unsigned char *header)
+{
+  return 4 + (((unsigned long) header[0] << 24) |
+              ((unsigned long) header[1] << 16) |
+              ((unsigned long) header[2] << 8) | (unsigned long) header[3]);
+}
+
+unsigned long
+wire_peek_id (const unsigned char *header)
+{
+  return ((unsigned long) header[4] << 24) | ((unsigned long) header[5] << 16)
+    | ((unsigned long) header[6] << 8) | (unsigned long) header[7];
+}
+
+void
+wire_put_byte (struct wire *wire, int value)
+{
+  unsigned char byte = (unsigned char) value;
+
+  put_bytes (wire, &byte, 1);
+}
+
+void
+wire_put_int (struct wire *wire, long value)
+{
+  put_u32 (wire, (unsigned long) value & 0xffffffffUL);
+}
+
+void
+wire_put_time (struct wire *wire, time_t value)
+{
+  long long full = (long long) value;
+
+  put_u32 (wire, (unsigned long) ((unsigned long long) full >> 32));
+  put_u32 (wire, (unsigned long) (full & 0xffffffffLL));
+}
+
+/* wire_put_double - put VALUE as its bits; the client and server are on the
+ * same machine.
+ */
+
+void
+wire_put_double (struct wire *wire, double value)
+{
+  put_bytes (wire, &value, sizeof (double));
+}
+
+void
+wire_put_string (struct wire *wire, const char *string)
+{
+  size_t length;
+
+  if (string == NULL)
+    {
+      put_u32 (wire, NOTED_NULL);
+      return;
+    }
+
+  length = strlen (string);
+  put_u32 (wire, (unsigned long) length);
+  put_bytes (wire, string, length);
+}
+
+void
+wire_put_nfref (struct wire *wire, const newts_nfref *ref)
+{
+  wire_put_string (wire, nfref_owner (ref));
+  wire_put_string (wire, nfref_name (ref));
+}
+
+void
+wire_put_newtref (struct wire *wire, const struct newtref *nr)
+{
+  wire_put_nfref (wire, &nr->nfr);
+  wire_put_int (wire, nr->notenum);
+  wire_put_int (wire, nr->respnum);
+}
+
+void
+wire_put_newt (struct wire *wire, const struct newt *newt)
+{
+  wire_put_newtref (wire, &newt->nr);
+  wire_put_string (wire, newt->id.system);
+  wire_put_int (wire, newt->id.number);
+  wire_put_string (wire, newt->title);
+  wire_put_string (wire, newt->director_message);
+  wire_put_string (wire, newt->auth.name);
+  wire_put_string (wire, newt->auth.system);
+  wire_put_int (wire, (long) newt->auth.uid);
+  wire_put_time (wire, newt->created);
+  wire_put_time (wire, newt->modified);
+  wire_put_int (wire, newt->total_resps);
+  wire_put_string (wire, newt->text);
+  wire_put_int (wire, newt->options);
+}
+
+int
+wire_get_byte (struct wire *wire)
+{
+  if (wire->failed || wire->pos + 1 > wire->length)
+    {
+      wire->failed = TRUE;
+      return 0;
+    }
+
+  return wire->data[wire->pos++];
+}
+
+long
+wire_get_int (struct wire *wire)
+{
+  unsigned long value = get_u32 (wire);
+
+  /* Sign-extend, where long is wider than the four bytes sent. */
+
+  if (value & 0x80000000UL)
+    return -(long) (0xffffffffUL - value) - 1;
+
+  return (long) value;
+}
+
+time_t
+wire_get_time (struct wire *wire)
+{
+  unsigned long long high = get_u32 (wire);
+  unsigned long long low = get_u32 (wire);
+
+  return (time_t) (long long) ((high << 32) | low);
+}
+
+double
+wire_get_double (struct wire *wire)
+{
+  double value = 0;
+
+  if (wire->failed || wire->pos + sizeof (double) > wire->length)
+    wire->failed = TRUE;
+  else
+    {
+      memcpy (&value, wire->data + wire->pos, sizeof (double));
+      wire->pos += sizeof (double);
+    }
+
+  return value;
+}
+
+/* wire_get_string - return a newly allocated copy of the next string in
+ * WIRE, or NULL if it was NULL or isn't there.
+ */
+
+char *
+wire_get_string (struct wire *wire)
+{
+  unsigned long length = get_u32 (wire);
+  char *string;
+
+  if (wire->failed || length == NOTED_NULL)
+    return NULL;
+
+  if (length > wire->length - wire->pos)
+    {
+      wire->failed = TRUE;
+      return NULL;
+    }
+
+  string = newts_nmalloc (length + 1, sizeof (char));
+  memcpy (string, wire->data + wire->pos, length);
+  string[length] = '\0';
+  wire->pos += length;
+
+  return string;
+}
+
+/* wire_get_nfref - fill in REF from WIRE.  A notesfile sent over the wire is
+ * always one of the server's own.
+ */
+
+void
+wire_get_nfref (struct wire *wire, newts_nfref *ref)
+{
+  char *owner = wire_get_string (wire);
+  char *name = wire_get_string (wire);
+
+  nfref_set_owner (ref, owner);
+  nfref_set_name (ref, name);
+  nfref_set_protocol (ref, NEWTS_PROTOCOL_NCP);
+  nfref_set_system (ref, NULL);
+  nfref_set_user (ref, NULL);
+  nfref_set_port (ref, NEWTS_NCP_STANDARD_PORT);
+
+  newts_free (owner);
+  newts_free (name);
+
+  if (nfref_name (ref) == NULL)
+    wire->failed = TRUE;
+}
+
+void
+wire_get_newtref (struct wire *wire, struct newtref *nr)
+{
+  wire_get_nfref (wire, &nr->nfr);
+  nr->notenum = (int) wire_get_int (wire);
+  nr->respnum = (int) wire_get_int (wire);
+}
+
+/* wire_get_newt - fill in NEWT from WIRE, replacing the strings it points to,
+ * which must have been allocated, as the backend does.  Its reference to its
+ * notesfile is left alone.
+ */
+
+void
+wire_get_newt (struct wire *wire, struct newt *newt)
+{
+  char *owner, *name;
+
+  /* Skip the notesfile; the caller knows which it is. */
+
+  owner = wire_get_string (wire);
+  name = wire_get_string (wire);
+  newts_free (owner);
+  newts_free (name);
+
+  newt->nr.notenum = (int) wire_get_int (wire);
+  newt->nr.respnum = (int) wire_get_int (wire);
+  replace (&newt->id.system, wire_get_string (wire));
+  newt->id.number = wire_get_int (wire);
+  replace (&newt->title, wire_get_string (wire));
+  replace (&newt->director_message, wire_get_string (wire));
+  replace (&newt->auth.name, wire_get_string (wire));
+  replace (&newt->auth.system, wire_get_string (wire));
+  newt->auth.uid = (uid_t) wire_get_int (wire);
+  newt->created = wire_get_time (wire);
+  newt->modified = wire_get_time (wire);
+  newt->total_resps = (int) wire_get_int (wire);
+  replace (&newt->text, wire_get_string (wire));
+  newt->options = (int) wire_get_int (wire);
+}
+
+static void
+reserve (struct wire *wire, size_t length)
+{
+  if (wire->length + length > wire->size)
+    {
+      size_t size = wire->length + length;
+
+      wire->data = newts_realloc2 (wire->data, &size);
+      wire->size = size;
+    }
+}
+
+static void
+put_bytes (struct wire *wire, const void *data, size_t length)
+{
+  reserve (wire, length);
+  memcpy (wire->data + wire->length, data, length);
+  wire->length += length;
+}
+
+static void
+put_u32 (struct wire *wire, unsigned long value)
+{
+  unsigned char bytes[4];
+
+  bytes[0] = (unsigned char) (value >> 24);
+  bytes[1] = (unsigned char) (value >> 16);
+  bytes[2] = (unsigned char) (value >> 8);
+  bytes[3] = (unsigned char) value;
+  put_bytes (wire, bytes, 4);
+}
+
+static unsigned long
+get_u32 (struct wire *wire)
+{
+  const unsigned char *bytes;
+
+  if (wire->failed || wire->pos + 4 > wire->length)
+    {
+      wire->failed = TRUE;
+      return 0;
+    }
+
+  bytes = wire->data + wire->pos;
+  wire->pos += 4;
+
+  return ((unsigned long) bytes[0] << 24) | ((unsigned long) bytes[1] << 16)
+    | ((unsigned long) bytes[2] << 8) | (unsigned long) bytes[3];
+}
+
+static void
+replace (char **field, char *value)
+{
+  newts_free (*field);
+  *field = value;
+}
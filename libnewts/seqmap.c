@@ -0,0 +1,158 @@
+/*
+ * seqmap.c - methods for handling the newts_seqmap data type
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "internal.h"
+#include "newts/memory.h"
+#include "newts/nfref.h"
+#include "newts/sequencer.h"
+
+#define INITIAL_BUCKETS 64
+
+static unsigned long hash_name (const char *name);
+static struct newts_seqentry *find (const newts_seqmap *map,
+                                    const char *name);
+static void grow (newts_seqmap *map);
+
+newts_seqmap *
+seqmap_alloc (void)
+{
+  newts_seqmap *map = newts_zalloc (sizeof (newts_seqmap));
+
+  map->nbuckets = INITIAL_BUCKETS;
+  map->buckets = newts_zalloc (map->nbuckets *
+                               sizeof (struct newts_seqentry *));
+
+  return map;
+}
+
+void
+seqmap_free (newts_seqmap *map)
+{
+  struct newts_seqentry *entry, *next;
+  unsigned i;
+
+  for (i = 0; i < map->nbuckets; i++)
+    for (entry = map->buckets[i]; entry != NULL; entry = next)
+      {
+        next = entry->next;
+        newts_free (entry->name);
+        newts_free (entry);
+      }
+
+  newts_free (map->buckets);
+  newts_free (map);
+}
+
+int
+seqmap_get (const newts_seqmap *map, const newts_nfref *ref, time_t *seq)
+{
+  struct newts_seqentry *entry = find (map, nfref_name (ref));
+
+  *seq = entry != NULL ? entry->seq : 0;
+
+  return entry != NULL ? 0 : -1;
+}
+
+void
+seqmap_set (newts_seqmap *map, const newts_nfref *ref, time_t seq)
+{
+  seqmap_store (map, nfref_name (ref), seq, TRUE);
+}
+
+void
+seqmap_store (newts_seqmap *map, const char *name, time_t seq, int changed)
+{
+  struct newts_seqentry *entry = find (map, name);
+
+  if (entry == NULL)
+    {
+      unsigned long bucket;
+
+      if (map->count >= map->nbuckets)
+        grow (map);
+
+      bucket = hash_name (name) % map->nbuckets;
+      entry = newts_zalloc (sizeof (struct newts_seqentry));
+      entry->name = newts_strdup (name);
+      entry->next = map->buckets[bucket];
+      map->buckets[bucket] = entry;
+      map->count++;
+    }
+  else if (entry->changed && !changed)
+    return;
+
+  entry->seq = seq;
+  entry->changed = changed;
+}
+
+static unsigned long
+hash_name (const char *name)
+{
+  unsigned long hash = 0;
+
+  while (*name)
+    hash = hash * 31 + (unsigned char) *name++;
+
+  return hash;
+}
+
+static struct newts_seqentry *
+find (const newts_seqmap *map, const char *name)
+{
+  struct newts_seqentry *entry;
+
+  for (entry = map->buckets[hash_name (name) % map->nbuckets];
+       entry != NULL; entry = entry->next)
+    if (strcmp (entry->name, name) == 0)
+      return entry;
+
+  return NULL;
+}
+
+/* grow - double the number of buckets in MAP. */
+
+static void
+grow (newts_seqmap *map)
+{
+  unsigned nbuckets = map->nbuckets * 2;
+  struct newts_seqentry **buckets =
+    newts_zalloc (nbuckets * sizeof (struct newts_seqentry *));
+  struct newts_seqentry *entry, *next;
+  unsigned i;
+
+  for (i = 0; i < map->nbuckets; i++)
+    for (entry = map->buckets[i]; entry != NULL; entry = next)
+      {
+        unsigned long bucket = hash_name (entry->name) % nbuckets;
+
+        next = entry->next;
+        entry->next = buckets[bucket];
+        buckets[bucket] = entry;
+      }
+
+  newts_free (map->buckets);
+  map->buckets = buckets;
+  map->nbuckets = nbuckets;
+}
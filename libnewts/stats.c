@@ -47,6 +47,9 @@ stats_accumulate (const struct stats *stats, struct stats *total)
   total->entries += stats->entries;
   total->total_time += stats->total_time;
   total->days_used += stats->days_used;
+  total->text_size += stats->text_size;
+  total->text_free += stats->text_free;
+  total->free_extents += stats->free_extents;
 
   return;
 }
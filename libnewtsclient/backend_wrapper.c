@@ -24,24 +24,77 @@
 #endif
 
 #include "internal.h"
+#include "protocol.h"
 #include "newts/newts.h"
 #include "newts/uiuc.h"
 
+/* Notesfiles named with the noted:// protocol are reached through noted, for
+ * the calls its protocol carries; see noted_client.c.  Everything else goes
+ * straight to the UIUC backend, which is also where the other calls on
+ * noted's notesfiles go, since noted serves the ones on this machine.
+ */
+
+static int
+remote (const newts_nfref *ref)
+{
+  return ref != NULL && nfref_protocol (ref) == NEWTS_PROTOCOL_NOTED;
+}
+
 inline int
 author_search (struct newtref *nrp, const char *search)
 {
   return uiuc_author_search (nrp, search);
 }
 
+inline int
+author_search_all (const newts_nfref *ref, const char *author,
+                   struct newts_match **matches)
+{
+  if (ref == NULL || author == NULL || matches == NULL)
+    return NEWTS_NULL_POINTER;
+
+  if (remote (ref))
+    return noted_search (NOTED_SEARCH_AUTHOR, ref, author, 0, matches);
+
+  return uiuc_author_search_all (ref, author, matches);
+}
+
+inline int
+begin_batch (struct notesfile *nf)
+{
+  if (nf == NULL)
+    return NEWTS_NULL_POINTER;
+
+  if (remote (nf->ref))
+    return NEWTS_NO_ERROR;      /* noted decides when to sync. */
+
+  return uiuc_begin_batch (nf);
+}
+
 inline int
 close_nf (struct notesfile *nf, int updatestats)
 {
   if (nf == NULL)
     return NEWTS_NULL_POINTER;
 
+  if (remote (nf->ref))
+    return noted_close_nf (nf, updatestats);
+
   return uiuc_close_nf (nf, updatestats);
 }
 
+inline int
+commit_batch (struct notesfile *nf)
+{
+  if (nf == NULL)
+    return NEWTS_NULL_POINTER;
+
+  if (remote (nf->ref))
+    return NEWTS_NO_ERROR;
+
+  return uiuc_commit_batch (nf);
+}
+
 inline int
 compress_nf (struct notesfile *nf, unsigned *numnotes, unsigned *numresps)
 {
@@ -51,6 +104,17 @@ compress_nf (struct notesfile *nf, unsigned *numnotes, unsigned *numresps)
   return uiuc_compress_nf (nf, numnotes, numresps);
 }
 
+inline int
+compress_nf_online (struct notesfile *nf, unsigned *numnotes,
+                    unsigned *numresps,
+                    void (*progress) (unsigned, unsigned, void *), void *data)
+{
+  if (nf == NULL)
+    return NEWTS_NULL_POINTER;
+
+  return uiuc_compress_nf_online (nf, numnotes, numresps, progress, data);
+}
+
 inline int
 create_nf (const newts_nfref *ref, int flags)
 {
@@ -72,6 +136,9 @@ delete_nf (const newts_nfref *ref)
 inline int
 delete_note (struct newtref *nrp)
 {
+  if (nrp != NULL && remote (&nrp->nfr))
+    return noted_delete_note (nrp);
+
   return uiuc_delete_note (nrp);
 }
 
@@ -84,6 +151,24 @@ get_access_list (const newts_nfref *ref, List *list)
   return uiuc_get_access_list (ref, list);
 }
 
+inline int
+get_all_seqtimes (const char *name, newts_seqmap *map)
+{
+  if (name == NULL || map == NULL)
+    return NEWTS_NULL_POINTER;
+
+  return uiuc_get_all_seqtimes (name, map);
+}
+
+inline int
+get_changes (const newts_nfref *ref, time_t seq, struct newts_change **changes)
+{
+  if (ref == NULL || changes == NULL)
+    return NEWTS_NULL_POINTER;
+
+  return uiuc_get_changes (ref, seq, changes);
+}
+
 inline int
 get_next_bug (const struct notesfile *nf)
 {
@@ -96,6 +181,9 @@ get_next_bug (const struct notesfile *nf)
 inline int
 get_next_note (struct newtref *nrp, time_t seq)
 {
+  if (nrp != NULL && remote (&nrp->nfr))
+    return noted_get_next_note (nrp, seq);
+
   return uiuc_get_next_note (nrp, seq);
 }
 
@@ -108,15 +196,35 @@ get_next_resp (struct newtref *nrp, time_t seq)
 inline int
 get_note (struct newt *notep, short updatestats)
 {
+  if (notep != NULL && remote (&notep->nr.nfr))
+    return noted_get_note (notep, updatestats);
+
   return uiuc_get_note (notep, updatestats);
 }
 
+inline int
+get_notes_range (struct newt *newts, int count, int flags)
+{
+  if (newts == NULL)
+    return NEWTS_NULL_POINTER;
+  if (count <= 0)
+    return 0;
+
+  if (remote (&newts[0].nr.nfr))
+    return noted_get_notes_range (newts, count, flags);
+
+  return uiuc_get_notes_range (newts, count, flags);
+}
+
 inline int
 get_seqtime (const newts_nfref *ref, const char *name, time_t *seq)
 {
   if (ref == NULL)
     return NEWTS_NULL_POINTER;
 
+  if (remote (ref))
+    return noted_get_seqtime (ref, name, seq);
+
   return uiuc_get_seqtime (ref, name, seq);
 }
 
@@ -141,15 +249,30 @@ modify_nf (struct notesfile *nf)
 inline int
 modify_note (struct newt *notep, int flags)
 {
+  if (notep != NULL && remote (&notep->nr.nfr))
+    return noted_modify_note (notep, flags);
+
   return uiuc_modify_note (notep, flags);
 }
 
 inline int
 modify_note_text (struct newt *notep)
 {
+  if (notep != NULL && remote (&notep->nr.nfr))
+    return noted_modify_note_text (notep);
+
   return uiuc_modify_note_text (notep);
 }
 
+inline int
+next_new_note (struct newtref *nrp)
+{
+  if (nrp == NULL)
+    return NEWTS_NULL_POINTER;
+
+  return noted_next_new_note (nrp);
+}
+
 inline int
 open_nf (const newts_nfref *ref, struct notesfile *nf)
 {
@@ -159,6 +282,15 @@ open_nf (const newts_nfref *ref, struct notesfile *nf)
   if (nf == NULL)
     return NEWTS_NULL_POINTER;
 
+  /* Reopening NF by another route means letting go of the old one first. */
+
+  if (nf->handle != NULL && nf->ref != NULL &&
+      remote (nf->ref) != remote (ref))
+    close_nf (nf, FALSE);
+
+  if (remote (ref))
+    return noted_open_nf (ref, nf);
+
   return uiuc_open_nf (ref, nf);
 }
 
@@ -168,27 +300,80 @@ set_seqtime (const newts_nfref *ref, const char *name, time_t seq)
   if (ref == NULL)
     return NEWTS_NULL_POINTER;
 
+  if (remote (ref))
+    return noted_set_seqtime (ref, name, seq);
+
   return uiuc_set_seqtime (ref, name, seq);
 }
 
+inline int
+set_seqtimes (const char *name, newts_seqmap *map)
+{
+  if (name == NULL || map == NULL)
+    return NEWTS_NULL_POINTER;
+
+  return uiuc_set_seqtimes (name, map);
+}
+
+inline int
+set_sync_policy (int policy, unsigned interval)
+{
+  return uiuc_set_sync_policy (policy, interval);
+}
+
 inline int
 text_search (struct newtref *nrp, const char *search)
 {
   return uiuc_text_search (nrp, search);
 }
 
+inline int
+text_search_all (const newts_nfref *ref, const char *search, int flags,
+                 struct newts_match **matches)
+{
+  if (ref == NULL || search == NULL || matches == NULL)
+    return NEWTS_NULL_POINTER;
+
+  if (remote (ref))
+    return noted_search (NOTED_SEARCH_TEXT, ref, search, flags, matches);
+
+  return uiuc_text_search_all (ref, search, flags, matches);
+}
+
 inline int
 title_search (struct newtref *nrp, const char *search)
 {
   return uiuc_title_search (nrp, search);
 }
 
+inline int
+title_search_all (const newts_nfref *ref, const char *search,
+                  struct newts_match **matches)
+{
+  if (ref == NULL || search == NULL || matches == NULL)
+    return NEWTS_NULL_POINTER;
+
+  if (remote (ref))
+    return noted_search (NOTED_SEARCH_TITLE, ref, search, 0, matches);
+
+  return uiuc_title_search_all (ref, search, matches);
+}
+
 inline int
 update_nf (struct notesfile *nf)
 {
   return uiuc_update_nf (nf);
 }
 
+inline int
+watch_nfs (const char *name, newts_nfref **refs, int count, int *fresh)
+{
+  if (name == NULL || refs == NULL || fresh == NULL)
+    return NEWTS_NULL_POINTER;
+
+  return noted_watch_nfs (name, refs, count, fresh);
+}
+
 inline int
 write_access_list (const newts_nfref *ref, List *list)
 {
@@ -204,5 +389,8 @@ write_note (struct notesfile *nf, struct newt *notep, int flags)
   if (nf == NULL)
     return NEWTS_NULL_POINTER;
 
+  if (remote (nf->ref))
+    return noted_write_note (nf, notep, flags);
+
   return uiuc_write_note (nf, notep, flags);
 }
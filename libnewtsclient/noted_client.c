@@ -0,0 +1,982 @@
+/*
+ * noted_client.c - client calls carried to noted
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "internal.h"
+#include "protocol.h"
+#include "newts/uiuc.h"
+
+#if HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+
+#if HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+#if NOTED_RINGS
+# include <sys/mman.h>
+#endif
+
+#include <sys/un.h>
+
+/* Calls on notesfiles named noted://... come here from backend_wrapper.c.
+ * The process keeps one connection to noted, made when it's first needed;
+ * if it breaks, the call fails with -1 and the next call connects again.
+ *
+ * Each call sends its request and waits for the reply with the same ID.
+ * Replies that turn up for other requests are kept until they're asked for,
+ * so a call may have several requests out at once: get_notes_range sends a
+ * window of get_note requests ahead of the replies it's reading.  Events
+ * about watched notesfiles are kept the same way, under their own ID, until
+ * next_new_note asks for one.
+ *
+ * On connecting, we ask noted for a ring, and if we get one, text of any
+ * length is copied straight out of it rather than read from the socket.
+ */
+
+#define PIPELINE_DEPTH 32       /* Most get_note requests out at once. */
+
+/* What noted's handle on an open notesfile looks like to us. */
+
+struct remote_nf
+{
+  long id;
+};
+
+/* A reply that came before it was asked for. */
+
+struct early_reply
+{
+  unsigned long id;
+  struct wire wire;
+  struct early_reply *next;
+};
+
+static int sock = -1;
+static unsigned long next_id = 1;
+static struct early_reply *early = NULL;
+
+/* The notesfiles being watched, as noted numbers them, and where each was in
+ * the list given to watch_nfs.
+ */
+
+static newts_nfref **watched = NULL;
+static int *watched_index = NULL;
+static int nwatched = 0;
+
+/* Our ring, if noted gave us one, and the last descriptor it passed us. */
+
+static struct noted_ring *ring = NULL;
+static size_t ring_size = 0;
+static int passed_fd = -1;
+
+static int connect_noted (void);
+static void map_ring (void);
+static void disconnect (void);
+static unsigned long begin_request (struct wire *wire, int operation);
+static int send_request (struct wire *wire);
+static int await_reply (unsigned long id, struct wire *reply);
+static int call (struct wire *request, struct wire *reply);
+static int read_fully (void *buffer, size_t length);
+static void get_text (struct wire *reply, struct newt *newt);
+static int local (const newts_nfref *ref);
+static void forget_watches (void);
+
+int
+noted_open_nf (const newts_nfref *ref, struct notesfile *nf)
+{
+  struct wire request, reply;
+  struct uiuc_opts *opts;
+  struct remote_nf *remote;
+  int result;
+
+  wire_init (&request);
+  wire_init (&reply);
+
+  begin_request (&request, NOTED_OPEN_NF);
+  wire_put_nfref (&request, ref);
+
+  result = call (&request, &reply);
+
+  if (result == NEWTS_NO_ERROR)
+    {
+      /* Let go of whatever NF had open before. */
+
+      if (nf->handle != NULL)
+        noted_close_nf (nf, FALSE);
+
+      if (nf->ref)
+        nfref_free (nf->ref);
+      nf->ref = nfref_alloc ();
+      nfref_copy (nf->ref, ref);
+
+      remote = newts_malloc (sizeof (struct remote_nf));
+      remote->id = wire_get_int (&reply);
+      nf->handle = remote;
+
+      newts_free (nf->title);
+      nf->title = wire_get_string (&reply);
+      newts_free (nf->director_message);
+      nf->director_message = wire_get_string (&reply);
+      nf->total_notes = (unsigned) wire_get_int (&reply);
+      nf->modified = wire_get_time (&reply);
+      nf->time_entered = wire_get_time (&reply);
+      nf->options = (int) wire_get_int (&reply);
+      nf->perms = (short) wire_get_int (&reply);
+
+      opts = newts_zalloc (sizeof (struct uiuc_opts));
+      opts->deleted_notes = (int) wire_get_int (&reply);
+      opts->deleted_resps = (int) wire_get_int (&reply);
+      opts->expire_threshold = (int) wire_get_int (&reply);
+      opts->expire_action = (int) wire_get_int (&reply);
+      opts->expire_by_dirmsg = (int) wire_get_int (&reply);
+      opts->minimum_notes = (int) wire_get_int (&reply);
+      opts->maximum_note_size = (int) wire_get_int (&reply);
+      opts->notesfile_number = (int) wire_get_int (&reply);
+      opts->current_note_id = (int) wire_get_int (&reply);
+      newts_free (nf->opts);
+      nf->opts = (struct opts *) opts;
+
+      if (reply.failed)
+        result = -1;
+    }
+
+  wire_free (&request);
+  wire_free (&reply);
+
+  return result;
+}
+
+int
+noted_close_nf (struct notesfile *nf, int updatestats)
+{
+  struct wire request, reply;
+  struct remote_nf *remote = nf->handle;
+  int result;
+
+  if (remote == NULL)
+    return NEWTS_NO_ERROR;
+
+  wire_init (&request);
+  wire_init (&reply);
+
+  begin_request (&request, NOTED_CLOSE_NF);
+  wire_put_int (&request, remote->id);
+  wire_put_byte (&request, updatestats);
+
+  result = call (&request, &reply);
+
+  newts_free (remote);
+  nf->handle = NULL;
+
+  wire_free (&request);
+  wire_free (&reply);
+
+  return result;
+}
+
+int
+noted_get_note (struct newt *notep, short updatestats)
+{
+  struct wire request, reply;
+  int flags, result;
+
+  if (connect_noted () < 0)
+    return -1;
+  flags = ring != NULL ? NOTED_TEXT_IN_RING : 0;
+
+  wire_init (&request);
+  wire_init (&reply);
+
+  begin_request (&request, NOTED_GET_NOTE);
+  wire_put_newtref (&request, &notep->nr);
+  wire_put_byte (&request, updatestats);
+  wire_put_int (&request, flags);
+
+  result = call (&request, &reply);
+
+  if (result == 0 || result == -3)
+    {
+      wire_get_newt (&reply, notep);
+      if (flags & NOTED_TEXT_IN_RING)
+        get_text (&reply, notep);
+      if (reply.failed)
+        result = -1;
+    }
+
+  wire_free (&request);
+  wire_free (&reply);
+
+  return result;
+}
+
+/* noted_get_notes_range - fetch the newts one at a time, as get_notes_range
+ * promises to be equivalent to, but without waiting for each before asking
+ * for the next.
+ */
+
+int
+noted_get_notes_range (struct newt *newts, int count, int flags)
+{
+  struct wire request, reply;
+  unsigned long ids[PIPELINE_DEPTH];
+  int sent = 0, received = 0, filled = 0, stopped = FALSE;
+  int result = 0;
+
+  if (count <= 0)
+    return 0;
+  if (connect_noted () < 0)
+    return -1;
+  if (ring != NULL)
+    flags |= NOTED_TEXT_IN_RING;
+
+  wire_init (&request);
+  wire_init (&reply);
+
+  while (received < sent || (!stopped && sent < count))
+    {
+      /* Keep the window full... */
+
+      while (!stopped && sent < count && sent - received < PIPELINE_DEPTH)
+        {
+          struct newtref nr = newts[0].nr;
+
+          if (nr.respnum == 0)
+            nr.notenum += sent;
+          else
+            nr.respnum += sent;
+
+          ids[sent % PIPELINE_DEPTH] = begin_request (&request,
+                                                      NOTED_GET_NOTE);
+          wire_put_newtref (&request, &nr);
+          wire_put_byte (&request, FALSE);
+          wire_put_int (&request, flags);
+
+          if (send_request (&request) < 0)
+            {
+              wire_free (&request);
+              wire_free (&reply);
+              return -1;
+            }
+          sent++;
+        }
+
+      /* ...and take the replies in order.  Corrupted and unapproved newts
+       * come with placeholders and count as filled in, as they do for
+       * uiuc_get_notes_range.  After the first newt that isn't there, the
+       * rest can't be either; their replies are just drained.
+       */
+
+      result = await_reply (ids[received % PIPELINE_DEPTH], &reply);
+      if (reply.failed)
+        {
+          wire_free (&request);
+          wire_free (&reply);
+          return -1;
+        }
+
+      if (!stopped && (result == 0 || result == -3))
+        {
+          struct newt *newtp = &newts[received];
+          char *text = newtp->text;
+
+          if (flags & FETCH_NO_TEXT)
+            newtp->text = NULL;
+
+          wire_get_newt (&reply, newtp);
+          if (flags & NOTED_TEXT_IN_RING)
+            get_text (&reply, newtp);
+
+          if (flags & FETCH_NO_TEXT)
+            {
+              newts_free (newtp->text);
+              newtp->text = text;
+            }
+
+          filled++;
+        }
+      else if (!stopped)
+        {
+          stopped = TRUE;
+          if (filled == 0)
+            filled = result;
+        }
+
+      received++;
+    }
+
+  wire_free (&request);
+  wire_free (&reply);
+
+  return filled;
+}
+
+int
+noted_get_next_note (struct newtref *nrp, time_t seq)
+{
+  struct wire request, reply;
+  int result;
+
+  wire_init (&request);
+  wire_init (&reply);
+
+  begin_request (&request, NOTED_GET_NEXT_NOTE);
+  wire_put_newtref (&request, nrp);
+  wire_put_time (&request, seq);
+
+  result = call (&request, &reply);
+
+  if (!reply.failed && reply.pos < reply.length)
+    nrp->notenum = (int) wire_get_int (&reply);
+
+  wire_free (&request);
+  wire_free (&reply);
+
+  return result;
+}
+
+int
+noted_write_note (struct notesfile *nf, struct newt *notep, int flags)
+{
+  struct wire request, reply;
+  struct remote_nf *remote = nf->handle;
+  int result;
+
+  if (remote == NULL)
+    return -1;
+
+  wire_init (&request);
+  wire_init (&reply);
+
+  begin_request (&request, NOTED_WRITE_NOTE);
+  wire_put_int (&request, remote->id);
+  wire_put_int (&request, flags);
+  wire_put_newt (&request, notep);
+
+  result = call (&request, &reply);
+
+  if (result >= 0)
+    nf->total_notes = (unsigned) wire_get_int (&reply);
+
+  wire_free (&request);
+  wire_free (&reply);
+
+  return result;
+}
+
+int
+noted_delete_note (struct newtref *nrp)
+{
+  struct wire request, reply;
+  int result;
+
+  wire_init (&request);
+  wire_init (&reply);
+
+  begin_request (&request, NOTED_DELETE_NOTE);
+  wire_put_newtref (&request, nrp);
+
+  result = call (&request, &reply);
+
+  wire_free (&request);
+  wire_free (&reply);
+
+  return result;
+}
+
+int
+noted_modify_note (struct newt *notep, int flags)
+{
+  struct wire request, reply;
+  int result;
+
+  wire_init (&request);
+  wire_init (&reply);
+
+  begin_request (&request, NOTED_MODIFY_NOTE);
+  wire_put_nfref (&request, &notep->nr.nfr);
+  wire_put_int (&request, flags);
+  wire_put_newt (&request, notep);
+
+  result = call (&request, &reply);
+
+  wire_free (&request);
+  wire_free (&reply);
+
+  return result;
+}
+
+int
+noted_modify_note_text (struct newt *notep)
+{
+  struct wire request, reply;
+  int result;
+
+  wire_init (&request);
+  wire_init (&reply);
+
+  begin_request (&request, NOTED_MODIFY_NOTE_TEXT);
+  wire_put_nfref (&request, &notep->nr.nfr);
+  wire_put_newt (&request, notep);
+
+  result = call (&request, &reply);
+
+  wire_free (&request);
+  wire_free (&reply);
+
+  return result;
+}
+
+int
+noted_search (int kind, const newts_nfref *ref, const char *search, int flags,
+              struct newts_match **matches)
+{
+  struct wire request, reply;
+  int result, i;
+
+  *matches = NULL;
+
+  wire_init (&request);
+  wire_init (&reply);
+
+  begin_request (&request, NOTED_SEARCH);
+  wire_put_byte (&request, kind);
+  wire_put_nfref (&request, ref);
+  wire_put_string (&request, search);
+  wire_put_int (&request, flags);
+
+  result = call (&request, &reply);
+
+  if (result > 0)
+    {
+      *matches = newts_nmalloc ((size_t) result, sizeof (struct newts_match));
+      for (i = 0; i < result; i++)
+        {
+          (*matches)[i].notenum = (int) wire_get_int (&reply);
+          (*matches)[i].respnum = (int) wire_get_int (&reply);
+          (*matches)[i].score = wire_get_double (&reply);
+        }
+
+      if (reply.failed)
+        {
+          newts_free (*matches);
+          *matches = NULL;
+          result = -1;
+        }
+    }
+
+  wire_free (&request);
+  wire_free (&reply);
+
+  return result;
+}
+
+int
+noted_get_seqtime (const newts_nfref *ref, const char *name, time_t *seq)
+{
+  struct wire request, reply;
+  int result;
+
+  wire_init (&request);
+  wire_init (&reply);
+
+  begin_request (&request, NOTED_GET_SEQTIME);
+  wire_put_nfref (&request, ref);
+  wire_put_string (&request, name);
+
+  result = call (&request, &reply);
+
+  if (result == NEWTS_NO_ERROR)
+    *seq = wire_get_time (&reply);
+
+  wire_free (&request);
+  wire_free (&reply);
+
+  return result;
+}
+
+int
+noted_set_seqtime (const newts_nfref *ref, const char *name, time_t seq)
+{
+  struct wire request, reply;
+  int result;
+
+  wire_init (&request);
+  wire_init (&reply);
+
+  begin_request (&request, NOTED_SET_SEQTIME);
+  wire_put_nfref (&request, ref);
+  wire_put_string (&request, name);
+  wire_put_time (&request, seq);
+
+  result = call (&request, &reply);
+
+  wire_free (&request);
+  wire_free (&reply);
+
+  return result;
+}
+
+/* noted_watch_nfs - watch those of the notesfiles in REFS that are on this
+ * system; noted can't know about the others.
+ */
+
+int
+noted_watch_nfs (const char *name, newts_nfref **refs, int count, int *fresh)
+{
+  struct wire request, reply;
+  int result, i;
+
+  forget_watches ();
+
+  watched = newts_nmalloc ((size_t) count + 1, sizeof (newts_nfref *));
+  watched_index = newts_nmalloc ((size_t) count + 1, sizeof (int));
+
+  for (i = 0; i < count; i++)
+    {
+      fresh[i] = -1;
+
+      if (local (refs[i]))
+        {
+          watched[nwatched] = nfref_alloc ();
+          nfref_copy (watched[nwatched], refs[i]);
+          watched_index[nwatched++] = i;
+        }
+    }
+
+  wire_init (&request);
+  wire_init (&reply);
+
+  begin_request (&request, NOTED_WATCH);
+  wire_put_string (&request, name);
+  wire_put_int (&request, nwatched);
+  for (i = 0; i < nwatched; i++)
+    wire_put_nfref (&request, watched[i]);
+
+  result = call (&request, &reply);
+
+  if (result == 0)
+    for (i = 0; i < nwatched; i++)
+      fresh[watched_index[i]] = (int) wire_get_int (&reply);
+
+  if (reply.failed)
+    result = -1;
+
+  wire_free (&request);
+  wire_free (&reply);
+
+  return result < 0 ? -1 : 0;
+}
+
+int
+noted_next_new_note (struct newtref *nrp)
+{
+  struct wire reply;
+  long which;
+  int result;
+
+  if (sock < 0 || nwatched == 0)
+    return -1;
+
+  wire_init (&reply);
+
+  result = await_reply (NOTED_EVENT, &reply);
+  which = wire_get_int (&reply);
+  nrp->notenum = (int) wire_get_int (&reply);
+  nrp->respnum = (int) wire_get_int (&reply);
+
+  if (result != 0 || reply.failed || which < 0 || which >= nwatched)
+    result = -1;
+  else
+    {
+      nfref_copy (&nrp->nfr, watched[which]);
+      result = watched_index[which];
+    }
+
+  wire_free (&reply);
+
+  return result;
+}
+
+/* connect_noted - make sure we're connected to noted.  Returns 0, or -1 if
+ * we can't be.
+ */
+
+static int
+connect_noted (void)
+{
+  struct sockaddr_un name;
+  const char *path;
+
+  if (sock >= 0)
+    return 0;
+
+  path = getenv (NOTED_SOCKET_ENV);
+  if (path == NULL || *path == '\0')
+    path = NOTED_SOCKET;
+
+  if (strlen (path) >= sizeof name.sun_path)
+    return -1;
+
+  memset (&name, 0, sizeof name);
+  name.sun_family = AF_UNIX;
+  strcpy (name.sun_path, path);
+
+  if ((sock = socket (PF_UNIX, SOCK_STREAM, 0)) < 0)
+    return -1;
+
+  if (TEMP_FAILURE_RETRY (connect (sock, (struct sockaddr *) &name,
+                                   sizeof name)) < 0)
+    {
+      close (sock);
+      sock = -1;
+      return -1;
+    }
+
+  map_ring ();
+
+  return sock >= 0 ? 0 : -1;
+}
+
+/* map_ring - ask noted for a ring, and map it if we get one.  Without one,
+ * text just comes down the socket.
+ */
+
+static void
+map_ring (void)
+{
+#if NOTED_RINGS
+  struct wire request, reply;
+  struct stat st;
+  void *base;
+  long size = 0;
+
+  wire_init (&request);
+  wire_init (&reply);
+
+  if (passed_fd >= 0)
+    close (passed_fd);
+  passed_fd = -1;
+
+  begin_request (&request, NOTED_MAP_RING);
+  if (call (&request, &reply) == 0)
+    size = wire_get_int (&reply);
+
+  if (!reply.failed && size > 0 && passed_fd >= 0
+      && fstat (passed_fd, &st) == 0
+      && st.st_size >= (off_t) (sizeof (struct noted_ring) + (size_t) size))
+    {
+      base = mmap (NULL, sizeof (struct noted_ring) + (size_t) size,
+                   PROT_READ | PROT_WRITE, MAP_SHARED, passed_fd, 0);
+      if (base != MAP_FAILED)
+        {
+          ring = base;
+          ring_size = (size_t) size;
+        }
+    }
+
+  if (passed_fd >= 0)
+    close (passed_fd);
+  passed_fd = -1;
+
+  wire_free (&request);
+  wire_free (&reply);
+#endif
+}
+
+/* disconnect - give up on the connection, and on any replies still due on
+ * it.
+ */
+
+static void
+disconnect (void)
+{
+  struct early_reply *next;
+
+  if (sock >= 0)
+    close (sock);
+  sock = -1;
+
+#if NOTED_RINGS
+  if (ring != NULL)
+    munmap ((void *) ring, sizeof (struct noted_ring) + ring_size);
+#endif
+  ring = NULL;
+  ring_size = 0;
+
+  for (; early != NULL; early = next)
+    {
+      next = early->next;
+      wire_free (&early->wire);
+      newts_free (early);
+    }
+}
+
+/* begin_request - start a request for OPERATION in WIRE, and return its
+ * ID.
+ */
+
+static unsigned long
+begin_request (struct wire *wire, int operation)
+{
+  unsigned long id = next_id;
+
+  next_id = (next_id + 1) & 0xffffffffUL;
+  if (next_id == 0)
+    next_id = 1;
+
+  wire_begin (wire, id);
+  wire_put_byte (wire, operation);
+
+  return id;
+}
+
+/* send_request - finish the request in WIRE and send it.  Returns 0, or -1
+ * if it couldn't be sent.
+ */
+
+static int
+send_request (struct wire *wire)
+{
+  size_t sent = 0;
+  ssize_t count;
+
+  if (connect_noted () < 0)
+    return -1;
+
+  wire_finish (wire);
+
+  while (sent < wire->length)
+    {
+      count = TEMP_FAILURE_RETRY (write (sock, wire->data + sent,
+                                         wire->length - sent));
+      if (count <= 0)
+        {
+          disconnect ();
+          return -1;
+        }
+      sent += (size_t) count;
+    }
+
+  return 0;
+}
+
+/* await_reply - wait for the reply to request ID, and leave it in REPLY
+ * ready to read the results from.  Returns its status, or -1 with
+ * REPLY->FAILED set if it didn't come.
+ */
+
+static int
+await_reply (unsigned long id, struct wire *reply)
+{
+  struct early_reply **prev, *found;
+  unsigned char header[NOTED_HEADER];
+  unsigned long length;
+
+  for (prev = &early; *prev != NULL; prev = &(*prev)->next)
+    if ((*prev)->id == id)
+      {
+        found = *prev;
+        *prev = found->next;
+        wire_free (reply);
+        *reply = found->wire;
+        newts_free (found);
+        return (int) wire_get_int (reply);
+      }
+
+  while (sock >= 0)
+    {
+      if (read_fully (header, NOTED_HEADER) < 0)
+        break;
+
+      length = wire_peek_length (header);
+      if (length < NOTED_HEADER + 4)
+        break;
+
+      wire_take (reply, header, NOTED_HEADER);
+      reply->length = length;
+      if (reply->size < length)
+        {
+          size_t size = length;
+
+          reply->data = newts_realloc2 (reply->data, &size);
+          reply->size = size;
+        }
+      if (read_fully (reply->data + NOTED_HEADER, length - NOTED_HEADER) < 0)
+        break;
+
+      if (wire_peek_id (header) == id)
+        return (int) wire_get_int (reply);
+
+      /* Someone else's; keep it for them. */
+
+      found = newts_zalloc (sizeof (struct early_reply));
+      found->id = wire_peek_id (header);
+      found->wire = *reply;
+      found->next = early;
+      early = found;
+      wire_init (reply);
+    }
+
+  disconnect ();
+  wire_take (reply, "", 0);
+  return -1;
+}
+
+/* call - send REQUEST and wait for its reply in REPLY.  Returns the reply's
+ * status, or -1 if noted couldn't be reached.
+ */
+
+static int
+call (struct wire *request, struct wire *reply)
+{
+  if (send_request (request) < 0)
+    {
+      wire_take (reply, "", 0);
+      return -1;
+    }
+
+  return await_reply (wire_peek_id (request->data), reply);
+}
+
+/* local - return TRUE if REF is a notesfile noted serves. */
+
+static int
+local (const newts_nfref *ref)
+{
+  return (nfref_protocol (ref) == NEWTS_PROTOCOL_NCP ||
+          nfref_protocol (ref) == NEWTS_PROTOCOL_NOTED) &&
+    nfref_system_is_localhost (ref);
+}
+
+/* forget_watches - forget the notesfiles we were watching. */
+
+static void
+forget_watches (void)
+{
+  int i;
+
+  for (i = 0; i < nwatched; i++)
+    nfref_free (watched[i]);
+
+  newts_free (watched);
+  newts_free (watched_index);
+  watched = NULL;
+  watched_index = NULL;
+  nwatched = 0;
+}
+
+/* get_text - take the text of NEWT, sent after it with NOTED_TEXT_IN_RING,
+ * from REPLY or from our ring.  Sets REPLY->FAILED if it makes no sense.
+ */
+
+static void
+get_text (struct wire *reply, struct newt *newt)
+{
+  long slot = wire_get_int (reply);
+  unsigned long offset, length;
+
+  newts_free (newt->text);
+  newt->text = NULL;
+
+  if (slot < 0)
+    {
+      newt->text = wire_get_string (reply);
+      return;
+    }
+
+  offset = (unsigned long) wire_get_int (reply);
+  length = (unsigned long) wire_get_int (reply);
+
+  if (reply->failed || ring == NULL || slot >= NOTED_RING_SLOTS ||
+      offset > ring_size || length > ring_size - offset)
+    {
+      reply->failed = TRUE;
+      return;
+    }
+
+  newt->text = newts_malloc ((size_t) length + 1);
+  memcpy (newt->text, (char *) (ring + 1) + offset, (size_t) length);
+  newt->text[length] = '\0';
+
+  /* noted may reuse the space as soon as it sees the slot free. */
+
+#if NOTED_RINGS
+  __sync_synchronize ();
+#endif
+  *(volatile unsigned *) &ring->busy[slot] = 0;
+}
+
+/* read_fully - read exactly LENGTH bytes from noted into BUFFER, keeping any
+ * descriptor passed along with them in PASSED_FD.  Returns 0, or -1 if the
+ * connection broke.
+ */
+
+static int
+read_fully (void *buffer, size_t length)
+{
+  char *p = buffer;
+  ssize_t count;
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union
+  {
+    struct cmsghdr align;
+    char space[CMSG_SPACE (sizeof (int))];
+  } control;
+  int fd;
+
+  while (length > 0)
+    {
+      memset (&msg, 0, sizeof msg);
+      iov.iov_base = p;
+      iov.iov_len = length;
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control.space;
+      msg.msg_controllen = sizeof control.space;
+
+      count = TEMP_FAILURE_RETRY (recvmsg (sock, &msg, 0));
+      if (count <= 0)
+        return -1;
+
+      for (cmsg = CMSG_FIRSTHDR (&msg); cmsg != NULL;
+           cmsg = CMSG_NXTHDR (&msg, cmsg))
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+            && cmsg->cmsg_len >= CMSG_LEN (sizeof (int)))
+          {
+            memcpy (&fd, CMSG_DATA (cmsg), sizeof (int));
+            if (passed_fd >= 0)
+              close (passed_fd);
+            passed_fd = fd;
+          }
+
+      p += count;
+      length -= (size_t) count;
+    }
+
+  return 0;
+}
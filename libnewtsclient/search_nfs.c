@@ -0,0 +1,501 @@
+/*
+ * search_nfs.c - search many notesfiles at once
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "internal.h"
+#include "newts/newts.h"
+
+#if HAVE_SYS_SELECT_H
+# include <sys/select.h>
+#endif
+
+#if HAVE_SYS_WAIT_H
+# include <sys/wait.h>
+#endif
+
+/* The backend isn't safe to use from more than one thread, so the searching
+ * is done by a pool of worker processes instead.  The parent hands out the
+ * notesfiles a list index at a time through one pipe, and the workers send
+ * back every hit through another, each in a single write small enough to be
+ * atomic.  The parent passes hits on to the caller as they arrive.
+ */
+
+#define MAX_JOBS 64
+#define BATCH    64             /* Newts fetched at once for date checks. */
+
+struct hit
+{
+  int nf;                       /* Index of the notesfile in the list. */
+  int notenum;
+  int respnum;                  /* The response, or the error. */
+};
+
+static void worker (newts_nfref **refs, const struct newts_search *search,
+                    int work, int results);
+static int search_one (const newts_nfref *ref,
+                       const struct newts_search *search,
+                       struct newts_match **matches);
+static int intersect (struct newts_match *matches, int count,
+                      struct newts_match *other, int ocount, int by_note);
+static int every_newt (const newts_nfref *ref,
+                       const struct newts_search *search,
+                       struct newts_match **matches);
+static int in_range (const newts_nfref *ref,
+                     const struct newts_search *search,
+                     struct newts_match *matches, int count);
+static int wanted (const struct newt *newt,
+                   const struct newts_search *search);
+static void free_newts (struct newt *newts, int count);
+
+/* search_nfs - search every notesfile in NFLIST for what SEARCH describes,
+ * with up to JOBS worker processes, or one per processor if JOBS isn't
+ * positive.  HIT is called with DATA for each note and response found, as
+ * they're found, so hits from different notesfiles come interleaved; within
+ * one notesfile they're in note order.  If a notesfile can't be searched,
+ * HIT is called once for it with a note number of -1 and the error code as
+ * the response number.
+ *
+ * Returns: the number of hits, or a negative error code.
+ */
+
+int
+search_nfs (List *nflist, const struct newts_search *search, int jobs,
+            void (*hit) (const newts_nfref *ref, int notenum, int respnum,
+                         void *data),
+            void *data)
+{
+  newts_nfref **refs;
+  ListNode *node;
+  pid_t pids[MAX_JOBS];
+  int work[2], results[2];
+  int next = 0, hits = 0;
+  int count, i, started = 0;
+
+  if (nflist == NULL || search == NULL || hit == NULL)
+    return NEWTS_NULL_POINTER;
+
+  if ((count = list_size (nflist)) == 0)
+    return 0;
+
+  if (jobs <= 0)
+    {
+#ifdef _SC_NPROCESSORS_ONLN
+      jobs = (int) sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+      if (jobs <= 0)
+        jobs = 1;
+    }
+  if (jobs > MAX_JOBS)
+    jobs = MAX_JOBS;
+  if (jobs > count)
+    jobs = count;
+
+  refs = newts_nmalloc (count, sizeof (newts_nfref *));
+  for (i = 0, node = list_head (nflist); node != NULL;
+       i++, node = list_next (node))
+    refs[i] = (newts_nfref *) list_data (node);
+
+  if (pipe (work) != 0)
+    {
+      newts_free (refs);
+      return -1;
+    }
+  if (pipe (results) != 0)
+    {
+      close (work[0]);
+      close (work[1]);
+      newts_free (refs);
+      return -1;
+    }
+
+  fflush (NULL);
+
+  for (i = 0; i < jobs; i++)
+    {
+      if ((pids[started] = fork ()) < 0)
+        break;
+
+      if (pids[started] == 0)
+        {
+          close (work[1]);
+          close (results[0]);
+          worker (refs, search, work[0], results[1]);
+          _exit (EXIT_SUCCESS);
+        }
+
+      started++;
+    }
+
+  close (work[0]);
+  close (results[1]);
+
+  if (started == 0)
+    {
+      close (work[1]);
+      close (results[0]);
+      newts_free (refs);
+      return -1;
+    }
+
+  /* Hand out the notesfiles while passing on the hits; doing one and then the
+   * other could leave us and the workers each waiting on the other's pipe.
+   */
+
+  for (;;)
+    {
+      fd_set readers, writers;
+      int highest = results[0];
+
+      FD_ZERO (&readers);
+      FD_ZERO (&writers);
+      FD_SET (results[0], &readers);
+      if (next < count)
+        {
+          FD_SET (work[1], &writers);
+          if (work[1] > highest)
+            highest = work[1];
+        }
+
+      if (select (highest + 1, &readers, &writers, NULL, NULL) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          break;
+        }
+
+      if (next < count && FD_ISSET (work[1], &writers))
+        {
+          if (TEMP_FAILURE_RETRY (write (work[1], &next, sizeof next)) ==
+              sizeof next)
+            next++;
+          if (next == count)
+            close (work[1]);
+        }
+
+      if (FD_ISSET (results[0], &readers))
+        {
+          struct hit h;
+          ssize_t got = TEMP_FAILURE_RETRY (read (results[0], &h, sizeof h));
+
+          if (got <= 0)
+            break;
+          if (got != sizeof h || h.nf < 0 || h.nf >= count)
+            continue;
+
+          hit (refs[h.nf], h.notenum, h.respnum, data);
+          if (h.notenum >= 0)
+            hits++;
+        }
+    }
+
+  if (next < count)
+    close (work[1]);
+  close (results[0]);
+
+  for (i = 0; i < started; i++)
+    TEMP_FAILURE_RETRY (waitpid (pids[i], NULL, 0));
+
+  newts_free (refs);
+
+  return hits;
+}
+
+/* worker - search the notesfiles of REFS named by the indexes read from
+ * WORK, and write every hit to RESULTS.
+ */
+
+static void
+worker (newts_nfref **refs, const struct newts_search *search, int work,
+        int results)
+{
+  int nf;
+
+  while (TEMP_FAILURE_RETRY (read (work, &nf, sizeof nf)) == sizeof nf)
+    {
+      struct newts_match *matches;
+      struct hit h;
+      int count, i;
+
+      h.nf = nf;
+      count = search_one (refs[nf], search, &matches);
+
+      if (count < 0)
+        {
+          h.notenum = -1;
+          h.respnum = count;
+          TEMP_FAILURE_RETRY (write (results, &h, sizeof h));
+          continue;
+        }
+
+      for (i = 0; i < count; i++)
+        {
+          h.notenum = matches[i].notenum;
+          h.respnum = matches[i].respnum;
+          TEMP_FAILURE_RETRY (write (results, &h, sizeof h));
+        }
+
+      newts_free (matches);
+    }
+}
+
+/* search_one - find everything in REF that matches SEARCH, and store it in a
+ * newly allocated array in MATCHES, in note order.  Returns the number found,
+ * or a negative error code.
+ */
+
+static int
+search_one (const newts_nfref *ref, const struct newts_search *search,
+            struct newts_match **matches)
+{
+  struct newts_match *other;
+  int count = -1, ocount;
+
+  *matches = NULL;
+
+  if (search->text != NULL)
+    {
+      if ((count = text_search_all (ref, search->text, 0, matches)) < 0)
+        return count;
+    }
+
+  if (search->author != NULL)
+    {
+      if ((ocount = author_search_all (ref, search->author, &other)) < 0)
+        {
+          newts_free (*matches);
+          return ocount;
+        }
+      if (count < 0)
+        {
+          *matches = other;
+          count = ocount;
+        }
+      else
+        {
+          count = intersect (*matches, count, other, ocount, FALSE);
+          newts_free (other);
+        }
+    }
+
+  /* A title belongs to the whole thread, responses and all. */
+
+  if (search->title != NULL)
+    {
+      if ((ocount = title_search_all (ref, search->title, &other)) < 0)
+        {
+          newts_free (*matches);
+          return ocount;
+        }
+      if (count < 0)
+        {
+          *matches = other;
+          count = ocount;
+        }
+      else
+        {
+          count = intersect (*matches, count, other, ocount, TRUE);
+          newts_free (other);
+        }
+    }
+
+  if (count < 0)
+    return every_newt (ref, search, matches);
+
+  if (search->after != 0 || search->before != 0)
+    count = in_range (ref, search, *matches, count);
+
+  return count;
+}
+
+/* intersect - keep only those of the COUNT MATCHES that are also among the
+ * OCOUNT in OTHER, or whose basenote is if BY_NOTE is nonzero.  Both are in
+ * note order.  Returns the number kept.
+ */
+
+static int
+intersect (struct newts_match *matches, int count, struct newts_match *other,
+           int ocount, int by_note)
+{
+  int i, j = 0, kept = 0;
+
+  for (i = 0; i < count; i++)
+    {
+      while (j < ocount &&
+             (other[j].notenum < matches[i].notenum ||
+              (!by_note && other[j].notenum == matches[i].notenum &&
+               other[j].respnum < matches[i].respnum)))
+        j++;
+
+      if (j < ocount && other[j].notenum == matches[i].notenum &&
+          (by_note || other[j].respnum == matches[i].respnum))
+        matches[kept++] = matches[i];
+    }
+
+  return kept;
+}
+
+/* every_newt - find every note and response in REF within the dates of
+ * SEARCH, for a search by date alone.
+ */
+
+static int
+every_newt (const newts_nfref *ref, const struct newts_search *search,
+            struct newts_match **matches)
+{
+  struct newt notes[BATCH], resps[BATCH];
+  int count = 0, notenum = 1;
+  int fetched, i;
+
+  memset (notes, 0, sizeof notes);
+  memset (resps, 0, sizeof resps);
+  nfref_copy (&notes[0].nr.nfr, ref);
+  nfref_copy (&resps[0].nr.nfr, ref);
+
+  for (;;)
+    {
+      notes[0].nr.notenum = notenum;
+      notes[0].nr.respnum = 0;
+      if ((fetched = get_notes_range (notes, BATCH, FETCH_NO_TEXT)) <= 0)
+        break;
+
+      for (i = 0; i < fetched; i++)
+        {
+          int respnum, got, j;
+
+          if (wanted (&notes[i], search))
+            {
+              *matches = newts_nrealloc (*matches, count + 1,
+                                         sizeof (struct newts_match));
+              (*matches)[count].notenum = notes[i].nr.notenum;
+              (*matches)[count].respnum = 0;
+              (*matches)[count].score = 1.0;
+              count++;
+            }
+
+          for (respnum = 1; respnum <= notes[i].total_resps; respnum += got)
+            {
+              resps[0].nr.notenum = notes[i].nr.notenum;
+              resps[0].nr.respnum = respnum;
+              if ((got = get_notes_range (resps, BATCH, FETCH_NO_TEXT)) <= 0)
+                break;
+
+              for (j = 0; j < got; j++)
+                if (wanted (&resps[j], search))
+                  {
+                    *matches = newts_nrealloc (*matches, count + 1,
+                                               sizeof (struct newts_match));
+                    (*matches)[count].notenum = resps[j].nr.notenum;
+                    (*matches)[count].respnum = resps[j].nr.respnum;
+                    (*matches)[count].score = 1.0;
+                    count++;
+                  }
+            }
+        }
+
+      notenum = notes[fetched - 1].nr.notenum + 1;
+    }
+
+  free_newts (notes, BATCH);
+  free_newts (resps, BATCH);
+
+  /* Running off the end is how this normally stops; but if it happened at
+   * once, the notesfile may not be there at all.
+   */
+
+  if (fetched == -1 && notenum == 1)
+    {
+      struct stats stats;
+
+      if (get_stats (ref, &stats) != NEWTS_NO_ERROR)
+        return -1;
+    }
+
+  if (fetched < -1)
+    {
+      newts_free (*matches);
+      *matches = NULL;
+      return fetched;
+    }
+
+  return count;
+}
+
+/* in_range - keep only those of the COUNT MATCHES in REF that were written
+ * within the dates of SEARCH.  Returns the number kept.
+ */
+
+static int
+in_range (const newts_nfref *ref, const struct newts_search *search,
+          struct newts_match *matches, int count)
+{
+  struct newt newt;
+  int i, kept = 0;
+
+  memset (&newt, 0, sizeof newt);
+  nfref_copy (&newt.nr.nfr, ref);
+
+  for (i = 0; i < count; i++)
+    {
+      newt.nr.notenum = matches[i].notenum;
+      newt.nr.respnum = matches[i].respnum;
+
+      if (get_notes_range (&newt, 1, FETCH_NO_TEXT) == 1 &&
+          wanted (&newt, search))
+        matches[kept++] = matches[i];
+    }
+
+  free_newts (&newt, 1);
+
+  return kept;
+}
+
+/* wanted - return TRUE if NEWT exists and was written within the dates of
+ * SEARCH.
+ */
+
+static int
+wanted (const struct newt *newt, const struct newts_search *search)
+{
+  return !(newt->options & NOTE_DELETED) &&
+    (search->after == 0 || newt->created >= search->after) &&
+    (search->before == 0 || newt->created < search->before);
+}
+
+/* free_newts - free what get_notes_range allocated in the COUNT NEWTS. */
+
+static void
+free_newts (struct newt *newts, int count)
+{
+  int i;
+
+  for (i = 0; i < count; i++)
+    {
+      newts_free (newts[i].title);
+      newts_free (newts[i].director_message);
+      newts_free (newts[i].auth.system);
+      newts_free (newts[i].auth.name);
+      newts_free (newts[i].id.system);
+      newts_free (newts[i].text);
+    }
+}
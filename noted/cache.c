@@ -0,0 +1,463 @@
+/*
+ * cache.c - notes that many clients ask for, kept ready to send
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "noted.h"
+#include "newts/uiuc.h"
+#include "newts/uiuc-compatibility.h"
+
+#if HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
+/* When something new is posted to a busy notesfile, everyone reading it asks
+ * for the same note within a few seconds, and each request would otherwise
+ * wait its turn for BACKEND_LOCK to decode the same records and read the
+ * same text.  So the notes get_note returns are kept here, keyed by
+ * notesfile, note and response, and sent straight from the cache to anyone
+ * allowed to read them.
+ *
+ * The cache is split into shards, each with its own lock, hash table and
+ * list of entries from most to least recently used, so workers looking up
+ * different notes rarely wait for one another.  A note and all its
+ * responses live in the same shard, which lets a write drop them together.
+ * Each shard keeps to its share of the memory budget by dropping the
+ * entries used longest ago.
+ *
+ * Notes are only stored, and dropped for writes, by workers holding
+ * BACKEND_LOCK, so a copy read before a write through noted can't be stored
+ * after the write has dropped it.  Other processes write to the notesfiles as well: local
+ * clients, nfmail, and compression, which renumbers everything.  So each
+ * entry keeps a stamp of its notesfile taken just before the note was read,
+ * and is only sent while the notesfile still matches it.  The stamp is the
+ * count of writes to the descriptor, which every write makes, kept by the
+ * backend where any process can see it without locking, along with the
+ * status of 'note.indx', which compression replaces.  Checking it costs a
+ * stat per lookup, which is far cheaper than waiting for the backend.
+ * Where the backend can't count writes, nothing is cached.
+ */
+
+#define NSHARDS  16
+#define NBUCKETS 1024             /* Per shard. */
+
+struct entry
+{
+  struct newt newt;             /* Its NR is the key. */
+  struct nf_stamp stamp;        /* Its notesfile when it was read. */
+  size_t size;                  /* Bytes charged to the budget. */
+  unsigned long hash;
+  struct entry *next_hash;      /* Next in the same bucket. */
+  struct entry *newer;          /* Neighbours in the shard's list. */
+  struct entry *older;
+};
+
+struct shard
+{
+  pthread_mutex_t lock;
+  struct entry *buckets[NBUCKETS];
+  struct entry *newest;
+  struct entry *oldest;
+  size_t bytes;
+  unsigned long entries;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long stale;          /* Misses found, but out of date. */
+};
+
+static struct shard shards[NSHARDS];
+static size_t shard_budget = 0;
+
+static unsigned long hash_note (const newts_nfref *ref, int notenum);
+static int same_nf (const newts_nfref *one, const newts_nfref *two);
+static int same_stamp (const struct nf_stamp *one,
+                       const struct nf_stamp *two);
+static struct entry *find (struct shard *shard, const struct newtref *nr,
+                           unsigned long hash);
+static void unlink_entry (struct shard *shard, struct entry *entry);
+static void link_newest (struct shard *shard, struct entry *entry);
+static void drop (struct shard *shard, struct entry *entry);
+static void free_entry (struct entry *entry);
+static char *copy_string (const char *string, size_t *size);
+
+/* cache_init - keep up to BUDGET bytes of notes.  A budget of 0 leaves the
+ * cache off.
+ */
+
+void
+cache_init (size_t budget)
+{
+  int i;
+
+  for (i = 0; i < NSHARDS; i++)
+    {
+      memset (&shards[i], 0, sizeof (struct shard));
+      pthread_mutex_init (&shards[i].lock, NULL);
+    }
+
+  shard_budget = budget / NSHARDS;
+}
+
+/* cache_stamp - fill in STAMP for the open notesfile NF as it is now.  A
+ * note to be stored is stamped before it's read.
+ *
+ * Returns: 0, or -1 if the notesfile can't be stamped just now.
+ */
+
+int
+cache_stamp (const struct notesfile *nf, struct nf_stamp *stamp)
+{
+  struct stat statbuf;
+  char filename[1024];
+  const char *owner = nfref_owner (nf->ref);
+
+  if (owner == NULL)
+    snprintf (filename, sizeof filename, "%s/%s/%s", SPOOL,
+              nfref_name (nf->ref), NOTEINDX);
+  else
+    snprintf (filename, sizeof filename, "%s/%s:%s/%s", SPOOL, owner,
+              nfref_name (nf->ref), NOTEINDX);
+
+  memset (stamp, 0, sizeof (struct nf_stamp));
+  if (uiuc_get_generation (nf, &stamp->generation) != 0 ||
+      stat (filename, &statbuf) != 0)
+    return -1;
+
+  stamp->dev = statbuf.st_dev;
+  stamp->ino = statbuf.st_ino;
+  stamp->size = statbuf.st_size;
+  stamp->mtime = statbuf.st_mtime;
+#if HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  stamp->mtime_ns = statbuf.st_mtim.tv_nsec;
+#endif
+
+  return 0;
+}
+
+/* cache_lookup - if the note NR refers to is cached, and nothing has been
+ * written to its notesfile NF since, put it in REPLY to CLIENT as get_note
+ * would, with FLAGS as for put_newt.
+ *
+ * Returns: TRUE if it was cached, otherwise FALSE.
+ */
+
+int
+cache_lookup (struct client *client, const struct notesfile *nf,
+              const struct newtref *nr, int flags, struct wire *reply)
+{
+  unsigned long hash;
+  struct shard *shard;
+  struct entry *entry;
+  struct nf_stamp now;
+
+  if (shard_budget == 0 || cache_stamp (nf, &now) != 0)
+    return FALSE;
+
+  hash = hash_note (&nr->nfr, nr->notenum);
+  shard = &shards[hash % NSHARDS];
+  hash = hash * 31 + (unsigned) nr->respnum;
+
+  pthread_mutex_lock (&shard->lock);
+
+  entry = find (shard, nr, hash);
+  if (entry != NULL && !same_stamp (&entry->stamp, &now))
+    {
+      drop (shard, entry);
+      entry = NULL;
+      shard->stale++;
+    }
+
+  if (entry == NULL)
+    {
+      shard->misses++;
+      pthread_mutex_unlock (&shard->lock);
+      return FALSE;
+    }
+
+  shard->hits++;
+  unlink_entry (shard, entry);
+  link_newest (shard, entry);
+
+  put_newt (client, reply, &entry->newt, flags);
+
+  pthread_mutex_unlock (&shard->lock);
+  return TRUE;
+}
+
+/* cache_store - keep a copy of NEWT, as just returned by get_note from the
+ * notesfile as STAMP found it.  The caller holds BACKEND_LOCK.
+ */
+
+void
+cache_store (const struct newt *newt, const struct nf_stamp *stamp)
+{
+  unsigned long hash;
+  struct shard *shard;
+  struct entry *entry, *old;
+  size_t size = sizeof (struct entry);
+
+  if (shard_budget == 0)
+    return;
+
+  entry = newts_zalloc (sizeof (struct entry));
+  entry->newt = *newt;
+  entry->stamp = *stamp;
+  memset (&entry->newt.nr.nfr, 0, sizeof (newts_nfref));
+  entry->newt.nr.nfr.owner = copy_string (newt->nr.nfr.owner, &size);
+  entry->newt.nr.nfr.name = copy_string (newt->nr.nfr.name, &size);
+  entry->newt.id.system = copy_string (newt->id.system, &size);
+  entry->newt.title = copy_string (newt->title, &size);
+  entry->newt.director_message = copy_string (newt->director_message, &size);
+  entry->newt.auth.name = copy_string (newt->auth.name, &size);
+  entry->newt.auth.system = copy_string (newt->auth.system, &size);
+  entry->newt.text = copy_string (newt->text, &size);
+  entry->size = size;
+
+  hash = hash_note (&newt->nr.nfr, newt->nr.notenum);
+  shard = &shards[hash % NSHARDS];
+  entry->hash = hash * 31 + (unsigned) newt->nr.respnum;
+
+  pthread_mutex_lock (&shard->lock);
+
+  old = find (shard, &newt->nr, entry->hash);
+  if (old != NULL)
+    drop (shard, old);
+
+  if (size > shard_budget)
+    {
+      pthread_mutex_unlock (&shard->lock);
+      free_entry (entry);
+      return;
+    }
+
+  while (shard->bytes + size > shard_budget)
+    drop (shard, shard->oldest);
+
+  entry->next_hash = shard->buckets[entry->hash % NBUCKETS];
+  shard->buckets[entry->hash % NBUCKETS] = entry;
+  link_newest (shard, entry);
+  shard->bytes += size;
+  shard->entries++;
+
+  pthread_mutex_unlock (&shard->lock);
+}
+
+/* cache_forget - drop note NOTENUM of REF and all its responses, which a
+ * write is about to change.  The caller holds BACKEND_LOCK.
+ */
+
+void
+cache_forget (const newts_nfref *ref, int notenum)
+{
+  struct shard *shard;
+  struct entry *entry, *older;
+
+  if (shard_budget == 0)
+    return;
+
+  shard = &shards[hash_note (ref, notenum) % NSHARDS];
+
+  pthread_mutex_lock (&shard->lock);
+
+  for (entry = shard->newest; entry != NULL; entry = older)
+    {
+      older = entry->older;
+      if (entry->newt.nr.notenum == notenum
+          && same_nf (&entry->newt.nr.nfr, ref))
+        drop (shard, entry);
+    }
+
+  pthread_mutex_unlock (&shard->lock);
+}
+
+/* cache_report - write how well the cache has done to STREAM. */
+
+void
+cache_report (FILE *stream)
+{
+  unsigned long hits = 0, misses = 0, stale = 0, entries = 0;
+  size_t bytes = 0;
+  int i;
+
+  if (shard_budget == 0)
+    {
+      fprintf (stream, _("noted: cache: off\n"));
+      return;
+    }
+
+  for (i = 0; i < NSHARDS; i++)
+    {
+      pthread_mutex_lock (&shards[i].lock);
+      hits += shards[i].hits;
+      misses += shards[i].misses;
+      stale += shards[i].stale;
+      entries += shards[i].entries;
+      bytes += shards[i].bytes;
+      pthread_mutex_unlock (&shards[i].lock);
+    }
+
+  fprintf (stream, _("noted: cache: %lu hits, %lu misses (%lu stale), %lu "
+                     "notes in %lu of %lu bytes\n"), hits, misses, stale,
+           entries, (unsigned long) bytes,
+           (unsigned long) (shard_budget * NSHARDS));
+}
+
+/* hash_note - hash note NOTENUM of REF, which picks the shard it and its
+ * responses go in.
+ */
+
+static unsigned long
+hash_note (const newts_nfref *ref, int notenum)
+{
+  const char *c;
+  unsigned long hash = 5381;
+
+  for (c = nfref_name (ref); c != NULL && *c != '\0'; c++)
+    hash = hash * 33 + (unsigned char) *c;
+  hash = hash * 33 + '/';
+  for (c = nfref_owner (ref); c != NULL && *c != '\0'; c++)
+    hash = hash * 33 + (unsigned char) *c;
+
+  return hash * 31 + (unsigned) notenum;
+}
+
+/* same_nf - return TRUE if ONE and TWO name the same notesfile of ours. */
+
+static int
+same_nf (const newts_nfref *one, const newts_nfref *two)
+{
+  const char *owner1 = nfref_owner (one);
+  const char *owner2 = nfref_owner (two);
+
+  if ((owner1 == NULL) != (owner2 == NULL))
+    return FALSE;
+  if (owner1 != NULL && strcmp (owner1, owner2) != 0)
+    return FALSE;
+
+  return strcmp (nfref_name (one), nfref_name (two)) == 0;
+}
+
+/* same_stamp - return TRUE if ONE and TWO are the same notesfile, unwritten
+ * between them.
+ */
+
+static int
+same_stamp (const struct nf_stamp *one, const struct nf_stamp *two)
+{
+  return one->generation == two->generation &&
+    one->dev == two->dev && one->ino == two->ino && one->size == two->size &&
+    one->mtime == two->mtime && one->mtime_ns == two->mtime_ns;
+}
+
+static struct entry *
+find (struct shard *shard, const struct newtref *nr, unsigned long hash)
+{
+  struct entry *entry;
+
+  for (entry = shard->buckets[hash % NBUCKETS]; entry != NULL;
+       entry = entry->next_hash)
+    if (entry->hash == hash && entry->newt.nr.notenum == nr->notenum
+        && entry->newt.nr.respnum == nr->respnum
+        && same_nf (&entry->newt.nr.nfr, &nr->nfr))
+      return entry;
+
+  return NULL;
+}
+
+static void
+unlink_entry (struct shard *shard, struct entry *entry)
+{
+  if (entry->newer != NULL)
+    entry->newer->older = entry->older;
+  else
+    shard->newest = entry->older;
+
+  if (entry->older != NULL)
+    entry->older->newer = entry->newer;
+  else
+    shard->oldest = entry->newer;
+
+  entry->newer = entry->older = NULL;
+}
+
+static void
+link_newest (struct shard *shard, struct entry *entry)
+{
+  entry->newer = NULL;
+  entry->older = shard->newest;
+
+  if (shard->newest != NULL)
+    shard->newest->newer = entry;
+  else
+    shard->oldest = entry;
+
+  shard->newest = entry;
+}
+
+/* drop - take ENTRY out of SHARD and free it.  The caller holds the shard's
+ * lock.
+ */
+
+static void
+drop (struct shard *shard, struct entry *entry)
+{
+  struct entry **link = &shard->buckets[entry->hash % NBUCKETS];
+
+  while (*link != entry)
+    link = &(*link)->next_hash;
+  *link = entry->next_hash;
+
+  unlink_entry (shard, entry);
+  shard->bytes -= entry->size;
+  shard->entries--;
+
+  free_entry (entry);
+}
+
+static void
+free_entry (struct entry *entry)
+{
+  newts_free (entry->newt.nr.nfr.owner);
+  newts_free (entry->newt.nr.nfr.name);
+  newts_free (entry->newt.id.system);
+  newts_free (entry->newt.title);
+  newts_free (entry->newt.director_message);
+  newts_free (entry->newt.auth.name);
+  newts_free (entry->newt.auth.system);
+  newts_free (entry->newt.text);
+  newts_free (entry);
+}
+
+/* copy_string - return a newly allocated copy of STRING, or NULL if it's
+ * NULL, adding the bytes it takes to SIZE.
+ */
+
+static char *
+copy_string (const char *string, size_t *size)
+{
+  if (string == NULL)
+    return NULL;
+
+  *size += strlen (string) + 1;
+  return newts_strdup (string);
+}
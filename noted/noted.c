@@ -2,7 +2,7 @@
  * noted.c - main routine for note daemon
  *
  * This file is part of the Newts notesfile system.
- * Copyright (C) 2002, 2003 Tyler Berry.
+ * Copyright (C) 2002, 2003, 2008 Tyler Berry.
  *
  * Newts is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License as published by
@@ -23,15 +23,212 @@
 # include <config.h>
 #endif
 
-#include "common.h"
+#include "noted.h"
+
+#include "dirname.h"
+#include "getopt.h"
+
+#if HAVE_LOCALE_H
+# include <locale.h>
+#endif
+
+#if HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+
+#if HAVE_PWD_H
+# include <pwd.h>
+#endif
+
+/* Whether to display debugging messages. */
+int debug = FALSE;
+
+char *program_name;
+
+/* Set when we're asked to say how the cache is doing. */
+volatile sig_atomic_t report_wanted = FALSE;
+
+/* Bytes of text space in each client's ring; 0 turns rings off. */
+size_t ring_size = 0;
+
+static int parse_count (const char *what, const char *string, int least,
+                        int most);
+static void want_report (int signum);
 
 int
 main (int argc, char **argv)
 {
+  char *path = DEFAULT_SOCKET;
+  int backlog = DEFAULT_BACKLOG;
+  int workers = DEFAULT_WORKERS;
+  int cache = DEFAULT_CACHE;
+  int ring = DEFAULT_RING;
+  struct passwd *pw;
   int sock;
 
-  sock = create_socket (9734);
+  int opt;
+  int option_index = 0;
+  extern char *optarg;
+  extern int optind, opterr, optopt;
+
+  struct option long_options[] =
+    {
+      {"backlog",1,0,'b'},
+      {"cache",1,0,'c'},
+      {"debug",0,0,'D'},
+      {"ring",1,0,'r'},
+      {"socket",1,0,'s'},
+      {"workers",1,0,'w'},
+      {"help",0,0,'h'},
+      {"version",0,0,0},
+      {0,0,0,0}
+    };
+
+#ifdef __GLIBC__
+  program_name = program_invocation_short_name;
+#else
+  program_name = base_name (argv[0]);
+#endif
+
+#ifdef HAVE_SETLOCALE
+  setlocale (LC_ALL, "");
+#endif
+
+#if ENABLE_NLS
+  bindtextdomain (PACKAGE, LOCALEDIR);
+  textdomain (PACKAGE);
+#endif
+
+  while ((opt = getopt_long (argc, argv, "b:c:hr:s:w:",
+                             long_options, &option_index)) != -1)
+    {
+      switch (opt)
+        {
+        case 0:
+          printf (N_("%s - %s %s\n"), program_name, PACKAGE_NAME, VERSION);
+          exit (EXIT_SUCCESS);
+
+        case 'b':
+          backlog = parse_count (_("backlog"), optarg, 1, SOMAXCONN);
+          break;
+
+        case 'c':
+          cache = parse_count (_("cache size"), optarg, 0, MAX_CACHE);
+          break;
+
+        case 'D':
+          debug = TRUE;
+          break;
+
+        case 'r':
+          ring = parse_count (_("ring size"), optarg, 0, MAX_RING);
+          break;
+
+        case 's':
+          path = optarg;
+          break;
+
+        case 'w':
+          workers = parse_count (_("number of workers"), optarg, 1,
+                                 MAX_WORKERS);
+          break;
+
+        case 'h':
+          printf (_("Usage: %s [OPTION]...\n"
+                    "Serve notesfiles to local clients.\n\n"), program_name);
+
+          printf (_("  -s, --socket=PATH    Listen on PATH (default: %s)\n"
+                    "  -b, --backlog=N      Queue up to N connections not yet accepted\n"
+                    "                         (default: %d)\n"
+                    "  -w, --workers=N      Serve up to N requests at once (default: %d)\n"
+                    "  -c, --cache=MB       Keep up to MB megabytes of notes ready to send\n"
+                    "                         (default: %d; 0 turns the cache off)\n"
+                    "  -r, --ring=KB        Share up to KB kilobytes of note text with each\n"
+                    "                         client that asks (default: %d; 0 turns\n"
+                    "                         sharing off)\n"
+                    "      --debug          Display debugging messages\n\n"
+                    "  -h, --help           Display this help and exit\n"
+                    "      --version        Display version information and exit\n\n"),
+                  DEFAULT_SOCKET, DEFAULT_BACKLOG, DEFAULT_WORKERS,
+                  DEFAULT_CACHE, DEFAULT_RING);
+
+          printf (_("Report bugs to <%s>.\n"), PACKAGE_BUGREPORT);
+          exit (EXIT_SUCCESS);
+
+        case '?':
+          fprintf (stderr, _("Try '%s --help' for more information.\n"),
+                   program_name);
+          exit (EXIT_FAILURE);
+        }
+    }
+
+  /* The notesfiles belong to notes, so that's who we run as; each client's
+   * own permissions are checked against the access lists.
+   */
+
+  pw = getpwnam (NOTES);
+  if (geteuid () == 0 && pw != NULL)
+    {
+      setgid (pw->pw_gid);
+      setuid (pw->pw_uid);
+    }
+  euid = geteuid ();
+
+  /* A client that hangs up while we're writing to it isn't our problem. */
+
+  signal (SIGPIPE, SIG_IGN);
+
+  /* SIGUSR1 asks for the cache's hits and misses. */
+
+  signal (SIGUSR1, want_report);
+
+  cache_init ((size_t) cache * 1024 * 1024);
+  ring_size = (size_t) ring * 1024;
+
+  sock = create_socket (path, backlog);
+
+  if (start_workers (workers) < 0)
+    {
+      fprintf (stderr, _("%s: unable to start any workers\n"), program_name);
+      exit (EXIT_FAILURE);
+    }
+
+  if (watch_start () < 0)
+    fprintf (stderr, _("%s: unable to follow watched notesfiles\n"),
+             program_name);
+
   run_server (sock);
 
   return EXIT_FAILURE;
 }
+
+/* parse_count - return the number in STRING, which is the WHAT option, or
+ * exit with an error if it isn't a number from LEAST to MOST.
+ */
+
+static int
+parse_count (const char *what, const char *string, int least, int most)
+{
+  char *end;
+  long count;
+
+  count = strtol (string, &end, 10);
+  if (*string == '\0' || *end != '\0' || count < least || count > most)
+    {
+      fprintf (stderr, _("%s: invalid %s '%s' (must be from %d to %d)\n"),
+               program_name, what, string, least, most);
+      exit (EXIT_FAILURE);
+    }
+
+  return (int) count;
+}
+
+/* want_report - have the I/O thread report on the cache, which isn't safe
+ * to do from a signal handler.
+ */
+
+static void
+want_report (int signum)
+{
+  report_wanted = TRUE;
+}
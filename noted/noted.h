@@ -0,0 +1,193 @@
+/*
+ * noted.h - declarations shared by the parts of the notes daemon
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef NOTED_H
+#define NOTED_H
+
+#include "internal.h"
+#include "protocol.h"
+
+#include <pthread.h>
+#include <signal.h>
+
+/* noted serves many notes clients from one long-lived process, so that the
+ * notesfiles they use stay open and cached between requests.
+ *
+ * One thread, in socket.c, does all the socket I/O through epoll: it accepts
+ * connections, reads whatever arrives into each client's input buffer, and
+ * sends whatever has been put in its output buffer.  A client with input is
+ * put on the run queue, and a pool of worker threads, in worker.c, takes
+ * clients off it and serves their requests (serve.c) by calling the
+ * backend.  Each connection acts for the user at the other end, as told by
+ * getpeereid.
+ *
+ * The backend isn't thread-safe, so only one worker is in it at a time,
+ * whichever notesfile it's using.  Notes sent from the cache don't need it,
+ * but everything else waits its turn: more workers let more requests be
+ * taken apart and answered at once, not more notesfiles be read or written
+ * at once, and a request that has to wait for a lock in the backend - a
+ * write held up by a compression, say - holds up every other client too.
+ */
+
+#define DEFAULT_SOCKET  NOTED_SOCKET
+#define DEFAULT_BACKLOG 128
+#define DEFAULT_WORKERS 4
+#define MAX_WORKERS     256
+#define DEFAULT_CACHE   16      /* Megabytes of notes cached. */
+#define MAX_CACHE       65536
+#define DEFAULT_RING    4096    /* Kilobytes of shared text per client. */
+#define MAX_RING        1048576
+#define RING_MIN_TEXT   512     /* Shorter text just goes down the socket. */
+
+/* A client's input is only read while less than MAX_PENDING bytes of it
+ * are waiting to be served, which must leave room for a whole request.
+ */
+
+#define READ_CHUNK    4096      /* Bytes read from a client at once. */
+#define MAX_PENDING   (2 * NOTED_MAX_FRAME)
+#define SERVE_BATCH   16        /* Requests served before giving others a go. */
+
+/* struct buffer - bytes on their way in or out. */
+
+struct buffer
+{
+  char *base;                   /* What was allocated. */
+  char *data;                   /* The first byte in use, within BASE. */
+  size_t length;                /* Bytes in use. */
+  size_t size;                  /* Bytes allocated. */
+};
+
+/* struct ring - where a client's note text is put for it, in ring.c.  The
+ * offset of each busy slot's text is kept in START.
+ */
+
+struct ring
+{
+  int fd;                       /* Until it's been passed to the client. */
+  struct noted_ring *shared;
+  char *text;                   /* The text space, in SHARED; */
+  size_t size;                  /* how many bytes of it there are, */
+  size_t head;                  /* and where the next text goes. */
+  unsigned long first;          /* The oldest slot that may be busy, */
+  unsigned long next;           /* and the next to use, counting up. */
+  size_t start[NOTED_RING_SLOTS];
+};
+
+/* struct client - a connected notes client.  LOCK guards everything below
+ * it; FD, UID and GID don't change once the client is set up.
+ */
+
+struct client
+{
+  int fd;
+  uid_t uid;                    /* Who's at the other end. */
+  gid_t gid;
+  pthread_mutex_t lock;
+  struct buffer in;             /* Received but not yet served. */
+  struct buffer out;            /* Served but not yet sent. */
+  int queued;                   /* On the run queue, or being served. */
+  int paused;                   /* Not being read until IN drains. */
+  int closing;                  /* Hung up or failed; close once idle. */
+  int woken;                    /* On the wake list. */
+  int closed;                   /* Closed, and about to be freed. */
+  int pass_fd;                  /* A descriptor, or -1, to send along */
+  size_t pass_at;               /* with the byte of OUT at PASS_AT. */
+  struct client *next_run;      /* Next on the run queue. */
+  struct client *next_wake;     /* Next on the wake list. */
+  struct notesfile **nfs;       /* The notesfiles it has open, by handle, */
+  int nnfs;
+  struct ring *ring;            /* and its ring, or NULL; only the worker
+                                   serving it uses these. */
+};
+
+/* Settings and signals, in noted.c. */
+
+extern int debug;
+extern char *program_name;
+extern volatile sig_atomic_t report_wanted;
+extern size_t ring_size;
+
+/* Buffers, connections and the I/O thread, in socket.c. */
+
+extern void buffer_append (struct buffer *buffer, const void *data,
+                           size_t length);
+extern void buffer_consume (struct buffer *buffer, size_t length);
+extern int create_socket (const char *path, int backlog);
+extern void run_server (int sock);
+extern void wake_client (struct client *client);
+
+/* The worker threads, in worker.c. */
+
+extern pthread_mutex_t backend_lock;
+extern uid_t euid;
+
+extern int start_workers (int count);
+extern void schedule (struct client *client);
+extern void act_for (struct client *client);
+
+/* struct nf_stamp - the state of a notesfile when a note was read from it,
+ * which changes with every write.
+ */
+
+struct nf_stamp
+{
+  unsigned long generation;     /* Descriptor writes; see uiuc_get_generation. */
+  dev_t dev;                    /* 'note.indx'. */
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  long mtime_ns;
+};
+
+/* Notes kept ready to send, in cache.c. */
+
+extern void cache_init (size_t budget);
+extern int cache_stamp (const struct notesfile *nf, struct nf_stamp *stamp);
+extern int cache_lookup (struct client *client, const struct notesfile *nf,
+                         const struct newtref *nr, int flags,
+                         struct wire *reply);
+extern void cache_store (const struct newt *newt,
+                         const struct nf_stamp *stamp);
+extern void cache_forget (const newts_nfref *ref, int notenum);
+extern void cache_report (FILE *stream);
+
+/* Clients' rings, in ring.c. */
+
+extern struct ring *ring_create (void);
+extern int ring_put (struct ring *ring, const char *text, size_t length,
+                     size_t *offset);
+extern void ring_free (struct ring *ring);
+
+/* Watched notesfiles, in watch.c. */
+
+extern int watch_start (void);
+extern void watch_add (struct client *client, long which,
+                       const newts_nfref *ref);
+extern void watch_forget (struct client *client);
+
+/* Requests, in serve.c. */
+
+extern int serve_one (struct client *client);
+extern void forget_client (struct client *client);
+extern void put_newt (struct client *client, struct wire *reply,
+                      const struct newt *newt, int flags);
+
+#endif /* not NOTED_H */
@@ -0,0 +1,218 @@
+/*
+ * ring.c - shared memory for handing note text to local clients
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "noted.h"
+
+#if NOTED_RINGS
+# include <sys/mman.h>
+#endif
+
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+/* Sending a long thread down the socket copies every text twice, into the
+ * socket and out again, in pieces no bigger than the socket will hold.  A
+ * client with a ring instead gets each text copied once, by us, into memory
+ * it has mapped, and only the note's details go down the socket.
+ *
+ * Each client has a ring of its own, which only the worker serving it
+ * touches, so there's nothing to lock.  Texts go in one after another,
+ * wrapping around to the front, and each takes one of the ring's slots,
+ * also in turn.  The client marks a slot free when it's done with the text;
+ * we take back space from the oldest text only, so a slot freed out of turn
+ * waits for those before it.  When there's no room, or no slot, the text
+ * goes down the socket after all.
+ *
+ * Only the busy flags are read back from the shared memory.  Where each text
+ * starts is kept here, where the client can't change it: a client that
+ * scribbles on its ring only spoils its own notes.
+ *
+ * The client has the ring's descriptor too, and could shrink the file under
+ * us, so that our next copy into it faults.  The file is sealed against
+ * changing size before it's handed over, and where that can't be done,
+ * there are no rings.
+ */
+
+#define ALIGN 8
+
+#if NOTED_RINGS
+static int sealed_file (size_t length);
+#endif
+
+/* ring_create - make a ring of RING_SIZE bytes for a client.  Its FD is the
+ * descriptor to pass to the client.
+ *
+ * Returns: the ring, or NULL if rings are turned off or it can't be made.
+ */
+
+struct ring *
+ring_create (void)
+{
+#if NOTED_RINGS
+  struct ring *ring;
+  size_t length = sizeof (struct noted_ring) + ring_size;
+  void *base;
+  int fd;
+
+  if (ring_size == 0 || (fd = sealed_file (length)) < 0)
+    return NULL;
+
+  base = mmap (NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  ring = newts_zalloc (sizeof (struct ring));
+  ring->fd = fd;
+  ring->shared = base;
+  ring->shared->size = (unsigned) ring_size;
+  ring->text = (char *) base + sizeof (struct noted_ring);
+  ring->size = ring_size;
+
+  return ring;
+#else
+  return NULL;
+#endif
+}
+
+/* ring_put - copy LENGTH bytes of TEXT into RING, and mark the slot they
+ * take busy.  Sets *OFFSET to where they went.
+ *
+ * Returns: the slot, or -1 if there wasn't room.
+ */
+
+int
+ring_put (struct ring *ring, const char *text, size_t length,
+          size_t *offset)
+{
+#if NOTED_RINGS
+  size_t need = (length | (ALIGN - 1)) + 1;
+  size_t oldest, at;
+  int slot;
+
+  while (ring->first != ring->next &&
+         *(volatile unsigned *)
+         &ring->shared->busy[ring->first % NOTED_RING_SLOTS] == 0)
+    ring->first++;
+
+  /* Whatever the client read from the space we take back is read by now. */
+
+  __sync_synchronize ();
+
+  if (ring->first == ring->next)
+    {
+      if (need > ring->size)
+        return -1;
+      at = 0;
+    }
+  else if (ring->next - ring->first == NOTED_RING_SLOTS)
+    return -1;
+  else
+    {
+      /* The space after the newest text runs either to the end of the ring
+       * and on from the front, or up to the oldest.  It never quite reaches
+       * the oldest, so a full ring doesn't look like an empty one.
+       */
+
+      oldest = ring->start[ring->first % NOTED_RING_SLOTS];
+
+      if (ring->head > oldest && need <= ring->size - ring->head)
+        at = ring->head;
+      else if (ring->head > oldest && need < oldest)
+        at = 0;
+      else if (ring->head < oldest && need < oldest - ring->head)
+        at = ring->head;
+      else
+        return -1;
+    }
+
+  memcpy (ring->text + at, text, length);
+
+  slot = (int) (ring->next % NOTED_RING_SLOTS);
+  ring->start[slot] = at;
+  ring->head = at + need;
+  ring->next++;
+
+  __sync_synchronize ();
+  *(volatile unsigned *) &ring->shared->busy[slot] = 1;
+
+  *offset = at;
+  return slot;
+#else
+  return -1;
+#endif
+}
+
+/* ring_free - unmap RING and free it, closing its descriptor if it was never
+ * passed on.
+ */
+
+void
+ring_free (struct ring *ring)
+{
+  if (ring == NULL)
+    return;
+
+#if NOTED_RINGS
+  munmap ((void *) ring->shared, sizeof (struct noted_ring) + ring->size);
+#endif
+  if (ring->fd >= 0)
+    close (ring->fd);
+
+  newts_free (ring);
+}
+
+#if NOTED_RINGS
+
+/* sealed_file - return a descriptor for a new file of LENGTH bytes with no
+ * name, which nobody else can open and nobody can resize, or -1.
+ */
+
+static int
+sealed_file (size_t length)
+{
+# if HAVE_MEMFD_CREATE && defined F_ADD_SEALS
+  int fd = memfd_create ("noted-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+  if (fd < 0)
+    return -1;
+
+  if (ftruncate (fd, (off_t) length) < 0 ||
+      fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+    {
+      close (fd);
+      return -1;
+    }
+
+  return fd;
+# else
+  return -1;
+# endif
+}
+
+#endif /* NOTED_RINGS */
@@ -0,0 +1,966 @@
+/*
+ * serve.c - answering clients' requests
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "noted.h"
+#include "newts/uiuc.h"
+
+#if HAVE_PWD_H
+# include <pwd.h>
+#endif
+
+/* Each request is taken off the client's input whole, and answered while
+ * the client's lock is let go, so the I/O thread can go on reading and
+ * writing meanwhile.  The handlers below run with BACKEND_LOCK held and the
+ * backend acting for the client.  Each reads its arguments from REQUEST,
+ * puts its results in REPLY, and returns the status.  Notes found in the
+ * cache (cache.c) are sent without going near the backend at all.
+ *
+ * Clients are who getpeereid says they are, and nothing in a request can
+ * change that: what they write is signed with their own name, they may only
+ * delete or modify their own notes unless they direct the notesfile, and
+ * they may only set their own sequencer times.  Only the notes user may do
+ * any of these on someone else's behalf.
+ */
+
+static int handle_open_nf (struct client *client, struct wire *request,
+                           struct wire *reply);
+static int handle_close_nf (struct client *client, struct wire *request,
+                            struct wire *reply);
+static int handle_get_note (struct client *client, struct wire *request,
+                            struct wire *reply);
+static int handle_get_next_note (struct client *client, struct wire *request,
+                                 struct wire *reply);
+static int handle_write_note (struct client *client, struct wire *request,
+                              struct wire *reply);
+static int handle_search (struct client *client, struct wire *request,
+                          struct wire *reply);
+static int handle_get_seqtime (struct client *client, struct wire *request,
+                               struct wire *reply);
+static int handle_set_seqtime (struct client *client, struct wire *request,
+                               struct wire *reply);
+static int handle_watch (struct client *client, struct wire *request,
+                         struct wire *reply);
+static int handle_map_ring (struct client *client, struct wire *request,
+                            struct wire *reply);
+static int handle_delete_note (struct client *client, struct wire *request,
+                               struct wire *reply);
+static int handle_modify_note (struct client *client, struct wire *request,
+                               struct wire *reply);
+static int handle_modify_note_text (struct client *client,
+                                    struct wire *request, struct wire *reply);
+
+static int (*handlers[]) (struct client *, struct wire *, struct wire *) =
+  {
+    NULL,
+    handle_open_nf,             /* NOTED_OPEN_NF */
+    handle_close_nf,            /* NOTED_CLOSE_NF */
+    handle_get_note,            /* NOTED_GET_NOTE */
+    handle_get_next_note,       /* NOTED_GET_NEXT_NOTE */
+    handle_write_note,          /* NOTED_WRITE_NOTE */
+    handle_search,              /* NOTED_SEARCH */
+    handle_get_seqtime,         /* NOTED_GET_SEQTIME */
+    handle_set_seqtime,         /* NOTED_SET_SEQTIME */
+    handle_watch,               /* NOTED_WATCH */
+    handle_map_ring,            /* NOTED_MAP_RING */
+    handle_delete_note,         /* NOTED_DELETE_NOTE */
+    handle_modify_note,         /* NOTED_MODIFY_NOTE */
+    handle_modify_note_text     /* NOTED_MODIFY_NOTE_TEXT */
+  };
+
+#define NHANDLERS ((int) (sizeof handlers / sizeof handlers[0]))
+
+static int from_cache (struct client *client, struct wire *request,
+                       struct wire *reply);
+static struct notesfile *find_nf (struct client *client, long handle);
+static struct notesfile *held_nf (const struct client *client,
+                                  const newts_nfref *ref);
+static int may_read (const struct client *client, const newts_nfref *ref);
+static int may_change (const struct client *client, const struct newtref *nr);
+static void keep_director_flags (const struct client *client,
+                                 struct newt *newt);
+static int sane_nfref (const newts_nfref *ref);
+static int privileged (const struct client *client);
+static int owns_sequencer (const struct client *client, const char *name);
+static char *user_name (uid_t uid);
+static void clear_newt (struct newt *newt);
+static void set_status (struct wire *reply, int status);
+
+/* serve_one - serve the first request in CLIENT's input, if it's all there,
+ * putting the reply in its output.  The caller holds CLIENT's lock, which is
+ * let go while the request is answered.
+ *
+ * Returns: TRUE if a request was served, or FALSE if there isn't a whole one
+ * to serve yet.  A client that sends something that can't be a request is
+ * hung up on.
+ */
+
+int
+serve_one (struct client *client)
+{
+  struct wire request, reply;
+  unsigned long length;
+  int operation, status;
+
+  if (client->in.length < NOTED_HEADER)
+    return FALSE;
+
+  length = wire_peek_length ((unsigned char *) client->in.data);
+  if (length > NOTED_MAX_FRAME || length < NOTED_HEADER + 1)
+    {
+      client->closing = TRUE;
+      buffer_consume (&client->in, client->in.length);
+      return FALSE;
+    }
+
+  if (client->in.length < length)
+    return FALSE;
+
+  wire_init (&request);
+  wire_init (&reply);
+
+  wire_take (&request, client->in.data, length);
+  buffer_consume (&client->in, length);
+
+  pthread_mutex_unlock (&client->lock);
+
+  operation = wire_get_byte (&request);
+
+  wire_begin (&reply, wire_peek_id (request.data));
+  wire_put_int (&reply, 0);
+
+  if (operation == NOTED_GET_NOTE && from_cache (client, &request, &reply))
+    status = 0;
+  else if (operation > 0 && operation < NHANDLERS)
+    {
+      pthread_mutex_lock (&backend_lock);
+      act_for (client);
+      status = handlers[operation] (client, &request, &reply);
+      pthread_mutex_unlock (&backend_lock);
+    }
+  else
+    status = -1;
+
+  /* A request that didn't make sense gets nothing back but the status. */
+
+  if (request.failed)
+    {
+      status = -1;
+      reply.length = NOTED_HEADER + 4;
+    }
+
+  set_status (&reply, status);
+  wire_finish (&reply);
+
+  if (debug)
+    fprintf (stderr, "noted: client uid=%d on %d: operation %d -> %d\n",
+             (int) client->uid, client->fd, operation, status);
+
+  pthread_mutex_lock (&client->lock);
+  buffer_append (&client->out, reply.data, reply.length);
+
+  /* A new ring's descriptor goes along with the reply that announces it. */
+
+  if (client->ring != NULL && client->ring->fd >= 0)
+    {
+      client->pass_fd = client->ring->fd;
+      client->pass_at = client->out.length - reply.length;
+      client->ring->fd = -1;
+    }
+
+  wire_free (&request);
+  wire_free (&reply);
+
+  return TRUE;
+}
+
+/* forget_client - close the notesfiles CLIENT left open, stop watching any
+ * for it, and let go of its ring.
+ */
+
+void
+forget_client (struct client *client)
+{
+  int i;
+
+  pthread_mutex_lock (&backend_lock);
+  act_for (client);
+  watch_forget (client);
+
+  for (i = 0; i < client->nnfs; i++)
+    if (client->nfs[i] != NULL)
+      {
+        uiuc_close_nf (client->nfs[i], FALSE);
+        nf_free (client->nfs[i]);
+      }
+
+  pthread_mutex_unlock (&backend_lock);
+
+  newts_free (client->nfs);
+  client->nfs = NULL;
+  client->nnfs = 0;
+
+  ring_free (client->ring);
+  client->ring = NULL;
+}
+
+/* put_newt - put NEWT in REPLY as get_note returns it to CLIENT, leaving out
+ * the text if FLAGS has FETCH_NO_TEXT.  If FLAGS has NOTED_TEXT_IN_RING, the
+ * text goes in the client's ring if there's room for it.
+ */
+
+void
+put_newt (struct client *client, struct wire *reply, const struct newt *newt,
+          int flags)
+{
+  struct newt bare = *newt;
+  size_t length, offset;
+  int slot = -1;
+
+  if (flags & FETCH_NO_TEXT)
+    bare.text = NULL;
+
+  if (!(flags & NOTED_TEXT_IN_RING))
+    {
+      wire_put_newt (reply, &bare);
+      return;
+    }
+
+  bare.text = NULL;
+  wire_put_newt (reply, &bare);
+
+  if (client->ring != NULL && !(flags & FETCH_NO_TEXT) && newt->text != NULL
+      && (length = strlen (newt->text)) >= RING_MIN_TEXT)
+    slot = ring_put (client->ring, newt->text, length, &offset);
+
+  wire_put_int (reply, slot);
+  if (slot < 0)
+    wire_put_string (reply, flags & FETCH_NO_TEXT ? NULL : newt->text);
+  else
+    {
+      wire_put_int (reply, (long) offset);
+      wire_put_int (reply, (long) length);
+    }
+}
+
+/* handle_open_nf - open a notesfile and keep it open under a handle for the
+ * client.
+ */
+
+static int
+handle_open_nf (struct client *client, struct wire *request,
+                struct wire *reply)
+{
+  newts_nfref *ref = nfref_alloc ();
+  struct notesfile *nf;
+  struct uiuc_opts *opts;
+  int handle, result;
+
+  wire_get_nfref (request, ref);
+  if (request->failed || !sane_nfref (ref))
+    {
+      nfref_free (ref);
+      return -1;
+    }
+
+  nf = nf_alloc ();
+  result = uiuc_open_nf (ref, nf);
+  nfref_free (ref);
+
+  if (result != NEWTS_NO_ERROR)
+    {
+      nf_free (nf);
+      return result;
+    }
+
+  for (handle = 0; handle < client->nnfs; handle++)
+    if (client->nfs[handle] == NULL)
+      break;
+
+  if (handle == client->nnfs)
+    {
+      client->nnfs = client->nnfs ? 2 * client->nnfs : 4;
+      client->nfs = newts_nrealloc (client->nfs, (size_t) client->nnfs,
+                                    sizeof (struct notesfile *));
+      memset (client->nfs + handle, 0,
+              (size_t) (client->nnfs - handle) * sizeof (struct notesfile *));
+    }
+  client->nfs[handle] = nf;
+
+  wire_put_int (reply, handle);
+  wire_put_string (reply, nf->title);
+  wire_put_string (reply, nf->director_message);
+  wire_put_int (reply, (long) nf->total_notes);
+  wire_put_time (reply, nf->modified);
+  wire_put_time (reply, nf->time_entered);
+  wire_put_int (reply, nf->options);
+  wire_put_int (reply, nf->perms);
+
+  opts = (struct uiuc_opts *) nf->opts;
+  wire_put_int (reply, opts->deleted_notes);
+  wire_put_int (reply, opts->deleted_resps);
+  wire_put_int (reply, opts->expire_threshold);
+  wire_put_int (reply, opts->expire_action);
+  wire_put_int (reply, opts->expire_by_dirmsg);
+  wire_put_int (reply, opts->minimum_notes);
+  wire_put_int (reply, opts->maximum_note_size);
+  wire_put_int (reply, opts->notesfile_number);
+  wire_put_int (reply, opts->current_note_id);
+
+  return NEWTS_NO_ERROR;
+}
+
+static int
+handle_close_nf (struct client *client, struct wire *request,
+                 struct wire *reply)
+{
+  long handle = wire_get_int (request);
+  int updatestats = wire_get_byte (request);
+  struct notesfile *nf = find_nf (client, handle);
+  int result;
+
+  if (request->failed || nf == NULL)
+    return -1;
+
+  result = uiuc_close_nf (nf, updatestats);
+  nf_free (nf);
+  client->nfs[handle] = NULL;
+
+  return result;
+}
+
+static int
+handle_get_note (struct client *client, struct wire *request,
+                 struct wire *reply)
+{
+  struct notesfile *nf;
+  struct newt newt;
+  struct nf_stamp stamp;
+  int updatestats, flags, stamped, result;
+
+  memset (&newt, 0, sizeof (struct newt));
+
+  wire_get_newtref (request, &newt.nr);
+  updatestats = wire_get_byte (request);
+  flags = (int) wire_get_int (request);
+
+  if (request->failed || !sane_nfref (&newt.nr.nfr))
+    {
+      clear_newt (&newt);
+      return -1;
+    }
+
+  nf = held_nf (client, &newt.nr.nfr);
+  stamped = nf != NULL && cache_stamp (nf, &stamp) == 0;
+  result = uiuc_get_note (&newt, (short) updatestats);
+
+  /* A corrupted or unapproved newt comes back as -3 with a placeholder,
+   * which the client gets too.
+   */
+
+  if (result == 0 || result == -3)
+    {
+      /* What a director alone may see mustn't be handed to anyone else. */
+
+      if (result == 0 && stamped && !(newt.options & NOTE_UNAPPROVED))
+        cache_store (&newt, &stamp);
+
+      put_newt (client, reply, &newt, flags);
+    }
+
+  clear_newt (&newt);
+  return result;
+}
+
+static int
+handle_get_next_note (struct client *client, struct wire *request,
+                      struct wire *reply)
+{
+  struct newtref nr;
+  time_t seq;
+  int result;
+
+  memset (&nr, 0, sizeof (struct newtref));
+
+  wire_get_newtref (request, &nr);
+  seq = wire_get_time (request);
+
+  if (request->failed || !sane_nfref (&nr.nfr))
+    result = -1;
+  else if (!may_read (client, &nr.nfr))
+    result = -2;
+  else
+    {
+      result = uiuc_get_next_note (&nr, seq);
+      wire_put_int (reply, nr.notenum);
+    }
+
+  newts_free (nr.nfr.owner);
+  newts_free (nr.nfr.name);
+  return result;
+}
+
+static int
+handle_write_note (struct client *client, struct wire *request,
+                   struct wire *reply)
+{
+  struct notesfile *nf;
+  struct newt newt;
+  long handle;
+  int flags, result;
+
+  memset (&newt, 0, sizeof (struct newt));
+
+  handle = wire_get_int (request);
+  flags = (int) wire_get_int (request);
+  wire_get_newt (request, &newt);
+
+  nf = find_nf (client, handle);
+  if (request->failed || nf == NULL)
+    {
+      clear_newt (&newt);
+      return -1;
+    }
+
+  /* Sign it with the client's own name, unless it's the notes user loading
+   * someone else's.  Anonymous notes are taken care of by the backend.
+   */
+
+  if (!privileged (client))
+    {
+      newts_free (newt.auth.name);
+      newt.auth.name = user_name (client->uid);
+      newts_free (newt.auth.system);
+      newt.auth.system = newts_strdup (newts_get_fqdn ());
+      newt.auth.uid = client->uid;
+    }
+
+  if (newt.auth.name == NULL || newt.auth.system == NULL)
+    result = -1;
+  else
+    {
+      if (newt.nr.notenum >= 0)
+        cache_forget (nf->ref, newt.nr.notenum);
+      else if (flags & ADD_POLICY)
+        cache_forget (nf->ref, 0);
+
+      /* Watchers hear about it from the change log; see watch.c. */
+
+      result = uiuc_write_note (nf, &newt, flags);
+      wire_put_int (reply, (long) nf->total_notes);
+    }
+
+  clear_newt (&newt);
+  return result;
+}
+
+static int
+handle_search (struct client *client, struct wire *request, struct wire *reply)
+{
+  struct newts_match *matches = NULL;
+  newts_nfref *ref = nfref_alloc ();
+  char *string;
+  int kind, flags, result, i;
+
+  kind = wire_get_byte (request);
+  wire_get_nfref (request, ref);
+  string = wire_get_string (request);
+  flags = (int) wire_get_int (request);
+
+  if (request->failed || string == NULL || !sane_nfref (ref))
+    result = -1;
+  else if (kind == NOTED_SEARCH_TITLE)
+    result = uiuc_title_search_all (ref, string, &matches);
+  else if (kind == NOTED_SEARCH_AUTHOR)
+    result = uiuc_author_search_all (ref, string, &matches);
+  else if (kind == NOTED_SEARCH_TEXT)
+    result = uiuc_text_search_all (ref, string, flags, &matches);
+  else
+    result = -1;
+
+  for (i = 0; i < result; i++)
+    {
+      wire_put_int (reply, matches[i].notenum);
+      wire_put_int (reply, matches[i].respnum);
+      wire_put_double (reply, matches[i].score);
+    }
+
+  newts_free (matches);
+  newts_free (string);
+  nfref_free (ref);
+  return result;
+}
+
+static int
+handle_get_seqtime (struct client *client, struct wire *request,
+                    struct wire *reply)
+{
+  newts_nfref *ref = nfref_alloc ();
+  char *name;
+  time_t seq = 0;
+  int result;
+
+  wire_get_nfref (request, ref);
+  name = wire_get_string (request);
+
+  if (request->failed || name == NULL || !sane_nfref (ref))
+    result = -1;
+  else if (!owns_sequencer (client, name))
+    result = -2;
+  else
+    {
+      result = uiuc_get_seqtime (ref, name, &seq);
+      wire_put_time (reply, seq);
+    }
+
+  newts_free (name);
+  nfref_free (ref);
+  return result;
+}
+
+static int
+handle_set_seqtime (struct client *client, struct wire *request,
+                    struct wire *reply)
+{
+  newts_nfref *ref = nfref_alloc ();
+  char *name;
+  time_t seq;
+  int result;
+
+  wire_get_nfref (request, ref);
+  name = wire_get_string (request);
+  seq = wire_get_time (request);
+
+  if (request->failed || name == NULL || !sane_nfref (ref))
+    result = -1;
+  else if (!owns_sequencer (client, name))
+    result = -2;
+  else
+    result = uiuc_set_seqtime (ref, name, seq);
+
+  newts_free (name);
+  nfref_free (ref);
+  return result;
+}
+
+/* handle_watch - watch the notesfiles in the request for the client, and
+ * tell it which have been modified since the time of the sequencer it names,
+ * which must be its own.  Only those it may read are watched.
+ */
+
+static int
+handle_watch (struct client *client, struct wire *request,
+              struct wire *reply)
+{
+  newts_nfref *ref = nfref_alloc ();
+  struct notesfile *nf;
+  char *name;
+  long count, i;
+  time_t seq;
+  int result;
+
+  name = wire_get_string (request);
+  count = wire_get_int (request);
+
+  if (request->failed || name == NULL || count < 0)
+    {
+      newts_free (name);
+      nfref_free (ref);
+      return -1;
+    }
+
+  if (!owns_sequencer (client, name))
+    {
+      newts_free (name);
+      nfref_free (ref);
+      return -2;
+    }
+
+  watch_forget (client);
+
+  for (i = 0; i < count && !request->failed; i++)
+    {
+      wire_get_nfref (request, ref);
+
+      if (request->failed || !sane_nfref (ref))
+        {
+          wire_put_int (reply, -1);
+          continue;
+        }
+
+      nf = nf_alloc ();
+      result = uiuc_open_nf (ref, nf);
+
+      if (result == NEWTS_NO_ERROR)
+        {
+          if (nf->perms & READ)
+            {
+              if (uiuc_get_seqtime (ref, name, &seq) != NEWTS_NO_ERROR)
+                seq = 0;
+              result = difftime (seq, nf->modified) <= 0;
+              watch_add (client, i, ref);
+            }
+          else
+            result = -2;
+
+          uiuc_close_nf (nf, FALSE);
+        }
+
+      nf_free (nf);
+      wire_put_int (reply, result);
+    }
+
+  newts_free (name);
+  nfref_free (ref);
+  return 0;
+}
+
+/* handle_map_ring - make the client a ring to send note text through.  Its
+ * descriptor goes with the reply; see serve_one.
+ */
+
+static int
+handle_map_ring (struct client *client, struct wire *request,
+                 struct wire *reply)
+{
+  if (client->ring != NULL)
+    return -1;
+
+  client->ring = ring_create ();
+  if (client->ring == NULL)
+    return -1;
+
+  wire_put_int (reply, (long) client->ring->size);
+  return 0;
+}
+
+static int
+handle_delete_note (struct client *client, struct wire *request,
+                    struct wire *reply)
+{
+  struct newtref nr;
+  int result;
+
+  memset (&nr, 0, sizeof (struct newtref));
+
+  wire_get_newtref (request, &nr);
+
+  if (request->failed || !sane_nfref (&nr.nfr))
+    result = -1;
+  else if (!may_change (client, &nr))
+    result = -2;
+  else
+    {
+      cache_forget (&nr.nfr, nr.notenum);
+      result = uiuc_delete_note (&nr);
+    }
+
+  newts_free (nr.nfr.owner);
+  newts_free (nr.nfr.name);
+  return result;
+}
+
+static int
+handle_modify_note (struct client *client, struct wire *request,
+                    struct wire *reply)
+{
+  struct newt newt;
+  int flags, result;
+
+  memset (&newt, 0, sizeof (struct newt));
+
+  wire_get_nfref (request, &newt.nr.nfr);
+  flags = (int) wire_get_int (request);
+  wire_get_newt (request, &newt);
+
+  if (request->failed || !sane_nfref (&newt.nr.nfr))
+    result = -1;
+  else if (!may_change (client, &newt.nr))
+    result = -2;
+  else
+    {
+      keep_director_flags (client, &newt);
+      cache_forget (&newt.nr.nfr, newt.nr.notenum);
+      result = uiuc_modify_note (&newt, flags);
+    }
+
+  clear_newt (&newt);
+  return result;
+}
+
+static int
+handle_modify_note_text (struct client *client, struct wire *request,
+                         struct wire *reply)
+{
+  struct newt newt;
+  int result;
+
+  memset (&newt, 0, sizeof (struct newt));
+
+  wire_get_nfref (request, &newt.nr.nfr);
+  wire_get_newt (request, &newt);
+
+  if (request->failed || !sane_nfref (&newt.nr.nfr) || newt.text == NULL)
+    result = -1;
+  else if (!may_change (client, &newt.nr))
+    result = -2;
+  else
+    {
+      keep_director_flags (client, &newt);
+      cache_forget (&newt.nr.nfr, newt.nr.notenum);
+      result = uiuc_modify_note_text (&newt);
+    }
+
+  clear_newt (&newt);
+  return result;
+}
+
+/* from_cache - answer the get_note REQUEST from the cache, without the
+ * backend, if CLIENT may read the note and it's there.  A request that
+ * updates the notesfile's statistics has to go to the backend.
+ *
+ * Returns: TRUE if REPLY has the note, or FALSE with REQUEST left as it was.
+ */
+
+static int
+from_cache (struct client *client, struct wire *request, struct wire *reply)
+{
+  struct notesfile *nf;
+  struct newtref nr;
+  size_t pos = request->pos;
+  int updatestats, flags, found = FALSE;
+
+  memset (&nr, 0, sizeof (struct newtref));
+
+  wire_get_newtref (request, &nr);
+  updatestats = wire_get_byte (request);
+  flags = (int) wire_get_int (request);
+
+  if (!request->failed && !updatestats && may_read (client, &nr.nfr))
+    {
+      nf = held_nf (client, &nr.nfr);
+      found = cache_lookup (client, nf, &nr, flags, reply);
+    }
+
+  if (!found)
+    {
+      request->pos = pos;
+      request->failed = FALSE;
+    }
+
+  newts_free (nr.nfr.owner);
+  newts_free (nr.nfr.name);
+  return found;
+}
+
+/* find_nf - return the notesfile CLIENT has open as HANDLE, or NULL. */
+
+static struct notesfile *
+find_nf (struct client *client, long handle)
+{
+  if (handle < 0 || handle >= client->nnfs)
+    return NULL;
+
+  return client->nfs[handle];
+}
+
+/* held_nf - return CLIENT's open notesfile REF, or NULL if it hasn't got
+ * it open.
+ */
+
+static struct notesfile *
+held_nf (const struct client *client, const newts_nfref *ref)
+{
+  int i;
+
+  for (i = 0; i < client->nnfs; i++)
+    if (client->nfs[i] != NULL && nfref_compare (client->nfs[i]->ref, ref) == 0)
+      return client->nfs[i];
+
+  return NULL;
+}
+
+/* may_read - return TRUE if CLIENT has REF open, and may read it. */
+
+static int
+may_read (const struct client *client, const newts_nfref *ref)
+{
+  struct notesfile *nf = held_nf (client, ref);
+
+  return nf != NULL && nf->perms & READ;
+}
+
+/* may_change - return TRUE if CLIENT may delete or modify the note NR refers
+ * to: it has to have the notesfile open, and either direct it or have
+ * written the note itself.  The notes user may change anything.
+ */
+
+static int
+may_change (const struct client *client, const struct newtref *nr)
+{
+  struct notesfile *nf;
+  struct newt newt;
+  int result = FALSE;
+
+  if (privileged (client))
+    return TRUE;
+
+  nf = held_nf (client, &nr->nfr);
+  if (nf == NULL)
+    return FALSE;
+  if (nf->perms & DIRECTOR)
+    return TRUE;
+
+  memset (&newt, 0, sizeof (struct newt));
+  nfref_copy (&newt.nr.nfr, &nr->nfr);
+  newt.nr.notenum = nr->notenum;
+  newt.nr.respnum = nr->respnum;
+
+  if (uiuc_get_note (&newt, FALSE) == 0)
+    result = newt.auth.uid == client->uid && newt.auth.system != NULL &&
+      strcmp (newt.auth.system, newts_get_fqdn ()) == 0;
+
+  clear_newt (&newt);
+  return result;
+}
+
+/* keep_director_flags - unless CLIENT directs NEWT's notesfile, give NEWT
+ * the director message and approval of the note as it's stored, since only
+ * a director may change them.
+ */
+
+static void
+keep_director_flags (const struct client *client, struct newt *newt)
+{
+  struct notesfile *nf = held_nf (client, &newt->nr.nfr);
+  struct newt stored;
+
+  if (privileged (client) || (nf != NULL && nf->perms & DIRECTOR))
+    return;
+
+  memset (&stored, 0, sizeof (struct newt));
+  nfref_copy (&stored.nr.nfr, &newt->nr.nfr);
+  stored.nr.notenum = newt->nr.notenum;
+  stored.nr.respnum = newt->nr.respnum;
+
+  if (uiuc_get_note (&stored, FALSE) == 0)
+    {
+      newts_free (newt->director_message);
+      newt->director_message = stored.director_message;
+      stored.director_message = NULL;
+      newt->options &= ~NOTE_UNAPPROVED;
+      newt->options |= stored.options & NOTE_UNAPPROVED;
+    }
+
+  clear_newt (&stored);
+}
+
+/* sane_nfref - return TRUE if REF names a notesfile, and nothing else. */
+
+static int
+sane_nfref (const newts_nfref *ref)
+{
+  const char *owner = nfref_owner (ref);
+  const char *name = nfref_name (ref);
+
+  if (name == NULL || *name == '\0' || *name == '.' || strchr (name, '/'))
+    return FALSE;
+  if (owner != NULL && (*owner == '.' || strchr (owner, '/')))
+    return FALSE;
+
+  return TRUE;
+}
+
+/* privileged - return TRUE if CLIENT is the notes user, who may act for
+ * anyone.
+ */
+
+static int
+privileged (const struct client *client)
+{
+  struct passwd *pw = getpwnam (NOTES);
+
+  return pw != NULL && pw->pw_uid == client->uid;
+}
+
+/* owns_sequencer - return TRUE if CLIENT may read and set the sequencer
+ * times kept under NAME: its own, or anyone's for the notes user.
+ */
+
+static int
+owns_sequencer (const struct client *client, const char *name)
+{
+  char *own;
+  int result;
+
+  if (privileged (client))
+    return TRUE;
+
+  own = user_name (client->uid);
+  result = own != NULL && strcmp (own, name) == 0;
+  newts_free (own);
+
+  return result;
+}
+
+/* user_name - return a newly allocated copy of UID's login name, or NULL. */
+
+static char *
+user_name (uid_t uid)
+{
+  struct passwd *pw = getpwuid (uid);
+
+  return pw != NULL ? newts_strdup (pw->pw_name) : NULL;
+}
+
+/* clear_newt - free the strings in NEWT. */
+
+static void
+clear_newt (struct newt *newt)
+{
+  newts_free (newt->nr.nfr.owner);
+  newts_free (newt->nr.nfr.name);
+  newts_free (newt->nr.nfr.system);
+  newts_free (newt->nr.nfr.user);
+  newts_free (newt->nr.nfr.pretty_name);
+  newts_free (newt->id.system);
+  newts_free (newt->title);
+  newts_free (newt->director_message);
+  newts_free (newt->auth.name);
+  newts_free (newt->auth.system);
+  newts_free (newt->text);
+}
+
+/* set_status - fill in the status of REPLY, now that it's known. */
+
+static void
+set_status (struct wire *reply, int status)
+{
+  unsigned long value = (unsigned long) (long) status & 0xffffffffUL;
+
+  reply->data[NOTED_HEADER] = (unsigned char) (value >> 24);
+  reply->data[NOTED_HEADER + 1] = (unsigned char) (value >> 16);
+  reply->data[NOTED_HEADER + 2] = (unsigned char) (value >> 8);
+  reply->data[NOTED_HEADER + 3] = (unsigned char) value;
+}
@@ -2,10 +2,7 @@
  * socket.c - functions to handle the BSD socket interface
  *
  * This file is part of the Newts notesfile system.
- * Copyright (C) 2002, 2003 Tyler Berry.
- *
- * This file is heavily indebted to the select(2) info manual and
- * various other info nodes.
+ * Copyright (C) 2002, 2003, 2008 Tyler Berry.
  *
  * Newts is free software; you can redistribute it and/or modify it
  * under the terms of the GNU General Public License as published by
@@ -26,39 +23,131 @@
 # include <config.h>
 #endif
 
-#include "common.h"
+#include "noted.h"
 
 #ifdef HAVE_SYS_SOCKET_H
 # include <sys/socket.h>
 #endif
 
-#ifdef HAVE_NETINET_IN_H
-# include <netinet/in.h>
+#if HAVE_SYS_STAT_H
+# include <sys/stat.h>
 #endif
 
-#if TIME_WITH_SYS_TIME
-# include <sys/time.h>
-# include <time.h>
-#else
-# if HAVE_SYS_TIME_H
-#  include <sys/time.h>
-# else
-#  include <time.h>
-# endif
+#if HAVE_FCNTL_H
+# include <fcntl.h>
 #endif
 
+#include <sys/epoll.h>
 #include <sys/un.h>
 
-#define PORT 9734
+/* All the sockets are nonblocking and watched edge-triggered, so each time
+ * epoll says one is ready, we read, write or accept until it would block.
+ * Only this thread reads from or writes to a client, and only this thread
+ * closes one; the workers tell it when there's something to send, or a
+ * paused client has room for more input, by putting the client on the wake
+ * list and writing a byte to the wake pipe.
+ *
+ * A descriptor being passed to a client, for its ring, is sent with
+ * SCM_RIGHTS along with the first byte of the reply it belongs to, so the
+ * client finds it when it reads that reply.
+ */
+
+#define MAX_EVENTS 64
+
+static int epfd;
+static int wake_pipe[2];
+
+static struct client *wake_list = NULL;
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Clients closed while handling a batch of events, which may yet turn up
+ * later in the batch; they're freed once it's done.
+ */
+
+static struct client *dead_list = NULL;
+
+/* epoll hands back one of these for the listening socket and the wake pipe,
+ * and the client itself for a connection.
+ */
+
+static char listener_mark, wake_mark;
+
+static void accept_clients (int sock);
+static void read_client (struct client *client);
+static void flush_client (struct client *client);
+static void handle_wakes (void);
+static void close_if_done (struct client *client);
+static void hang_up (struct client *client);
+static ssize_t send_with_fd (int fd, const void *data, size_t length,
+                             int pass);
+static int set_nonblocking (int fd);
+
+/* buffer_append - add LENGTH bytes at DATA to the end of BUFFER. */
 
-static int read_from_client (int fd);
+void
+buffer_append (struct buffer *buffer, const void *data, size_t length)
+{
+  size_t used = (size_t) (buffer->data - buffer->base) + buffer->length;
+
+  if (used + length > buffer->size)
+    {
+      /* Move what's left to the front before growing the buffer. */
+
+      if (buffer->length > 0)
+        memmove (buffer->base, buffer->data, buffer->length);
+      buffer->data = buffer->base;
+
+      if (buffer->length + length > buffer->size)
+        {
+          size_t size = buffer->length + length;
+
+          buffer->base = newts_realloc2 (buffer->base, &size);
+          buffer->data = buffer->base;
+          buffer->size = size;
+        }
+    }
+
+  memcpy (buffer->data + buffer->length, data, length);
+  buffer->length += length;
+}
+
+/* buffer_consume - drop the first LENGTH bytes of BUFFER.  They're only
+ * skipped over, and the space is taken back by buffer_append, so taking
+ * a large buffer apart a little at a time doesn't copy it over and over.
+ */
+
+void
+buffer_consume (struct buffer *buffer, size_t length)
+{
+  if (length >= buffer->length)
+    {
+      buffer->data = buffer->base;
+      buffer->length = 0;
+    }
+  else
+    {
+      buffer->data += length;
+      buffer->length -= length;
+    }
+}
+
+/* create_socket - make a socket at PATH for anyone to connect to, and listen
+ * on it with room for BACKLOG connections not yet accepted.  Exits if it
+ * can't.
+ */
 
 int
-create_socket (uint16_t port)
+create_socket (const char *path, int backlog)
 {
   int sock;
   struct sockaddr_un name;
 
+  if (strlen (path) >= sizeof name.sun_path)
+    {
+      fprintf (stderr, _("noted: socket path '%s' is too long\n"), path);
+      exit (EXIT_FAILURE);
+    }
+
   sock = socket (PF_UNIX, SOCK_STREAM, 0);
 
   if (sock < 0)
@@ -67,8 +156,13 @@ create_socket (uint16_t port)
       exit (EXIT_FAILURE);
     }
 
+  memset (&name, 0, sizeof name);
   name.sun_family = AF_UNIX;
-  strcpy (name.sun_path, "/tmp/newts-sock");
+  strcpy (name.sun_path, path);
+
+  /* A socket left behind by an earlier noted would keep us from binding. */
+
+  unlink (path);
 
   if (bind (sock, (struct sockaddr *) &name, sizeof name) < 0)
     {
@@ -76,97 +170,458 @@ create_socket (uint16_t port)
       exit (EXIT_FAILURE);
     }
 
+  /* Everyone may connect; what they may do is up to the access lists. */
+
+  chmod (path, 0777);
+
+  if (set_nonblocking (sock) < 0 || listen (sock, backlog) < 0)
+    {
+      perror ("noted: listen");
+      exit (EXIT_FAILURE);
+    }
+
   return sock;
 }
-     
-int
+
+/* run_server - serve the clients that connect to SOCK, forever. */
+
+void
 run_server (int sock)
 {
-  fd_set active_fd_set, read_fd_set;
-  int i;
-  struct sockaddr_in clientname;
-  size_t size;
-     
-  if (listen (sock, 1) < 0)
+  struct epoll_event event, events[MAX_EVENTS];
+  int i, count;
+
+  if ((epfd = epoll_create (MAX_EVENTS)) < 0 || pipe (wake_pipe) < 0 ||
+      set_nonblocking (wake_pipe[0]) < 0 || set_nonblocking (wake_pipe[1]) < 0)
     {
-      perror ("noted: listen");
+      perror ("noted: epoll");
+      exit (EXIT_FAILURE);
+    }
+
+  memset (&event, 0, sizeof event);
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = &listener_mark;
+  if (epoll_ctl (epfd, EPOLL_CTL_ADD, sock, &event) < 0)
+    {
+      perror ("noted: epoll_ctl");
       exit (EXIT_FAILURE);
     }
-     
-  FD_ZERO (&active_fd_set);
-  FD_SET (sock, &active_fd_set);
-     
+
+  event.data.ptr = &wake_mark;
+  if (epoll_ctl (epfd, EPOLL_CTL_ADD, wake_pipe[0], &event) < 0)
+    {
+      perror ("noted: epoll_ctl");
+      exit (EXIT_FAILURE);
+    }
+
   while (1)
     {
-      read_fd_set = active_fd_set;
-
-      fprintf (stderr, "Server waiting.\n");
-
-      if (select (FD_SETSIZE, &read_fd_set, NULL, NULL, NULL) < 0)
-	{
-	  perror ("noted: select");
-	  exit (EXIT_FAILURE);
-	}
-     
-      for (i = 0; i < FD_SETSIZE; ++i)
-	if (FD_ISSET (i, &read_fd_set))
-	  {
-	    if (i == sock)
-	      {
-		int new;
-
-		size = sizeof (clientname);
-		new = accept (sock, (struct sockaddr *) &clientname,
-			      &size);
-		if (new < 0)
-		  {
-		    perror ("noted: accept");
-		    exit (EXIT_FAILURE);
-		  }
-		fprintf (stderr, "Connect found on %d assigned to %d\n", i, new);
-		FD_SET (new, &active_fd_set);
-	      }
-	    else
-	      {
-		/* Data arriving on an already-connected socket. */
-		if (read_from_client (i) < 0)
-		  {
-		    fprintf (stderr, "Closing fd %d\n", i);
-		    close (i);
-		    FD_CLR (i, &active_fd_set);
-		  }
-	      }
-	  }
-    }
-  exit (EXIT_FAILURE);           /* We should never get here. */
+      if (report_wanted)
+        {
+          report_wanted = FALSE;
+          cache_report (stderr);
+        }
+
+      count = epoll_wait (epfd, events, MAX_EVENTS, -1);
+
+      if (count < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          perror ("noted: epoll_wait");
+          exit (EXIT_FAILURE);
+        }
+
+      for (i = 0; i < count; i++)
+        {
+          if (events[i].data.ptr == &listener_mark)
+            accept_clients (sock);
+          else if (events[i].data.ptr == &wake_mark)
+            handle_wakes ();
+          else
+            {
+              struct client *client = events[i].data.ptr;
+
+              if (client->closed)
+                continue;
+              if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP |
+                                      EPOLLERR))
+                read_client (client);
+              if (events[i].events & EPOLLOUT)
+                {
+                  pthread_mutex_lock (&client->lock);
+                  flush_client (client);
+                  pthread_mutex_unlock (&client->lock);
+                }
+              close_if_done (client);
+            }
+        }
+
+      while (dead_list != NULL)
+        {
+          struct client *client = dead_list;
+
+          dead_list = client->next_wake;
+          if (client->pass_fd >= 0)
+            close (client->pass_fd);
+          pthread_mutex_destroy (&client->lock);
+          newts_free (client->in.base);
+          newts_free (client->out.base);
+          newts_free (client);
+        }
+    }
 }
 
-static int
-read_from_client (int sock)
+/* wake_client - ask the I/O thread to look at CLIENT again: to send what's
+ * been put in its output, to start reading again if it was paused, or to
+ * close it.  The caller holds CLIENT's lock.
+ */
+
+void
+wake_client (struct client *client)
 {
-  char buffer;
-  int nbytes;
-  int uid, gid;
+  char byte = 0;
+
+  if (client->woken)
+    return;
+  client->woken = TRUE;
+
+  pthread_mutex_lock (&wake_lock);
+  client->next_wake = wake_list;
+  wake_list = client;
+  pthread_mutex_unlock (&wake_lock);
 
-  nbytes = read (sock, &buffer, 1);
+  /* If the pipe is full, a wakeup is pending anyway. */
+
+  while (write (wake_pipe[1], &byte, 1) < 0 && errno == EINTR)
+    ;
+}
 
-  if (nbytes < 0)
+/* accept_clients - accept every connection waiting on SOCK, and start
+ * watching it.
+ */
+
+static void
+accept_clients (int sock)
+{
+  struct epoll_event event;
+  struct client *client;
+  uid_t uid;
+  gid_t gid;
+  int fd;
+
+  while (1)
     {
-      perror ("noted: read");
-      exit (EXIT_FAILURE);
+      fd = accept (sock, NULL, NULL);
+
+      if (fd < 0)
+        {
+          if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+          if (errno != EAGAIN && errno != EWOULDBLOCK)
+            perror ("noted: accept");
+          return;
+        }
+
+      /* We have to know who's there to know what they may do. */
+
+      if (getpeereid (fd, &uid, &gid) < 0 || set_nonblocking (fd) < 0)
+        {
+          close (fd);
+          continue;
+        }
+
+      client = newts_zalloc (sizeof (struct client));
+      client->fd = fd;
+      client->uid = uid;
+      client->gid = gid;
+      client->pass_fd = -1;
+      pthread_mutex_init (&client->lock, NULL);
+
+      memset (&event, 0, sizeof event);
+      event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+      event.data.ptr = client;
+      if (epoll_ctl (epfd, EPOLL_CTL_ADD, fd, &event) < 0)
+        {
+          perror ("noted: epoll_ctl");
+          pthread_mutex_destroy (&client->lock);
+          newts_free (client);
+          close (fd);
+          continue;
+        }
+
+      if (debug)
+        fprintf (stderr, "noted: client uid=%d connected on %d\n",
+                 (int) uid, fd);
     }
-  else if (nbytes == 0)
+}
+
+/* read_client - read everything CLIENT has sent, and put it on the run queue
+ * if there's anything to serve.  Stop reading, for now, if it has sent more
+ * than we're willing to hold.
+ */
+
+static void
+read_client (struct client *client)
+{
+  char chunk[READ_CHUNK];
+  ssize_t count;
+  int eof = FALSE, failed = FALSE;
+
+  while (1)
     {
-      return -1;
+      pthread_mutex_lock (&client->lock);
+      if (client->paused || client->closing)
+        {
+          pthread_mutex_unlock (&client->lock);
+          break;
+        }
+      pthread_mutex_unlock (&client->lock);
+
+      count = read (client->fd, chunk, sizeof chunk);
+
+      if (count < 0 && errno == EINTR)
+        continue;
+      if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+      if (count <= 0)
+        {
+          if (count < 0)
+            failed = TRUE;
+          else
+            eof = TRUE;
+        }
+
+      pthread_mutex_lock (&client->lock);
+
+      if (eof || failed)
+        {
+          /* Once they've hung up, serve what they've sent and then close;
+           * if the connection broke, there's no one to serve it to.
+           */
+
+          if (failed)
+            hang_up (client);
+          else
+            client->closing = TRUE;
+        }
+      else
+        {
+          buffer_append (&client->in, chunk, (size_t) count);
+          if (client->in.length > MAX_PENDING)
+            client->paused = TRUE;
+        }
+
+      if (client->in.length > 0 && !client->queued)
+        {
+          client->queued = TRUE;
+          schedule (client);
+        }
+
+      pthread_mutex_unlock (&client->lock);
+
+      if (eof || failed)
+        break;
     }
-  else
+}
+
+/* flush_client - send as much of CLIENT's output as it will take.  The caller
+ * holds CLIENT's lock.
+ */
+
+static void
+flush_client (struct client *client)
+{
+  ssize_t count;
+  size_t sent = 0, length;
+  int passing;
+
+  while (sent < client->out.length)
+    {
+      length = client->out.length - sent;
+      passing = client->pass_fd >= 0 && client->pass_at == sent;
+
+      /* Stop short of a descriptor's byte, to send it with the next write. */
+
+      if (client->pass_fd >= 0 && client->pass_at > sent)
+        length = client->pass_at - sent;
+
+      if (passing)
+        count = send_with_fd (client->fd, client->out.data + sent, length,
+                              client->pass_fd);
+      else
+        count = write (client->fd, client->out.data + sent, length);
+
+      if (count < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+              /* They're gone; nobody will read the rest. */
+
+              hang_up (client);
+              sent = 0;
+            }
+          break;
+        }
+
+      if (passing)
+        {
+          close (client->pass_fd);
+          client->pass_fd = -1;
+        }
+
+      sent += (size_t) count;
+    }
+
+  buffer_consume (&client->out, sent);
+  if (client->pass_fd >= 0)
+    client->pass_at -= sent;
+}
+
+/* handle_wakes - do what the workers asked for each client on the wake
+ * list.
+ */
+
+static void
+handle_wakes (void)
+{
+  struct client *list, *client, *next;
+  char drain[64];
+
+  while (read (wake_pipe[0], drain, sizeof drain) > 0)
+    ;
+
+  pthread_mutex_lock (&wake_lock);
+  list = wake_list;
+  wake_list = NULL;
+  pthread_mutex_unlock (&wake_lock);
+
+  for (client = list; client != NULL; client = next)
+    {
+      int resume = FALSE;
+
+      pthread_mutex_lock (&client->lock);
+      next = client->next_wake;
+      client->woken = FALSE;
+
+      flush_client (client);
+
+      /* The edge that would have told us about more input went by while we
+       * weren't reading, so go and look.
+       */
+
+      if (client->paused && client->in.length <= MAX_PENDING)
+        {
+          client->paused = FALSE;
+          resume = TRUE;
+        }
+
+      pthread_mutex_unlock (&client->lock);
+
+      if (resume)
+        read_client (client);
+      close_if_done (client);
+    }
+}
+
+/* close_if_done - close CLIENT if it's hung up, and nothing more will be
+ * done for it.
+ */
+
+static void
+close_if_done (struct client *client)
+{
+  pthread_mutex_lock (&client->lock);
+
+  if (client->closed || !client->closing || client->queued ||
+      client->woken || client->out.length > 0)
     {
-      getpeereid (sock, &uid, &gid);
-      fprintf (stderr, "Serving client uid=%d on %d: %c to %c\n", uid, sock,
-	       buffer, buffer + 1);
-      buffer++;
-      sleep (5);
-      write (sock, &buffer, 1);
-      return 0;
+      pthread_mutex_unlock (&client->lock);
+      return;
     }
+
+  pthread_mutex_unlock (&client->lock);
+
+  if (debug)
+    fprintf (stderr, "noted: closing %d\n", client->fd);
+
+  forget_client (client);
+
+  epoll_ctl (epfd, EPOLL_CTL_DEL, client->fd, NULL);
+  close (client->fd);
+
+  client->closed = TRUE;
+  client->next_wake = dead_list;
+  dead_list = client;
+}
+
+/* hang_up - give up on CLIENT, whose connection has broken: there's no one
+ * to serve what it sent, or to send anything to.  The caller holds CLIENT's
+ * lock.
+ */
+
+static void
+hang_up (struct client *client)
+{
+  client->closing = TRUE;
+  buffer_consume (&client->in, client->in.length);
+  buffer_consume (&client->out, client->out.length);
+
+  if (client->pass_fd >= 0)
+    {
+      close (client->pass_fd);
+      client->pass_fd = -1;
+    }
+}
+
+/* send_with_fd - write LENGTH bytes at DATA to FD, as write would, passing
+ * the descriptor PASS along with the first of them.
+ */
+
+static ssize_t
+send_with_fd (int fd, const void *data, size_t length, int pass)
+{
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cmsg;
+  union
+  {
+    struct cmsghdr align;
+    char space[CMSG_SPACE (sizeof (int))];
+  } control;
+
+  memset (&msg, 0, sizeof msg);
+  memset (&control, 0, sizeof control);
+
+  iov.iov_base = (void *) data;
+  iov.iov_len = length;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.space;
+  msg.msg_controllen = sizeof control.space;
+
+  cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (int));
+  memcpy (CMSG_DATA (cmsg), &pass, sizeof (int));
+
+  return sendmsg (fd, &msg, 0);
+}
+
+/* set_nonblocking - make reads and writes on FD return at once rather than
+ * wait.  Returns 0, or -1 on error.
+ */
+
+static int
+set_nonblocking (int fd)
+{
+  int flags = fcntl (fd, F_GETFL);
+
+  if (flags < 0)
+    return -1;
+
+  return fcntl (fd, F_SETFL, flags | O_NONBLOCK);
 }
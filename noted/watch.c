@@ -0,0 +1,340 @@
+/*
+ * watch.c - telling clients what's been written to the notesfiles they watch
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "noted.h"
+#include "newts/uiuc.h"
+
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#include <sys/inotify.h>
+
+/* Rather than have every user's checknotes read their sequencer and every
+ * notesfile in it over and over, a client may watch a list of notesfiles,
+ * and be sent an event whenever a note or response is written to one of
+ * them.  Every watch is kept in a table by notesfile name.
+ *
+ * Notes are written by noted's clients and by programs that use the backend
+ * themselves, so rather than wait to be told, we follow each watched
+ * notesfile's change log (see uiuc_follow_changes).  Its directory is
+ * watched with inotify, and a thread of our own looks at the logs of the
+ * notesfiles it hears about.
+ *
+ * The table only changes, and is only read, with BACKEND_LOCK held: watches
+ * are added by a request, dropped when their client goes, and looked up
+ * when a notesfile is written.  An event is put straight into the watching
+ * client's output, under its lock, unless the client is on its way out.  A
+ * client that doesn't read its events doesn't get more than MAX_PENDING
+ * bytes of them; the rest are dropped, as the client will find when it next
+ * checks its sequencer.
+ */
+
+#define NBUCKETS 256
+#define EVENT_BUFSIZE 4096
+
+struct watch
+{
+  struct client *client;
+  long which;                   /* Its place in the client's list. */
+  newts_nfref *ref;             /* The notesfile, */
+  int wd;                       /* its directory's inotify watch, or -1, */
+  struct uiuc_follow follow;    /* and how far we've read its change log. */
+  struct watch *next;
+};
+
+static struct watch *watches[NBUCKETS];
+static int notify_fd = -1;
+
+static void *follow (void *unused);
+static void catch_up (int wd);
+static void announce (struct watch *watch, int notenum, int respnum);
+static void release_wd (int wd);
+static void drop_wd (int wd);
+static unsigned long hash_name (const char *name);
+
+/* watch_start - start the thread that follows watched notesfiles.  Returns 0,
+ * or -1 if it couldn't be started, in which case watches get no events.
+ */
+
+int
+watch_start (void)
+{
+  pthread_attr_t attr;
+  pthread_t thread;
+  sigset_t signals, old;
+  int result;
+
+  if ((notify_fd = inotify_init ()) < 0)
+    return -1;
+  fcntl (notify_fd, F_SETFD, FD_CLOEXEC);
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+  /* Leave SIGUSR1 to the I/O thread, whose epoll_wait it interrupts. */
+
+  sigemptyset (&signals);
+  sigaddset (&signals, SIGUSR1);
+  pthread_sigmask (SIG_BLOCK, &signals, &old);
+
+  result = pthread_create (&thread, &attr, follow, NULL);
+
+  pthread_sigmask (SIG_SETMASK, &old, NULL);
+  pthread_attr_destroy (&attr);
+
+  if (result != 0)
+    {
+      close (notify_fd);
+      notify_fd = -1;
+      return -1;
+    }
+
+  return 0;
+}
+
+/* watch_add - send CLIENT an event, numbered WHICH, for everything written
+ * to REF from now on.  The caller holds BACKEND_LOCK.
+ */
+
+void
+watch_add (struct client *client, long which, const newts_nfref *ref)
+{
+  struct watch *watch = newts_zalloc (sizeof (struct watch));
+  unsigned long bucket = hash_name (nfref_name (ref)) % NBUCKETS;
+  struct newts_change *changes;
+  char directory[1024];
+  const char *owner = nfref_owner (ref);
+  int count;
+
+  watch->client = client;
+  watch->which = which;
+  watch->ref = nfref_alloc ();
+  nfref_copy (watch->ref, ref);
+
+  if (owner == NULL)
+    snprintf (directory, sizeof directory, "%s/%s", SPOOL,
+              nfref_name (ref));
+  else
+    snprintf (directory, sizeof directory, "%s/%s:%s", SPOOL, owner,
+              nfref_name (ref));
+
+  /* Watch first, then skip what's already logged, so that nothing written
+   * in between is missed.
+   */
+
+  watch->wd = notify_fd < 0 ? -1 :
+    inotify_add_watch (notify_fd, directory, IN_MODIFY);
+
+  count = uiuc_follow_changes (watch->ref, &watch->follow, &changes);
+  if (count > 0)
+    changes_free (changes, count);
+
+  watch->next = watches[bucket];
+  watches[bucket] = watch;
+}
+
+/* watch_forget - drop all of CLIENT's watches.  The caller holds
+ * BACKEND_LOCK.
+ */
+
+void
+watch_forget (struct client *client)
+{
+  struct watch **link, *watch;
+  int i;
+
+  for (i = 0; i < NBUCKETS; i++)
+    for (link = &watches[i]; *link != NULL;)
+      {
+        watch = *link;
+        if (watch->client != client)
+          {
+            link = &watch->next;
+            continue;
+          }
+
+        *link = watch->next;
+        release_wd (watch->wd);
+        nfref_free (watch->ref);
+        newts_free (watch);
+      }
+}
+
+/* follow - wait to hear from inotify that a watched notesfile was written,
+ * and announce what was written to it, forever.
+ */
+
+static void *
+follow (void *unused)
+{
+  char buffer[EVENT_BUFSIZE]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  const struct inotify_event *event;
+  ssize_t length;
+  char *p;
+  int last;
+
+  while (1)
+    {
+      length = read (notify_fd, buffer, sizeof buffer);
+      if (length < 0 && errno == EINTR)
+        continue;
+      if (length <= 0)
+        return NULL;
+
+      pthread_mutex_lock (&backend_lock);
+
+      /* A write sets off an event for each file it touches, one after the
+       * other; looking at the change log once for the lot is enough.
+       */
+
+      for (p = buffer, last = -1; p < buffer + length;
+           p += sizeof (struct inotify_event) + event->len)
+        {
+          event = (const struct inotify_event *) p;
+
+          if (event->mask & IN_Q_OVERFLOW)
+            catch_up (-1);
+          else if (event->mask & IN_IGNORED)
+            drop_wd (event->wd);
+          else if (event->wd != last)
+            catch_up (event->wd);
+          last = event->wd;
+        }
+
+      pthread_mutex_unlock (&backend_lock);
+    }
+
+  return NULL;
+}
+
+/* catch_up - announce what's been written to the notesfiles whose directory
+ * has the inotify watch WD, or to every notesfile if WD is -1.  The caller
+ * holds BACKEND_LOCK.
+ */
+
+static void
+catch_up (int wd)
+{
+  struct newts_change *changes;
+  struct watch *watch;
+  int i, j, count;
+
+  for (i = 0; i < NBUCKETS; i++)
+    for (watch = watches[i]; watch != NULL; watch = watch->next)
+      {
+        if (wd != -1 && watch->wd != wd)
+          continue;
+
+        count = uiuc_follow_changes (watch->ref, &watch->follow, &changes);
+        if (count <= 0)
+          continue;
+
+        for (j = 0; j < count; j++)
+          if (changes[j].auth.uid != watch->client->uid)
+            announce (watch, changes[j].notenum, changes[j].response);
+
+        changes_free (changes, count);
+      }
+}
+
+/* announce - tell WATCH's client that response RESPNUM to note NOTENUM, or
+ * basenote NOTENUM if RESPNUM is 0, was written.  The caller holds
+ * BACKEND_LOCK.
+ */
+
+static void
+announce (struct watch *watch, int notenum, int respnum)
+{
+  struct wire event;
+  struct client *client = watch->client;
+
+  wire_init (&event);
+  wire_begin (&event, NOTED_EVENT);
+  wire_put_int (&event, 0);
+  wire_put_int (&event, watch->which);
+  wire_put_int (&event, notenum);
+  wire_put_int (&event, respnum);
+  wire_finish (&event);
+
+  pthread_mutex_lock (&client->lock);
+  if (!client->closing && client->out.length < MAX_PENDING)
+    {
+      buffer_append (&client->out, event.data, event.length);
+      wake_client (client);
+    }
+  pthread_mutex_unlock (&client->lock);
+
+  wire_free (&event);
+}
+
+/* release_wd - stop watching the directory with the inotify watch WD, unless
+ * another watch still needs it.  The caller holds BACKEND_LOCK.
+ */
+
+static void
+release_wd (int wd)
+{
+  struct watch *watch;
+  int i;
+
+  if (wd < 0)
+    return;
+
+  for (i = 0; i < NBUCKETS; i++)
+    for (watch = watches[i]; watch != NULL; watch = watch->next)
+      if (watch->wd == wd)
+        return;
+
+  inotify_rm_watch (notify_fd, wd);
+}
+
+/* drop_wd - forget the inotify watch WD, which inotify has dropped because
+ * its directory went away.  The caller holds BACKEND_LOCK.
+ */
+
+static void
+drop_wd (int wd)
+{
+  struct watch *watch;
+  int i;
+
+  for (i = 0; i < NBUCKETS; i++)
+    for (watch = watches[i]; watch != NULL; watch = watch->next)
+      if (watch->wd == wd)
+        watch->wd = -1;
+}
+
+static unsigned long
+hash_name (const char *name)
+{
+  unsigned long hash = 5381;
+
+  while (*name != '\0')
+    hash = hash * 33 + (unsigned char) *name++;
+
+  return hash;
+}
@@ -0,0 +1,169 @@
+/*
+ * worker.c - the threads that serve clients' requests
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include "noted.h"
+#include "newts/uiuc.h"
+
+/* A client with input waiting is on the run queue, and stays marked queued
+ * until a worker has served everything it can, so no two workers ever serve
+ * the same client.  A worker serves a few requests at a time and then puts
+ * the client at the back of the queue, so one busy client can't keep the
+ * others waiting.
+ *
+ * The backend keeps its caches, and who it's acting for, in globals, so only
+ * one worker may be in it at a time, even for different notesfiles; that's
+ * BACKEND_LOCK.  Everything else a worker does - taking requests apart,
+ * answering from the note cache and putting replies together - runs
+ * alongside the others.
+ */
+
+pthread_mutex_t backend_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Who the backend's access checks think is asking; see act_for. */
+uid_t euid;
+
+static struct client *run_head = NULL;
+static struct client *run_tail = NULL;
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t run_ready = PTHREAD_COND_INITIALIZER;
+
+static void *work (void *unused);
+static void serve (struct client *client);
+
+/* start_workers - start COUNT worker threads.  Returns 0, or -1 if none could
+ * be started.
+ */
+
+int
+start_workers (int count)
+{
+  pthread_attr_t attr;
+  pthread_t thread;
+  sigset_t signals, old;
+  int i, started = 0;
+
+  pthread_attr_init (&attr);
+  pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+
+  /* Leave SIGUSR1 to the I/O thread, whose epoll_wait it interrupts. */
+
+  sigemptyset (&signals);
+  sigaddset (&signals, SIGUSR1);
+  pthread_sigmask (SIG_BLOCK, &signals, &old);
+
+  for (i = 0; i < count; i++)
+    if (pthread_create (&thread, &attr, work, NULL) == 0)
+      started++;
+
+  pthread_sigmask (SIG_SETMASK, &old, NULL);
+  pthread_attr_destroy (&attr);
+
+  if (started < count)
+    fprintf (stderr, _("noted: started only %d of %d workers\n"), started,
+             count);
+
+  return started > 0 ? 0 : -1;
+}
+
+/* schedule - put CLIENT at the back of the run queue.  The caller has marked
+ * it queued.
+ */
+
+void
+schedule (struct client *client)
+{
+  pthread_mutex_lock (&run_lock);
+
+  client->next_run = NULL;
+  if (run_tail == NULL)
+    run_head = client;
+  else
+    run_tail->next_run = client;
+  run_tail = client;
+
+  pthread_cond_signal (&run_ready);
+  pthread_mutex_unlock (&run_lock);
+}
+
+/* act_for - make the backend act for CLIENT: its access checks go by
+ * CLIENT's user, and so do the authors of what it writes.  The caller holds
+ * BACKEND_LOCK.
+ */
+
+void
+act_for (struct client *client)
+{
+  euid = client->uid;
+  uiuc_set_identity (client->uid);
+}
+
+/* work - take clients off the run queue and serve them, forever. */
+
+static void *
+work (void *unused)
+{
+  struct client *client;
+
+  while (1)
+    {
+      pthread_mutex_lock (&run_lock);
+      while (run_head == NULL)
+        pthread_cond_wait (&run_ready, &run_lock);
+
+      client = run_head;
+      run_head = client->next_run;
+      if (run_head == NULL)
+        run_tail = NULL;
+      pthread_mutex_unlock (&run_lock);
+
+      serve (client);
+    }
+
+  return NULL;
+}
+
+/* serve - serve up to SERVE_BATCH of CLIENT's requests, then either put it
+ * back on the run queue or, if it has nothing more to serve, take it off.
+ * Either way, have the I/O thread send the replies.
+ */
+
+static void
+serve (struct client *client)
+{
+  int served = 0;
+
+  pthread_mutex_lock (&client->lock);
+
+  while (served < SERVE_BATCH && serve_one (client))
+    served++;
+
+  if (served == SERVE_BATCH)
+    schedule (client);
+  else
+    client->queued = FALSE;
+
+  wake_client (client);
+  pthread_mutex_unlock (&client->lock);
+}
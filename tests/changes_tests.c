@@ -0,0 +1,282 @@
+/*
+ * changes_tests.c - tests for the change log behind get_changes
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#if STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+#endif
+
+#if STDC_HEADERS || HAVE_STRING_H
+# include <string.h>
+#elif HAVE_STRINGS_H
+# include <strings.h>
+#endif
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include "check/check.h"
+#include "internal.h"
+#include "newts/nfref.h"
+#include "newts/note.h"
+#include "newts/notesfile.h"
+#include "newts/sequencer.h"
+
+/* Each test writes to a notesfile of its own in the notes spool, which has
+ * to be writable; where it isn't, they're skipped.  Notes are
+ * written well before SEQ, so that only what's done to them afterwards is
+ * new.
+ */
+
+#define AGO(seconds) (time (NULL) - (seconds))
+#define WRITTEN      AGO (120)
+#define SEQ          AGO (60)
+
+uid_t euid;
+static newts_nfref *ref;
+static struct notesfile nf;
+static char nfname[32];
+
+void
+setup_changes (void)
+{
+  euid = geteuid ();
+  snprintf (nfname, sizeof nfname, "changes%ld", (long) getpid ());
+
+  ref = nfref_alloc ();
+  nfref_set_name (ref, nfname);
+  memset (&nf, 0, sizeof nf);
+
+  fail_unless (create_nf (ref, 0) == 0, NULL);
+  fail_unless (open_nf (ref, &nf) == 0, NULL);
+}
+
+void
+teardown_changes (void)
+{
+  close_nf (&nf, FALSE);
+  delete_nf (ref);
+  nfref_free (ref);
+}
+
+/* post - write a basenote, or a response to NOTENUM if it's positive, with
+ * TEXT.  Returns the number of the basenote or response.
+ */
+
+static int
+post (int notenum, const char *text)
+{
+  struct newt note;
+  int result;
+
+  memset (&note, 0, sizeof note);
+  nfref_copy (&note.nr.nfr, nf.ref);
+  note.nr.notenum = notenum > 0 ? notenum : -1;
+  note.title = "A title";
+  note.text = (char *) text;
+  note.auth.name = "george";
+  note.auth.system = "host.example";
+  note.auth.uid = 1000;
+  note.created = note.modified = WRITTEN;
+
+  result = write_note (&nf, &note, UPDATE_TIMES + ADD_ID);
+  fail_unless (result > 0, "couldn't write a note: %d", result);
+
+  return result;
+}
+
+/* fetch - read basenote NOTENUM, or its response RESPNUM, into NOTE. */
+
+static void
+fetch (struct newt *note, int notenum, int respnum)
+{
+  memset (note, 0, sizeof (struct newt));
+  nfref_copy (&note->nr.nfr, nf.ref);
+  note->nr.notenum = notenum;
+  note->nr.respnum = respnum;
+
+  fail_unless (get_note (note, FALSE) == 0, NULL);
+}
+
+/* changed - return how many changes get_changes finds after SEQ, checking
+ * that the one for NOTENUM is there if it's positive.
+ */
+
+static int
+changed (time_t seq, int notenum, int response)
+{
+  struct newts_change *changes;
+  int count, i, seen = FALSE;
+
+  count = get_changes (ref, seq, &changes);
+  fail_if (count < 0, "get_changes failed: %d", count);
+
+  for (i = 0; i < count; i++)
+    if (changes[i].notenum == notenum && changes[i].response == response)
+      seen = TRUE;
+  changes_free (changes, count);
+
+  if (notenum > 0)
+    fail_unless (seen, "note %d wasn't found", notenum);
+
+  return count;
+}
+
+/* forget_log - remove the change log, so that it's rebuilt from the notes. */
+
+static void
+forget_log (void)
+{
+  char filename[1024];
+
+  snprintf (filename, sizeof filename, "%s/%s/changes", SPOOL, nfname);
+  unlink (filename);
+}
+
+START_TEST (test_written)
+{
+  int notenum;
+
+  notenum = post (0, "A basenote.\n");
+  post (notenum, "A response.\n");
+
+  fail_unless (changed (WRITTEN - 1, notenum, FALSE) == 2, NULL);
+  fail_unless (changed (SEQ, 0, FALSE) == 0, NULL);
+}
+END_TEST
+
+START_TEST (test_modified_text)
+{
+  struct newt note;
+  int notenum;
+
+  notenum = post (0, "A basenote.\n");
+  post (notenum, "A response.\n");
+  fail_unless (changed (SEQ, 0, FALSE) == 0, NULL);
+
+  fetch (&note, notenum, 0);
+  note.text = "An edited basenote.\n";
+  note.modified = AGO (10);
+  fail_unless (modify_note_text (&note) == 0, NULL);
+
+  fail_unless (changed (SEQ, notenum, FALSE) == 1, NULL);
+
+  fetch (&note, notenum, 1);
+  note.text = "An edited response.\n";
+  note.modified = AGO (5);
+  fail_unless (modify_note_text (&note) == 0, NULL);
+
+  fail_unless (changed (SEQ, notenum, TRUE) == 2, NULL);
+  fail_unless (changed (AGO (8), notenum, TRUE) == 1, NULL);
+}
+END_TEST
+
+START_TEST (test_modified_note)
+{
+  struct newt note;
+  int notenum;
+
+  notenum = post (0, "A basenote.\n");
+
+  /* Changing the title counts only when it says so. */
+
+  fetch (&note, notenum, 0);
+  note.title = "Another title";
+  note.modified = AGO (10);
+  fail_unless (modify_note (&note, 0) == 0, NULL);
+  fail_unless (changed (SEQ, 0, FALSE) == 0, NULL);
+
+  fail_unless (modify_note (&note, UPDATE_TIMES) == 0, NULL);
+  fail_unless (changed (SEQ, notenum, FALSE) == 1, NULL);
+
+  /* Deleting it takes it back out, and bringing it back puts it in. */
+
+  note.options |= NOTE_DELETED;
+  fail_unless (modify_note (&note, 0) == 0, NULL);
+  fail_unless (changed (SEQ, 0, FALSE) == 0, NULL);
+
+  note.options &= ~NOTE_DELETED;
+  fail_unless (modify_note (&note, 0) == 0, NULL);
+  fail_unless (changed (SEQ, notenum, FALSE) == 1, NULL);
+}
+END_TEST
+
+START_TEST (test_rebuilt)
+{
+  struct newt note;
+  int notenum, other;
+
+  notenum = post (0, "A basenote.\n");
+  other = post (0, "Another basenote.\n");
+
+  fetch (&note, notenum, 0);
+  note.text = "An edited basenote.\n";
+  note.modified = AGO (10);
+  fail_unless (modify_note_text (&note) == 0, NULL);
+
+  /* The notes themselves say the first was edited, and the second not. */
+
+  forget_log ();
+  fail_unless (changed (SEQ, notenum, FALSE) == 1, NULL);
+  fail_unless (changed (WRITTEN - 1, other, FALSE) == 2, NULL);
+}
+END_TEST
+
+Suite *
+changes_suite (void)
+{
+  Suite *suite = suite_create ("changes");
+  TCase *log = tcase_create ("Change Log");
+
+  suite_add_tcase (suite, log);
+  tcase_add_checked_fixture (log, setup_changes, teardown_changes);
+
+  tcase_add_test (log, test_written);
+  tcase_add_test (log, test_modified_text);
+  tcase_add_test (log, test_modified_note);
+  tcase_add_test (log, test_rebuilt);
+
+  return suite;
+}
+
+int
+main (void)
+{
+  int failures;
+  Suite *suite;
+  SRunner *srunner;
+
+  if (access (SPOOL, W_OK) != 0)
+    return 77;
+
+  suite = changes_suite ();
+  srunner = srunner_create (suite);
+  srunner_run_all (srunner, CK_ENV);
+  failures = srunner_ntests_failed (srunner);
+  srunner_free (srunner);
+
+  return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
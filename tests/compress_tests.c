@@ -0,0 +1,338 @@
+/*
+ * compress_tests.c - tests for compressing a notesfile while it's in use
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#if STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+#endif
+
+#if STDC_HEADERS || HAVE_STRING_H
+# include <string.h>
+#elif HAVE_STRINGS_H
+# include <strings.h>
+#endif
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "check/check.h"
+#include "internal.h"
+#include "newts/error.h"
+#include "newts/nfref.h"
+#include "newts/note.h"
+#include "newts/notesfile.h"
+
+/* The tests write to a notesfile of their own in the notes spool, which has
+ * to be writable; where it isn't, they're skipped.
+ *
+ * An editor process keeps adding a line to the text of note 1 while we
+ * compress the notesfile over and over.  The other notes are there to give
+ * the compression something to do, and every other one is deleted so that
+ * it renumbers them.  Every edit that succeeded has to be there at the end,
+ * including those that were waiting for the compression to let go.
+ *
+ * A compression that can't copy all the text, here because we've limited the
+ * size of the files it can write, has to leave the notesfile as it was.
+ */
+
+#define NOTES 200
+#define EDITS 400
+
+uid_t euid;
+static newts_nfref *ref;
+static char nfname[32];
+
+void
+setup_compress (void)
+{
+  euid = geteuid ();
+  snprintf (nfname, sizeof nfname, "compress%ld", (long) getpid ());
+
+  ref = nfref_alloc ();
+  nfref_set_name (ref, nfname);
+}
+
+void
+teardown_compress (void)
+{
+  delete_nf (ref);
+  nfref_free (ref);
+}
+
+/* post - write a basenote with TEXT to NF.  Returns its number. */
+
+static int
+post (struct notesfile *nf, const char *text)
+{
+  struct newt note;
+
+  memset (&note, 0, sizeof note);
+  nfref_copy (&note.nr.nfr, nf->ref);
+  note.nr.notenum = -1;
+  note.title = "A title";
+  note.text = (char *) text;
+  note.auth.name = "george";
+  note.auth.system = "host.example";
+  note.auth.uid = 1000;
+  note.created = note.modified = time (NULL) - 60;
+
+  return write_note (nf, &note, UPDATE_TIMES + ADD_ID);
+}
+
+/* fetch - read basenote NOTENUM into NOTE.  Returns what get_note does. */
+
+static int
+fetch (struct newt *note, int notenum)
+{
+  memset (note, 0, sizeof (struct newt));
+  nfref_copy (&note->nr.nfr, ref);
+  note->nr.notenum = notenum;
+
+  return get_note (note, FALSE);
+}
+
+/* count_lines - the number of lines in TEXT. */
+
+static int
+count_lines (const char *text)
+{
+  int count = 0;
+
+  for (; *text != '\0'; text++)
+    if (*text == '\n')
+      count++;
+
+  return count;
+}
+
+/* edit - once READY says the notesfile is there, add a line to note 1 EDITS
+ * times, and write to DONE how many of them succeeded.  Runs in a process of
+ * its own, so that it has files of its own open.
+ */
+
+static void
+edit (int ready, int done)
+{
+  struct newt note;
+  char go, *text;
+  int i, edited = 0;
+
+  if (read (ready, &go, 1) != 1)
+    _exit (1);
+
+  for (i = 0; i < EDITS; i++)
+    {
+      if (fetch (&note, 1) != 0)
+        continue;
+
+      text = malloc (strlen (note.text) + 3);
+      sprintf (text, "%sx\n", note.text);
+      note.text = text;
+      time (&note.modified);
+
+      if (modify_note_text (&note) == 0)
+        edited++;
+      free (text);
+    }
+
+  write (done, &edited, sizeof edited);
+  _exit (0);
+}
+
+START_TEST (test_edits_survive)
+{
+  struct notesfile nf;
+  struct newtref nr;
+  struct newt note;
+  unsigned numnotes, numresps;
+  int ready[2], done[2];
+  int status, edited, i, rounds = 0;
+  pid_t editor;
+  char go = 1;
+
+  fail_unless (pipe (ready) == 0 && pipe (done) == 0, NULL);
+
+  /* Start the editor before anything is open, so that none of our files are
+   * shared with it.
+   */
+
+  editor = fork ();
+  fail_if (editor < 0, NULL);
+  if (editor == 0)
+    edit (ready[0], done[1]);
+
+  memset (&nf, 0, sizeof nf);
+  fail_unless (create_nf (ref, 0) == 0, NULL);
+  fail_unless (open_nf (ref, &nf) == 0, NULL);
+
+  fail_unless (post (&nf, "") == 1, NULL);
+  for (i = 2; i <= NOTES; i++)
+    fail_unless (post (&nf, "Something to copy.\n") == i, NULL);
+
+  memset (&nr, 0, sizeof nr);
+  nfref_copy (&nr.nfr, ref);
+  for (nr.notenum = 2; nr.notenum <= NOTES; nr.notenum += 2)
+    fail_unless (delete_note (&nr) == 0, NULL);
+
+  write (ready[1], &go, 1);
+
+  do
+    {
+      fail_unless (compress_nf_online (&nf, &numnotes, &numresps, NULL,
+                                       NULL) == 0, NULL);
+      rounds++;
+    }
+  while (waitpid (editor, &status, WNOHANG) == 0);
+
+  fail_unless (WIFEXITED (status) && WEXITSTATUS (status) == 0, NULL);
+  fail_unless (read (done[0], &edited, sizeof edited) == sizeof edited, NULL);
+  fail_unless (edited == EDITS, "only %d of %d edits worked", edited, EDITS);
+
+  fail_unless (fetch (&note, 1) == 0, NULL);
+  fail_unless (count_lines (note.text) == edited,
+               "%d of %d edits survived %d compressions",
+               count_lines (note.text), edited, rounds);
+  fail_unless (numnotes == NOTES / 2, "%u notes left", numnotes);
+
+  close_nf (&nf, FALSE);
+}
+END_TEST
+
+/* check_short_copy - fill a notesfile with notes, then check that COMPRESS
+ * fails on it when the new text won't fit, and that the notes are still all
+ * there afterwards.
+ */
+
+static void
+check_short_copy (int (*compress) (struct notesfile *nf))
+{
+  struct notesfile nf;
+  struct newt note;
+  struct rlimit limit, saved;
+  char text[1024];
+  int i;
+
+  memset (text, 'y', sizeof text - 2);
+  text[sizeof text - 2] = '\n';
+  text[sizeof text - 1] = '\0';
+
+  memset (&nf, 0, sizeof nf);
+  fail_unless (create_nf (ref, 0) == 0, NULL);
+  fail_unless (open_nf (ref, &nf) == 0, NULL);
+  for (i = 1; i <= NOTES / 4; i++)
+    fail_unless (post (&nf, text) == i, NULL);
+
+  signal (SIGXFSZ, SIG_IGN);
+  getrlimit (RLIMIT_FSIZE, &saved);
+  limit = saved;
+  limit.rlim_cur = 8 * sizeof text;
+  fail_unless (setrlimit (RLIMIT_FSIZE, &limit) == 0, NULL);
+
+  i = compress (&nf);
+
+  setrlimit (RLIMIT_FSIZE, &saved);
+  fail_unless (i == NEWTS_IO_ERROR, "compression returned %d", i);
+
+  fail_unless (fetch (&note, NOTES / 4) == 0, NULL);
+  fail_unless (strcmp (note.text, text) == 0, NULL);
+  fail_unless (fetch (&note, 1) == 0, NULL);
+  fail_unless (strcmp (note.text, text) == 0, NULL);
+
+  close_nf (&nf, FALSE);
+}
+
+static int
+compress_offline (struct notesfile *nf)
+{
+  unsigned numnotes, numresps;
+
+  return compress_nf (nf, &numnotes, &numresps);
+}
+
+static int
+compress_online (struct notesfile *nf)
+{
+  unsigned numnotes, numresps;
+
+  return compress_nf_online (nf, &numnotes, &numresps, NULL, NULL);
+}
+
+START_TEST (test_short_copy_offline)
+{
+  check_short_copy (compress_offline);
+}
+END_TEST
+
+START_TEST (test_short_copy_online)
+{
+  check_short_copy (compress_online);
+}
+END_TEST
+
+Suite *
+compress_suite (void)
+{
+  Suite *suite = suite_create ("compress");
+  TCase *online = tcase_create ("Online Compression");
+  TCase *failed = tcase_create ("Failed Compression");
+
+  suite_add_tcase (suite, online);
+  tcase_add_checked_fixture (online, setup_compress, teardown_compress);
+  tcase_set_timeout (online, 60);
+
+  tcase_add_test (online, test_edits_survive);
+
+  suite_add_tcase (suite, failed);
+  tcase_add_checked_fixture (failed, setup_compress, teardown_compress);
+
+  tcase_add_test (failed, test_short_copy_offline);
+  tcase_add_test (failed, test_short_copy_online);
+
+  return suite;
+}
+
+int
+main (void)
+{
+  int failures;
+  Suite *suite;
+  SRunner *srunner;
+
+  if (access (SPOOL, W_OK) != 0)
+    return 77;
+
+  suite = compress_suite ();
+  srunner = srunner_create (suite);
+  srunner_run_all (srunner, CK_ENV);
+  failures = srunner_ntests_failed (srunner);
+  srunner_free (srunner);
+
+  return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
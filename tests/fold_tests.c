@@ -0,0 +1,291 @@
+/*
+ * fold_tests.c - tests for case-insensitive substring search
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#if STDC_HEADERS
+# include <ctype.h>
+# include <stdlib.h>
+#endif
+
+#if STDC_HEADERS || HAVE_STRING_H
+# include <string.h>
+#elif HAVE_STRINGS_H
+# include <strings.h>
+#endif
+
+#if HAVE_SYS_TYPES_H
+# include <sys/types.h>
+#endif
+
+#include "check/check.h"
+#include "fold.h"
+
+/* Every search is made with each width of vector fold_search can use, and
+ * checked against the obvious search; on machines without them, the wider
+ * ones fall back on the narrower.
+ */
+
+#define MAX_TEXT 300
+
+static const size_t widths[] = { 0, 16, 32 };
+
+#define NWIDTHS (sizeof widths / sizeof widths[0])
+
+uid_t euid;
+
+void
+teardown_fold (void)
+{
+  fold_set_width (32);
+}
+
+/* naive_search - the first place NEEDLE occurs in the LENGTH characters of
+ * TEXT, ignoring case, found the slow way.
+ */
+
+static const char *
+naive_search (const char *needle, const char *text, size_t length)
+{
+  size_t m = strlen (needle), i, j;
+
+  for (i = 0; i + m <= length; i++)
+    {
+      for (j = 0; j < m; j++)
+        if (tolower ((unsigned char) text[i + j]) !=
+            tolower ((unsigned char) needle[j]))
+          break;
+      if (j == m)
+        return text + i;
+    }
+
+  return NULL;
+}
+
+/* check_search - check that every width finds NEEDLE in the LENGTH
+ * characters of TEXT where naive_search does.
+ */
+
+static void
+check_search (const char *needle, const char *text, size_t length)
+{
+  struct fold_needle *compiled = fold_compile (needle);
+  const char *expected = naive_search (needle, text, length);
+  size_t w;
+
+  for (w = 0; w < NWIDTHS; w++)
+    {
+      const char *found;
+
+      fold_set_width (widths[w]);
+      found = fold_search (compiled, text, length);
+
+      fail_unless (found == expected,
+                   "width %u: '%s' in %u characters found at %ld, not %ld",
+                   (unsigned) widths[w], needle, (unsigned) length,
+                   found ? (long) (found - text) : -1L,
+                   expected ? (long) (expected - text) : -1L);
+    }
+
+  fold_free (compiled);
+}
+
+/* fill - fill LENGTH characters of TEXT with C. */
+
+static void
+fill (char *text, size_t length, char c)
+{
+  memset (text, c, length);
+}
+
+START_TEST (test_empty_needle)
+{
+  struct fold_needle *compiled = fold_compile ("");
+  const char *text = "anything";
+
+  fail_unless (fold_search (compiled, text, strlen (text)) == text, NULL);
+  fold_free (compiled);
+}
+END_TEST
+
+START_TEST (test_needle_longer_than_text)
+{
+  check_search ("longer", "long", 4);
+  check_search ("x", "", 0);
+}
+END_TEST
+
+START_TEST (test_ignores_case)
+{
+  const char *text = "The Quick Brown FOX jumps over the lazy dog";
+
+  check_search ("fox", text, strlen (text));
+  check_search ("QUICK brown", text, strlen (text));
+  check_search ("LAZY DOG", text, strlen (text));
+  check_search ("cat", text, strlen (text));
+}
+END_TEST
+
+START_TEST (test_block_boundaries)
+{
+  static const char *needles[] = { "a", "Zq", "needle", "NeEdLeS_and_pins",
+    "a needle longer than one whole block of text"
+  };
+  char text[MAX_TEXT];
+  size_t n, at;
+
+  /* Put each needle at every offset around the ends of the first few
+   * 16- and 32-byte blocks, so that it straddles them every way it can.
+   */
+
+  for (n = 0; n < sizeof needles / sizeof needles[0]; n++)
+    for (at = 0; at < 100; at++)
+      {
+        size_t m = strlen (needles[n]);
+
+        fill (text, sizeof text, 'x');
+        memcpy (text + at, needles[n], m);
+        text[at] = (char) toupper ((unsigned char) text[at]);
+
+        check_search (needles[n], text, sizeof text);
+      }
+}
+END_TEST
+
+START_TEST (test_end_of_text)
+{
+  char text[MAX_TEXT];
+  size_t length;
+
+  /* The match ends exactly where the text does, after every possible number
+   * of whole and part blocks.
+   */
+
+  for (length = 6; length < 140; length++)
+    {
+      fill (text, sizeof text, '.');
+      memcpy (text + length - 6, "NEEDLE", 6);
+      check_search ("needle", text, length);
+    }
+}
+END_TEST
+
+START_TEST (test_match_past_end)
+{
+  char text[MAX_TEXT];
+  size_t length;
+
+  /* The text goes on past LENGTH to complete a match, which mustn't be
+   * found.
+   */
+
+  for (length = 1; length < 140; length++)
+    {
+      fill (text, sizeof text, '.');
+      memcpy (text + length - 1, "needle", 6);
+      check_search ("needle", text, length);
+    }
+}
+END_TEST
+
+START_TEST (test_near_misses)
+{
+  char text[MAX_TEXT];
+  size_t at;
+
+  /* The first and last characters are right but the middle isn't, many
+   * times over before the real match.
+   */
+
+  fill (text, sizeof text, '-');
+  for (at = 0; at + 6 < 200; at += 7)
+    memcpy (text + at, "nEEDLe", 6);
+  memcpy (text + 250, "needle", 6);
+  memcpy (text + 205, "needLE", 6);
+
+  check_search ("needle", text, sizeof text);
+  check_search ("needle", text, 220);
+}
+END_TEST
+
+START_TEST (test_random_text)
+{
+  static const char alphabet[] = "abAB";
+  char text[MAX_TEXT], needle[8];
+  int round;
+
+  srand (1);
+
+  /* A small alphabet makes partial and overlapping matches common. */
+
+  for (round = 0; round < 2000; round++)
+    {
+      size_t length = (size_t) rand () % MAX_TEXT;
+      size_t m = 1 + (size_t) rand () % (sizeof needle - 1);
+      size_t i;
+
+      for (i = 0; i < sizeof text; i++)
+        text[i] = alphabet[rand () % 4];
+      for (i = 0; i < m; i++)
+        needle[i] = alphabet[rand () % 4];
+      needle[m] = '\0';
+
+      check_search (needle, text, length);
+    }
+}
+END_TEST
+
+Suite *
+fold_suite (void)
+{
+  Suite *suite = suite_create ("fold");
+  TCase *search = tcase_create ("Search");
+
+  suite_add_tcase (suite, search);
+  tcase_add_checked_fixture (search, NULL, teardown_fold);
+
+  tcase_add_test (search, test_empty_needle);
+  tcase_add_test (search, test_needle_longer_than_text);
+  tcase_add_test (search, test_ignores_case);
+  tcase_add_test (search, test_block_boundaries);
+  tcase_add_test (search, test_end_of_text);
+  tcase_add_test (search, test_match_past_end);
+  tcase_add_test (search, test_near_misses);
+  tcase_add_test (search, test_random_text);
+
+  return suite;
+}
+
+int
+main (void)
+{
+  int failures;
+  Suite *suite = fold_suite ();
+  SRunner *srunner = srunner_create (suite);
+
+  srunner_run_all (srunner, CK_ENV);
+  failures = srunner_ntests_failed (srunner);
+  srunner_free (srunner);
+
+  return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -324,6 +324,40 @@ START_TEST (test_nonstandard_port_personal_pretty_name)
 }
 END_TEST
 
+START_TEST (test_noted_pretty_name)
+{
+  char *expected = "noted://test";
+
+  nfref_set_name (ref, "test");
+  nfref_set_owner (ref, NULL);
+  nfref_set_protocol (ref, NEWTS_PROTOCOL_NOTED);
+  nfref_set_port (ref, NEWTS_NCP_STANDARD_PORT);
+  nfref_set_system (ref, "localhost");
+  nfref_set_user (ref, "tests");
+
+  fail_unless (strcmp (nfref_pretty_name (ref), expected) == 0,
+               "got '%s' instead of '%s'",
+               nfref_pretty_name (ref), expected);
+}
+END_TEST
+
+START_TEST (test_noted_personal_pretty_name)
+{
+  char *expected = "noted://george:test";
+
+  nfref_set_name (ref, "test");
+  nfref_set_owner (ref, "george");
+  nfref_set_protocol (ref, NEWTS_PROTOCOL_NOTED);
+  nfref_set_port (ref, NEWTS_NCP_STANDARD_PORT);
+  nfref_set_system (ref, NULL);
+  nfref_set_user (ref, "tests");
+
+  fail_unless (strcmp (nfref_pretty_name (ref), expected) == 0,
+               "got '%s' instead of '%s'",
+               nfref_pretty_name (ref), expected);
+}
+END_TEST
+
 START_TEST (test_parse_local)
 {
   char *expected = "=test";
@@ -491,6 +525,23 @@ START_TEST (test_parse_protocol)
 }
 END_TEST
 
+START_TEST (test_parse_noted)
+{
+  char *expected = "noted://george:test";
+
+  parse_single_nf ("noted:///george:test", ref);
+
+  fail_unless (strcmp (nfref_name (ref), "test") == 0, NULL);
+  fail_unless (strcmp (nfref_owner (ref), "george") == 0, NULL);
+  fail_unless (nfref_protocol (ref) == NEWTS_PROTOCOL_NOTED, NULL);
+  fail_unless (nfref_system_is_localhost (ref), NULL);
+
+  fail_unless (strcmp (nfref_pretty_name (ref), expected) == 0,
+               "got '%s' instead of '%s'",
+               nfref_pretty_name (ref), expected);
+}
+END_TEST
+
 Suite *
 nfref_suite (void)
 {
@@ -530,6 +581,8 @@ nfref_suite (void)
   tcase_add_test (pretty, test_nonlocal_personal_pretty_name);
   tcase_add_test (pretty, test_nonstandard_port_pretty_name);
   tcase_add_test (pretty, test_nonstandard_port_personal_pretty_name);
+  tcase_add_test (pretty, test_noted_pretty_name);
+  tcase_add_test (pretty, test_noted_personal_pretty_name);
 
   suite_add_tcase (suite, parsing);
   tcase_add_checked_fixture (parsing, setup_nfref, teardown_nfref);
@@ -543,6 +596,7 @@ nfref_suite (void)
   tcase_add_test (parsing, test_parse_user);
   tcase_add_test (parsing, test_parse_complicated);
   tcase_add_test (parsing, test_parse_protocol);
+  tcase_add_test (parsing, test_parse_noted);
 
   return suite;
 }
@@ -0,0 +1,408 @@
+/*
+ * protocol_tests.c - tests for the frames noted and its clients exchange
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#if STDC_HEADERS
+# include <stdlib.h>
+#endif
+
+#if STDC_HEADERS || HAVE_STRING_H
+# include <string.h>
+#elif HAVE_STRINGS_H
+# include <strings.h>
+#endif
+
+#include "check/check.h"
+#include "internal.h"
+#include "protocol.h"
+
+#define REQUEST_ID 0x01020304UL
+
+uid_t euid;
+static struct wire out, in;
+
+void
+setup_wire (void)
+{
+  wire_init (&out);
+  wire_init (&in);
+  wire_begin (&out, REQUEST_ID);
+}
+
+void
+teardown_wire (void)
+{
+  wire_free (&out);
+  wire_free (&in);
+}
+
+/* receive - finish the frame in OUT and take it into IN, as the other end
+ * would.
+ */
+
+static void
+receive (void)
+{
+  wire_finish (&out);
+  wire_take (&in, out.data, out.length);
+}
+
+/* put_everything and get_everything - put one of every kind of thing in a
+ * frame, and take them out again, checking each.  GET_EVERYTHING doesn't
+ * check what it reads once the frame has failed.
+ */
+
+static void
+put_everything (struct wire *wire)
+{
+  wire_put_byte (wire, NOTED_GET_NOTE);
+  wire_put_int (wire, -2);
+  wire_put_string (wire, "general");
+  wire_put_string (wire, NULL);
+  wire_put_time (wire, (time_t) 1234567890);
+  wire_put_double (wire, 0.5);
+  wire_put_int (wire, 7);
+}
+
+static void
+get_everything (struct wire *wire)
+{
+  char *one, *two;
+  int byte;
+  long first, last;
+  time_t when;
+  double score;
+
+  byte = wire_get_byte (wire);
+  first = wire_get_int (wire);
+  one = wire_get_string (wire);
+  two = wire_get_string (wire);
+  when = wire_get_time (wire);
+  score = wire_get_double (wire);
+  last = wire_get_int (wire);
+
+  if (!wire->failed)
+    {
+      fail_unless (byte == NOTED_GET_NOTE, NULL);
+      fail_unless (first == -2, NULL);
+      fail_unless (one != NULL && strcmp (one, "general") == 0, NULL);
+      fail_unless (two == NULL, NULL);
+      fail_unless (when == (time_t) 1234567890, NULL);
+      fail_unless (score == 0.5, NULL);
+      fail_unless (last == 7, NULL);
+    }
+
+  newts_free (one);
+  newts_free (two);
+}
+
+START_TEST (test_header)
+{
+  wire_put_byte (&out, NOTED_OPEN_NF);
+  wire_finish (&out);
+
+  fail_unless (out.length == NOTED_HEADER + 1, NULL);
+  fail_unless (wire_peek_length (out.data) == out.length, NULL);
+  fail_unless (wire_peek_id (out.data) == REQUEST_ID, NULL);
+
+  wire_take (&in, out.data, out.length);
+  fail_unless (in.pos == NOTED_HEADER, NULL);
+  fail_unless (wire_get_byte (&in) == NOTED_OPEN_NF, NULL);
+  fail_if (in.failed, NULL);
+}
+END_TEST
+
+START_TEST (test_ints)
+{
+  static const long values[] = { 0, 1, -1, 255, 256, 65536, -65536,
+    0x7fffffffL, -0x7fffffffL - 1
+  };
+  size_t i, count = sizeof values / sizeof values[0];
+
+  for (i = 0; i < count; i++)
+    wire_put_int (&out, values[i]);
+  receive ();
+
+  for (i = 0; i < count; i++)
+    fail_unless (wire_get_int (&in) == values[i], "lost %ld", values[i]);
+  fail_if (in.failed, NULL);
+}
+END_TEST
+
+START_TEST (test_times)
+{
+  time_t values[4];
+  size_t i;
+
+  values[0] = 0;
+  values[1] = (time_t) 1234567890;
+  values[2] = (time_t) -1;
+  values[3] = sizeof (time_t) > 4 ? (time_t) 5000000000LL : (time_t) 1;
+
+  for (i = 0; i < 4; i++)
+    wire_put_time (&out, values[i]);
+  receive ();
+
+  for (i = 0; i < 4; i++)
+    fail_unless (wire_get_time (&in) == values[i], NULL);
+  fail_if (in.failed, NULL);
+}
+END_TEST
+
+START_TEST (test_strings)
+{
+  static const char high[] = "caf\xc3\xa9 \xff";
+  char *string;
+
+  wire_put_string (&out, "title");
+  wire_put_string (&out, "");
+  wire_put_string (&out, NULL);
+  wire_put_string (&out, high);
+  receive ();
+
+  string = wire_get_string (&in);
+  fail_unless (string != NULL && strcmp (string, "title") == 0, NULL);
+  newts_free (string);
+
+  string = wire_get_string (&in);
+  fail_unless (string != NULL && *string == '\0', NULL);
+  newts_free (string);
+
+  fail_unless (wire_get_string (&in) == NULL, NULL);
+
+  string = wire_get_string (&in);
+  fail_unless (string != NULL && strcmp (string, high) == 0, NULL);
+  newts_free (string);
+
+  fail_if (in.failed, NULL);
+}
+END_TEST
+
+START_TEST (test_nfref)
+{
+  newts_nfref *ref = nfref_alloc ();
+  newts_nfref *back = nfref_alloc ();
+
+  nfref_set_owner (ref, "george");
+  nfref_set_name (ref, "test");
+  nfref_set_protocol (ref, NEWTS_PROTOCOL_NOTED);
+  wire_put_nfref (&out, ref);
+  receive ();
+
+  /* Whatever the client called it, it's one of the server's own. */
+
+  wire_get_nfref (&in, back);
+  fail_if (in.failed, NULL);
+  fail_unless (strcmp (nfref_owner (back), "george") == 0, NULL);
+  fail_unless (strcmp (nfref_name (back), "test") == 0, NULL);
+  fail_unless (nfref_protocol (back) == NEWTS_PROTOCOL_NCP, NULL);
+  fail_unless (nfref_system_is_localhost (back), NULL);
+
+  nfref_free (ref);
+  nfref_free (back);
+}
+END_TEST
+
+START_TEST (test_nfref_without_name)
+{
+  newts_nfref *back = nfref_alloc ();
+
+  wire_put_string (&out, NULL);
+  wire_put_string (&out, NULL);
+  receive ();
+
+  wire_get_nfref (&in, back);
+  fail_unless (in.failed, NULL);
+
+  nfref_free (back);
+}
+END_TEST
+
+START_TEST (test_newt)
+{
+  struct newt newt, back;
+
+  memset (&newt, 0, sizeof newt);
+  memset (&back, 0, sizeof back);
+
+  nfref_set_name (&newt.nr.nfr, "test");
+  newt.nr.notenum = 12;
+  newt.nr.respnum = 3;
+  newt.id.system = "host.example";
+  newt.id.number = 4711;
+  newt.title = "A title";
+  newt.director_message = NULL;
+  newt.auth.name = "george";
+  newt.auth.system = "host.example";
+  newt.auth.uid = 1000;
+  newt.created = (time_t) 1200000000;
+  newt.modified = (time_t) 1200000060;
+  newt.total_resps = 5;
+  newt.text = "Some text.\nMore text.\n";
+  newt.options = NOTE_ANONYMOUS;
+
+  wire_put_newt (&out, &newt);
+  receive ();
+  wire_get_newt (&in, &back);
+
+  fail_if (in.failed, NULL);
+  fail_unless (back.nr.notenum == 12 && back.nr.respnum == 3, NULL);
+  fail_unless (strcmp (back.id.system, newt.id.system) == 0, NULL);
+  fail_unless (back.id.number == 4711, NULL);
+  fail_unless (strcmp (back.title, newt.title) == 0, NULL);
+  fail_unless (back.director_message == NULL, NULL);
+  fail_unless (strcmp (back.auth.name, newt.auth.name) == 0, NULL);
+  fail_unless (strcmp (back.auth.system, newt.auth.system) == 0, NULL);
+  fail_unless (back.auth.uid == 1000, NULL);
+  fail_unless (back.created == newt.created, NULL);
+  fail_unless (back.modified == newt.modified, NULL);
+  fail_unless (back.total_resps == 5, NULL);
+  fail_unless (strcmp (back.text, newt.text) == 0, NULL);
+  fail_unless (back.options == NOTE_ANONYMOUS, NULL);
+  fail_unless (in.pos == in.length, NULL);
+
+  nfref_set_name (&newt.nr.nfr, NULL);
+  newts_free (back.id.system);
+  newts_free (back.title);
+  newts_free (back.auth.name);
+  newts_free (back.auth.system);
+  newts_free (back.text);
+}
+END_TEST
+
+START_TEST (test_everything)
+{
+  put_everything (&out);
+  receive ();
+  get_everything (&in);
+
+  fail_if (in.failed, NULL);
+  fail_unless (in.pos == in.length, NULL);
+}
+END_TEST
+
+START_TEST (test_truncated_frames)
+{
+  size_t cut;
+
+  put_everything (&out);
+  wire_finish (&out);
+
+  /* However much of the frame is missing, reading it fails, and nothing is
+   * read from beyond what arrived.
+   */
+
+  for (cut = 0; cut < out.length; cut++)
+    {
+      unsigned char *partial = newts_nmalloc (cut + 1, 1);
+
+      memcpy (partial, out.data, cut);
+      wire_take (&in, partial, cut);
+      newts_free (partial);
+
+      get_everything (&in);
+      fail_unless (in.failed, "a frame cut to %u bytes didn't fail",
+                   (unsigned) cut);
+      fail_unless (cut < NOTED_HEADER || in.pos <= in.length, NULL);
+    }
+}
+END_TEST
+
+START_TEST (test_failure_sticks)
+{
+  wire_put_int (&out, 1);
+  wire_put_int (&out, 2);
+  receive ();
+
+  /* Lop off the last byte, so the second int is short. */
+
+  in.length--;
+  fail_unless (wire_get_int (&in) == 1, NULL);
+  fail_unless (wire_get_int (&in) == 0, NULL);
+  fail_unless (in.failed, NULL);
+
+  /* Once failed, even what's there reads as nothing. */
+
+  in.pos = NOTED_HEADER;
+  fail_unless (wire_get_int (&in) == 0, NULL);
+  fail_unless (wire_get_byte (&in) == 0, NULL);
+  fail_unless (wire_get_string (&in) == NULL, NULL);
+}
+END_TEST
+
+START_TEST (test_overlong_string)
+{
+  wire_put_int (&out, 1000);
+  wire_put_string (&out, "short");
+  receive ();
+
+  /* The length says a thousand bytes follow, and they don't. */
+
+  fail_unless (wire_get_string (&in) == NULL, NULL);
+  fail_unless (in.failed, NULL);
+}
+END_TEST
+
+Suite *
+protocol_suite (void)
+{
+  Suite *suite = suite_create ("protocol");
+  TCase *round_trips = tcase_create ("Round Trips");
+  TCase *damage = tcase_create ("Damaged Frames");
+
+  suite_add_tcase (suite, round_trips);
+  tcase_add_checked_fixture (round_trips, setup_wire, teardown_wire);
+
+  tcase_add_test (round_trips, test_header);
+  tcase_add_test (round_trips, test_ints);
+  tcase_add_test (round_trips, test_times);
+  tcase_add_test (round_trips, test_strings);
+  tcase_add_test (round_trips, test_nfref);
+  tcase_add_test (round_trips, test_newt);
+  tcase_add_test (round_trips, test_everything);
+
+  suite_add_tcase (suite, damage);
+  tcase_add_checked_fixture (damage, setup_wire, teardown_wire);
+
+  tcase_add_test (damage, test_nfref_without_name);
+  tcase_add_test (damage, test_truncated_frames);
+  tcase_add_test (damage, test_failure_sticks);
+  tcase_add_test (damage, test_overlong_string);
+
+  return suite;
+}
+
+int
+main (void)
+{
+  int failures;
+  Suite *suite = protocol_suite ();
+  SRunner *srunner = srunner_create (suite);
+
+  srunner_run_all (srunner, CK_ENV);
+  failures = srunner_ntests_failed (srunner);
+  srunner_free (srunner);
+
+  return (failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,317 @@
+/*
+ * seqmap_tests.c - tests for sets of sequencer times
+ *
+ * This file is part of the Newts notesfile system.
+ * Copyright (C) 2008 Tyler Berry.
+ *
+ * Newts is free software; you can redistribute it and/or modify it under the
+ * terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 2 of the License, or (at your option) any later
+ * version.
+ *
+ * Newts is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * Newts; if not, write to the Free Software Foundation, Inc., 59 Temple Place,
+ * Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#if STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+#endif
+
+#if STDC_HEADERS || HAVE_STRING_H
+# include <string.h>
+#elif HAVE_STRINGS_H
+# include <strings.h>
+#endif
+
+#if HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#include "check/check.h"
+#include "internal.h"
+#include "newts/nfref.h"
+#include "newts/sequencer.h"
+#include "newts/uiuc-compatibility.h"
+
+/* The bulk tests use a sequencer file of their own in the notes spool, which
+ * has to be writable; where it isn't, they're left out, and the whole program
+ * reports itself skipped if the rest pass.
+ */
+
+#define BASE_TIME ((time_t) 1000000000)
+#define MANY      1000
+
+uid_t euid;
+static newts_seqmap *map;
+static newts_nfref *ref;
+static char seqname[32];
+
+void
+setup_seqmap (void)
+{
+  map = seqmap_alloc ();
+  ref = nfref_alloc ();
+}
+
+void
+teardown_seqmap (void)
+{
+  seqmap_free (map);
+  nfref_free (ref);
+}
+
+void
+setup_seqfile (void)
+{
+  setup_seqmap ();
+  snprintf (seqname, sizeof seqname, "seqmap-tests.%ld", (long) getpid ());
+}
+
+void
+teardown_seqfile (void)
+{
+  char filename[1024];
+
+  snprintf (filename, sizeof filename, "%s/%s/%s", SPOOL, SEQUENCER, seqname);
+  unlink (filename);
+  teardown_seqmap ();
+}
+
+/* set_named - set the time of the notesfile NAME in MAP to SEQ. */
+
+static void
+set_named (newts_seqmap *map, const char *name, time_t seq)
+{
+  nfref_set_name (ref, (char *) name);
+  seqmap_set (map, ref, seq);
+}
+
+/* get_named - return the time of NAME in MAP, or -1 if it has none. */
+
+static time_t
+get_named (newts_seqmap *map, const char *name)
+{
+  time_t seq;
+
+  nfref_set_name (ref, (char *) name);
+  if (seqmap_get (map, ref, &seq) != 0)
+    return (time_t) -1;
+
+  return seq;
+}
+
+START_TEST (test_empty_map)
+{
+  time_t seq = 42;
+
+  nfref_set_name (ref, "general");
+
+  fail_unless (seqmap_get (map, ref, &seq) == -1, NULL);
+  fail_unless (seq == 0, NULL);
+}
+END_TEST
+
+START_TEST (test_set_and_get)
+{
+  set_named (map, "general", BASE_TIME);
+
+  fail_unless (get_named (map, "general") == BASE_TIME, NULL);
+  fail_unless (get_named (map, "general.2") == -1, NULL);
+}
+END_TEST
+
+START_TEST (test_set_replaces)
+{
+  set_named (map, "general", BASE_TIME);
+  set_named (map, "general", BASE_TIME + 60);
+
+  fail_unless (get_named (map, "general") == BASE_TIME + 60, NULL);
+  fail_unless (map->count == 1, "got %u entries", map->count);
+}
+END_TEST
+
+START_TEST (test_many_entries)
+{
+  char name[32];
+  int i;
+
+  /* Enough to make the map grow several times. */
+
+  for (i = 0; i < MANY; i++)
+    {
+      snprintf (name, sizeof name, "nf.%d", i);
+      set_named (map, name, BASE_TIME + i);
+    }
+
+  fail_unless (map->count == MANY, "got %u entries", map->count);
+  fail_unless (map->nbuckets >= MANY, NULL);
+
+  for (i = 0; i < MANY; i++)
+    {
+      snprintf (name, sizeof name, "nf.%d", i);
+      fail_unless (get_named (map, name) == BASE_TIME + i,
+                   "lost the time of %s", name);
+    }
+}
+END_TEST
+
+START_TEST (test_store_keeps_changes)
+{
+  set_named (map, "general", BASE_TIME + 60);
+  seqmap_store (map, "general", BASE_TIME, FALSE);
+  seqmap_store (map, "other", BASE_TIME, FALSE);
+
+  fail_unless (get_named (map, "general") == BASE_TIME + 60, NULL);
+  fail_unless (get_named (map, "other") == BASE_TIME, NULL);
+}
+END_TEST
+
+START_TEST (test_round_trip)
+{
+  newts_seqmap *back;
+  char name[32];
+  int i;
+
+  for (i = 0; i < 100; i++)
+    {
+      snprintf (name, sizeof name, "nf.%d", (i * 37) % 100);
+      set_named (map, name, BASE_TIME + i);
+    }
+
+  fail_unless (set_seqtimes (seqname, map) == 0, NULL);
+
+  back = seqmap_alloc ();
+  fail_unless (get_all_seqtimes (seqname, back) == 100, NULL);
+
+  for (i = 0; i < 100; i++)
+    {
+      snprintf (name, sizeof name, "nf.%d", (i * 37) % 100);
+      fail_unless (get_named (back, name) == BASE_TIME + i,
+                   "got %ld for %s", (long) get_named (back, name), name);
+    }
+
+  seqmap_free (back);
+}
+END_TEST
+
+START_TEST (test_round_trip_updates)
+{
+  newts_seqmap *back;
+
+  set_named (map, "general", BASE_TIME);
+  set_named (map, "other", BASE_TIME);
+  fail_unless (set_seqtimes (seqname, map) == 0, NULL);
+
+  /* Only what changed since is written, and the rest is left alone. */
+
+  set_named (map, "general", BASE_TIME + 60);
+  set_named (map, "another", BASE_TIME + 120);
+  fail_unless (set_seqtimes (seqname, map) == 0, NULL);
+
+  back = seqmap_alloc ();
+  fail_unless (get_all_seqtimes (seqname, back) == 3, NULL);
+  fail_unless (get_named (back, "general") == BASE_TIME + 60, NULL);
+  fail_unless (get_named (back, "other") == BASE_TIME, NULL);
+  fail_unless (get_named (back, "another") == BASE_TIME + 120, NULL);
+  seqmap_free (back);
+}
+END_TEST
+
+START_TEST (test_file_is_sorted)
+{
+  struct seq_f entry, previous;
+  char filename[1024], name[32];
+  long count = 0;
+  int fid, i;
+
+  for (i = 0; i < 50; i++)
+    {
+      snprintf (name, sizeof name, "nf.%d", (i * 7) % 50);
+      set_named (map, name, BASE_TIME + i);
+    }
+
+  fail_unless (set_seqtimes (seqname, map) == 0, NULL);
+
+  snprintf (filename, sizeof filename, "%s/%s/%s", SPOOL, SEQUENCER, seqname);
+  fid = open (filename, O_RDONLY);
+  fail_if (fid < 0, NULL);
+
+  /* The header comes first, with a blank name, and the rest in order. */
+
+  fail_unless (read (fid, &entry, sizeof entry) == sizeof entry, NULL);
+  fail_unless (entry.nfname[0] == '\0', NULL);
+
+  while (read (fid, &entry, sizeof entry) == sizeof entry)
+    {
+      if (count++ > 0)
+        fail_unless (strncmp (previous.nfname, entry.nfname, NNLEN) < 0,
+                     "%.*s comes before %.*s", NNLEN, previous.nfname,
+                     NNLEN, entry.nfname);
+      previous = entry;
+    }
+
+  close (fid);
+  fail_unless (count == 50, "got %ld entries", count);
+}
+END_TEST
+
+Suite *
+seqmap_suite (int with_files)
+{
+  Suite *suite = suite_create ("seqmap");
+  TCase *memory = tcase_create ("In Memory");
+  TCase *files;
+
+  suite_add_tcase (suite, memory);
+  tcase_add_checked_fixture (memory, setup_seqmap, teardown_seqmap);
+
+  tcase_add_test (memory, test_empty_map);
+  tcase_add_test (memory, test_set_and_get);
+  tcase_add_test (memory, test_set_replaces);
+  tcase_add_test (memory, test_many_entries);
+  tcase_add_test (memory, test_store_keeps_changes);
+
+  if (with_files)
+    {
+      files = tcase_create ("Sequencer Files");
+      suite_add_tcase (suite, files);
+      tcase_add_checked_fixture (files, setup_seqfile, teardown_seqfile);
+
+      tcase_add_test (files, test_round_trip);
+      tcase_add_test (files, test_round_trip_updates);
+      tcase_add_test (files, test_file_is_sorted);
+    }
+
+  return suite;
+}
+
+int
+main (void)
+{
+  int failures, with_files = access (SPOOL, W_OK) == 0;
+  Suite *suite = seqmap_suite (with_files);
+  SRunner *srunner = srunner_create (suite);
+
+  srunner_run_all (srunner, CK_ENV);
+  failures = srunner_ntests_failed (srunner);
+  srunner_free (srunner);
+
+  if (failures != 0)
+    return EXIT_FAILURE;
+  return with_files ? EXIT_SUCCESS : 77;
+}